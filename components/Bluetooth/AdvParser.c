@@ -0,0 +1,57 @@
+#include "AdvParser.h"
+
+void AdvIteratorInit(struct adv_iterator *it, const uint8_t *buf, const size_t len)
+{
+  it->buf = buf;
+  it->len = len;
+  it->pos = 0;
+}
+
+bool AdvNextField(struct adv_iterator *it, struct adv_field *field)
+{
+  if (it->pos >= it->len)
+  {
+    return false;
+  }
+  const uint8_t field_len = it->buf[it->pos]; // Type and data, the length byte excluded
+  if (field_len == 0 || field_len > it->len - it->pos - 1)
+  {
+    it->pos = it->len;
+    return false;
+  }
+  field->type = it->buf[it->pos + 1];
+  field->data = &it->buf[it->pos + 2];
+  field->len = field_len - 1;
+  it->pos += 1 + field_len;
+  return true;
+}
+
+bool AdvFindField(const uint8_t *buf, const size_t len, const uint8_t type, struct adv_field *field)
+{
+  struct adv_iterator it;
+  AdvIteratorInit(&it, buf, len);
+  while (AdvNextField(&it, field))
+  {
+    if (field->type == type)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool AdvFindServiceData16(const uint8_t *buf, const size_t len, const uint16_t uuid, struct adv_field *payload)
+{
+  struct adv_iterator it;
+  struct adv_field field;
+  AdvIteratorInit(&it, buf, len);
+  while (AdvNextField(&it, &field))
+  {
+    if (field.type == ADV_TYPE_SERVICE_DATA_16 && field.len >= 2 && (field.data[0] | (field.data[1] << 8)) == uuid)
+    {
+      *payload = (struct adv_field){.type = field.type, .data = field.data + 2, .len = field.len - 2};
+      return true;
+    }
+  }
+  return false;
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADV_TYPE_SERVICE_DATA_16 0x16 // Service Data - 16-bit UUID, the UUID (little endian) leads the data
+
+/**
+ * @brief One AD structure of advertising or scan response data. A view into the scanned buffer, nothing is copied,
+ * it is only valid while that buffer is.
+ */
+struct adv_field
+{
+  uint8_t type;
+  const uint8_t *data;
+  uint8_t len;
+};
+
+/**
+ * @brief Walks the length-type-value AD structures of a buffer.
+ */
+struct adv_iterator
+{
+  const uint8_t *buf;
+  size_t len;
+  size_t pos;
+};
+
+void AdvIteratorInit(struct adv_iterator *it, const uint8_t *buf, const size_t len);
+
+/**
+ * @brief Yields the next AD structure. Stops at the end of the buffer, at the zero length that starts the padding,
+ * and at a structure running past the buffer, so malformed data never reads out of bounds.
+ *
+ * @param it The iterator.
+ * @param field Output, the structure found.
+ * @return true if a structure was found.
+ */
+bool AdvNextField(struct adv_iterator *it, struct adv_field *field);
+
+/**
+ * @brief Finds the first AD structure of a type.
+ *
+ * @return true if found, field then holds it.
+ */
+bool AdvFindField(const uint8_t *buf, const size_t len, const uint8_t type, struct adv_field *field);
+
+/**
+ * @brief Finds the service data of a 16-bit UUID.
+ *
+ * @param payload Output, the service data after the UUID.
+ * @return true if found.
+ */
+bool AdvFindServiceData16(const uint8_t *buf, const size_t len, const uint16_t uuid, struct adv_field *payload);
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include "LeScanner.h"
 #include "WiFiHandler.h"
 #include "Module.h"
@@ -6,23 +7,44 @@
 #define SCAN_DURATION 10               // Scan duration in seconds.
 #define SHORT_WIFI_UUID_TARGET 0xDEAD  // Service target for WiFi credentials
 #define SHORT_TOKEN_UUID_TARGET 0xFADE // Service target for token API
-#define DATA_START_OFFSET 4            // 4 offset bytes without counting the length byte
 static const char TAG[] = "LeScanner";
 static int scan_retry = 0;
+static bool classic_bt_released = false;
+static bool whitelisted = false; // The scan only reports the provisioner found first
+static esp_ble_scan_params_t scan_params = {
+    .scan_type = BLE_SCAN_TYPE_ACTIVE,
+    .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+    .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
+    .scan_interval = 0x0500, // 1000 ms
+    .scan_window = 0x0100,   // 307  ms
+    // Each advertiser is reported once per distinct payload (CONFIG_BTDM_SCAN_DUPL_TYPE_DATA_DEVICE), so the
+    // credentials and the token of one provisioner both get through while beacons repeating themselves do not
+    .scan_duplicate = BLE_SCAN_DUPLICATE_ENABLE};
 
 void EnableBLE()
 {
-  // ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BTDM));
   ESP_LOGI(TAG, "Enabling BLE");
+  const int64_t start_us = esp_timer_get_time();
   esp_err_t status;
+  if (!classic_bt_released)
+  {
+    // Provisioning only scans BLE, the classic BT controller memory goes back to the heap for good
+    const uint32_t free_before = esp_get_free_heap_size();
+    if ((status = esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT)) != ESP_OK)
+    {
+      ESP_LOGW(TAG, "Could not release classic BT memory: %s", esp_err_to_name(status));
+    }
+    classic_bt_released = true;
+    ESP_LOGI(TAG, "Classic BT memory released: %" PRIu32 " bytes", esp_get_free_heap_size() - free_before);
+  }
   esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
   if ((status = esp_bt_controller_init(&bt_cfg)) != ESP_OK)
   {
     ESP_LOGE(TAG, "BT Controller Init failed: %s", esp_err_to_name(status));
   }
 
-  // Important; setting is only for dual mode (WiFi and BLE coexistence)
-  if ((status = esp_bt_controller_enable(ESP_BT_MODE_BTDM)) != ESP_OK)
+  // BLE only, it shares the radio with WiFi through the coexistence arbiter (CONFIG_ESP_COEX_SW_COEXIST_ENABLE)
+  if ((status = esp_bt_controller_enable(ESP_BT_MODE_BLE)) != ESP_OK)
   {
     ESP_LOGE(TAG, "BT Controller Enable failed: %s", esp_err_to_name(status));
   }
@@ -31,15 +53,9 @@ void EnableBLE()
   {
     ESP_LOGE(TAG, "Error while enabling bluedroid");
   }
-  esp_ble_scan_params_t scanParams = {
-      .scan_type = BLE_SCAN_TYPE_ACTIVE,
-      .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
-      .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
-      .scan_interval = 0x0500, // 1000 ms
-      .scan_window = 0x0100,   // 307  ms
-      .scan_duplicate = BLE_SCAN_DUPLICATE_ENABLE};
-
-  if (esp_ble_gap_set_scan_params(&scanParams) != ESP_OK)
+  whitelisted = false; // The controller whitelist starts empty after every init
+  scan_params.scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL;
+  if (esp_ble_gap_set_scan_params(&scan_params) != ESP_OK)
   {
     ESP_LOGE(TAG, "Could not set scan params");
   }
@@ -47,6 +63,7 @@ void EnableBLE()
   {
     ESP_LOGE(TAG, "Could not register Scan Result Callback: %s", esp_err_to_name(status));
   }
+  ESP_LOGI(TAG, "BLE enabled in %" PRId64 " us, free heap %" PRIu32 " bytes", esp_timer_get_time() - start_us, esp_get_free_heap_size());
 }
 
 void DisableBLE()
@@ -70,30 +87,30 @@ void StopScan()
   esp_ble_gap_stop_scanning();
 }
 
-static bool UUIDCorresponds(const struct ble_scan_result_evt_param *scanResult, const uint16_t short_uuid)
-{
-  uint8_t *data = scanResult->ble_adv;
-  uint16_t uuid = data[2] | (data[3] << 8);
-  return uuid == short_uuid;
-}
-
 static void SwitchToWiFiCallback()
 {
   ESP_LOGI(TAG, "Switching back to WiFi mode");
   LEDEvent(SWITCH_MODE);
   DisableBLE();
-  SwitchWiFi();
+  EndProvisioning();
   vTaskDelete(NULL);
 }
 
 static void ScanResultCallback(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
-  ESP_LOGI(TAG, "Event number %d", event);
+  // Runs on the BTC task for every advertisement in range, nothing is logged unless the advertiser is a provisioner
   switch (event)
   {
   // Scan stops
   case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
     ESP_LOGI(TAG, "Scan Stopped");
+    if (whitelisted && scan_params.scan_filter_policy != BLE_SCAN_FILTER_ALLOW_ONLY_WLST)
+    {
+      // Stopped by WhitelistProvisioner, the controller drops every other advertiser from now on
+      scan_params.scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ONLY_WLST;
+      esp_ble_gap_set_scan_params(&scan_params);
+      StartScan();
+    }
     return;
     // Scan starts
   case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
@@ -101,55 +118,37 @@ static void ScanResultCallback(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_para
     break;
   case ESP_GAP_BLE_SCAN_RESULT_EVT: // When we scanned a result event
     const struct ble_scan_result_evt_param *scanResult = &(param->scan_rst);
-    ESP_LOGI(TAG, "Number of responses: %d", scanResult->num_resps);
-    if (UUIDCorresponds(scanResult, SHORT_WIFI_UUID_TARGET) && scanResult->adv_data_len > 0 && scanResult->scan_rsp_len > 0)
+    struct adv_field adv, rsp;
+    if (scanResult->search_evt == ESP_GAP_SEARCH_INQ_RES_EVT &&
+        FindProvisioningData(scanResult, SHORT_WIFI_UUID_TARGET, &adv, &rsp))
     {
-      ESP_LOGI(TAG, "Message from WIFI UUID %s", scanResult->ble_adv);
-      uint8_t *ssid = malloc(sizeof(uint8_t) * MAX_SSID_SIZE + 1);
-      uint8_t *pwd = malloc(sizeof(uint8_t) * MAX_PWD_SIZE + 1);
-      // safe check of memory allocation
-      if (!pwd || !ssid)
-      {
-        ESP_LOGE(TAG, "NOT ENOUGH MEMORY TO MAKE ALLOCATION, RESTARTING BOARD");
-        LEDEvent(MEM_ALLOC_FAILURE);
-        vTaskDelay(500 / portTICK_PERIOD_MS);
-      }
-      else
-      {
-        FetchCredentials(scanResult, ssid, pwd);
-        SetCredentials(ssid, pwd);
-        ESP_LOGI(TAG, "New SSID: [%s] pwd: [%s]", (char *)ssid, (char *)pwd);
-        free(ssid);
-        free(pwd);
-        LEDEvent(BLE_CONFIG_SETTED);
-      }
+      ESP_LOGI(TAG, "Message from WIFI UUID");
+      uint8_t ssid[MAX_SSID_SIZE + 1];
+      uint8_t pwd[MAX_PWD_SIZE + 1];
+      FetchCredentials(&adv, &rsp, ssid, pwd);
+      SetCredentials(ssid, pwd);
+      ESP_LOGI(TAG, "New SSID: [%s] pwd: [%s]", (char *)ssid, (char *)pwd);
+      LEDEvent(BLE_CONFIG_SETTED);
+      WhitelistProvisioner(scanResult);
     }
-    else if (UUIDCorresponds(scanResult, SHORT_TOKEN_UUID_TARGET) && scanResult->adv_data_len > 0 && scanResult->scan_rsp_len > 0)
+    else if (scanResult->search_evt == ESP_GAP_SEARCH_INQ_RES_EVT &&
+             FindProvisioningData(scanResult, SHORT_TOKEN_UUID_TARGET, &adv, &rsp))
     {
-      ESP_LOGI(TAG, "Message from Token UUID %s", scanResult->ble_adv);
-      uint8_t *token = malloc(sizeof(uint8_t) * TOKEN_SIZE + 1);
-      // safe check of memory allocation
-      if (!token)
-      {
-        ESP_LOGE(TAG, "NOT ENOUGH MEMORY TO MAKE ALLOCATION, RESTARTING BOARD");
-        LEDEvent(MEM_ALLOC_FAILURE);
-        vTaskDelay(500 / portTICK_PERIOD_MS);
-      }
-      else
-      {
-        FetchTokenAPI(scanResult, token);
-        RegisterTokenAPI((char *)token);
-        ESP_LOGI(TAG, "New Token: [%s]", (char *)token);
-        free(token);
-        LEDEvent(BLE_CONFIG_SETTED);
-      }
+      ESP_LOGI(TAG, "Message from Token UUID");
+      uint8_t token[TOKEN_SIZE + 1];
+      FetchTokenAPI(&adv, &rsp, token);
+      RegisterTokenAPI((char *)token);
+      ESP_LOGI(TAG, "New Token: [%s]", (char *)token);
+      LEDEvent(BLE_CONFIG_SETTED);
+      WhitelistProvisioner(scanResult);
     }
     else if (scanResult->search_evt == ESP_GAP_SEARCH_INQ_CMPL_EVT)
     {
       if (++scan_retry > MAX_RETRY)
       {
         scan_retry = 0;
-        xTaskCreate(SwitchToWiFiCallback, "switch_to_WiFi", 2096, NULL, 5, NULL);
+        xTaskCreatePinnedToCore(SwitchToWiFiCallback, "switch_to_WiFi", PROVISIONING_TASK_STACK_SIZE, NULL,
+                                PROVISIONING_TASK_PRIORITY, NULL, PROVISIONING_TASK_CORE);
       }
       else
       {
@@ -163,28 +162,73 @@ static void ScanResultCallback(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_para
   }
 }
 
-static void FetchCredentials(
+static bool FindProvisioningData(
     const struct ble_scan_result_evt_param *scanResult,
+    const uint16_t short_uuid,
+    struct adv_field *adv,
+    struct adv_field *rsp)
+{
+  // Most advertisers are rejected here, on the first AD structures of their advertising data
+  if (!AdvFindServiceData16(scanResult->ble_adv, scanResult->adv_data_len, short_uuid, adv))
+  {
+    return false;
+  }
+  // The second half of the value is the service data of the scan response, whatever its UUID
+  if (!AdvFindField(scanResult->ble_adv + scanResult->adv_data_len, scanResult->scan_rsp_len, ADV_TYPE_SERVICE_DATA_16, rsp) ||
+      rsp->len < 2)
+  {
+    return false;
+  }
+  rsp->data += 2;
+  rsp->len -= 2;
+  return true;
+}
+
+static void WhitelistProvisioner(const struct ble_scan_result_evt_param *scanResult)
+{
+  if (whitelisted)
+  {
+    return;
+  }
+  esp_err_t status = esp_ble_gap_update_whitelist(true, (uint8_t *)scanResult->bda,
+                                                  scanResult->ble_addr_type == BLE_ADDR_TYPE_PUBLIC ? BLE_WL_ADDR_TYPE_PUBLIC : BLE_WL_ADDR_TYPE_RANDOM);
+  if (status != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Could not whitelist the provisioner: %s", esp_err_to_name(status));
+    return;
+  }
+  whitelisted = true;
+  StopScan(); // Scan parameters only change while stopped, the scan restarts filtered once it is
+}
+
+/**
+ * @brief Copies an AD structure view into a NUL terminated string, truncated to cap bytes.
+ */
+static size_t CopyField(uint8_t *out, const size_t cap, const struct adv_field *field)
+{
+  const size_t len = (field->len < cap) ? field->len : cap;
+  memcpy(out, field->data, len);
+  out[len] = '\0';
+  return len;
+}
+
+static void FetchCredentials(
+    const struct adv_field *adv,
+    const struct adv_field *rsp,
     uint8_t *ssid,
     uint8_t *pwd)
 {
-  ESP_LOGI(TAG, "Fetching credentials. Adv data length: %d, Scan rsp len: %d",
-           scanResult->adv_data_len, scanResult->scan_rsp_len);
-  const int size_ssid = (MAX_SSID_SIZE > scanResult->adv_data_len - DATA_START_OFFSET) ? scanResult->adv_data_len - DATA_START_OFFSET : MAX_SSID_SIZE;
-  const int size_pwd = (MAX_PWD_SIZE > scanResult->scan_rsp_len - DATA_START_OFFSET) ? scanResult->scan_rsp_len - DATA_START_OFFSET : MAX_PWD_SIZE;
-  strncpy((char *)ssid, (char *)(scanResult->ble_adv + DATA_START_OFFSET), size_ssid);
-  strncpy((char *)pwd, (char *)(scanResult->ble_adv + scanResult->adv_data_len + DATA_START_OFFSET), size_pwd);
-  *(ssid + size_ssid) = '\0';
-  *(pwd + size_pwd) = '\0';
+  ESP_LOGI(TAG, "Fetching credentials. SSID length: %d, password length: %d", adv->len, rsp->len);
+  CopyField(ssid, MAX_SSID_SIZE, adv);
+  CopyField(pwd, MAX_PWD_SIZE, rsp);
 }
 
 static void FetchTokenAPI(
-    const struct ble_scan_result_evt_param *scanResult,
+    const struct adv_field *adv,
+    const struct adv_field *rsp,
     uint8_t *token)
 {
-  ESP_LOGI(TAG, "Fetching Token API. Adv data length: %d, Scan rsp len: %d",
-           scanResult->adv_data_len, scanResult->scan_rsp_len);
-  strncpy((char *)token, (char *)(scanResult->ble_adv + DATA_START_OFFSET), (int)scanResult->adv_data_len - DATA_START_OFFSET);
-  strncpy((char *)(token + scanResult->adv_data_len - DATA_START_OFFSET), (char *)(scanResult->ble_adv + scanResult->adv_data_len + DATA_START_OFFSET), (int)scanResult->scan_rsp_len - DATA_START_OFFSET);
-  *(token + TOKEN_SIZE) = '\0';
+  ESP_LOGI(TAG, "Fetching Token API. Lengths: %d + %d", adv->len, rsp->len);
+  const size_t len = CopyField(token, TOKEN_SIZE, adv);
+  CopyField(token + len, TOKEN_SIZE - len, rsp);
 }
\ No newline at end of file
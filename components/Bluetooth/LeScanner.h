@@ -2,6 +2,8 @@
 #include "esp_bt.h"
 #include "esp_bt_main.h"
 #include "esp_gap_ble_api.h"
+#include "esp_timer.h"
+#include "AdvParser.h"
 
 void EnableBLE();
 
@@ -9,14 +11,24 @@ void DisableBLE();
 void StartScan();
 
 /**
- * @brief Checks whether a scan result matches with a given short UUID.
- * This function checks if the short UUID corresponds to the one
- * advertised in the scan result.
+ * @brief Checks whether a scan result is a provisioner advertising the given short UUID, and finds the
+ * two halves of the value it carries: the service data of the advertisement and of the scan response.
  * @param scanResult The scan result to check.
  * @param short_uuid The short UUID to compare against.
+ * @param adv Output, view of the advertised service data.
+ * @param rsp Output, view of the scan response service data.
  * @return true if the UUID matches, false otherwise.
  */
-static bool UUIDCorresponds(const struct ble_scan_result_evt_param *scanResult,const uint16_t short_uuid);
+static bool FindProvisioningData(const struct ble_scan_result_evt_param *scanResult, const uint16_t short_uuid,
+                                 struct adv_field *adv, struct adv_field *rsp);
+
+/**
+ * @brief Restricts the scan to the first provisioner found, so the controller filters out every other
+ * advertiser in range.
+ */
+static void WhitelistProvisioner(const struct ble_scan_result_evt_param *scanResult);
+
+static size_t CopyField(uint8_t *out, const size_t cap, const struct adv_field *field);
 
 void StopScan();
 
@@ -31,18 +43,20 @@ static void ScanResultCallback(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_para
 static void SwitchToWiFiCallback();
 
 /**
- * @brief Fetches Credentials from a scanResult adv that matches with the UUID service established.
+ * @brief Fetches Credentials from the service data of an adv that matches with the UUID service established.
  *
- * @param scanResult
- * @param ssid
- * @param pwd
+ * @param adv SSID, the advertised service data.
+ * @param rsp Password, the scan response service data.
+ * @param ssid Output, MAX_SSID_SIZE + 1 bytes.
+ * @param pwd Output, MAX_PWD_SIZE + 1 bytes.
  */
-static void FetchCredentials(const struct ble_scan_result_evt_param *scanResult, uint8_t *ssid, uint8_t *pwd);
+static void FetchCredentials(const struct adv_field *adv, const struct adv_field *rsp, uint8_t *ssid, uint8_t *pwd);
 
 /**
- * @brief Fetches Token API from a scanResult adv that matches with the UUID service established.
+ * @brief Fetches Token API from the service data of an adv that matches with the UUID service established.
  *
- * @param scanResult
- * @param token
+ * @param adv First part of the token, the advertised service data.
+ * @param rsp Rest of the token, the scan response service data.
+ * @param token Output, TOKEN_SIZE + 1 bytes.
  */
-static void FetchTokenAPI(const struct ble_scan_result_evt_param *scanResult, uint8_t *token);
\ No newline at end of file
+static void FetchTokenAPI(const struct adv_field *adv, const struct adv_field *rsp, uint8_t *token);
\ No newline at end of file
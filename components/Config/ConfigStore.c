@@ -0,0 +1,290 @@
+#include <inttypes.h>
+#include <string.h>
+#include "ConfigStore.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define CONFIG_BLOB_MAX_SIZE 512         // Largest blob accepted, leaves room for fields added by newer firmware
+#define LEGACY_TOKEN_API_KEY "token_api" // Keys of the former per-key layout
+#define LEGACY_MODULE_UUID_KEY "module_uuid"
+static const char TAG[] = "ConfigStore";
+_Static_assert(sizeof(struct module_config) <= CONFIG_BLOB_MAX_SIZE, "The configuration does not fit in the blob buffer");
+
+// RAM mirror of the blob, every read is served from here. Written from several tasks (token over BLE, registrations,
+// policies pushed by the server), so every setter and commit holds config_lock: a commit always writes a consistent
+// mirror, and two commits never interleave
+static StaticSemaphore_t config_lock_buffer;
+static SemaphoreHandle_t config_lock = NULL;
+static struct module_config config;
+static bool dirty = false;  // RAM mirror differs from the blob in flash
+static bool loaded = false; // The mirror reflects flash, a commit before that would overwrite it with defaults
+static uint8_t blob_buffer[CONFIG_BLOB_MAX_SIZE];
+
+/**
+ * @brief Loads the configuration blob into RAM. A blob written by an older firmware is upgraded,
+ * and when there is no blob at all the former per-key layout is migrated into one.
+ * Meant to be called once at boot, right after nvs_flash_init and before any setter.
+ *
+ * @param peripheral_keys NVS keys the former layout stored each peripheral id under, in peripheral order.
+ * @param n_peripherals Number of peripherals, up to CONFIG_MAX_PERIPHERALS.
+ * @return esp_err_t ESP_OK on success, otherwise an error code (the defaults are used).
+ */
+esp_err_t ConfigInit(const char *const *peripheral_keys, const size_t n_peripherals)
+{
+  config_lock = xSemaphoreCreateMutexStatic(&config_lock_buffer);
+  ConfigSetDefaults(&config);
+  nvs_handle_t handle;
+  esp_err_t ret = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to open NVS namespace: %s", esp_err_to_name(ret));
+    return ret;
+  }
+  size_t size = sizeof(blob_buffer);
+  ret = nvs_get_blob(handle, CONFIG_NVS_KEY, blob_buffer, &size);
+  if (ret == ESP_ERR_NVS_NOT_FOUND)
+  {
+    loaded = true;
+    ret = MigrateLegacyKeys(handle, peripheral_keys, n_peripherals);
+    nvs_close(handle);
+    return ret;
+  }
+  nvs_close(handle);
+  if (ret != ESP_OK || size < offsetof(struct module_config, token_api))
+  {
+    ESP_LOGE(TAG, "Failed to load the configuration: %s", esp_err_to_name(ret));
+    return (ret != ESP_OK) ? ret : ESP_ERR_INVALID_SIZE;
+  }
+  // Fields are append-only: keep the part this firmware knows, the missing tail keeps its defaults
+  memcpy(&config, blob_buffer, (size < sizeof(config)) ? size : sizeof(config));
+  loaded = true;
+  config.token_api[CONFIG_TOKEN_SIZE - 1] = '\0';
+  config.module_uuid[CONFIG_TOKEN_SIZE - 1] = '\0';
+  if (config.version < CONFIG_VERSION || size < sizeof(config))
+  {
+    ESP_LOGI(TAG, "Upgrading configuration v%d (%zu bytes) to v%d", config.version, size, CONFIG_VERSION);
+    config.version = CONFIG_VERSION;
+    config.size = sizeof(config);
+    dirty = true;
+    return ConfigCommit();
+  }
+  return ESP_OK;
+}
+
+/**
+ * @brief Returns the RAM mirror of the configuration. It must not be modified directly, use the setters.
+ *
+ * @return const struct module_config* The configuration.
+ */
+const struct module_config *ConfigGet()
+{
+  return &config;
+}
+
+void ConfigSetTokenApi(const char *token_api)
+{
+  xSemaphoreTake(config_lock, portMAX_DELAY);
+  if (strncmp(config.token_api, token_api, CONFIG_TOKEN_SIZE) != 0)
+  {
+    strncpy(config.token_api, token_api, CONFIG_TOKEN_SIZE - 1);
+    dirty = true;
+  }
+  xSemaphoreGive(config_lock);
+}
+
+void ConfigSetModuleUuid(const char *module_uuid)
+{
+  xSemaphoreTake(config_lock, portMAX_DELAY);
+  if (strncmp(config.module_uuid, module_uuid, CONFIG_TOKEN_SIZE) != 0)
+  {
+    strncpy(config.module_uuid, module_uuid, CONFIG_TOKEN_SIZE - 1);
+    dirty = true;
+  }
+  xSemaphoreGive(config_lock);
+}
+
+void ConfigSetPeripheralId(const size_t index, const uint32_t peripheral_id)
+{
+  xSemaphoreTake(config_lock, portMAX_DELAY);
+  if (index < CONFIG_MAX_PERIPHERALS && config.peripheral_ids[index] != peripheral_id)
+  {
+    config.peripheral_ids[index] = peripheral_id;
+    dirty = true;
+  }
+  xSemaphoreGive(config_lock);
+}
+
+void ConfigSetReportPolicies(const struct report_policy *policies, const size_t n_policies)
+{
+  xSemaphoreTake(config_lock, portMAX_DELAY);
+  for (size_t i = 0; i < n_policies && i < CONFIG_MAX_PERIPHERALS; i++)
+  {
+    if (!config.has_report_policies || !SameReportPolicy(&config.report_policies[i], &policies[i]))
+    {
+      config.report_policies[i] = policies[i];
+      dirty = true;
+    }
+  }
+  config.has_report_policies = true;
+  xSemaphoreGive(config_lock);
+}
+
+// The retained policy comes back on every reconnect of the push channel, an unchanged one is not written again
+void ConfigSetControlPolicy(const struct control_policy *policy)
+{
+  xSemaphoreTake(config_lock, portMAX_DELAY);
+  if (!config.has_control_policy || !SameControlPolicy(&config.control_policy, policy))
+  {
+    config.control_policy = *policy;
+    config.has_control_policy = true;
+    dirty = true;
+  }
+  xSemaphoreGive(config_lock);
+}
+
+void ConfigSetServerValveState(const int32_t state)
+{
+  xSemaphoreTake(config_lock, portMAX_DELAY);
+  if (config.server_valve_state != state)
+  {
+    config.server_valve_state = state;
+    dirty = true;
+  }
+  xSemaphoreGive(config_lock);
+}
+
+/**
+ * @brief Writes the configuration to flash if any setter changed it since the last commit.
+ * Setters only touch RAM, so several changes end up in a single blob write and commit.
+ * Setters called by other tasks wait for the write to finish, the blob never holds a half-updated mirror.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE before ConfigInit, otherwise an NVS error
+ * (the changes stay pending).
+ */
+esp_err_t ConfigCommit()
+{
+  if (config_lock == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  xSemaphoreTake(config_lock, portMAX_DELAY);
+  esp_err_t ret = WriteBlob();
+  xSemaphoreGive(config_lock);
+  return ret;
+}
+
+/**
+ * @brief Body of ConfigCommit, called with config_lock held.
+ */
+static esp_err_t WriteBlob()
+{
+  if (!dirty)
+  {
+    return ESP_OK;
+  }
+  if (!loaded)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  nvs_handle_t handle;
+  esp_err_t ret = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to open NVS namespace: %s", esp_err_to_name(ret));
+    return ret;
+  }
+  ret = nvs_set_blob(handle, CONFIG_NVS_KEY, &config, sizeof(config));
+  if (ret == ESP_OK)
+  {
+    ret = nvs_commit(handle);
+  }
+  nvs_close(handle);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to save the configuration: %s", esp_err_to_name(ret));
+    return ret;
+  }
+  dirty = false;
+  return ESP_OK;
+}
+
+/**
+ * @brief Compares two report policies field by field, memcmp would also compare their padding.
+ */
+static bool SameReportPolicy(const struct report_policy *a, const struct report_policy *b)
+{
+  return a->deadband == b->deadband && a->heartbeat_s == b->heartbeat_s;
+}
+
+/**
+ * @brief Compares two policies field by field, memcmp would also compare their padding.
+ */
+static bool SameControlPolicy(const struct control_policy *a, const struct control_policy *b)
+{
+  return a->on_below == b->on_below && a->off_above == b->off_above && a->min_on_s == b->min_on_s &&
+         a->min_off_s == b->min_off_s && a->override_ttl_s == b->override_ttl_s;
+}
+
+static void ConfigSetDefaults(struct module_config *defaults)
+{
+  memset(defaults, 0, sizeof(*defaults));
+  defaults->version = CONFIG_VERSION;
+  defaults->size = sizeof(*defaults);
+  for (size_t i = 0; i < CONFIG_MAX_PERIPHERALS; i++)
+  {
+    defaults->peripheral_ids[i] = CONFIG_NO_PERIPHERAL_ID;
+  }
+  defaults->server_valve_state = -1;
+}
+
+/**
+ * @brief Moves the former one-key-per-setting layout into the configuration blob, erasing the old keys
+ * in the same commit. Also runs on a blank NVS, where it just writes the defaults.
+ *
+ * @param handle Open handle on the configuration namespace.
+ * @param peripheral_keys NVS keys of the peripheral ids.
+ * @param n_peripherals Number of peripheral keys.
+ * @return esp_err_t ESP_OK on success, otherwise an NVS error.
+ */
+static esp_err_t MigrateLegacyKeys(nvs_handle_t handle, const char *const *peripheral_keys, const size_t n_peripherals)
+{
+  size_t len = CONFIG_TOKEN_SIZE;
+  if (nvs_get_str(handle, LEGACY_TOKEN_API_KEY, config.token_api, &len) != ESP_OK)
+  {
+    config.token_api[0] = '\0';
+  }
+  len = CONFIG_TOKEN_SIZE;
+  if (nvs_get_str(handle, LEGACY_MODULE_UUID_KEY, config.module_uuid, &len) != ESP_OK)
+  {
+    config.module_uuid[0] = '\0';
+  }
+  for (size_t i = 0; i < n_peripherals && i < CONFIG_MAX_PERIPHERALS; i++)
+  {
+    if (nvs_get_u32(handle, peripheral_keys[i], &config.peripheral_ids[i]) != ESP_OK)
+    {
+      config.peripheral_ids[i] = CONFIG_NO_PERIPHERAL_ID;
+    }
+  }
+
+  esp_err_t ret = nvs_set_blob(handle, CONFIG_NVS_KEY, &config, sizeof(config));
+  if (ret == ESP_OK)
+  {
+    nvs_erase_key(handle, LEGACY_TOKEN_API_KEY);
+    nvs_erase_key(handle, LEGACY_MODULE_UUID_KEY);
+    for (size_t i = 0; i < n_peripherals; i++)
+    {
+      nvs_erase_key(handle, peripheral_keys[i]);
+    }
+    ret = nvs_commit(handle);
+  }
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to migrate the configuration: %s", esp_err_to_name(ret));
+    dirty = true; // Retried on the next commit
+    return ret;
+  }
+  ESP_LOGI(TAG, "Configuration migrated to a single blob (token %s, uuid %s)",
+           config.token_api[0] != '\0' ? "set" : "unset", config.module_uuid[0] != '\0' ? "set" : "unset");
+  return ESP_OK;
+}
\ No newline at end of file
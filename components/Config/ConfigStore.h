@@ -0,0 +1,71 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "nvs.h"
+
+#define CONFIG_NVS_NAMESPACE "Module" // Same namespace as the former per-key layout, migrated in place
+#define CONFIG_NVS_KEY "config"
+#define CONFIG_VERSION 1
+#define CONFIG_TOKEN_SIZE 37           // UUID length is 36 characters + 1 for null terminator
+#define CONFIG_MAX_PERIPHERALS 16
+#define CONFIG_NO_PERIPHERAL_ID UINT32_MAX // Peripheral not registered yet
+
+/**
+ * @brief When a peripheral value is uploaded: on a change larger than the deadband,
+ * or when no value was reported for heartbeat_s seconds.
+ */
+struct report_policy
+{
+  double deadband;      // Smallest change reported, in the units of the peripheral value
+  uint32_t heartbeat_s; // Longest time between two reports of the peripheral
+};
+
+/**
+ * @brief Thresholds of the on-device irrigation loop, pushed by the server. The valve opens when the moisture
+ * drops below on_below and closes once it rises above off_above; the gap between them is the hysteresis.
+ */
+struct control_policy
+{
+  double on_below;         // Moisture fraction under which the valve opens
+  double off_above;        // Moisture fraction over which the valve closes
+  uint32_t min_on_s;       // Shortest time the valve stays open
+  uint32_t min_off_s;      // Shortest time the valve stays closed
+  uint32_t override_ttl_s; // How long a server command holds the loop off
+};
+
+/**
+ * @brief Persistent configuration of the module, stored as a single NVS blob and mirrored in RAM.
+ * New fields are only ever appended, so a blob written by an older firmware is still loaded
+ * (the missing tail keeps its defaults). Resizing a field takes a new version and a conversion in ConfigInit.
+ */
+struct module_config
+{
+  uint16_t version;
+  uint16_t size;                                             // Size of the struct that wrote the blob
+  char token_api[CONFIG_TOKEN_SIZE];                         // Provisioned over BLE, empty if not configured
+  char module_uuid[CONFIG_TOKEN_SIZE];                       // Returned by the server on registration, empty if not registered
+  uint32_t peripheral_ids[CONFIG_MAX_PERIPHERALS];           // CONFIG_NO_PERIPHERAL_ID if not registered
+  bool has_report_policies;                                  // Whether report_policies was set, otherwise the defaults apply
+  struct report_policy report_policies[CONFIG_MAX_PERIPHERALS];
+  bool has_control_policy;                                   // Whether control_policy was set, otherwise the loop is off
+  struct control_policy control_policy;
+  int32_t server_valve_state;                                // Last valve state the server asked for (0 or 1), -1 if it never did
+};
+
+esp_err_t ConfigInit(const char *const *peripheral_keys, const size_t n_peripherals);
+const struct module_config *ConfigGet();
+void ConfigSetTokenApi(const char *token_api);
+void ConfigSetModuleUuid(const char *module_uuid);
+void ConfigSetPeripheralId(const size_t index, const uint32_t peripheral_id);
+void ConfigSetReportPolicies(const struct report_policy *policies, const size_t n_policies);
+void ConfigSetControlPolicy(const struct control_policy *policy);
+void ConfigSetServerValveState(const int32_t state);
+esp_err_t ConfigCommit();
+
+static esp_err_t WriteBlob();
+static void ConfigSetDefaults(struct module_config *config);
+static bool SameReportPolicy(const struct report_policy *a, const struct report_policy *b);
+static bool SameControlPolicy(const struct control_policy *a, const struct control_policy *b);
+static esp_err_t MigrateLegacyKeys(nvs_handle_t handle, const char *const *peripheral_keys, const size_t n_peripherals);
\ No newline at end of file
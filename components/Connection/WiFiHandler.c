@@ -1,12 +1,39 @@
+#include <inttypes.h>
 #include "WiFiHandler.h"
 #include "Module.h"
 #include "LeScanner.h"
 #include "LedHandler.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 
-#define MAX_RETRIES 3
 static const char TAG[] = "WiFiHandler";
-static int con_retry = 0;
+static int con_retry = 0;     // Failed attempts since the last connection, sets the backoff
+static int auth_failures = 0; // Failed attempts in a row that point at wrong credentials
+static bool wifi_on = false;
+static bool reconnecting = false; // The link was lost, the running connection attempt is a reconnection
+static bool credentials_verified = false; // The current credentials connected at least once
+static bool credentials_changed = false;  // New credentials were provisioned while WiFi stayed up
+static bool provisioning = false;         // BLE provisioning is running
+static bool has_ip = false;
+static esp_timer_handle_t reconnect_timer = NULL;
 static const int WIFI_CONNECT_BIT = BIT0;
+static bool resumed = false; // Woken up from deep sleep, the module is known to be configured
+static bool targeted = false; // The station is locked on the cached access point, no scan
+static int64_t connect_start_us = 0;
+static struct wifi_connect_stats connect_stats;
+
+/**
+ * @brief Access point the station was last associated with, kept in RTC memory across deep sleep
+ * and in NVS across power cycles, so the next connection can skip the scan.
+ */
+struct wifi_association
+{
+  bool valid;
+  uint8_t bssid[6];
+  uint8_t channel;
+};
+RTC_DATA_ATTR static struct wifi_association last_association;
 
 /* FreeRTOS event group to signal when we are connected & ready to make a request */
 static EventGroupHandle_t s_wifi_event_group;
@@ -16,7 +43,8 @@ void InitWiFi()
   ESP_LOGI(TAG, "InitWifi");
   esp_netif_init();
   s_wifi_event_group = xEventGroupCreate();
-  esp_netif_create_default_wifi_sta();
+  esp_netif_t *netif = esp_netif_create_default_wifi_sta();
+  ApplyStaticIp(netif);
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
 
   ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -24,6 +52,10 @@ void InitWiFi()
   ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &WiFiEventHandler, NULL));
   ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &WiFiEventHandler, NULL));
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+  const esp_timer_create_args_t reconnect_timer_args = {
+      .callback = &ReconnectTimerCallback,
+      .name = "WiFiReconnect"};
+  ESP_ERROR_CHECK(esp_timer_create(&reconnect_timer_args, &reconnect_timer));
 
   wifi_config_t wifi_conf;
   if (ESP_OK == esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_conf))
@@ -36,19 +68,167 @@ void InitWiFi()
     else
     {
       ESP_LOGI(TAG, "Credentials found for SSID:[%s] and PWD:[%s]", wifi_conf.sta.ssid, wifi_conf.sta.password);
+      ApplyAssociation();
     }
   }
 }
 
+/**
+ * @brief Fast wake path: initializes WiFi and connects straight to the last associated access point
+ * (cached by InitWiFi), without the LED feedback and configuration check of a regular boot.
+ *
+ */
+void ResumeWiFi()
+{
+  resumed = true;
+  InitWiFi();
+  SwitchWiFi();
+}
+
+/**
+ * @brief Returns the connection latency counters.
+ *
+ * @param stats Output, a snapshot of the counters.
+ */
+void GetWiFiConnectStats(struct wifi_connect_stats *stats)
+{
+  *stats = connect_stats;
+}
+
+/**
+ * @brief Restores the last access point from NVS when RTC memory lost it (power cycle, flashing).
+ *
+ */
+static void LoadAssociation()
+{
+  nvs_handle_t handle;
+  if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+  {
+    return;
+  }
+  struct wifi_association stored;
+  size_t len = sizeof(stored);
+  if (nvs_get_blob(handle, WIFI_ASSOCIATION_NVS_KEY, &stored, &len) == ESP_OK && len == sizeof(stored))
+  {
+    last_association = stored;
+  }
+  nvs_close(handle);
+}
+
+/**
+ * @brief Saves the last access point to NVS, only when it changed so a stable network never writes flash.
+ *
+ */
+static void SaveAssociation()
+{
+  nvs_handle_t handle;
+  if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+  {
+    return;
+  }
+  struct wifi_association stored;
+  size_t len = sizeof(stored);
+  if (nvs_get_blob(handle, WIFI_ASSOCIATION_NVS_KEY, &stored, &len) != ESP_OK || len != sizeof(stored) ||
+      memcmp(&stored, &last_association, sizeof(stored)) != 0)
+  {
+    if (nvs_set_blob(handle, WIFI_ASSOCIATION_NVS_KEY, &last_association, sizeof(last_association)) != ESP_OK ||
+        nvs_commit(handle) != ESP_OK)
+    {
+      ESP_LOGW(TAG, "Failed to save the access point");
+    }
+  }
+  nvs_close(handle);
+}
+
+/**
+ * @brief Locks the station on the cached access point and channel, so the connection skips the scan.
+ * A failed attempt drops the lock (see ForgetAssociation) and the retries take the full path.
+ *
+ */
+static void ApplyAssociation()
+{
+  if (!last_association.valid)
+  {
+    LoadAssociation();
+  }
+  wifi_config_t wifi_conf;
+  if (last_association.valid && esp_wifi_get_config(WIFI_IF_STA, &wifi_conf) == ESP_OK)
+  {
+    wifi_conf.sta.bssid_set = true;
+    memcpy(wifi_conf.sta.bssid, last_association.bssid, sizeof(wifi_conf.sta.bssid));
+    wifi_conf.sta.channel = last_association.channel;
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM)); // The lock on the access point must not outlive this boot
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_conf);
+    targeted = true;
+    credentials_verified = true; // Only cached once these credentials connected
+    ESP_LOGI(TAG, "Connecting to cached access point on channel %d", last_association.channel);
+  }
+}
+
+/**
+ * @brief Configures WIFI_STATIC_IP instead of DHCP, if set. DHCP leases are otherwise reused across boots
+ * through CONFIG_LWIP_DHCP_RESTORE_LAST_IP, which requests the last address without a discovery.
+ *
+ * @param netif The station interface.
+ */
+static void ApplyStaticIp(esp_netif_t *netif)
+{
+  if (strlen(WIFI_STATIC_IP) == 0)
+  {
+    return;
+  }
+  const esp_netif_ip_info_t ip_info = {
+      .ip.addr = esp_ip4addr_aton(WIFI_STATIC_IP),
+      .netmask.addr = esp_ip4addr_aton(WIFI_STATIC_NETMASK),
+      .gw.addr = esp_ip4addr_aton(WIFI_STATIC_GATEWAY),
+  };
+  esp_netif_dns_info_t dns = {.ip.type = ESP_IPADDR_TYPE_V4};
+  dns.ip.u_addr.ip4.addr = esp_ip4addr_aton(WIFI_STATIC_DNS);
+  if (esp_netif_dhcpc_stop(netif) != ESP_OK || esp_netif_set_ip_info(netif, &ip_info) != ESP_OK ||
+      esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to set static IP, using DHCP");
+    esp_netif_dhcpc_start(netif);
+    return;
+  }
+  ESP_LOGI(TAG, "Static IP %s", WIFI_STATIC_IP);
+}
+
+/**
+ * @brief Drops the lock on the cached access point, the next connection attempt scans again.
+ *
+ */
+static void ForgetAssociation()
+{
+  wifi_config_t wifi_conf;
+  last_association.valid = false;
+  targeted = false;
+  if (esp_wifi_get_config(WIFI_IF_STA, &wifi_conf) == ESP_OK && wifi_conf.sta.bssid_set)
+  {
+    wifi_conf.sta.bssid_set = false;
+    wifi_conf.sta.channel = 0;
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_conf);
+  }
+}
+
 bool SwitchWiFi()
 {
-  static bool isOn = false;
-  if (!isOn)
+  if (!wifi_on)
+  {
+    con_retry = 0;
+    auth_failures = 0;
+    connect_start_us = esp_timer_get_time();
+    wifi_on = true; // Set first, STA_START may be handled before esp_wifi_start returns
     ESP_ERROR_CHECK(esp_wifi_start());
+  }
   else
+  {
+    wifi_on = false; // The disconnection caused by the stop must not schedule a retry
+    esp_timer_stop(reconnect_timer);
     ESP_ERROR_CHECK(esp_wifi_stop());
-  ESP_LOGI(TAG, "WiFi switch: %d", !isOn);
-  return isOn = !isOn;
+  }
+  ESP_LOGI(TAG, "WiFi switch: %d", wifi_on);
+  return wifi_on;
 }
 
 void SetCredentials(const uint8_t *ssid, const uint8_t *pwd)
@@ -64,7 +244,20 @@ void SetCredentials(const uint8_t *ssid, const uint8_t *pwd)
   };
   strncpy((char *)conf.sta.ssid, (const char *)ssid, MAX_SSID_SIZE);
   strncpy((char *)conf.sta.password, (const char *)pwd, MAX_PWD_SIZE);
+  // New network: persist the credentials and drop the access point cached for the old one
+  esp_wifi_set_storage(WIFI_STORAGE_FLASH);
   esp_wifi_set_config(WIFI_IF_STA, &conf);
+  last_association.valid = false;
+  targeted = false;
+  credentials_verified = false;
+  credentials_changed = true;
+  nvs_handle_t handle;
+  if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+  {
+    nvs_erase_key(handle, WIFI_ASSOCIATION_NVS_KEY);
+    nvs_commit(handle);
+    nvs_close(handle);
+  }
 }
 
 bool BlockUntilHasConnection()
@@ -75,11 +268,61 @@ bool BlockUntilHasConnection()
   return a == WIFI_CONNECT_BIT;
 }
 
-static void SwitchToLEScanCallback()
+/**
+ * @brief Ends BLE provisioning, called once BLE is disabled again. When WiFi stayed up the connection is
+ * kept and only handed to the module (or redone with the new credentials), otherwise WiFi is restarted.
+ *
+ */
+void EndProvisioning()
 {
-  ESP_LOGI(TAG, "Switch to BLE Scan");
+  provisioning = false;
+  if (!wifi_on)
+  {
+    SwitchWiFi();
+    return;
+  }
+  if (credentials_changed)
+  {
+    credentials_changed = false;
+    if (has_ip)
+    {
+      esp_wifi_disconnect(); // The retry joins the new network
+    }
+    return;
+  }
+  if (has_ip)
+  {
+    if (ModuleIsConfigured())
+      xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECT_BIT);
+    else
+      StartProvisioning(true);
+  }
+}
+
+/**
+ * @brief Starts BLE provisioning on its own task, the BT stack must not be brought up from the event loop.
+ *
+ * @param keep_wifi Keep the station associated and scan in coexistence (the module needs a token),
+ * rather than stopping WiFi (the credentials are wrong, there is no connection to keep).
+ */
+static void StartProvisioning(const bool keep_wifi)
+{
+  provisioning = true;
+  credentials_changed = false;
+  connect_stats.ble_escalations++;
+  xTaskCreatePinnedToCore(SwitchToLEScanCallback, "switch_to_LEScan", PROVISIONING_TASK_STACK_SIZE, keep_wifi ? (void *)1 : NULL,
+                          PROVISIONING_TASK_PRIORITY, NULL, PROVISIONING_TASK_CORE);
+}
+
+static void SwitchToLEScanCallback(void *arg)
+{
+  const bool keep_wifi = arg != NULL;
+  ESP_LOGI(TAG, "Switch to BLE Scan%s", keep_wifi ? ", WiFi kept up" : "");
   LEDEvent(SWITCH_MODE);
-  SwitchWiFi();
+  if (!keep_wifi)
+  {
+    SwitchWiFi();
+  }
   EnableBLE();
   StartScan();
   vTaskDelete(NULL);
@@ -95,43 +338,156 @@ static void WiFiEventHandler(
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
   {
     ESP_LOGI(TAG, "Trying to connect...");
-    LEDEvent(WIFI_CONNECTING);
+    if (!resumed)
+    {
+      LEDEvent(WIFI_CONNECTING);
+    }
     esp_wifi_connect();
   }
   else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
   {
+    const bool was_connected = has_ip;
+    has_ip = false;
     xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECT_BIT);
-    if (++con_retry > MAX_RETRIES)
+    if (!wifi_on)
+    {
+      return; // Stopped on purpose
+    }
+    const wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+    connect_stats.last_disconnect_reason = event->reason;
+    if (was_connected)
+    {
+      connect_stats.disconnects++;
+      connect_start_us = esp_timer_get_time(); // A reconnection is timed from the link loss
+      reconnecting = true;
+    }
+    if (last_association.valid)
+    {
+      ForgetAssociation(); // The access point may have moved to another channel
+    }
+    auth_failures = IsAuthFailure(event->reason) ? auth_failures + 1 : 0;
+    con_retry++;
+    // Only wrong credentials justify leaving WiFi, a lost or rebooting access point is waited for
+    if (!provisioning &&
+        (auth_failures >= WIFI_MAX_AUTH_FAILURES || (!credentials_verified && con_retry > WIFI_MAX_UNVERIFIED_RETRIES)))
     {
+      ESP_LOGW(TAG, "Credentials rejected or never valid (reason %d)", event->reason);
       con_retry = 0;
-      xTaskCreate(SwitchToLEScanCallback, "switch_to_LEScan", 2096, NULL, 5, NULL);
+      auth_failures = 0;
+      StartProvisioning(false);
     }
     else
     {
-      ESP_LOGI(TAG, "Disconnected, retrying... [%d]", con_retry);
-      LEDEvent(WIFI_CONNECTING);
-      esp_wifi_connect();
+      if (!resumed)
+      {
+        LEDEvent(WIFI_CONNECTING);
+      }
+      ScheduleReconnect();
     }
   }
   else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
   {
     con_retry = 0;
-    if(!ModuleIsConfigured())
+    auth_failures = 0;
+    credentials_verified = true;
+    has_ip = true;
+    ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+    connect_stats.last_connect_us = esp_timer_get_time() - connect_start_us;
+    connect_stats.last_targeted = targeted;
+    if (targeted)
+      connect_stats.targeted_connects++;
+    else
+      connect_stats.full_connects++;
+    if (reconnecting)
     {
-      ESP_LOGI(TAG, "Module is not configured, switching to BLE scan mode.");
-      xTaskCreate(SwitchToLEScanCallback, "switch_to_LEScan", 2096, NULL, 5, NULL);
+      reconnecting = false;
+      connect_stats.total_reconnect_us += connect_stats.last_connect_us;
+      if (connect_stats.last_connect_us > connect_stats.max_reconnect_us)
+        connect_stats.max_reconnect_us = connect_stats.last_connect_us;
+    }
+    ESP_LOGI(TAG, "Got ip: " IPSTR ", connect_us=%" PRId64 " targeted=%d", IP2STR(&event->ip_info.ip),
+             connect_stats.last_connect_us, targeted);
+    if (!resumed)
+    {
+      LEDEvent(WIFI_CONNECTED);
+    }
+    if (!resumed && !ModuleIsConfigured())
+    {
+      // The connection is handed to the module once provisioning gave it a token, see EndProvisioning
+      ESP_LOGI(TAG, "Module is not configured, starting BLE provisioning with WiFi kept up.");
+      if (!provisioning)
+      {
+        StartProvisioning(true);
+      }
+      return;
     }
-    ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-    ESP_LOGI(TAG, "Got ip: " IPSTR, IP2STR(&event->ip_info.ip));
     xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECT_BIT);
-    LEDEvent(WIFI_CONNECTED);
   }
   else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
   {
     ESP_LOGI(TAG, "Connected, Waiting for DHCP protocol...");
+    wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+    memcpy(last_association.bssid, event->bssid, sizeof(last_association.bssid));
+    last_association.channel = event->channel;
+    last_association.valid = true;
+    SaveAssociation();
   }
   else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
   {
     ESP_LOGI(TAG, "Disconnected, something happened.");
   }
+}
+
+/**
+ * @brief Plans the next connection attempt with exponential backoff. The wait doubles on every failure up to
+ * WIFI_BACKOFF_MAX_MS, and WIFI_BACKOFF_JITTER_PERCENT of it is random so the modules of a site spread
+ * their attempts when their access point comes back.
+ *
+ */
+static void ScheduleReconnect()
+{
+  const int shift = (con_retry > 16) ? 16 : con_retry - 1;
+  uint64_t delay_ms = (uint64_t)WIFI_BACKOFF_BASE_MS << shift;
+  if (delay_ms > WIFI_BACKOFF_MAX_MS)
+  {
+    delay_ms = WIFI_BACKOFF_MAX_MS;
+  }
+  const uint64_t jitter_ms = delay_ms * WIFI_BACKOFF_JITTER_PERCENT / 100;
+  if (jitter_ms > 0)
+  {
+    delay_ms = delay_ms - jitter_ms + esp_random() % (jitter_ms + 1);
+  }
+  ESP_LOGI(TAG, "Disconnected, retrying in %llu ms... [%d]", delay_ms, con_retry);
+  esp_timer_stop(reconnect_timer); // Not running unless a disconnection raced the previous attempt
+  esp_timer_start_once(reconnect_timer, delay_ms * 1000);
+}
+
+/**
+ * @brief Fires once the backoff has elapsed, runs on the esp_timer task.
+ */
+static void ReconnectTimerCallback(void *arg)
+{
+  if (wifi_on)
+  {
+    connect_stats.reconnect_attempts++;
+    esp_wifi_connect();
+  }
+}
+
+/**
+ * @brief Tells whether a disconnection reason means the access point refused the credentials,
+ * rather than being out of reach. Handshake timeouts are left out: an overloaded or rebooting access point and a
+ * weak signal cause them too. Wrong new credentials that only ever time out are caught by the unverified retry limit.
+ */
+static bool IsAuthFailure(const uint8_t reason)
+{
+  switch (reason)
+  {
+  case WIFI_REASON_AUTH_FAIL:
+  case WIFI_REASON_MIC_FAILURE:
+  case WIFI_REASON_802_1X_AUTH_FAILED:
+    return true;
+  default:
+    return false;
+  }
 }
\ No newline at end of file
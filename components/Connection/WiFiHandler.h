@@ -10,9 +10,42 @@
 #include "esp_event.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
+#include "TaskLayout.h"
 
 #define MAX_SSID_SIZE 16 // in Bytes
 #define MAX_PWD_SIZE 16  // in Bytes
+#define WIFI_NVS_NAMESPACE "WiFi"
+#define WIFI_ASSOCIATION_NVS_KEY "assoc" // Last access point, survives power cycles
+#ifndef WIFI_STATIC_IP
+#define WIFI_STATIC_IP "" // e.g. "192.168.1.50" to skip DHCP, empty to use DHCP
+#endif
+#define WIFI_STATIC_NETMASK "255.255.255.0"
+#define WIFI_STATIC_GATEWAY "192.168.1.1"
+#define WIFI_STATIC_DNS "192.168.1.1"
+#define WIFI_BACKOFF_BASE_MS 500       // Wait before the first retry, doubled on every failed attempt
+#define WIFI_BACKOFF_MAX_MS 60000      // Ceiling of the wait between retries
+#define WIFI_BACKOFF_JITTER_PERCENT 50 // Share of the wait that is randomized, so modules do not retry in lockstep
+#define WIFI_MAX_AUTH_FAILURES 3       // Authentication failures in a row before asking for new credentials
+#define WIFI_MAX_UNVERIFIED_RETRIES 3  // Failures before asking for new credentials that never connected
+#define PROVISIONING_TASK_STACK_SIZE 2096 // Tasks switching between WiFi and BLE
+
+/**
+ * @brief Connection latency, from esp_wifi_start (or the link loss) to having an IP, and reconnection counters.
+ */
+struct wifi_connect_stats
+{
+  int64_t last_connect_us;        // Duration of the last connection
+  bool last_targeted;             // The last connection went straight to the cached access point
+  uint32_t targeted_connects;     // Connections made without scanning
+  uint32_t full_connects;         // Connections that had to scan
+  uint32_t disconnects;           // Links lost after having an IP
+  uint32_t reconnect_attempts;    // Connection attempts made after a failure, all outages included
+  int64_t total_reconnect_us;     // Accumulated time from a link loss to getting an IP back
+  int64_t max_reconnect_us;       // Longest outage recovered from
+  uint8_t last_disconnect_reason; // wifi_err_reason_t of the last failure
+  uint32_t ble_escalations;       // Times BLE provisioning was started
+};
+
 bool HasCredentialsSaved();
 
 bool BlockUntilHasConnection();
@@ -21,7 +54,8 @@ bool BlockUntilHasConnection();
  * @brief The InitWiFi function initializes the Wi-Fi subsystem for an ESP32 device,
  * setting up the necessary network interfaces, event handlers, and default configurations.
  * It also checks for existing Wi-Fi credentials, logging them if found, or setting default
- * placeholder values if none are available.
+ * placeholder values if none are available. The first connection goes straight to the last
+ * access point (or the static IP) when one is cached.
  *
  */
 void InitWiFi();
@@ -34,9 +68,28 @@ void InitWiFi();
  */
 bool SwitchWiFi();
 
+/**
+ * @brief Fast wake path of InitWiFi: skips the module configuration check and the LED feedback.
+ *
+ */
+void ResumeWiFi();
+
 void SetCredentials(const uint8_t *ssid, const uint8_t *pwd);
 
-static void SwitchToLEScanCallback();
+void GetWiFiConnectStats(struct wifi_connect_stats *stats);
+
+void EndProvisioning();
+
+static void StartProvisioning(const bool keep_wifi);
+static void SwitchToLEScanCallback(void *arg);
+static void ScheduleReconnect();
+static void ReconnectTimerCallback(void *arg);
+static bool IsAuthFailure(const uint8_t reason);
+static void LoadAssociation();
+static void SaveAssociation();
+static void ApplyAssociation();
+static void ApplyStaticIp(esp_netif_t *netif);
+static void ForgetAssociation();
 
 static void WiFiEventHandler(void *arg, esp_event_base_t event_base,
                              int32_t event_id, void *event_data);
\ No newline at end of file
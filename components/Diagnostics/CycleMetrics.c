@@ -0,0 +1,108 @@
+#include <inttypes.h>
+#include "CycleMetrics.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+
+static const char TAG[] = "CycleMetrics";
+
+// Updated from the heap hooks, which may run on either core and from ISRs. Stay at 0 without CONFIG_HEAP_USE_HOOKS
+static volatile uint32_t heap_allocations = 0;
+static volatile uint32_t heap_allocated_bytes = 0;
+
+static uint32_t n_cycles = 0;
+static bool uploaded = false; // Whether an upload succeeded since boot
+static portMUX_TYPE last_lock = portMUX_INITIALIZER_UNLOCKED; // Runs end on the sampler and the uplink
+static struct cycle_metrics last_metrics;
+
+#if CONFIG_HEAP_USE_HOOKS
+/**
+ * @brief Heap hook called by the allocator after every successful allocation.
+ * Kept in IRAM and lock free, it may run while the flash cache is disabled.
+ */
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+  __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&heap_allocated_bytes, size, __ATOMIC_RELAXED);
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+}
+#endif
+
+/**
+ * @brief Snapshots the counters at the start of a measured run.
+ *
+ * @param run Output, the run, to hand to CycleMetricsEnd.
+ */
+void CycleMetricsBegin(struct cycle_metrics_run *run)
+{
+  GetHttpsSessionStats(&run->start_https);
+  run->start_allocations = __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED);
+  run->start_allocated_bytes = __atomic_load_n(&heap_allocated_bytes, __ATOMIC_RELAXED);
+  run->start_us = esp_timer_get_time();
+}
+
+/**
+ * @brief Computes the cost of the run started by CycleMetricsBegin and logs it as a single
+ * key=value line, so a serial capture can be diffed against a previous baseline.
+ *
+ * @param run The run, as started by CycleMetricsBegin.
+ * @param label Name of the measured run (e.g. "init", "sample", "upload").
+ * @param metrics Output, may be NULL if only the log line is wanted.
+ */
+void CycleMetricsEnd(const struct cycle_metrics_run *run, const char *label, struct cycle_metrics *metrics)
+{
+  struct cycle_metrics m;
+  struct https_session_stats https;
+  m.wall_us = esp_timer_get_time() - run->start_us;
+  m.allocations = __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED) - run->start_allocations;
+  m.allocated_bytes = __atomic_load_n(&heap_allocated_bytes, __ATOMIC_RELAXED) - run->start_allocated_bytes;
+  GetHttpsSessionStats(&https);
+  m.cycle = __atomic_fetch_add(&n_cycles, 1, __ATOMIC_RELAXED);
+  m.requests = https.requests - run->start_https.requests;
+  m.handshakes = https.handshakes - run->start_https.handshakes;
+  m.bytes_sent = https.bytes_sent - run->start_https.bytes_sent;
+  m.bytes_received = https.bytes_received - run->start_https.bytes_received;
+
+  ESP_LOGI(TAG, "%s cycle=%" PRIu32 " wall_us=%" PRId64 " allocs=%" PRIu32 " alloc_bytes=%" PRIu32 " requests=%" PRIu32
+           " handshakes=%" PRIu32 " tx=%" PRIu32 " rx=%" PRIu32,
+           label, m.cycle, m.wall_us, m.allocations, m.allocated_bytes, m.requests, m.handshakes, m.bytes_sent, m.bytes_received);
+  taskENTER_CRITICAL(&last_lock);
+  last_metrics = m;
+  taskEXIT_CRITICAL(&last_lock);
+  if (metrics != NULL)
+  {
+    *metrics = m;
+  }
+}
+
+/**
+ * @brief Returns the cost of the last measured run, zeroed before the first one ends.
+ *
+ * @param metrics Output.
+ */
+void CycleMetricsGetLast(struct cycle_metrics *metrics)
+{
+  taskENTER_CRITICAL(&last_lock);
+  *metrics = last_metrics;
+  taskEXIT_CRITICAL(&last_lock);
+}
+
+/**
+ * @brief Records a successful upload. The first one after boot (or deep sleep wakeup) logs the time it took
+ * to get there, the latency a duty-cycled module pays on every wakeup.
+ *
+ */
+void CycleMetricsUploadDone()
+{
+  if (uploaded)
+  {
+    return;
+  }
+  uploaded = true;
+  ESP_LOGI(TAG, "first_upload wake_to_upload_us=%" PRId64, esp_timer_get_time());
+}
\ No newline at end of file
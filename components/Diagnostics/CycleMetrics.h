@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include "HttpsClient.h"
+
+/**
+ * @brief Cost of one measured run (module init or update cycle), used as the regression baseline
+ * for performance changes. Every counter is the difference between CycleMetricsBegin and CycleMetricsEnd.
+ * The counters are system-wide, not scoped to the task of the run: two runs measured at the same time (the
+ * sampler's and the uplink's) both count the allocations and requests made while they overlap.
+ */
+struct cycle_metrics
+{
+  uint32_t cycle;           // Sequence number of the measured run
+  int64_t wall_us;          // Wall time of the run
+  uint32_t allocations;     // Heap allocations performed by any task during the run
+  uint32_t allocated_bytes; // Bytes requested by those allocations
+  uint32_t requests;        // HTTPS requests performed
+  uint32_t handshakes;      // Connections opened for those requests
+  uint32_t bytes_sent;      // Bytes written to the socket by those requests, TLS included
+  uint32_t bytes_received;  // Bytes read from the socket by those requests, TLS included
+};
+
+/**
+ * @brief A run in progress, owned by the task that measures it. Tasks measure their runs independently.
+ */
+struct cycle_metrics_run
+{
+  int64_t start_us;
+  uint32_t start_allocations;
+  uint32_t start_allocated_bytes;
+  struct https_session_stats start_https;
+};
+
+void CycleMetricsBegin(struct cycle_metrics_run *run);
+void CycleMetricsEnd(const struct cycle_metrics_run *run, const char *label, struct cycle_metrics *metrics);
+void CycleMetricsUploadDone();
+void CycleMetricsGetLast(struct cycle_metrics *metrics);
\ No newline at end of file
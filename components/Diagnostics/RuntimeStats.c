@@ -0,0 +1,243 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "RuntimeStats.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "driver/uart.h"
+
+#define CONSOLE_LINE_SIZE 32
+#define CPU_COUNTER_WRAP_US (1LL << 32) // The run time counters are 32-bit microseconds, they wrap every 71.6 minutes
+static const char TAG[] = "RuntimeStats";
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+/**
+ * @brief Computes the share of time each core spent outside its idle task since the caller's previous snapshot,
+ * then moves the baseline to this one. A window longer than the counter wrap can't be told from a shorter one
+ * and is reported as unknown: the hourly telemetry is only 11 minutes short of it, a late record is not unusual.
+ *
+ * @param task_status Every task of the system.
+ * @param n_tasks Number of tasks in task_status.
+ * @param total_run_time Run time counter at the snapshot.
+ * @param baseline Previous snapshot of the caller, updated.
+ * @param busy_percent Output, one entry per core.
+ */
+static void ComputeCpuUsage(const TaskStatus_t *task_status, const size_t n_tasks, const uint32_t total_run_time,
+                            struct cpu_usage_baseline *baseline, int busy_percent[portNUM_PROCESSORS])
+{
+  const int64_t now_us = esp_timer_get_time();
+  uint32_t idle_run_time[portNUM_PROCESSORS] = {0};
+  for (size_t i = 0; i < n_tasks; i++)
+  {
+    for (BaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+      if (task_status[i].xHandle == xTaskGetIdleTaskHandleForCore(core))
+      {
+        idle_run_time[core] = task_status[i].ulRunTimeCounter;
+      }
+    }
+  }
+  const bool wrapped = now_us - baseline->taken_us >= CPU_COUNTER_WRAP_US;
+  const uint32_t elapsed = total_run_time - baseline->total_run_time;
+  for (size_t core = 0; core < portNUM_PROCESSORS; core++)
+  {
+    const uint32_t idle = idle_run_time[core] - baseline->idle_run_time[core];
+    busy_percent[core] = (wrapped || elapsed == 0 || idle > elapsed) ? -1 : (int)(100 - (uint64_t)idle * 100 / elapsed);
+    baseline->idle_run_time[core] = idle_run_time[core];
+  }
+  baseline->total_run_time = total_run_time;
+  baseline->taken_us = now_us;
+}
+#endif
+
+/**
+ * @brief Takes a snapshot of the heap and of the stack high-water mark of every task.
+ * Needs CONFIG_FREERTOS_USE_TRACE_FACILITY for the task list, without it only the heap is reported.
+ *
+ * @param stats Output, the snapshot.
+ * @param baseline The caller's previous snapshot, the CPU usage is measured since then. Updated.
+ */
+void RuntimeStatsCollect(struct runtime_stats *stats, struct cpu_usage_baseline *baseline)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->uptime_us = esp_timer_get_time();
+  stats->free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  stats->min_free_heap = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  stats->largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  CycleMetricsGetLast(&stats->last_cycle);
+  TraceSummarize(stats->phases);
+  for (size_t core = 0; core < portNUM_PROCESSORS; core++)
+  {
+    stats->cpu_busy_percent[core] = -1;
+  }
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+  TaskStatus_t task_status[RUNTIME_STATS_MAX_TASKS];
+  stats->n_tasks = uxTaskGetNumberOfTasks();
+  uint32_t total_run_time = 0;
+  // Returns 0 if the array is too small, in that case report what the caller's own task knows
+  stats->n_reported_tasks = uxTaskGetSystemState(task_status, RUNTIME_STATS_MAX_TASKS, &total_run_time);
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+  if (stats->n_reported_tasks > 0)
+  {
+    ComputeCpuUsage(task_status, stats->n_reported_tasks, total_run_time, baseline, stats->cpu_busy_percent);
+  }
+#endif
+  for (size_t i = 0; i < stats->n_reported_tasks; i++)
+  {
+    struct task_stack_usage *task = &stats->tasks[i];
+    snprintf(task->name, sizeof(task->name), "%s", task_status[i].pcTaskName);
+    task->stack_free_min = task_status[i].usStackHighWaterMark; // ESP-IDF counts stacks in bytes
+    task->core = (task_status[i].xCoreID == tskNO_AFFINITY) ? -1 : (int)task_status[i].xCoreID;
+  }
+  if (stats->n_reported_tasks == 0)
+  {
+    snprintf(stats->tasks[0].name, sizeof(stats->tasks[0].name), "%s", pcTaskGetName(NULL));
+    stats->tasks[0].stack_free_min = uxTaskGetStackHighWaterMark(NULL);
+    stats->tasks[0].core = -1;
+    stats->n_reported_tasks = 1;
+  }
+#endif
+}
+
+/**
+ * @brief Logs a snapshot, one line for the heap and one per task.
+ */
+void RuntimeStatsLog(const struct runtime_stats *stats)
+{
+  ESP_LOGI(TAG, "heap free=%" PRIu32 " min_free=%" PRIu32 " largest_block=%" PRIu32 " cycle=%" PRIu32 " cycle_allocs=%" PRIu32
+           " cycle_alloc_bytes=%" PRIu32 " tasks=%zu",
+           stats->free_heap, stats->min_free_heap, stats->largest_free_block,
+           stats->last_cycle.cycle, stats->last_cycle.allocations, stats->last_cycle.allocated_bytes, stats->n_tasks);
+  for (size_t i = 0; i < stats->n_reported_tasks; i++)
+  {
+    ESP_LOGI(TAG, "task %-16s stack_free_min=%" PRIu32 " core=%d", stats->tasks[i].name, stats->tasks[i].stack_free_min, stats->tasks[i].core);
+  }
+  for (size_t core = 0; core < portNUM_PROCESSORS; core++)
+  {
+    ESP_LOGI(TAG, "cpu core=%zu busy_percent=%d", core, stats->cpu_busy_percent[core]);
+  }
+  for (size_t i = 0; i < N_TRACE_PHASES; i++)
+  {
+    const struct trace_phase_summary *phase = &stats->phases[i];
+    ESP_LOGI(TAG, "phase %-8s spans=%" PRIu32 " p50_us=%" PRIu32 " p95_us=%" PRIu32 " max_us=%" PRIu32,
+             TracePhaseName(i), phase->n_spans, phase->p50_us, phase->p95_us, phase->max_us);
+  }
+}
+
+/**
+ * @brief Encodes a snapshot as the diagnostics telemetry record
+ * {"module", "uptime_s", "free_heap", "min_free_heap", "largest_free_block", "cycle_allocs", "cycle_alloc_bytes",
+ * "tasks": [{"name", "stack_free_min"}, ...], "cpu_busy_percent": [<core 0>, ...],
+ * "phases": {"<phase>": {"n", "p50_us", "p95_us", "max_us"}, ...}}.
+ * Phases without spans are left out. Task names are plain identifiers, they are not escaped.
+ *
+ * @return int Length of the record, or -1 if it does not fit in buf.
+ */
+int RuntimeStatsEncode(char *buf, const size_t buf_len, const char *module_token, const struct runtime_stats *stats)
+{
+  int len = snprintf(buf, buf_len,
+                     "{\"module\":\"%s\",\"uptime_s\":%" PRId64 ",\"free_heap\":%" PRIu32 ",\"min_free_heap\":%" PRIu32
+                     ",\"largest_free_block\":%" PRIu32 ",\"cycle_allocs\":%" PRIu32 ",\"cycle_alloc_bytes\":%" PRIu32
+                     ",\"tasks\":[",
+                     module_token, stats->uptime_us / 1000000, stats->free_heap, stats->min_free_heap,
+                     stats->largest_free_block, stats->last_cycle.allocations, stats->last_cycle.allocated_bytes);
+  for (size_t i = 0; i < stats->n_reported_tasks && len >= 0 && (size_t)len < buf_len; i++)
+  {
+    len += snprintf(buf + len, buf_len - len, "%s{\"name\":\"%s\",\"stack_free_min\":%" PRIu32 "}",
+                    (i > 0) ? "," : "", stats->tasks[i].name, stats->tasks[i].stack_free_min);
+  }
+  if (len >= 0 && (size_t)len < buf_len)
+  {
+    len += snprintf(buf + len, buf_len - len, "],\"cpu_busy_percent\":[");
+  }
+  for (size_t core = 0; core < portNUM_PROCESSORS && len >= 0 && (size_t)len < buf_len; core++)
+  {
+    len += snprintf(buf + len, buf_len - len, "%s%d", (core > 0) ? "," : "", stats->cpu_busy_percent[core]);
+  }
+  if (len >= 0 && (size_t)len < buf_len)
+  {
+    len += snprintf(buf + len, buf_len - len, "],\"phases\":{");
+  }
+  bool first_phase = true;
+  for (size_t i = 0; i < N_TRACE_PHASES && len >= 0 && (size_t)len < buf_len; i++)
+  {
+    const struct trace_phase_summary *phase = &stats->phases[i];
+    if (phase->n_spans == 0)
+    {
+      continue;
+    }
+    len += snprintf(buf + len, buf_len - len, "%s\"%s\":{\"n\":%" PRIu32 ",\"p50_us\":%" PRIu32 ",\"p95_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+                    first_phase ? "" : ",", TracePhaseName(i), phase->n_spans, phase->p50_us, phase->p95_us, phase->max_us);
+    first_phase = false;
+  }
+  if (len >= 0 && (size_t)len < buf_len)
+  {
+    len += snprintf(buf + len, buf_len - len, "}}");
+  }
+  return (len < 0 || (size_t)len >= buf_len) ? -1 : len;
+}
+
+/**
+ * @brief Starts a low priority task answering RUNTIME_STATS_CONSOLE_COMMAND typed on the serial console
+ * with the current snapshot, and RUNTIME_STATS_TRACE_COMMAND with the spans of the phase trace ring.
+ *
+ * @return esp_err_t ESP_OK if the console was started, otherwise an error code.
+ */
+esp_err_t RuntimeStatsStartConsole()
+{
+  esp_err_t err = ESP_OK;
+  if (!uart_is_driver_installed(CONFIG_ESP_CONSOLE_UART_NUM))
+  {
+    err = uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, 256, 0, 0, NULL, 0);
+  }
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to install the console UART driver: %s", esp_err_to_name(err));
+    return err;
+  }
+  if (xTaskCreatePinnedToCore(ConsoleTask, "diag_console", RUNTIME_STATS_CONSOLE_STACK_SIZE, NULL, CONSOLE_TASK_PRIORITY, NULL,
+                              CONSOLE_TASK_CORE) != pdPASS)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+/**
+ * @brief Reads the serial console line by line, blocked in the UART driver while nothing is typed.
+ */
+static void ConsoleTask(void *arg)
+{
+  static struct runtime_stats stats; // Too big for this task's stack
+  static struct cpu_usage_baseline baseline; // CPU usage is measured from one diag command to the next
+  char line[CONSOLE_LINE_SIZE];
+  size_t len = 0;
+  for (;;)
+  {
+    char c;
+    if (uart_read_bytes(CONFIG_ESP_CONSOLE_UART_NUM, &c, 1, portMAX_DELAY) != 1)
+    {
+      continue;
+    }
+    if (c != '\r' && c != '\n')
+    {
+      if (len + 1 < sizeof(line))
+      {
+        line[len++] = c;
+      }
+      continue;
+    }
+    line[len] = '\0';
+    if (strcmp(line, RUNTIME_STATS_CONSOLE_COMMAND) == 0)
+    {
+      RuntimeStatsCollect(&stats, &baseline);
+      RuntimeStatsLog(&stats);
+    }
+    else if (strcmp(line, RUNTIME_STATS_TRACE_COMMAND) == 0)
+    {
+      TraceDump();
+    }
+    len = 0;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "CycleMetrics.h"
+#include "PhaseTrace.h"
+#include "TaskLayout.h"
+
+#define RUNTIME_STATS_MAX_TASKS 24          // Tasks reported, the rest are counted but left out
+#define RUNTIME_STATS_JSON_SIZE 2176        // Telemetry record with RUNTIME_STATS_MAX_TASKS tasks and every phase, worst case
+#define RUNTIME_STATS_CONSOLE_COMMAND "diag" // Serial line that prints the report
+#define RUNTIME_STATS_TRACE_COMMAND "trace"  // Serial line that dumps the phase trace ring
+#define RUNTIME_STATS_CONSOLE_STACK_SIZE 4096
+
+/**
+ * @brief Stack usage of one task. The high-water mark is the least free stack the task has had since it started,
+ * a task close to 0 is about to overflow.
+ */
+struct task_stack_usage
+{
+  char name[configMAX_TASK_NAME_LEN];
+  uint32_t stack_free_min; // Bytes
+  int core;                // Core the task is pinned to, -1 if it is not
+};
+
+/**
+ * @brief Run time counters of a caller's previous snapshot, the CPU usage it gets is measured from there.
+ * Every caller keeps its own, so the console and the telemetry do not shorten each other's window.
+ */
+struct cpu_usage_baseline
+{
+  int64_t taken_us;      // Time since boot of the snapshot, 0 if there was none
+  uint32_t total_run_time;
+  uint32_t idle_run_time[portNUM_PROCESSORS];
+};
+
+/**
+ * @brief Memory snapshot of the running firmware.
+ */
+struct runtime_stats
+{
+  int64_t uptime_us;
+  uint32_t free_heap;          // Bytes
+  uint32_t min_free_heap;      // Lowest free heap since boot
+  uint32_t largest_free_block; // Largest allocation that can succeed, far below free_heap means fragmentation
+  struct cycle_metrics last_cycle; // Allocations of the last measured cycle
+  struct trace_phase_summary phases[N_TRACE_PHASES]; // Latency of each cycle phase over the last few cycles
+  int cpu_busy_percent[portNUM_PROCESSORS]; // Time each core spent outside its idle task since the caller's previous snapshot, -1 if unknown
+  size_t n_tasks;                  // Tasks running, may exceed RUNTIME_STATS_MAX_TASKS
+  size_t n_reported_tasks;
+  struct task_stack_usage tasks[RUNTIME_STATS_MAX_TASKS];
+};
+
+void RuntimeStatsCollect(struct runtime_stats *stats, struct cpu_usage_baseline *baseline);
+void RuntimeStatsLog(const struct runtime_stats *stats);
+int RuntimeStatsEncode(char *buf, const size_t buf_len, const char *module_token, const struct runtime_stats *stats);
+esp_err_t RuntimeStatsStartConsole();
+
+static void ConsoleTask(void *arg);
\ No newline at end of file
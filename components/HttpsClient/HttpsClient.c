@@ -1,13 +1,62 @@
+#include <inttypes.h>
 #include "HttpsClient.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_crt_bundle.h"
-#include "cJson.h"
-#define MODULE_REGISTRY_SERVER_RESPONSE_SIZE 128     // Size of the response buffer for module registration
-#define PERIPHERAL_REGISTRY_SERVER_RESPONSE_SIZE 128 // Size of the response buffer for peripheral registration
-#define PERIPHERAL_DATA_SERVER_RESPONSE_SIZE 64      // Size of the response buffer for peripheral data
-#define PERIPHERAL_STATE_SERVER_RESPONSE_SIZE 64     // Size of the response buffer for peripheral state
+#include "SarpCodec.h"
+#include "PhaseTrace.h"
+#include "WireMeter.h"
+#define ERROR_RESPONSE_LOG_SIZE 64                   // Leading bytes of an error response kept for the log
+#define URL_BUFFER_SIZE 128                           // Longest request URL, base URL plus path and id
+#define REGISTRY_BODY_SIZE 128                        // Body of the registration requests, two tokens at most
+#define REGISTRY_BATCH_TYPE_SIZE 28                   // Room per peripheral type and instance in the bulk registration body
+#define HTTP_REQUEST_TIMEOUT_MS 100000                // Timeout for a single request
+#define HTTP_SESSION_BUFFER_SIZE 1024                 // Rx buffer of the persistent client, independent of the response sizes
+#define HTTP_SESSION_MAX_ATTEMPTS 2                   // A stale keep-alive connection gets one reconnect before failing
 static const char TAG[] = "HTTPSClient";
 
+// Long-lived client shared by every request. The TLS session ticket lives inside it,
+// so a dropped connection is resumed instead of paying a full handshake.
+static esp_http_client_handle_t session_client = NULL;
+static struct https_session_stats session_stats;
+static int64_t attempt_start_us = 0;
+static int last_status = 0; // Status of the last response, 0 if the last request got none
+static bool connection_open = false; // Whether the session holds a connection, kept alive from a previous request
+static int64_t headers_sent_us = 0; // Start of the response phase of the current attempt
+static int64_t parse_us = 0;        // Time spent scanning the current response body
+// The batch body is too large for the caller's stack, requests are serialized so one buffer is enough
+static char batch_body[MAX_BATCH_READINGS * SARP_MAX_READING_JSON_SIZE + 16];
+static char events_body[MAX_BATCH_EVENTS * SARP_MAX_EVENT_JSON_SIZE + 64];
+
+/**
+ * @brief Appends a chunk of the response body to the sink, bounded by its buffer, and feeds it to its consumer.
+ *
+ * @param sink Destination of the body, may be NULL.
+ * @param data Chunk received.
+ * @param len Length of the chunk.
+ */
+static void SinkAppend(struct http_response_sink *sink, const char *data, const size_t len)
+{
+  if (sink == NULL)
+  {
+    return;
+  }
+  sink->total_len += len;
+  if (sink->buf != NULL && sink->cap > 0)
+  {
+    const size_t room = sink->cap - 1 - sink->len;
+    const size_t n_copy = (len < room) ? len : room;
+    memcpy(sink->buf + sink->len, data, n_copy);
+    sink->len += n_copy;
+    sink->buf[sink->len] = '\0';
+    sink->truncated = sink->truncated || n_copy < len;
+  }
+  if (sink->feed != NULL)
+  {
+    sink->feed(sink->feed_ctx, data, len);
+  }
+}
+
 /**
  * @brief Handles HTTP events for the ESP HTTP client.
  * This function processes various events such as connection, data reception,
@@ -24,27 +73,32 @@ static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
     ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
     break;
   case HTTP_EVENT_ON_CONNECTED:
-    ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+    // Only raised when a new connection had to be opened, so this is the handshake cost
+    connection_open = true;
+    session_stats.handshakes++;
+    session_stats.last_handshake_us = esp_timer_get_time() - attempt_start_us;
+    session_stats.total_handshake_us += session_stats.last_handshake_us;
+    TRACE_RECORD(TRACE_PHASE_CONNECT, attempt_start_us, session_stats.last_handshake_us);
+    ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED, handshake took %" PRId64 " us", session_stats.last_handshake_us);
     break;
   case HTTP_EVENT_HEADER_SENT:
+    headers_sent_us = TRACE_NOW();
     ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
     break;
   case HTTP_EVENT_ON_HEADER:
     ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
     break;
   case HTTP_EVENT_ON_DATA:
-    ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-    if (!esp_http_client_is_chunked_response(evt->client))
-    {
-      memcpy(evt->user_data, evt->data, evt->data_len); // Copy data to user_data buffer
-      // Write data received to stdout
-      printf("%.*s", evt->data_len, (char *)evt->data);
-    }
+    // Chunked bodies arrive here already de-chunked, so both transfer modes take the same path
+    ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d: %.*s", evt->data_len, evt->data_len, (char *)evt->data);
+    SinkAppend(evt->user_data, evt->data, evt->data_len);
     break;
   case HTTP_EVENT_ON_FINISH:
+    TRACE_SPAN(TRACE_PHASE_RESPONSE, headers_sent_us);
     ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
     break;
   case HTTP_EVENT_DISCONNECTED:
+    connection_open = false;
     ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
     break;
   case HTTP_EVENT_REDIRECT:
@@ -54,54 +108,95 @@ static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
   return ESP_OK;
 }
 
+/**
+ * @brief Response sink consumer driving a SARP scanner.
+ */
+static void FeedScanner(void *ctx, const char *data, size_t len)
+{
+  const int64_t start_us = TRACE_NOW();
+  SarpScannerFeed(ctx, data, len);
+  parse_us += TRACE_NOW() - start_us;
+}
+
+/**
+ * @brief Returns the persistent session client, creating it on first use.
+ *
+ * @param url URL of the first request, used to set up the connection host.
+ * @return esp_http_client_handle_t The session client, or NULL on failure.
+ */
+static esp_http_client_handle_t GetSessionClient(const char *url)
+{
+  if (session_client != NULL)
+  {
+    return session_client;
+  }
+  esp_http_client_config_t config = {
+      .crt_bundle_attach = esp_crt_bundle_attach, // Use the built-in certificate bundle
+      .url = url,
+      .event_handler = _http_event_handler,      // Always good to have an event handler
+      .timeout_ms = HTTP_REQUEST_TIMEOUT_MS,     // Set a timeout for the request
+      .buffer_size = HTTP_SESSION_BUFFER_SIZE,   // Rx buffer shared by all requests
+      .keep_alive_enable = true,                 // TCP keep-alive, detects dead connections while idle
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+      .save_client_session = true, // Keep the TLS session ticket to resume after a drop
+#endif
+  };
+  session_client = esp_http_client_init(&config);
+  if (session_client == NULL)
+  {
+    ESP_LOGE(TAG, "Failed to initialize HTTP client");
+  }
+  return session_client;
+}
+
 /**
  * @brief Performs an HTTP request with a given method and URL.
  * Headers are set as json content type if the method is POST/PUT/PATCH.
+ * The request goes through the persistent session: the connection is reused while the server keeps it alive.
+ * When a kept-alive connection turns out to be stale before the request could be sent, it is reopened
+ * (resuming the TLS session) and the request sent once more. A request that may have reached the server is never
+ * replayed, so a POST is not duplicated.
  *
  * @param method The HTTP method (e.g., HTTP_METHOD_GET, HTTP_METHOD_POST).
  * @param url The URL for the request.
  * @param post_data Optional: Data to send in the request body for POST/PUT.
- * @param response_buffer Buffer to store the response data; must be large enough to hold the response.
- * @param resp_buff_leng Length of the response buffer.
- * @return esp_err_t ESP_OK on success, otherwise an error code.
+ * @param sink Optional: Destination of the response body, streamed into it chunk by chunk.
+ * @return esp_err_t ESP_OK on a 2xx response, ESP_ERR_INVALID_RESPONSE on any other status, otherwise the transport error.
  */
 esp_err_t PerformHttpRequest(esp_http_client_method_t method,
                              const char *url,
                              const char *post_data,
-                             char *response_buffer,
-                             size_t resp_buff_leng)
+                             struct http_response_sink *sink)
 {
-  // Init config struct
-  esp_http_client_config_t config = {
-      .crt_bundle_attach = esp_crt_bundle_attach, // Use the built-in certificate bundle
-      .url = url,
-      .method = method,
-      .event_handler = _http_event_handler, // Always good to have an event handler
-      .timeout_ms = 100000,                 // Set a timeout for the request
-      .user_data = response_buffer,         // Pass the response buffer to the event handler
-      .buffer_size = resp_buff_leng,        // Set the buffer size for the response
-  };
-
-  // Init HTTP client
-  esp_http_client_handle_t client = esp_http_client_init(&config);
+  esp_http_client_handle_t client = GetSessionClient(url);
   if (client == NULL)
   {
-    ESP_LOGE(TAG, "Failed to initialize HTTP client");
     return ESP_FAIL;
   }
 
+  esp_err_t err = esp_http_client_set_url(client, url);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to set URL: %s", esp_err_to_name(err));
+    return err;
+  }
+  esp_http_client_set_method(client, method);
+  // Error bodies are only logged, keep a few bytes of them when the caller has no buffer
+  char error_response[ERROR_RESPONSE_LOG_SIZE] = {0};
+  struct http_response_sink fallback_sink = {.buf = error_response, .cap = sizeof(error_response)};
+  if (sink == NULL)
+  {
+    sink = &fallback_sink;
+  }
+  esp_http_client_set_user_data(client, sink); // Pass the response sink to the event handler
+
   // If request method is sends data, use of update POST data if provided
+  const char *body = NULL;
   if (method == HTTP_METHOD_POST || method == HTTP_METHOD_PUT || method == HTTP_METHOD_PATCH)
   {
     if (post_data != NULL)
     {
-      esp_err_t err = esp_http_client_set_post_field(client, post_data, strlen(post_data));
-      if (err != ESP_OK)
-      {
-        ESP_LOGE(TAG, "Failed to set POST field: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
-        return err;
-      }
+      body = post_data;
       esp_http_client_set_header(client, "Content-Type", "application/json");
     }
     else
@@ -109,114 +204,151 @@ esp_err_t PerformHttpRequest(esp_http_client_method_t method,
       ESP_LOGW(TAG, "POST/PUT/PATCH method used but no post_data provided.");
     }
   }
+  // A NULL body also clears the body and Content-Type left by the previous request on this session
+  err = esp_http_client_set_post_field(client, body, body != NULL ? strlen(body) : 0);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to set POST field: %s", esp_err_to_name(err));
+    return err;
+  }
 
   // Perform the HTTP request
-  esp_err_t err = esp_http_client_perform(client);
+  const int64_t request_start_us = esp_timer_get_time();
+  parse_us = 0;
+  WireMeterStart(); // Every attempt counts, handshakes and TLS records included
+  for (int attempt = 1; attempt <= HTTP_SESSION_MAX_ATTEMPTS; attempt++)
+  {
+    attempt_start_us = esp_timer_get_time();
+    const bool reused = connection_open;
+    err = esp_http_client_perform(client);
+    if (err == ESP_OK)
+    {
+      break;
+    }
+    ESP_LOGW(TAG, "HTTP request attempt %d failed: %s", attempt, esp_err_to_name(err));
+    esp_http_client_close(client);
+    connection_open = false;
+    // Only a connection the server or the network dropped while idle is worth a second attempt, and only when the
+    // request failed to go out on it. Past that point (response timeout, broken response) the server may have
+    // processed the request already.
+    if (!reused || (err != ESP_ERR_HTTP_CONNECT && err != ESP_ERR_HTTP_WRITE_DATA))
+    {
+      break;
+    }
+  }
+  uint32_t bytes_sent = 0;
+  uint32_t bytes_received = 0;
+  WireMeterStop(&bytes_sent, &bytes_received);
+  session_stats.bytes_sent += bytes_sent;
+  session_stats.bytes_received += bytes_received;
+  session_stats.requests++;
+  session_stats.last_request_us = esp_timer_get_time() - request_start_us;
+  session_stats.total_request_us += session_stats.last_request_us;
+  TRACE_RECORD(TRACE_PHASE_REQUEST, request_start_us, session_stats.last_request_us);
+  if (parse_us > 0)
+  {
+    TRACE_RECORD(TRACE_PHASE_PARSE, request_start_us, parse_us);
+  }
 
   // Check results and log any status/errors
+  last_status = 0;
   if (err == ESP_OK)
   {
-    const long long int content_length = esp_http_client_get_content_length(client);
-    ESP_LOGI(TAG, "HTTP %s Status = %d, content_length = %lld",
+    const int status = esp_http_client_get_status_code(client);
+    last_status = status;
+    ESP_LOGI(TAG, "HTTP %s Status = %d, received = %zu%s, took %" PRId64 " us (handshakes: %" PRIu32 ", last %" PRId64 " us)",
              (method == HTTP_METHOD_GET) ? "GET" : ((method == HTTP_METHOD_POST) ? "POST" : "OTHER"),
-             esp_http_client_get_status_code(client),
-             content_length);
+             status,
+             sink->total_len,
+             sink->truncated ? " (truncated)" : "",
+             session_stats.last_request_us,
+             session_stats.handshakes,
+             session_stats.last_handshake_us);
+    if (status < 200 || status >= 300)
+    {
+      ESP_LOGE(TAG, "Server rejected the request: %s", (sink->buf != NULL) ? sink->buf : "");
+      err = ESP_ERR_INVALID_RESPONSE;
+    }
   }
-  else
+  if (err != ESP_OK)
   {
+    session_stats.failed_requests++;
     ESP_LOGE(TAG, "HTTP request failed: %s", esp_err_to_name(err));
   }
-
-  // Clean up client
-  esp_http_client_cleanup(client);
   return err;
 }
 
 /**
- * @brief Returns the module string with the module registration response. Must be freed by the caller.
+ * @brief Closes the persistent HTTPS session and releases its client.
+ * Intended for when the network goes away for good (e.g. WiFi stopped), the next request opens a new session.
  *
- * @param token_api
- * @return const char* The module token string if successful, NULL on failure.
  */
-const char *RegisterModule(const char *token_api)
+void CloseHttpsSession()
 {
-  // Prepare the URL and request body
-  char *url = malloc(strlen(SERVER_URL_API) + strlen(MODULE_URL) + 1); // Malloc of 128 bytes for URL plus 1 for null terminator
-  if (url == NULL)
+  if (session_client == NULL)
   {
-    ESP_LOGE(TAG, "Memory allocation failed for URL");
-    return NULL;
-  }
-  strcpy(url, SERVER_URL_API);
-  strcat(url, MODULE_URL);
-
-  cJSON *json_token_api = cJSON_CreateObject();
-  if (json_token_api == NULL)
-  {
-    ESP_LOGE(TAG, "Failed to create JSON object");
-    free(url);
-    return NULL;
+    return;
   }
+  esp_http_client_cleanup(session_client);
+  session_client = NULL;
+}
 
-  cJSON_AddStringToObject(json_token_api, "token_api", token_api);
-  char *post_data = cJSON_PrintUnformatted(json_token_api);
-  cJSON_Delete(json_token_api);
+/**
+ * @brief Copies the latency counters of the persistent HTTPS session.
+ *
+ * @param stats Output, filled with the current counters.
+ */
+void GetHttpsSessionStats(struct https_session_stats *stats)
+{
+  *stats = session_stats;
+}
 
-  if (post_data == NULL)
-  {
-    ESP_LOGE(TAG, "Failed to create JSON string");
-    free(url);
-    return NULL;
-  }
+/**
+ * @brief Tells the HTTP status of the last request, to tell apart why it failed with ESP_ERR_INVALID_RESPONSE.
+ *
+ * @return int The status code, 0 if the request got no response (transport error).
+ */
+int GetLastHttpStatus()
+{
+  return last_status;
+}
 
-  // Prepare response buffer
-  char *server_response = malloc(MODULE_REGISTRY_SERVER_RESPONSE_SIZE * sizeof(char)); // Malloc of 128 bytes for response buffer
-  if (server_response == NULL)
+/**
+ * @brief Registers the module on the server and returns its token.
+ *
+ * @param token_api The API token provisioned over BLE.
+ * @param module_token Output buffer for the module token (UUID) returned by the server.
+ * @param module_token_len Size of module_token.
+ * @return esp_err_t ESP_OK on success, otherwise an error code.
+ */
+esp_err_t RegisterModule(const char *token_api, char *module_token, const size_t module_token_len)
+{
+  // Prepare the URL and request body
+  char url[URL_BUFFER_SIZE];
+  snprintf(url, sizeof(url), "%s%s", SERVER_URL_API, MODULE_URL);
+  char post_data[REGISTRY_BODY_SIZE];
+  if (SarpEncodeRegisterModule(post_data, sizeof(post_data), token_api) < 0)
   {
-    ESP_LOGE(TAG, "Memory allocation failed for response buffer");
-    free(url);
-    free(post_data);
-    return NULL;
+    ESP_LOGE(TAG, "Token API does not fit in the request body");
+    return ESP_ERR_INVALID_SIZE;
   }
 
-  // Perform the HTTP request
-  esp_err_t err = PerformHttpRequest(HTTP_METHOD_POST, url, post_data, server_response, MODULE_REGISTRY_SERVER_RESPONSE_SIZE);
-
-  // Free allocated resources
-  free(url);
-  free(post_data);
-
+  // Perform the HTTP request, the token is picked straight out of the response stream
+  struct sarp_scanner scanner;
+  SarpScannerInit(&scanner, "moduleToken", module_token, module_token_len);
+  struct http_response_sink sink = {.feed = FeedScanner, .feed_ctx = &scanner};
+  esp_err_t err = PerformHttpRequest(HTTP_METHOD_POST, url, post_data, &sink);
   if (err != ESP_OK)
   {
-    free(server_response);
-    return NULL;
+    return err;
   }
 
-  cJSON *json_response = cJSON_Parse(server_response);
-  if (json_response->type != cJSON_Object)
-  {
-    ESP_LOGE(TAG, "Response is not a valid JSON object");
-    cJSON_Delete(json_response);
-    free(server_response);
-    return NULL;
-  }
-  cJSON *attr_pointer = cJSON_GetObjectItem(json_response, "moduleToken");
-  if (attr_pointer == NULL || attr_pointer->type != cJSON_String)
-  {
-    ESP_LOGE(TAG, "Response does not contain 'moduleToken' or it is not a string");
-    cJSON_Delete(json_response);
-    free(server_response);
-    return NULL;
-  }
-  const char *response = strdup(attr_pointer->valuestring); // Duplicate the string to return
-  if (response == NULL)
+  err = SarpScannerString(&scanner);
+  if (err != ESP_OK)
   {
-    ESP_LOGE(TAG, "Memory allocation failed for response string");
-    cJSON_Delete(json_response);
-    free(server_response);
-    return NULL;
+    ESP_LOGE(TAG, "Response does not contain a valid 'moduleToken': %s", esp_err_to_name(err));
   }
-  return response;
+  return err;
 }
 
 /**
@@ -224,205 +356,207 @@ const char *RegisterModule(const char *token_api)
  *
  * @param module_token The token of the module to which the peripheral belongs.
  * @param p_type The type of the peripheral.
- * @return uint32_t The ID of the registered peripheral, or -1 on failure.
+ * @param instance Tells apart the peripherals of the same type on the module, 0 for the first one.
+ * @param peripheral_id Output, the ID of the registered peripheral.
+ * @return esp_err_t ESP_OK on success, otherwise an error code.
  */
-const uint32_t RegisterPeripheral(const char *module_token, const char *p_type)
+esp_err_t RegisterPeripheral(const char *module_token, const char *p_type, const uint32_t instance, uint32_t *peripheral_id)
 {
   // Prepare the URL and request body
-  char *url = malloc(strlen(SERVER_URL_API) + strlen(PERIPHERAL_URL) + 1); // Malloc of 128 bytes for URL plus 1 for null terminator
-  if (url == NULL)
-  {
-    ESP_LOGE(TAG, "Memory allocation failed for URL");
-    return -1;
-  }
-  strcpy(url, SERVER_URL_API);
-  strcat(url, PERIPHERAL_URL);
-
-  cJSON *json_module_token = cJSON_CreateObject();
-  if (json_module_token == NULL)
+  char url[URL_BUFFER_SIZE];
+  snprintf(url, sizeof(url), "%s%s", SERVER_URL_API, PERIPHERAL_URL);
+  char post_data[REGISTRY_BODY_SIZE];
+  if (SarpEncodeRegisterPeripheral(post_data, sizeof(post_data), module_token, p_type, instance) < 0)
   {
-    ESP_LOGE(TAG, "Failed to create JSON object");
-    free(url);
-    return -1;
+    ESP_LOGE(TAG, "Peripheral registration does not fit in the request body");
+    return ESP_ERR_INVALID_SIZE;
   }
-
-  cJSON_AddStringToObject(json_module_token, "parent_module", module_token);
-  cJSON_AddStringToObject(json_module_token, "p_type", p_type);
-
-  char *post_data = cJSON_PrintUnformatted(json_module_token);
   ESP_LOGI(TAG, "Post data: %s", post_data);
-  cJSON_Delete(json_module_token);
-
-  if (post_data == NULL)
-  {
-    ESP_LOGE(TAG, "Failed to create JSON string");
-    free(url);
-    return -1;
-  }
-
-  // Prepare response buffer
-  char *server_response = malloc(MODULE_REGISTRY_SERVER_RESPONSE_SIZE * sizeof(char)); // Malloc of 128 bytes for response buffer
-  if (server_response == NULL)
-  {
-    ESP_LOGE(TAG, "Memory allocation failed for response buffer");
-    free(url);
-    free(post_data);
-    return -1;
-  }
 
   // Perform the HTTP request
-  esp_err_t err = PerformHttpRequest(HTTP_METHOD_POST, url, post_data, server_response, MODULE_REGISTRY_SERVER_RESPONSE_SIZE);
-
-  // Free allocated resources
-  free(url);
-  free(post_data);
-
+  char id_value[SARP_SCAN_NUMBER_SIZE];
+  struct sarp_scanner scanner;
+  SarpScannerInit(&scanner, "id", id_value, sizeof(id_value));
+  struct http_response_sink sink = {.feed = FeedScanner, .feed_ctx = &scanner};
+  esp_err_t err = PerformHttpRequest(HTTP_METHOD_POST, url, post_data, &sink);
   if (err != ESP_OK)
   {
-    free(server_response);
-    return -1;
-  }
-
-  cJSON *json_response = cJSON_Parse(server_response);
-
-  if (json_response->type != cJSON_Object)
-  {
-    ESP_LOGE(TAG, "Response is not a valid JSON object");
-    cJSON_Delete(json_response);
-    free(server_response);
-    return -1;
+    return err;
   }
 
-  cJSON *attr_pointer = cJSON_GetObjectItem(json_response, "id");
-
-  if (attr_pointer == NULL || attr_pointer->type != cJSON_Number)
+  err = SarpScannerUint32(&scanner, peripheral_id);
+  if (err != ESP_OK)
   {
-    ESP_LOGE(TAG, "Response does not contain 'id' or it is not an integer");
-    return -1;
+    ESP_LOGE(TAG, "Response does not contain 'id' or it is not an integer: %s", esp_err_to_name(err));
   }
-  uint32_t peripheral_id = (uint32_t) attr_pointer->valueint; // Convert the string to an integer
-  cJSON_Delete(json_response);
-  free(server_response);
-  return peripheral_id; // Return the peripheral ID as an integer
+  return err;
 }
 
-const char *GetPeripheralState(uint32_t peripheral_id)
+/**
+ * @brief Registers several peripherals of a module in a single request.
+ * The server answers {"ids": [...]} in the order of p_types, and returns the existing id for a type and instance
+ * the module already registered, so repeating the request after a failure does not create duplicates.
+ *
+ * @param module_token The token of the module to which the peripherals belong.
+ * @param p_types The types of the peripherals.
+ * @param instances Instance of each peripheral among those of its type, 0 for the first one.
+ * @param n_types Number of types, up to MAX_BATCH_PERIPHERALS.
+ * @param peripheral_ids Output, the ID of each peripheral, in the order of p_types.
+ * @return esp_err_t ESP_OK on success, otherwise an error code (peripheral_ids is left unspecified).
+ */
+esp_err_t RegisterPeripherals(const char *module_token, const char *const *p_types, const uint32_t *instances, const size_t n_types, uint32_t *peripheral_ids)
 {
-  char *bufferId = malloc(12 * sizeof(char)); // Allocate memory for the string representation of the ID
-  if (bufferId == NULL)
+  if (n_types == 0 || n_types > MAX_BATCH_PERIPHERALS)
   {
-    ESP_LOGE(TAG, "Memory allocation failed for bufferId");
-    return NULL;
+    return ESP_ERR_INVALID_ARG;
   }
-  const char *id = itoa(peripheral_id, bufferId, 10); // Convert peripheral_id to string in base 10
-  // Prepare the URL for the GET request
-  char *url = malloc(strlen(SERVER_URL_API) + strlen(PERIPHERAL_URL) + strlen(PERIPHERAL_STATE_EXT_URL) + strlen(id) + 1); // Malloc of 128 bytes for URL plus 1 for null terminator
-  if (url == NULL)
+  // Prepare the URL and request body
+  char url[URL_BUFFER_SIZE];
+  snprintf(url, sizeof(url), "%s%s%s", SERVER_URL_API, PERIPHERAL_URL, PERIPHERAL_BATCH_EXT_URL);
+  char post_data[REGISTRY_BODY_SIZE + MAX_BATCH_PERIPHERALS * REGISTRY_BATCH_TYPE_SIZE];
+  if (SarpEncodeRegisterPeripheralBatch(post_data, sizeof(post_data), module_token, p_types, instances, n_types) < 0)
   {
-    ESP_LOGE(TAG, "Memory allocation failed for URL");
-    return NULL;
+    ESP_LOGE(TAG, "Peripheral registration does not fit in the request body");
+    return ESP_ERR_INVALID_SIZE;
   }
-  sprintf(url, "%s%s%s%ld", SERVER_URL_API, PERIPHERAL_URL, PERIPHERAL_STATE_EXT_URL, peripheral_id);
+  ESP_LOGI(TAG, "Post data: %s", post_data);
 
-  // Prepare response buffer
-  char *server_response = malloc(PERIPHERAL_STATE_SERVER_RESPONSE_SIZE * sizeof(char)); // Malloc of 128 bytes for response buffer
-  if (server_response == NULL)
+  // Perform the HTTP request, the ids are parsed straight out of the response stream
+  struct sarp_scanner scanner;
+  SarpScannerInitUint32Array(&scanner, "ids", peripheral_ids, n_types);
+  struct http_response_sink sink = {.feed = FeedScanner, .feed_ctx = &scanner};
+  esp_err_t err = PerformHttpRequest(HTTP_METHOD_POST, url, post_data, &sink);
+  if (err != ESP_OK)
   {
-    ESP_LOGE(TAG, "Memory allocation failed for response buffer");
-    free(url);
-    return NULL;
+    return err;
   }
 
-  // Perform the HTTP request
-  esp_err_t err = PerformHttpRequest(HTTP_METHOD_GET, url, NULL, server_response, PERIPHERAL_STATE_SERVER_RESPONSE_SIZE);
-
-  // Free allocated resources
-  free(url);
-
-  if (err != ESP_OK)
+  size_t n_ids = 0;
+  err = SarpScannerUint32Array(&scanner, &n_ids);
+  if (err == ESP_OK && n_ids != n_types)
   {
-    free(server_response);
-    return NULL;
+    err = ESP_ERR_INVALID_SIZE;
   }
-
-  cJSON *json_response = cJSON_Parse(server_response);
-  if (json_response->type != cJSON_Object)
+  if (err != ESP_OK)
   {
-    ESP_LOGE(TAG, "Response is not a valid JSON object");
-    cJSON_Delete(json_response);
-    free(server_response);
-    return NULL;
+    ESP_LOGE(TAG, "Response does not contain one integer 'ids' entry per peripheral: %s", esp_err_to_name(err));
   }
+  return err;
+}
 
-  cJSON *attr_pointer = cJSON_GetObjectItem(json_response, "state");
+/**
+ * @brief Fetches the state the server wants for a peripheral (e.g. "on"/"off" for the valve).
+ *
+ * @param peripheral_id The ID of the peripheral.
+ * @param state Output buffer for the state string.
+ * @param state_len Size of state.
+ * @return esp_err_t ESP_OK on success, otherwise an error code.
+ */
+esp_err_t GetPeripheralState(const uint32_t peripheral_id, char *state, const size_t state_len)
+{
+  // Prepare the URL for the GET request
+  char url[URL_BUFFER_SIZE];
+  snprintf(url, sizeof(url), "%s%s%s%" PRIu32, SERVER_URL_API, PERIPHERAL_URL, PERIPHERAL_STATE_EXT_URL, peripheral_id);
 
-  if (attr_pointer == NULL || attr_pointer->type != cJSON_String)
+  // Perform the HTTP request
+  struct sarp_scanner scanner;
+  SarpScannerInit(&scanner, "state", state, state_len);
+  struct http_response_sink sink = {.feed = FeedScanner, .feed_ctx = &scanner};
+  esp_err_t err = PerformHttpRequest(HTTP_METHOD_GET, url, NULL, &sink);
+  if (err != ESP_OK)
   {
-    ESP_LOGE(TAG, "Response does not contain 'state' or it is not a string");
-    cJSON_Delete(json_response);
-    free(server_response);
-    return NULL;
+    return err;
   }
 
-  const char *response = strdup(attr_pointer->valuestring); // Duplicate the string to return
-  if (response == NULL)
+  err = SarpScannerString(&scanner);
+  if (err != ESP_OK)
   {
-    ESP_LOGE(TAG, "Memory allocation failed for response string");
-    cJSON_Delete(json_response);
-    free(server_response);
-    return NULL;
+    ESP_LOGE(TAG, "Response does not contain 'state' or it is not a string: %s", esp_err_to_name(err));
   }
-
-  cJSON_Delete(json_response);
-  free(server_response);
-
-  return response; // Return the state as a string
+  return err;
 }
+
 esp_err_t PostPeripheralData(const uint32_t peripheralId, const double data)
 {
   // Prepare the URL and request body
-  char *url = malloc(strlen(SERVER_URL_API) + strlen(PERIPHERAL_URL) + strlen(PERIPHERAL_DATA_EXT_URL) + 1); // Malloc of 128 bytes for URL plus 1 for null terminator
-  if (url == NULL)
+  char url[URL_BUFFER_SIZE];
+  snprintf(url, sizeof(url), "%s%s%s", SERVER_URL_API, PERIPHERAL_URL, PERIPHERAL_DATA_EXT_URL);
+  char post_data[SARP_MAX_READING_JSON_SIZE];
+  if (SarpEncodePeripheralData(post_data, sizeof(post_data), peripheralId, data) < 0)
   {
-    ESP_LOGE(TAG, "Memory allocation failed for URL");
-    return ESP_ERR_NO_MEM;
+    return ESP_ERR_INVALID_SIZE;
   }
-  strcpy(url, SERVER_URL_API);
-  strcat(url, PERIPHERAL_URL);
-  strcat(url, PERIPHERAL_DATA_EXT_URL);
+  ESP_LOGI(TAG, "Post data: %s", post_data);
+  // Perform the HTTP request, the response body carries nothing we need
+  return PerformHttpRequest(HTTP_METHOD_POST, url, post_data, NULL);
+}
 
-  cJSON *json_module_token = cJSON_CreateObject();
-  if (json_module_token == NULL)
+/**
+ * @brief Uploads the readings of several peripherals in a single request.
+ * The body is a JSON object with a "data" array holding one {"peripheral_id", "value", "timestamp"} entry per reading,
+ * the timestamp is left out when unknown so the server stamps the reading on arrival.
+ *
+ * @param data Readings to upload.
+ * @param n_data Number of readings in data, up to MAX_BATCH_READINGS.
+ * @return esp_err_t ESP_OK on success, otherwise an error code.
+ */
+esp_err_t PostPeripheralDataBatch(const struct peripheral_data *data, const size_t n_data)
+{
+  if (data == NULL || n_data == 0 || n_data > MAX_BATCH_READINGS)
   {
-    ESP_LOGE(TAG, "Failed to create JSON object");
-    free(url);
-    return -1;
+    return ESP_ERR_INVALID_ARG;
   }
-  cJSON_AddNumberToObject(json_module_token, "peripheral_id", peripheralId);
-  cJSON_AddNumberToObject(json_module_token, "value", data);
-  char *post_data = cJSON_PrintUnformatted(json_module_token);
-  ESP_LOGI(TAG, "Post data: %s", post_data);
-  cJSON_Delete(json_module_token);
-  if (post_data == NULL)
+  // Prepare the URL and request body
+  char url[URL_BUFFER_SIZE];
+  snprintf(url, sizeof(url), "%s%s%s", SERVER_URL_API, PERIPHERAL_URL, PERIPHERAL_DATA_BATCH_EXT_URL);
+  if (SarpEncodePeripheralDataBatch(batch_body, sizeof(batch_body), data, n_data) < 0)
   {
-    ESP_LOGE(TAG, "Failed to create JSON string");
-    free(url);
-    return ESP_ERR_NO_MEM;
+    ESP_LOGE(TAG, "Batch of %zu readings does not fit in the request body", n_data);
+    return ESP_ERR_INVALID_SIZE;
   }
-  // Prepare response buffer
-  char *server_response = malloc(PERIPHERAL_DATA_SERVER_RESPONSE_SIZE * sizeof(char)); // Malloc of 128 bytes for response buffer
-  if (server_response == NULL)
+  ESP_LOGI(TAG, "Post data: %s", batch_body);
+  // Perform the HTTP request, the response body carries nothing we need
+  return PerformHttpRequest(HTTP_METHOD_POST, url, batch_body, NULL);
+}
+
+/**
+ * @brief Uploads a diagnostics telemetry record of the module (heap, task stacks, cycle costs).
+ *
+ * @param record The record, a JSON object built by the caller.
+ * @return esp_err_t ESP_OK on success, otherwise an error code.
+ */
+esp_err_t PostModuleDiagnostics(const char *record)
+{
+  char url[URL_BUFFER_SIZE];
+  snprintf(url, sizeof(url), "%s%s%s", SERVER_URL_API, MODULE_URL, MODULE_DIAGNOSTICS_EXT_URL);
+  // Perform the HTTP request, the response body carries nothing we need
+  return PerformHttpRequest(HTTP_METHOD_POST, url, record, NULL);
+}
+
+/**
+ * @brief Uploads the actions the irrigation loop took on a valve, oldest first.
+ *
+ * @param peripheral_id The ID of the valve.
+ * @param events The events.
+ * @param n_events Number of events, up to MAX_BATCH_EVENTS.
+ * @param dropped Events the module lost before these ones, 0 if none.
+ * @return esp_err_t ESP_OK on success, otherwise an error code.
+ */
+esp_err_t PostControlEvents(const uint32_t peripheral_id, const struct control_event *events, const size_t n_events,
+                            const uint32_t dropped)
+{
+  if (events == NULL || n_events == 0 || n_events > MAX_BATCH_EVENTS)
   {
-    ESP_LOGE(TAG, "Memory allocation failed for response buffer");
-    free(url);
-    free(post_data);
-    return ESP_ERR_NO_MEM;
+    return ESP_ERR_INVALID_ARG;
   }
-  // Perform the HTTP request
-  esp_err_t err = PerformHttpRequest(HTTP_METHOD_POST, url, post_data, server_response, PERIPHERAL_DATA_SERVER_RESPONSE_SIZE);
-  // Free allocated resources
-  free(url);
-  free(post_data);
-  free(server_response);
-  return err; // Placeholder for actual implementation
-}
\ No newline at end of file
+  char url[URL_BUFFER_SIZE];
+  snprintf(url, sizeof(url), "%s%s%s", SERVER_URL_API, PERIPHERAL_URL, PERIPHERAL_EVENTS_EXT_URL);
+  if (SarpEncodeControlEvents(events_body, sizeof(events_body), peripheral_id, events, n_events, dropped) < 0)
+  {
+    ESP_LOGE(TAG, "%zu control events do not fit in the request body", n_events);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  ESP_LOGI(TAG, "Post data: %s", events_body);
+  // Perform the HTTP request, the response body carries nothing we need
+  return PerformHttpRequest(HTTP_METHOD_POST, url, events_body, NULL);
+}
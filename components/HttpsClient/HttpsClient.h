@@ -1,18 +1,105 @@
+#pragma once
 #include "esp_http_client.h"
 
 #define SERVER_URL_API "https://sarp01.westeurope.cloudapp.azure.com/api"
 #define MODULE_URL "/module/"
 #define PERIPHERAL_URL "/peripheral/"
+#define MODULE_DIAGNOSTICS_EXT_URL "diagnostics"
+#define PERIPHERAL_BATCH_EXT_URL "batch"
 #define PERIPHERAL_STATE_EXT_URL "state/"
 #define PERIPHERAL_DATA_EXT_URL "data"
+#define PERIPHERAL_DATA_BATCH_EXT_URL "data/batch"
+#define PERIPHERAL_EVENTS_EXT_URL "events"
+#define MAX_BATCH_READINGS 32 // Most readings a single batch upload can carry
+#define MAX_BATCH_PERIPHERALS 16 // Most peripherals a single bulk registration can carry
+#define MAX_BATCH_EVENTS 16 // Most control events a single upload can carry
+
+/**
+ * @brief A single peripheral reading, as uploaded to the server.
+ */
+struct peripheral_data
+{
+  uint32_t peripheral_id;
+  double value;
+  int64_t timestamp; // Unix time of the reading in seconds, 0 if the clock was not synchronized yet
+};
+
+/**
+ * @brief Why the on-device irrigation loop logged an event.
+ */
+enum control_reason
+{
+  CONTROL_REASON_NONE,     // Nothing to log
+  CONTROL_REASON_DRY,      // Moisture dropped below the on threshold, the valve was opened
+  CONTROL_REASON_WET,      // Moisture rose above the off threshold, the valve was closed
+  CONTROL_REASON_OVERRIDE, // A server command took over the valve
+  CONTROL_REASON_RESUME,   // The server command expired, the loop drives the valve again
+};
+
+/**
+ * @brief An action of the irrigation loop, as uploaded to the server.
+ */
+struct control_event
+{
+  int64_t timestamp; // Unix time of the event in seconds, 0 if the clock was not synchronized yet
+  double moisture;   // Reading the decision was based on, NAN if there was none
+  uint8_t state;     // Valve state after the event
+  uint8_t reason;    // enum control_reason
+};
+
+/**
+ * @brief Latency counters of the persistent HTTPS session.
+ * A handshake is counted every time the session has to (re)open its TLS connection,
+ * requests served over an already open connection only add to the request counters.
+ */
+struct https_session_stats
+{
+  uint32_t requests;          // Requests performed, successful or not
+  uint32_t failed_requests;   // Requests that failed after all attempts
+  uint32_t handshakes;        // TCP + TLS connections opened (full or resumed handshakes)
+  int64_t last_handshake_us;  // Duration of the last connection setup
+  int64_t total_handshake_us; // Accumulated connection setup time
+  int64_t last_request_us;    // Duration of the last request, including connection setup
+  int64_t total_request_us;   // Accumulated request time
+  uint32_t bytes_sent;        // Bytes written to the socket, TLS records and handshakes included
+  uint32_t bytes_received;    // Bytes read from the socket, TLS records and handshakes included
+};
+
+/**
+ * @brief Incremental consumer of a response body, called with every chunk as it arrives.
+ */
+typedef void (*http_response_feed_cb)(void *ctx, const char *data, size_t len);
+
+/**
+ * @brief Destination of a response body. Chunks are appended to buf while they fit (the rest is
+ * counted but dropped) and handed to feed, so a parser can consume bodies of any size in constant memory.
+ * Both buf and feed are optional; with neither the body is just discarded.
+ */
+struct http_response_sink
+{
+  char *buf;                   // Optional bounded copy of the body, always NUL terminated
+  size_t cap;                  // Size of buf
+  size_t len;                  // Bytes kept in buf
+  size_t total_len;            // Bytes received, kept or not
+  bool truncated;              // The body did not fit in buf
+  http_response_feed_cb feed;  // Optional incremental consumer
+  void *feed_ctx;              // Passed to feed
+};
 
 static esp_err_t _http_event_handler(esp_http_client_event_t *evt);
 esp_err_t PerformHttpRequest(esp_http_client_method_t method,
                                const char *url,
                                const char *post_data,
-                               char *response_buffer,
-                               size_t buffer_len);
-const char *RegisterModule(const char *token_api);
-const uint32_t RegisterPeripheral(const char* module_token, const char* p_type);
-const char *GetPeripheralState(const uint32_t peripheral_id);
-esp_err_t PostPeripheralData(const uint32_t peripheral_id, const double data);
\ No newline at end of file
+                               struct http_response_sink *sink);
+void CloseHttpsSession();
+void GetHttpsSessionStats(struct https_session_stats *stats);
+int GetLastHttpStatus();
+esp_err_t RegisterModule(const char *token_api, char *module_token, const size_t module_token_len);
+esp_err_t RegisterPeripheral(const char *module_token, const char *p_type, const uint32_t instance, uint32_t *peripheral_id);
+esp_err_t RegisterPeripherals(const char *module_token, const char *const *p_types, const uint32_t *instances, const size_t n_types, uint32_t *peripheral_ids);
+esp_err_t GetPeripheralState(const uint32_t peripheral_id, char *state, const size_t state_len);
+esp_err_t PostPeripheralData(const uint32_t peripheral_id, const double data);
+esp_err_t PostPeripheralDataBatch(const struct peripheral_data *data, const size_t n_data);
+esp_err_t PostModuleDiagnostics(const char *record);
+esp_err_t PostControlEvents(const uint32_t peripheral_id, const struct control_event *events, const size_t n_events,
+                            const uint32_t dropped);
\ No newline at end of file
@@ -0,0 +1,688 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SarpCodec.h"
+#include "HttpsClient.h"
+
+/**
+ * @brief Bounded writer over a caller supplied buffer. Once something does not fit the writer
+ * only keeps track of the overflow, so encoders check for it once at the end.
+ */
+struct sarp_writer
+{
+  char *buf;
+  size_t cap;
+  size_t len;
+  bool overflow;
+};
+
+static void PutChar(struct sarp_writer *w, const char c)
+{
+  if (w->len + 1 < w->cap)
+  {
+    w->buf[w->len++] = c;
+  }
+  else
+  {
+    w->overflow = true;
+  }
+}
+
+static void PutRaw(struct sarp_writer *w, const char *s)
+{
+  while (*s != '\0')
+  {
+    PutChar(w, *s++);
+  }
+}
+
+static void PutString(struct sarp_writer *w, const char *s)
+{
+  static const char hex[] = "0123456789abcdef";
+  PutChar(w, '"');
+  for (; *s != '\0'; s++)
+  {
+    const unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\')
+    {
+      PutChar(w, '\\');
+      PutChar(w, c);
+    }
+    else if (c < 0x20)
+    {
+      PutRaw(w, "\\u00");
+      PutChar(w, hex[c >> 4]);
+      PutChar(w, hex[c & 0xF]);
+    }
+    else
+    {
+      PutChar(w, c);
+    }
+  }
+  PutChar(w, '"');
+}
+
+static void PutUint64(struct sarp_writer *w, uint64_t value)
+{
+  char digits[20];
+  size_t n = 0;
+  do
+  {
+    digits[n++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (n > 0)
+  {
+    PutChar(w, digits[--n]);
+  }
+}
+
+/**
+ * @brief Writes a double as fixed point with SARP_VALUE_DECIMALS decimals, trailing zeros trimmed.
+ * Avoids printf's float formatting, which may allocate.
+ */
+static void PutDouble(struct sarp_writer *w, const double value)
+{
+  if (!isfinite(value))
+  {
+    PutRaw(w, "null");
+    return;
+  }
+  uint64_t scale = 1;
+  for (int i = 0; i < SARP_VALUE_DECIMALS; i++)
+  {
+    scale *= 10;
+  }
+  const uint64_t scaled = (uint64_t)llround(fabs(value) * (double)scale);
+  if (value < 0 && scaled != 0)
+  {
+    PutChar(w, '-');
+  }
+  PutUint64(w, scaled / scale);
+  uint64_t fraction = scaled % scale;
+  if (fraction == 0)
+  {
+    return;
+  }
+  PutChar(w, '.');
+  for (uint64_t digit = scale / 10; digit > 0 && fraction != 0; digit /= 10)
+  {
+    PutChar(w, (char)('0' + fraction / digit));
+    fraction %= digit;
+  }
+}
+
+static void PutKey(struct sarp_writer *w, const char *key)
+{
+  PutString(w, key);
+  PutChar(w, ':');
+}
+
+static int Finish(struct sarp_writer *w)
+{
+  if (w->cap == 0)
+  {
+    return -1;
+  }
+  w->buf[w->len] = '\0';
+  return w->overflow ? -1 : (int)w->len;
+}
+
+int SarpEncodeRegisterModule(char *buf, const size_t buf_len, const char *token_api)
+{
+  struct sarp_writer w = {.buf = buf, .cap = buf_len};
+  PutChar(&w, '{');
+  PutKey(&w, "token_api");
+  PutString(&w, token_api);
+  PutChar(&w, '}');
+  return Finish(&w);
+}
+
+int SarpEncodeRegisterPeripheral(char *buf, const size_t buf_len, const char *module_token, const char *p_type, const uint32_t instance)
+{
+  struct sarp_writer w = {.buf = buf, .cap = buf_len};
+  PutChar(&w, '{');
+  PutKey(&w, "parent_module");
+  PutString(&w, module_token);
+  PutChar(&w, ',');
+  PutKey(&w, "p_type");
+  PutString(&w, p_type);
+  if (instance > 0) // The first instance of a type is registered as before
+  {
+    PutChar(&w, ',');
+    PutKey(&w, "instance");
+    PutUint64(&w, instance);
+  }
+  PutChar(&w, '}');
+  return Finish(&w);
+}
+
+int SarpEncodeRegisterPeripheralBatch(char *buf, const size_t buf_len, const char *module_token, const char *const *p_types,
+                                      const uint32_t *instances, const size_t n_types)
+{
+  bool several_instances = false;
+  for (size_t i = 0; i < n_types; i++)
+  {
+    several_instances = several_instances || instances[i] > 0;
+  }
+  struct sarp_writer w = {.buf = buf, .cap = buf_len};
+  PutChar(&w, '{');
+  PutKey(&w, "parent_module");
+  PutString(&w, module_token);
+  PutChar(&w, ',');
+  PutKey(&w, "p_types");
+  PutChar(&w, '[');
+  for (size_t i = 0; i < n_types && !w.overflow; i++)
+  {
+    if (i > 0)
+    {
+      PutChar(&w, ',');
+    }
+    PutString(&w, p_types[i]);
+  }
+  PutChar(&w, ']');
+  if (several_instances)
+  {
+    PutChar(&w, ',');
+    PutKey(&w, "instances");
+    PutChar(&w, '[');
+    for (size_t i = 0; i < n_types && !w.overflow; i++)
+    {
+      if (i > 0)
+      {
+        PutChar(&w, ',');
+      }
+      PutUint64(&w, instances[i]);
+    }
+    PutChar(&w, ']');
+  }
+  PutChar(&w, '}');
+  return Finish(&w);
+}
+
+static void PutReading(struct sarp_writer *w, const uint32_t peripheral_id, const double value, const int64_t timestamp)
+{
+  PutChar(w, '{');
+  PutKey(w, "peripheral_id");
+  PutUint64(w, peripheral_id);
+  PutChar(w, ',');
+  PutKey(w, "value");
+  PutDouble(w, value);
+  if (timestamp > 0) // Unknown timestamps are left out, the server stamps the reading on arrival
+  {
+    PutChar(w, ',');
+    PutKey(w, "timestamp");
+    PutUint64(w, (uint64_t)timestamp);
+  }
+  PutChar(w, '}');
+}
+
+int SarpEncodePeripheralData(char *buf, const size_t buf_len, const uint32_t peripheral_id, const double value)
+{
+  struct sarp_writer w = {.buf = buf, .cap = buf_len};
+  PutReading(&w, peripheral_id, value, 0);
+  return Finish(&w);
+}
+
+int SarpEncodePeripheralDataBatch(char *buf, const size_t buf_len, const struct peripheral_data *data, const size_t n_data)
+{
+  struct sarp_writer w = {.buf = buf, .cap = buf_len};
+  PutChar(&w, '{');
+  PutKey(&w, "data");
+  PutChar(&w, '[');
+  for (size_t i = 0; i < n_data && !w.overflow; i++)
+  {
+    if (i > 0)
+    {
+      PutChar(&w, ',');
+    }
+    PutReading(&w, data[i].peripheral_id, data[i].value, data[i].timestamp);
+  }
+  PutChar(&w, ']');
+  PutChar(&w, '}');
+  return Finish(&w);
+}
+
+static const char *ControlReasonName(const uint8_t reason)
+{
+  switch (reason)
+  {
+  case CONTROL_REASON_DRY:
+    return "dry";
+  case CONTROL_REASON_WET:
+    return "wet";
+  case CONTROL_REASON_OVERRIDE:
+    return "override";
+  case CONTROL_REASON_RESUME:
+    return "resume";
+  default:
+    return "none";
+  }
+}
+
+int SarpEncodeControlEvents(char *buf, const size_t buf_len, const uint32_t peripheral_id, const struct control_event *events,
+                            const size_t n_events, const uint32_t dropped)
+{
+  struct sarp_writer w = {.buf = buf, .cap = buf_len};
+  PutChar(&w, '{');
+  PutKey(&w, "peripheral_id");
+  PutUint64(&w, peripheral_id);
+  PutChar(&w, ',');
+  if (dropped > 0)
+  {
+    PutKey(&w, "dropped");
+    PutUint64(&w, dropped);
+    PutChar(&w, ',');
+  }
+  PutKey(&w, "events");
+  PutChar(&w, '[');
+  for (size_t i = 0; i < n_events && !w.overflow; i++)
+  {
+    if (i > 0)
+    {
+      PutChar(&w, ',');
+    }
+    PutChar(&w, '{');
+    PutKey(&w, "state");
+    PutUint64(&w, events[i].state);
+    PutChar(&w, ',');
+    PutKey(&w, "reason");
+    PutString(&w, ControlReasonName(events[i].reason));
+    if (!isnan(events[i].moisture))
+    {
+      PutChar(&w, ',');
+      PutKey(&w, "moisture");
+      PutDouble(&w, events[i].moisture);
+    }
+    if (events[i].timestamp > 0) // Unknown timestamps are left out, the server stamps the event on arrival
+    {
+      PutChar(&w, ',');
+      PutKey(&w, "timestamp");
+      PutUint64(&w, (uint64_t)events[i].timestamp);
+    }
+    PutChar(&w, '}');
+  }
+  PutChar(&w, ']');
+  PutChar(&w, '}');
+  return Finish(&w);
+}
+
+static bool IsSpace(const char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static void CaptureChar(struct sarp_scanner *s, const char c)
+{
+  if (s->value_len + 1 < s->value_cap)
+  {
+    s->value[s->value_len++] = c;
+    s->value[s->value_len] = '\0';
+  }
+  else
+  {
+    s->overflow = true;
+  }
+}
+
+void SarpScannerInit(struct sarp_scanner *s, const char *key, char *value, const size_t value_cap)
+{
+  memset(s, 0, sizeof(*s));
+  s->key = key;
+  s->key_len = strlen(key);
+  s->value = value;
+  s->value_cap = value_cap;
+  if (value_cap > 0)
+  {
+    value[0] = '\0';
+  }
+  s->state = SCAN_EXPECT_OBJECT;
+}
+
+void SarpScannerInitUint32Array(struct sarp_scanner *s, const char *key, uint32_t *items, const size_t items_cap)
+{
+  SarpScannerInit(s, key, NULL, 0);
+  s->items = items;
+  s->items_cap = items_cap;
+}
+
+static void CaptureItem(struct sarp_scanner *s)
+{
+  if (s->n_items < s->items_cap)
+  {
+    s->items[s->n_items++] = (uint32_t)s->item;
+  }
+  else
+  {
+    s->overflow = true;
+  }
+}
+
+static void ScanValueStart(struct sarp_scanner *s, const char c)
+{
+  if (s->key_match)
+  {
+    if (s->items != NULL) // Array scanners report any other value as a member of no supported type
+    {
+      s->type = (c == '[') ? SCAN_VALUE_ARRAY : SCAN_VALUE_NONE;
+      s->state = (c == '[') ? SCAN_CAPTURE_ITEM : SCAN_FOUND;
+    }
+    else if (c == '"')
+    {
+      s->type = SCAN_VALUE_STRING;
+      s->state = SCAN_CAPTURE_STRING;
+    }
+    else if (c == '-' || (c >= '0' && c <= '9'))
+    {
+      s->type = SCAN_VALUE_NUMBER;
+      s->state = SCAN_CAPTURE_NUMBER;
+      CaptureChar(s, c);
+    }
+    else
+    {
+      s->state = SCAN_FOUND; // Objects, arrays and literals are reported as a member of no supported type
+    }
+    return;
+  }
+  if (c == '"')
+  {
+    s->state = SCAN_SKIP_STRING;
+  }
+  else if (c == '{' || c == '[')
+  {
+    s->depth = 1;
+    s->state = SCAN_SKIP_NESTED;
+  }
+  else
+  {
+    s->state = SCAN_SKIP_SCALAR;
+  }
+}
+
+static void ScanChar(struct sarp_scanner *s, const char c)
+{
+  switch (s->state)
+  {
+  case SCAN_EXPECT_OBJECT:
+    if (c == '{')
+      s->state = SCAN_EXPECT_KEY;
+    else if (!IsSpace(c))
+      s->state = SCAN_ERROR;
+    break;
+  case SCAN_EXPECT_KEY:
+    if (c == '"')
+    {
+      s->key_pos = 0;
+      s->key_match = true;
+      s->state = SCAN_IN_KEY;
+    }
+    else if (c == '}')
+      s->state = SCAN_NOT_FOUND;
+    else if (!IsSpace(c))
+      s->state = SCAN_ERROR;
+    break;
+  case SCAN_IN_KEY:
+    if (c == '"')
+    {
+      s->key_match = s->key_match && s->key_pos == s->key_len;
+      s->state = SCAN_EXPECT_COLON;
+    }
+    else if (c == '\\')
+    {
+      s->key_match = false; // Looked up keys never need escaping
+      s->state = SCAN_IN_KEY_ESCAPE;
+    }
+    else if (s->key_pos < s->key_len && c == s->key[s->key_pos])
+      s->key_pos++;
+    else
+      s->key_match = false;
+    break;
+  case SCAN_IN_KEY_ESCAPE:
+    s->state = SCAN_IN_KEY;
+    break;
+  case SCAN_EXPECT_COLON:
+    if (c == ':')
+      s->state = SCAN_EXPECT_VALUE;
+    else if (!IsSpace(c))
+      s->state = SCAN_ERROR;
+    break;
+  case SCAN_EXPECT_VALUE:
+    if (!IsSpace(c))
+      ScanValueStart(s, c);
+    break;
+  case SCAN_CAPTURE_STRING:
+    if (c == '"')
+      s->state = SCAN_FOUND;
+    else if (c == '\\')
+      s->state = SCAN_CAPTURE_ESCAPE;
+    else
+      CaptureChar(s, c);
+    break;
+  case SCAN_CAPTURE_ESCAPE:
+    s->state = SCAN_CAPTURE_STRING;
+    switch (c)
+    {
+    case 'n':
+      CaptureChar(s, '\n');
+      break;
+    case 't':
+      CaptureChar(s, '\t');
+      break;
+    case 'r':
+      CaptureChar(s, '\r');
+      break;
+    case 'b':
+      CaptureChar(s, '\b');
+      break;
+    case 'f':
+      CaptureChar(s, '\f');
+      break;
+    case 'u':
+      CaptureChar(s, '?'); // The SARP API only sends ASCII, code points are not decoded
+      s->unicode_left = 4;
+      s->state = SCAN_CAPTURE_UNICODE;
+      break;
+    default:
+      CaptureChar(s, c);
+      break;
+    }
+    break;
+  case SCAN_CAPTURE_UNICODE:
+    if (--s->unicode_left == 0)
+      s->state = SCAN_CAPTURE_STRING;
+    break;
+  case SCAN_CAPTURE_NUMBER:
+    if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+      CaptureChar(s, c);
+    else
+      s->state = SCAN_FOUND;
+    break;
+  case SCAN_CAPTURE_ITEM: // Start of an element, only integers are accepted
+    if (c >= '0' && c <= '9')
+    {
+      s->item = (uint64_t)(c - '0');
+      s->state = SCAN_CAPTURE_ITEM_NUMBER;
+    }
+    else if (c == ']' && s->n_items == 0)
+      s->state = SCAN_FOUND;
+    else if (!IsSpace(c))
+      s->state = SCAN_ERROR;
+    break;
+  case SCAN_CAPTURE_ITEM_NUMBER:
+    if (c >= '0' && c <= '9')
+    {
+      s->item = s->item * 10 + (uint64_t)(c - '0');
+      if (s->item > UINT32_MAX)
+        s->state = SCAN_ERROR;
+      break;
+    }
+    CaptureItem(s);
+    s->state = SCAN_CAPTURE_ITEM_END; // c is the separator
+    // fall through
+  case SCAN_CAPTURE_ITEM_END:
+    if (c == ',')
+      s->state = SCAN_CAPTURE_ITEM;
+    else if (c == ']')
+      s->state = SCAN_FOUND;
+    else if (!IsSpace(c))
+      s->state = SCAN_ERROR;
+    break;
+  case SCAN_SKIP_STRING:
+    if (c == '"')
+      s->state = SCAN_AFTER_VALUE;
+    else if (c == '\\')
+      s->state = SCAN_SKIP_STRING_ESCAPE;
+    break;
+  case SCAN_SKIP_STRING_ESCAPE:
+    s->state = SCAN_SKIP_STRING;
+    break;
+  case SCAN_SKIP_NESTED:
+    if (c == '"')
+      s->state = SCAN_SKIP_NESTED_STRING;
+    else if (c == '{' || c == '[')
+      s->depth++;
+    else if ((c == '}' || c == ']') && --s->depth == 0)
+      s->state = SCAN_AFTER_VALUE;
+    break;
+  case SCAN_SKIP_NESTED_STRING:
+    if (c == '"')
+      s->state = SCAN_SKIP_NESTED;
+    else if (c == '\\')
+      s->state = SCAN_SKIP_NESTED_ESCAPE;
+    break;
+  case SCAN_SKIP_NESTED_ESCAPE:
+    s->state = SCAN_SKIP_NESTED_STRING;
+    break;
+  case SCAN_SKIP_SCALAR:
+    if (c == ',')
+      s->state = SCAN_EXPECT_KEY;
+    else if (c == '}')
+      s->state = SCAN_NOT_FOUND;
+    else if (IsSpace(c))
+      s->state = SCAN_AFTER_VALUE;
+    break;
+  case SCAN_AFTER_VALUE:
+    if (c == ',')
+      s->state = SCAN_EXPECT_KEY;
+    else if (c == '}')
+      s->state = SCAN_NOT_FOUND;
+    else if (!IsSpace(c))
+      s->state = SCAN_ERROR;
+    break;
+  default: // Terminal states ignore the rest of the body
+    break;
+  }
+}
+
+void SarpScannerFeed(struct sarp_scanner *s, const char *data, const size_t len)
+{
+  for (size_t i = 0; i < len && s->state < SCAN_FOUND; i++)
+  {
+    ScanChar(s, data[i]);
+  }
+}
+
+esp_err_t SarpScannerResult(const struct sarp_scanner *s)
+{
+  switch (s->state)
+  {
+  case SCAN_FOUND:
+    return s->overflow ? ESP_ERR_INVALID_SIZE : ESP_OK;
+  case SCAN_NOT_FOUND:
+    return ESP_ERR_NOT_FOUND;
+  default: // Malformed or truncated body
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+}
+
+esp_err_t SarpScannerString(const struct sarp_scanner *s)
+{
+  esp_err_t err = SarpScannerResult(s);
+  if (err == ESP_OK && s->type != SCAN_VALUE_STRING)
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+  return err;
+}
+
+esp_err_t SarpScannerUint32(const struct sarp_scanner *s, uint32_t *out)
+{
+  esp_err_t err = SarpScannerResult(s);
+  if (err != ESP_OK)
+  {
+    return err;
+  }
+  if (s->type != SCAN_VALUE_NUMBER || s->value[0] == '-')
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+  uint64_t value = 0;
+  for (const char *c = s->value; *c >= '0' && *c <= '9'; c++) // Any fraction or exponent is ignored, ids are integers
+  {
+    value = value * 10 + (uint64_t)(*c - '0');
+    if (value > UINT32_MAX)
+    {
+      return ESP_ERR_INVALID_SIZE;
+    }
+  }
+  *out = (uint32_t)value;
+  return ESP_OK;
+}
+
+esp_err_t SarpScannerDouble(const struct sarp_scanner *s, double *out)
+{
+  esp_err_t err = SarpScannerResult(s);
+  if (err != ESP_OK)
+  {
+    return err;
+  }
+  if (s->type != SCAN_VALUE_NUMBER)
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+  char *end = NULL;
+  const double value = strtod(s->value, &end);
+  if (end == s->value || !isfinite(value))
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+  *out = value;
+  return ESP_OK;
+}
+
+esp_err_t SarpScannerUint32Array(const struct sarp_scanner *s, size_t *n_items)
+{
+  esp_err_t err = SarpScannerResult(s);
+  if (err == ESP_OK && s->type != SCAN_VALUE_ARRAY)
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+  *n_items = s->n_items;
+  return err;
+}
+
+esp_err_t SarpDecodeString(const char *json, const size_t json_len, const char *key, char *out, const size_t out_len)
+{
+  struct sarp_scanner s;
+  SarpScannerInit(&s, key, out, out_len);
+  SarpScannerFeed(&s, json, json_len);
+  return SarpScannerString(&s);
+}
+
+esp_err_t SarpDecodeUint32(const char *json, const size_t json_len, const char *key, uint32_t *out)
+{
+  char number[SARP_SCAN_NUMBER_SIZE];
+  struct sarp_scanner s;
+  SarpScannerInit(&s, key, number, sizeof(number));
+  SarpScannerFeed(&s, json, json_len);
+  return SarpScannerUint32(&s, out);
+}
+
+esp_err_t SarpDecodeDouble(const char *json, const size_t json_len, const char *key, double *out)
+{
+  char number[SARP_SCAN_NUMBER_SIZE];
+  struct sarp_scanner s;
+  SarpScannerInit(&s, key, number, sizeof(number));
+  SarpScannerFeed(&s, json, json_len);
+  return SarpScannerDouble(&s, out);
+}
@@ -0,0 +1,208 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define SARP_VALUE_DECIMALS 3          // Decimals kept when encoding reading values
+#define SARP_MAX_READING_JSON_SIZE 96  // Worst case size of one encoded reading, comma included
+#define SARP_MAX_EVENT_JSON_SIZE 96    // Worst case size of one encoded control event, comma included
+#define SARP_SCAN_NUMBER_SIZE 24       // Capture buffer for a number member, more than any 32-bit integer needs
+
+struct peripheral_data;
+struct control_event;
+
+enum scan_state
+{
+  SCAN_EXPECT_OBJECT,
+  SCAN_EXPECT_KEY,
+  SCAN_IN_KEY,
+  SCAN_IN_KEY_ESCAPE,
+  SCAN_EXPECT_COLON,
+  SCAN_EXPECT_VALUE,
+  SCAN_CAPTURE_STRING,
+  SCAN_CAPTURE_ESCAPE,
+  SCAN_CAPTURE_UNICODE,
+  SCAN_CAPTURE_NUMBER,
+  SCAN_CAPTURE_ITEM,
+  SCAN_CAPTURE_ITEM_NUMBER,
+  SCAN_CAPTURE_ITEM_END,
+  SCAN_SKIP_STRING,
+  SCAN_SKIP_STRING_ESCAPE,
+  SCAN_SKIP_NESTED,
+  SCAN_SKIP_NESTED_STRING,
+  SCAN_SKIP_NESTED_ESCAPE,
+  SCAN_SKIP_SCALAR,
+  SCAN_AFTER_VALUE,
+  SCAN_FOUND,
+  SCAN_NOT_FOUND,
+  SCAN_ERROR,
+};
+
+enum scan_value_type
+{
+  SCAN_VALUE_NONE,
+  SCAN_VALUE_STRING,
+  SCAN_VALUE_NUMBER,
+  SCAN_VALUE_ARRAY,
+};
+
+/**
+ * @brief Byte driven scanner looking for one top level member of a JSON object.
+ * It can be fed the body in chunks of any size as they arrive, only the value of that member
+ * is kept and everything else is skipped as it goes by, so memory use does not depend on the body size.
+ */
+struct sarp_scanner
+{
+  const char *key;
+  size_t key_len;
+  size_t key_pos;
+  bool key_match;
+  char *value; // Captured value, unescaped and NUL terminated
+  size_t value_cap;
+  size_t value_len;
+  bool overflow;
+  uint32_t *items; // Captured array of integers, only when set up with SarpScannerInitUint32Array
+  size_t items_cap;
+  size_t n_items;
+  uint64_t item;
+  enum scan_state state;
+  enum scan_value_type type;
+  uint32_t depth;
+  uint8_t unicode_left;
+};
+
+/**
+ * @brief Prepares a scanner to look for a top level member.
+ *
+ * @param s Scanner to initialize.
+ * @param key Member to look for, must outlive the scanner.
+ * @param value Capture buffer for the member value; for numbers at least SARP_SCAN_NUMBER_SIZE bytes.
+ * @param value_cap Size of value.
+ */
+void SarpScannerInit(struct sarp_scanner *s, const char *key, char *value, const size_t value_cap);
+
+/**
+ * @brief Prepares a scanner to look for a top level member holding an array of non negative 32-bit integers.
+ *
+ * @param s Scanner to initialize.
+ * @param key Member to look for, must outlive the scanner.
+ * @param items Capture buffer for the array elements.
+ * @param items_cap Number of elements items can hold.
+ */
+void SarpScannerInitUint32Array(struct sarp_scanner *s, const char *key, uint32_t *items, const size_t items_cap);
+
+/**
+ * @brief Feeds the next chunk of the body. Bytes after the member has been found are ignored.
+ */
+void SarpScannerFeed(struct sarp_scanner *s, const char *data, const size_t len);
+
+/**
+ * @brief Returns the outcome of the scan once the whole body has been fed.
+ *
+ * @return esp_err_t ESP_OK if the member was found, ESP_ERR_NOT_FOUND if it is missing,
+ * ESP_ERR_INVALID_SIZE if its value did not fit, ESP_ERR_INVALID_RESPONSE if the body is malformed or truncated.
+ */
+esp_err_t SarpScannerResult(const struct sarp_scanner *s);
+
+/**
+ * @brief Like SarpScannerResult, also requiring the member to be a string.
+ */
+esp_err_t SarpScannerString(const struct sarp_scanner *s);
+
+/**
+ * @brief Like SarpScannerResult, also converting the member to a non negative 32-bit integer.
+ */
+esp_err_t SarpScannerUint32(const struct sarp_scanner *s, uint32_t *out);
+
+/**
+ * @brief Like SarpScannerResult, also converting the member to a double.
+ */
+esp_err_t SarpScannerDouble(const struct sarp_scanner *s, double *out);
+
+/**
+ * @brief Like SarpScannerResult, also requiring the member to be an array of non negative 32-bit integers.
+ *
+ * @param n_items Output, number of elements captured.
+ */
+esp_err_t SarpScannerUint32Array(const struct sarp_scanner *s, size_t *n_items);
+
+/**
+ * @brief Encodes the module registration body {"token_api": ...}.
+ * Every encoder writes into the caller supplied buffer, always NUL terminated, and never allocates.
+ *
+ * @return int Length of the body without the terminator, or -1 if it does not fit in buf.
+ */
+int SarpEncodeRegisterModule(char *buf, const size_t buf_len, const char *token_api);
+
+/**
+ * @brief Encodes the peripheral registration body {"parent_module": ..., "p_type": ..., "instance": ...}.
+ * The instance tells apart several peripherals of the same type, it is left out for the first one (0).
+ *
+ * @return int Length of the body, or -1 if it does not fit in buf.
+ */
+int SarpEncodeRegisterPeripheral(char *buf, const size_t buf_len, const char *module_token, const char *p_type, const uint32_t instance);
+
+/**
+ * @brief Encodes the bulk peripheral registration body {"parent_module": ..., "p_types": [...], "instances": [...]}.
+ * The instances array is left out when every peripheral is the first of its type.
+ *
+ * @return int Length of the body, or -1 if it does not fit in buf.
+ */
+int SarpEncodeRegisterPeripheralBatch(char *buf, const size_t buf_len, const char *module_token, const char *const *p_types,
+                                      const uint32_t *instances, const size_t n_types);
+
+/**
+ * @brief Encodes a single reading {"peripheral_id": ..., "value": ...}.
+ *
+ * @return int Length of the body, or -1 if it does not fit in buf.
+ */
+int SarpEncodePeripheralData(char *buf, const size_t buf_len, const uint32_t peripheral_id, const double value);
+
+/**
+ * @brief Encodes a batch of readings {"data": [{"peripheral_id", "value", "timestamp"}, ...]}.
+ * A buffer of n_data * SARP_MAX_READING_JSON_SIZE + 16 bytes always fits.
+ *
+ * @return int Length of the body, or -1 if it does not fit in buf.
+ */
+int SarpEncodePeripheralDataBatch(char *buf, const size_t buf_len, const struct peripheral_data *data, const size_t n_data);
+
+/**
+ * @brief Encodes the control events of a valve {"peripheral_id": ..., "dropped": ..., "events": [{"state", "reason",
+ * "moisture", "timestamp"}, ...]}. The moisture and the timestamp are left out when unknown, dropped (events lost
+ * before these ones) when 0.
+ * A buffer of n_events * SARP_MAX_EVENT_JSON_SIZE + 64 bytes always fits.
+ *
+ * @return int Length of the body, or -1 if it does not fit in buf.
+ */
+int SarpEncodeControlEvents(char *buf, const size_t buf_len, const uint32_t peripheral_id, const struct control_event *events,
+                            const size_t n_events, const uint32_t dropped);
+
+/**
+ * @brief Extracts a top level string member of a JSON object without building a DOM.
+ *
+ * @param json Response body, does not need to be NUL terminated.
+ * @param json_len Length of the body.
+ * @param key Member to look for.
+ * @param out Output, the unescaped NUL terminated string.
+ * @param out_len Capacity of out.
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND if the member is missing or not a string,
+ * ESP_ERR_INVALID_SIZE if it does not fit in out, ESP_ERR_INVALID_RESPONSE if the body is not a JSON object.
+ */
+esp_err_t SarpDecodeString(const char *json, const size_t json_len, const char *key, char *out, const size_t out_len);
+
+/**
+ * @brief Extracts a top level non negative integer member of a JSON object without building a DOM.
+ *
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND if the member is missing or not a number,
+ * ESP_ERR_INVALID_SIZE if it overflows 32 bits, ESP_ERR_INVALID_RESPONSE if the body is not a JSON object.
+ */
+esp_err_t SarpDecodeUint32(const char *json, const size_t json_len, const char *key, uint32_t *out);
+
+/**
+ * @brief Extracts a top level number member of a JSON object without building a DOM.
+ *
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND if the member is missing or not a number,
+ * ESP_ERR_INVALID_RESPONSE if the body is not a JSON object.
+ */
+esp_err_t SarpDecodeDouble(const char *json, const size_t json_len, const char *key, double *out);
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "WireMeter.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+// One task is metered at a time, requests of the session are serialized
+static TaskHandle_t metered_task = NULL;
+static uint32_t sent = 0;
+static uint32_t received = 0;
+
+ssize_t __real_lwip_send(int s, const void *dataptr, size_t size, int flags);
+ssize_t __real_lwip_recv(int s, void *mem, size_t len, int flags);
+ssize_t __real_lwip_write(int s, const void *dataptr, size_t size);
+ssize_t __real_lwip_read(int s, void *mem, size_t len);
+
+/**
+ * @brief Adds the result of a socket call to a counter when it was made by the metered task.
+ */
+static void Count(uint32_t *counter, const ssize_t result)
+{
+  if (result > 0 && metered_task != NULL && xTaskGetCurrentTaskHandle() == metered_task)
+  {
+    *counter += (uint32_t)result;
+  }
+}
+
+// send() and recv() of esp-tls and the plain TCP transport
+ssize_t __wrap_lwip_send(int s, const void *dataptr, size_t size, int flags)
+{
+  const ssize_t result = __real_lwip_send(s, dataptr, size, flags);
+  Count(&sent, result);
+  return result;
+}
+
+ssize_t __wrap_lwip_recv(int s, void *mem, size_t len, int flags)
+{
+  const ssize_t result = __real_lwip_recv(s, mem, len, flags);
+  Count(&received, result);
+  return result;
+}
+
+// write() and read() through the VFS, used by the mbedTLS network layer
+ssize_t __wrap_lwip_write(int s, const void *dataptr, size_t size)
+{
+  const ssize_t result = __real_lwip_write(s, dataptr, size);
+  Count(&sent, result);
+  return result;
+}
+
+ssize_t __wrap_lwip_read(int s, void *mem, size_t len)
+{
+  const ssize_t result = __real_lwip_read(s, mem, len);
+  Count(&received, result);
+  return result;
+}
+
+/**
+ * @brief Starts counting the socket bytes of the calling task from zero.
+ *
+ */
+void WireMeterStart()
+{
+  sent = 0;
+  received = 0;
+  metered_task = xTaskGetCurrentTaskHandle();
+}
+
+/**
+ * @brief Stops counting and returns the bytes the calling task sent and received since WireMeterStart.
+ *
+ * @param bytes_sent Output, bytes written to the sockets.
+ * @param bytes_received Output, bytes read from the sockets.
+ */
+void WireMeterStop(uint32_t *bytes_sent, uint32_t *bytes_received)
+{
+  metered_task = NULL;
+  *bytes_sent = sent;
+  *bytes_received = received;
+}
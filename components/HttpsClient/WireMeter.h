@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+
+// Counts the bytes that actually go through the sockets, TLS records and handshakes included. The lwIP socket calls
+// are wrapped at link time (-Wl,--wrap, see CMakeLists.txt), so every transport on top of them is seen; only the
+// calls made by the metered task are counted, the MQTT client and the other network tasks use the same functions.
+
+void WireMeterStart();
+void WireMeterStop(uint32_t *bytes_sent, uint32_t *bytes_received);
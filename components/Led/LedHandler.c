@@ -1,63 +1,115 @@
 #include "LedHandler.h"
 
 #define LED_GPIO GPIO_NUM_2
+
+static QueueHandle_t led_queue = NULL;
+static bool pending[N_LED_MODES]; // Events received and not played yet, only touched by the LED task
+
+// Modes left out (e.g. OK) have no pattern
+static const struct led_pattern patterns[N_LED_MODES] = {
+    [ERROR] = {.times = 1, .blinks = 5, .on = pdMS_TO_TICKS(500), .off = pdMS_TO_TICKS(500), .priority = 3},
+    [WIFI_CONNECTED] = {.times = 1, .blinks = 4, .on = pdMS_TO_TICKS(250), .off = pdMS_TO_TICKS(250), .priority = 1},
+    [WIFI_CONNECTING] = {.times = 1, .blinks = 3, .on = pdMS_TO_TICKS(25), .off = pdMS_TO_TICKS(25), .priority = 0},
+    [BLE_SCANNING] = {.times = 2, .blinks = 2, .on = pdMS_TO_TICKS(10), .off = pdMS_TO_TICKS(10), .gap = pdMS_TO_TICKS(50), .priority = 0},
+    [SWITCH_MODE] = {.times = 1, .blinks = 2, .on = pdMS_TO_TICKS(80), .off = pdMS_TO_TICKS(80), .priority = 2},
+    [BLE_CONFIG_SETTED] = {.times = 1, .blinks = 1, .on = pdMS_TO_TICKS(1000), .priority = 2},
+};
+
 void InitLEDS()
 {
     gpio_set_direction(LED_GPIO, GPIO_MODE_OUTPUT);
+    led_queue = xQueueCreate(LED_QUEUE_LENGTH, sizeof(enum LED_MODE));
+    if (led_queue == NULL || xTaskCreatePinnedToCore(LEDTask, "led", LED_TASK_STACK_SIZE, NULL, LED_TASK_PRIORITY, NULL, LED_TASK_CORE) != pdPASS)
+    {
+        led_queue = NULL; // LEDEvent becomes a no-op, the LED is only feedback
+    }
 }
 
 void LEDEvent(enum LED_MODE state)
 {
-    TickType_t timesInterval = 0;                      // Time delay in between secuences.
-    int8_t times = 0;                                  // Times to repeat a secuence.
-    int8_t blinks = 0;                                 // blinks per secuence.
-    TickType_t blinkInterval1 = 0, blinkInterval2 = 0; // Time delay between blinks
-    switch (state)
+    if (led_queue != NULL && state < N_LED_MODES)
     {
-    case ERROR:
-        times = 1;
-        blinks = 5;
-        blinkInterval1 = blinkInterval2 = pdMS_TO_TICKS(500);
-        break;
-    case WIFI_CONNECTED:
-        times = 1;
-        blinks = 4;
-        blinkInterval1 = blinkInterval2 = pdMS_TO_TICKS(250);
-        break;
-    case WIFI_CONNECTING:
-        times = 1;
-        blinks = 3;
-        blinkInterval1 = blinkInterval2 = pdMS_TO_TICKS(25);
-        break;
-    case BLE_SCANNING:
-        times = 2;
-        blinks = 2;
-        blinkInterval1 = blinkInterval2 = pdMS_TO_TICKS(10);
-        timesInterval = pdMS_TO_TICKS(50);
-        break;
-    case SWITCH_MODE:
-        times = 1;
-        blinks = 2;
-        blinkInterval1 = blinkInterval2 = pdMS_TO_TICKS(80);
-        break;
-    case BLE_CONFIG_SETTED:
-        times = 1;
-        blinks = 1;
-        blinkInterval1 = pdMS_TO_TICKS(1000);
-        break;
-    default:
-        break;
+        xQueueSend(led_queue, &state, 0); // Never blocks the caller, a full queue drops the event
     }
+}
 
-    for (size_t j = 0; j < times; j++)
+/**
+ * @brief Plays the pending patterns, highest priority first, and sleeps while there are none.
+ */
+static void LEDTask(void *arg)
+{
+    enum LED_MODE state;
+    while (true)
     {
-        for (size_t i = 0; i < blinks; i++)
+        if (xQueueReceive(led_queue, &state, portMAX_DELAY) == pdTRUE)
+        {
+            pending[state] = true;
+        }
+        while (true)
+        {
+            int next = -1;
+            for (int i = 0; i < N_LED_MODES; i++)
+            {
+                if (pending[i] && (next < 0 || patterns[i].priority > patterns[next].priority))
+                {
+                    next = i;
+                }
+            }
+            if (next < 0)
+            {
+                break;
+            }
+            pending[next] = false;
+            PlayPattern(&patterns[next]);
+        }
+    }
+}
+
+/**
+ * @brief Waits for the given time while collecting new events.
+ *
+ * @param duration Time to wait.
+ * @param priority Priority of the pattern playing.
+ * @return true if an event of higher priority arrived, the pattern must stop.
+ */
+static bool WaitOrPreempt(TickType_t duration, uint8_t priority)
+{
+    const TickType_t start = xTaskGetTickCount();
+    TickType_t elapsed = 0;
+    enum LED_MODE state;
+    while (elapsed < duration && xQueueReceive(led_queue, &state, duration - elapsed) == pdTRUE)
+    {
+        pending[state] = true;
+        if (patterns[state].priority > priority)
+        {
+            return true;
+        }
+        elapsed = xTaskGetTickCount() - start;
+    }
+    return false;
+}
+
+static void PlayPattern(const struct led_pattern *pattern)
+{
+    for (size_t j = 0; j < pattern->times; j++)
+    {
+        for (size_t i = 0; i < pattern->blinks; i++)
+        {
+            gpio_set_level(LED_GPIO, 1);
+            if (WaitOrPreempt(pattern->on, pattern->priority))
+            {
+                gpio_set_level(LED_GPIO, 0);
+                return;
+            }
+            gpio_set_level(LED_GPIO, 0);
+            if (WaitOrPreempt(pattern->off, pattern->priority))
+            {
+                return;
+            }
+        }
+        if (WaitOrPreempt(pattern->gap, pattern->priority))
         {
-            gpio_set_level(GPIO_NUM_2, 1);
-            vTaskDelay(blinkInterval1);
-            gpio_set_level(GPIO_NUM_2, 0);
-            vTaskDelay(blinkInterval2);
+            return;
         }
-        vTaskDelay(timesInterval);
     }
 }
\ No newline at end of file
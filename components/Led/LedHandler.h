@@ -1,6 +1,11 @@
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "TaskLayout.h"
+
+#define LED_QUEUE_LENGTH 8    // Events posted while a pattern plays, more are dropped
+#define LED_TASK_STACK_SIZE 2048
 
 enum LED_MODE
 {
@@ -12,16 +17,38 @@ enum LED_MODE
     MEM_ALLOC_FAILURE,
     ERROR,
     OK,
+    N_LED_MODES,
 };
 
+/**
+ * @brief Blink sequence of a LED_MODE: `times` sequences of `blinks` blinks, `gap` apart.
+ * A pattern preempts the one playing if its priority is higher, otherwise it waits for it to finish.
+ */
+struct led_pattern
+{
+    int8_t times;
+    int8_t blinks;
+    TickType_t on;       // LED on time of a blink
+    TickType_t off;      // LED off time after a blink
+    TickType_t gap;      // Time between sequences
+    uint8_t priority;
+};
+
+/**
+ * @brief Sets up the LED pin and starts the task playing the patterns.
+ *
+ */
 void InitLEDS();
 
 /**
- * @brief The LEDEvent function controls the blinking behavior
- * of an LED based on the specified LED_MODE state. It uses predefined
- * timing and repetition patterns for different states, such as error,
- * Wi-Fi connection status, BLE scanning, and mode switching, by setting
- * GPIO pin levels and introducing delays.
- * 
+ * @brief The LEDEvent function posts the blinking pattern of the specified
+ * LED_MODE state (error, Wi-Fi connection status, BLE scanning, mode switching...)
+ * to the LED task and returns right away, so it is safe to call from event
+ * handlers and BT callbacks. Repeated events waiting to be played are merged.
+ *
  */
-void LEDEvent();
\ No newline at end of file
+void LEDEvent(enum LED_MODE state);
+
+static void LEDTask(void *arg);
+static bool WaitOrPreempt(TickType_t duration, uint8_t priority);
+static void PlayPattern(const struct led_pattern *pattern);
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include <math.h>
+#include "IrrigationControl.h"
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define US_PER_S 1000000LL
+
+// Events waiting for upload. Appended by the sampler, uploaded by the uplink; kept through deep sleep
+static portMUX_TYPE log_lock = portMUX_INITIALIZER_UNLOCKED;
+RTC_DATA_ATTR static struct control_event log_events[CONTROL_LOG_CAPACITY];
+RTC_DATA_ATTR static size_t log_head = 0;  // Oldest pending event
+RTC_DATA_ATTR static size_t log_count = 0;
+RTC_DATA_ATTR static uint32_t log_first = 0;   // Sequence number of the oldest pending event
+RTC_DATA_ATTR static uint32_t log_dropped = 0; // Events dropped to make room and not reported yet
+
+/**
+ * @brief Tells whether the valve stayed in its current state for at least min_s seconds.
+ */
+static bool MinTimeElapsed(const struct irrigation_control *c, const uint32_t min_s, const int64_t now_us)
+{
+  return !c->switched || now_us - c->last_switch_us >= (int64_t)min_s * US_PER_S;
+}
+
+/**
+ * @brief Sets up a loop without a policy: the valve follows the server commands only.
+ *
+ * @param c The loop.
+ */
+void ControlInit(struct irrigation_control *c)
+{
+  *c = (struct irrigation_control){0};
+}
+
+/**
+ * @brief Replaces the thresholds of the loop. An override in progress keeps its expiry.
+ *
+ * @param c The loop.
+ * @param policy New thresholds, validated by the caller.
+ */
+void ControlSetPolicy(struct irrigation_control *c, const struct control_policy *policy)
+{
+  c->policy = *policy;
+  c->configured = true;
+}
+
+/**
+ * @brief Runs one step of the loop and tells which state the valve has to be driven to.
+ * A server command is always applied and starts a new override, even when it repeats the previous state: the
+ * server stays authoritative. When the override expires the loop takes over again from the next step.
+ * Otherwise the valve opens below on_below and closes above off_above, once it stayed in its current state for
+ * the minimum time.
+ *
+ * @param c The loop.
+ * @param command State commanded by the server since the previous step (0 or 1), CONTROL_NO_COMMAND if none.
+ * @param moisture Hygrometer reading taken this cycle, NAN if there is none.
+ * @param valve_state Current valve output.
+ * @param now_us Current time since boot.
+ * @param event Output, the action to log; its reason is CONTROL_REASON_NONE when there is nothing to log.
+ * The timestamp is left to the caller.
+ * @return int The state to drive the valve to, -1 to leave it as it is.
+ */
+int ControlStep(struct irrigation_control *c, const int command, const double moisture, const int valve_state,
+                const int64_t now_us, struct control_event *event)
+{
+  *event = (struct control_event){.moisture = moisture, .state = valve_state, .reason = CONTROL_REASON_NONE};
+  int target = -1;
+  if (command != CONTROL_NO_COMMAND)
+  {
+    target = command;
+    if (c->configured)
+    {
+      c->override_active = true;
+      c->override_until_us = now_us + (int64_t)c->policy.override_ttl_s * US_PER_S;
+      event->reason = CONTROL_REASON_OVERRIDE;
+    }
+  }
+  else if (c->override_active && now_us >= c->override_until_us)
+  {
+    c->override_active = false;
+    event->reason = CONTROL_REASON_RESUME;
+  }
+  else if (c->configured && !c->override_active && !isnan(moisture))
+  {
+    if (valve_state == 0 && moisture < c->policy.on_below && MinTimeElapsed(c, c->policy.min_off_s, now_us))
+    {
+      target = 1;
+      event->reason = CONTROL_REASON_DRY;
+    }
+    else if (valve_state != 0 && moisture > c->policy.off_above && MinTimeElapsed(c, c->policy.min_on_s, now_us))
+    {
+      target = 0;
+      event->reason = CONTROL_REASON_WET;
+    }
+  }
+  if (target >= 0 && target != valve_state)
+  {
+    c->switched = true;
+    c->last_switch_us = now_us;
+  }
+  if (target >= 0)
+  {
+    event->state = target;
+  }
+  return target;
+}
+
+/**
+ * @brief Adds an event to the upload log. While the log is full the oldest event makes room for it: the newest
+ * events tell the current state of the loop. Dropped events are counted and reported with the next upload.
+ *
+ * @param event The event.
+ * @return true if the event was logged without dropping an older one.
+ */
+bool ControlLogAppend(const struct control_event *event)
+{
+  taskENTER_CRITICAL(&log_lock);
+  const bool full = log_count == CONTROL_LOG_CAPACITY;
+  if (full)
+  {
+    log_head = (log_head + 1) % CONTROL_LOG_CAPACITY;
+    log_count--;
+    log_first++;
+    log_dropped++;
+  }
+  log_events[(log_head + log_count) % CONTROL_LOG_CAPACITY] = *event;
+  log_count++;
+  taskEXIT_CRITICAL(&log_lock);
+  return !full;
+}
+
+/**
+ * @brief Copies the oldest pending events without removing them from the log.
+ *
+ * @param events Output buffer.
+ * @param max_events Capacity of events.
+ * @param batch Output, what the copied events cover, to consume them later.
+ * @return size_t Number of events copied.
+ */
+size_t ControlLogPeek(struct control_event *events, const size_t max_events, struct control_log_batch *batch)
+{
+  taskENTER_CRITICAL(&log_lock);
+  const size_t n = (log_count < max_events) ? log_count : max_events;
+  for (size_t i = 0; i < n; i++)
+  {
+    events[i] = log_events[(log_head + i) % CONTROL_LOG_CAPACITY];
+  }
+  batch->first = log_first;
+  batch->dropped = log_dropped;
+  taskEXIT_CRITICAL(&log_lock);
+  return n;
+}
+
+/**
+ * @brief Removes the events of an uploaded batch, and the drops reported with it. Events of the batch the sampler
+ * dropped in the meantime are already gone, only the ones still pending are removed.
+ *
+ * @param batch What the batch covers, as returned by ControlLogPeek.
+ * @param n_events Number of events in the batch.
+ */
+void ControlLogConsume(const struct control_log_batch *batch, const size_t n_events)
+{
+  taskENTER_CRITICAL(&log_lock);
+  const int32_t left = (int32_t)(batch->first + n_events - log_first); // Events of the batch still pending
+  const size_t n = (left <= 0) ? 0 : (((size_t)left < log_count) ? (size_t)left : log_count);
+  log_head = (log_head + n) % CONTROL_LOG_CAPACITY;
+  log_count -= n;
+  log_first += n;
+  log_dropped -= batch->dropped;
+  taskEXIT_CRITICAL(&log_lock);
+}
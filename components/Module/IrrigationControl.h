@@ -0,0 +1,43 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ConfigStore.h"
+#include "HttpsClient.h"
+
+#define CONTROL_NO_COMMAND -1    // No server command since the previous step
+#define CONTROL_LOG_CAPACITY 64  // Events kept until uploaded, the oldest ones are dropped while it is full
+
+/**
+ * @brief On-device irrigation loop of a single valve, stepped by the sampler at the sampling rate of its
+ * hygrometer. It opens and closes the valve on its own, with hysteresis and minimum on and off times, so
+ * irrigation goes on while the server is unreachable. A server command always wins: it is applied right away
+ * and holds the loop off for the override TTL of the policy.
+ */
+struct irrigation_control
+{
+  struct control_policy policy;
+  bool configured;           // Whether a policy was set, until then the valve only follows the server
+  bool override_active;      // A server command holds the loop off
+  int64_t override_until_us; // Time since boot the override expires at
+  bool switched;             // Whether last_switch_us holds a switch
+  int64_t last_switch_us;    // Time since boot of the last valve switch, for the minimum on and off times
+};
+
+void ControlInit(struct irrigation_control *c);
+void ControlSetPolicy(struct irrigation_control *c, const struct control_policy *policy);
+int ControlStep(struct irrigation_control *c, const int command, const double moisture, const int valve_state,
+                const int64_t now_us, struct control_event *event);
+
+/**
+ * @brief What a peeked batch of events covers, handed back to ControlLogConsume once it is uploaded.
+ */
+struct control_log_batch
+{
+  uint32_t first; // Sequence number of the first event of the batch
+  uint32_t dropped; // Events dropped before the batch, reported with it
+};
+
+bool ControlLogAppend(const struct control_event *event);
+size_t ControlLogPeek(struct control_event *events, const size_t max_events, struct control_log_batch *batch);
+void ControlLogConsume(const struct control_log_batch *batch, const size_t n_events);
\ No newline at end of file
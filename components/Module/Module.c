@@ -1,348 +1,1392 @@
 #include "esp_log.h"
 #include "Module.h"
 #include "HttpsClient.h"
+#include "ReadingStore.h"
+#include "ConfigStore.h"
 #include "driver/gpio.h"
-#include "esp_adc/adc_oneshot.h"
+#include "AdcSampler.h"
+#include "PeripheralDriver.h"
+#include "IrrigationControl.h"
+#include "CycleMetrics.h"
+#include "RuntimeStats.h"
+#include "PhaseTrace.h"
+#include "PushClient.h"
+#include "Scheduler.h"
+#include "SarpCodec.h"
 #include "esp_timer.h"
+#include "esp_sleep.h"
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "TaskLayout.h"
 #include "math.h"
+#include <inttypes.h>
+#include <time.h>
 
-#define N_PERIPHERAL_TYPES 3 // 4 (remove "other" peripheral type if not needed)
-#define MINUTES_TO_MICROSECONDS(x) ((x) * 60 * 1000000)
-#define HYGROMETER_ADC_CHANNEL ADC_CHANNEL_7  // GPIO35 = ADC_CHANNEL_7
-#define THERMOMETER_ADC_CHANNEL ADC_CHANNEL_6 // GPIO34 = ADC_CHANNEL_6
-#define VALVE_GPIO_PIN GPIO_NUM_26            // GPIO23 for valve control
+#define SAMPLER_TASK_STACK_SIZE 4096 // ADC scans and change detection, the network is left to the uplink
+#define UPLINK_TASK_STACK_SIZE 8192  // TLS handshakes and JSON handling need a roomy stack
+#define UPLINK_QUEUE_LENGTH (2 * MAX_BATCH_READINGS) // Readings in flight to the uplink, the overflow goes to the store
+#define PERIPHERAL_STATE_SIZE 16              // Longest peripheral state string ("on"/"off") accepted from the server
+#define STORE_DRAIN_BATCH_SIZE MAX_BATCH_READINGS // Stored readings uploaded per request when draining the store
+#define STORE_DRAIN_MAX_BATCHES 16            // Bounds the time a single cycle spends draining the store
+#define MIN_VALID_UNIX_TIME 1704067200        // 2024-01-01, anything earlier means SNTP has not synced yet
+#define MAX_SCHEDULE_PERIOD_S (24 * 60 * 60)  // Longest period accepted from the server
+#define MIN_WAKEUP_DELAY_US 1000              // Shortest wait before the next wakeup
+#ifndef MODULE_DEEP_SLEEP
+#define MODULE_DEEP_SLEEP 0                   // 1 = duty-cycled: deep sleep between wakeups instead of staying awake with WiFi on
+#endif
+#if MODULE_DEEP_SLEEP
+#define MODULE_RETAINED RTC_DATA_ATTR         // Kept across deep sleep, so a timer wakeup resumes without NVS or the server
+#else
+#define MODULE_RETAINED
+#endif
+#define MODULE_CONTEXT_MAGIC 0x4D4F4455       // Marks a complete module context in RTC memory
+#define DEEP_SLEEP_MIN_US 3000000             // Shorter waits are spent awake, a wakeup boot costs more than that
+#define DIAGNOSTICS_PERIOD_US (60 * 60 * 1000000LL) // Diagnostics record upload period, checked after each cycle
+#ifndef MODULE_SOIL_PROBES
+#define MODULE_SOIL_PROBES 1                  // Hygrometers wired to the module, up to 5 (see peripheral_table for their channels)
+#endif
+#define N_LEGACY_PERIPHERALS 3                // The former per-key layout knew the first three entries of the table
 
-static adc_oneshot_unit_handle_t adc1_handle;
+// Peripherals wired to the module, in registration order. Adding one takes a driver and a line here,
+// the sampling loop goes through this table and never names a peripheral. New entries go at the end:
+// the registered ids are stored by position in the table.
+static const struct peripheral_desc peripheral_table[] = {
+    {.driver = &hygrometer_driver, .pin = ADC_CHANNEL_7},  // GPIO35
+    {.driver = &thermometer_driver, .pin = ADC_CHANNEL_6}, // GPIO34
+    {.driver = &valve_driver, .pin = GPIO_NUM_26},
+    // Further soil probes, on the free ADC1 channels. ADC2 is left out: the ESP32 WiFi driver holds it whenever WiFi
+    // runs, and the module samples with WiFi on in both modes
+#if MODULE_SOIL_PROBES >= 2
+    {.driver = &hygrometer_driver, .pin = ADC_CHANNEL_0}, // GPIO36
+#endif
+#if MODULE_SOIL_PROBES >= 3
+    {.driver = &hygrometer_driver, .pin = ADC_CHANNEL_3}, // GPIO39
+#endif
+#if MODULE_SOIL_PROBES >= 4
+    {.driver = &hygrometer_driver, .pin = ADC_CHANNEL_4}, // GPIO32
+#endif
+#if MODULE_SOIL_PROBES >= 5
+    {.driver = &hygrometer_driver, .pin = ADC_CHANNEL_5}, // GPIO33
+#endif
+};
+#define N_PERIPHERALS (sizeof(peripheral_table) / sizeof(peripheral_table[0]))
+#if MODULE_SOIL_PROBES < 1 || MODULE_SOIL_PROBES > 5
+#error "MODULE_SOIL_PROBES must be between 1 and 5, the free ADC1 channels"
+#endif
+_Static_assert(N_PERIPHERALS <= CONFIG_MAX_PERIPHERALS, "The configuration has no room for every peripheral id");
+_Static_assert(N_PERIPHERALS <= MAX_BATCH_PERIPHERALS, "The peripherals are registered in a single request");
+#define CONTROL_SENSOR 0   // Entry of the hygrometer the irrigation loop reads
+#define CONTROL_ACTUATOR 2 // Entry of the valve it drives
+_Static_assert(CONTROL_SENSOR < N_PERIPHERALS && CONTROL_ACTUATOR < N_PERIPHERALS, "The irrigation loop is wired to missing entries");
+
+static adc_channel_t adc_channels[ADC_SAMPLER_MAX_CHANNELS]; // Channels of the analog peripherals, in table order
+static int adc_millivolts[ADC_SAMPLER_MAX_CHANNELS];         // Filtered and calibrated results of the last scan, -1 if unavailable
+static size_t n_adc_channels = 0;
 struct peripheral
 {
   uint32_t id;
   const char *p_type;
+  const struct peripheral_desc *desc;
+  int adc_slot;                // Position of its channel in the ADC results, -1 if it is not analog
+  struct report_policy policy;
+  bool reported;               // Whether a value was reported since boot
+  double last_reported_value;  // Last value uploaded (or stored for upload)
+  int64_t last_reported_us;    // Time since boot of that report
+  struct schedule schedule;
 };
 
-const char *peripheral_type[] = {
-    "hygrometer",
-    "thermometer",
-    "valve",
-    "other",
-};
+MODULE_RETAINED static struct peripheral peripherals[N_PERIPHERALS];
+static struct peripheral_data drain_batch[STORE_DRAIN_BATCH_SIZE]; // Static, keeps the uplink stack small
+static struct peripheral_data uplink_batch[MAX_BATCH_READINGS];     // Readings taken off the uplink queue
+MODULE_RETAINED static struct peripheral_data pending_readings[MAX_BATCH_READINGS]; // Readings waiting for the next upload
+MODULE_RETAINED static size_t n_pending_readings = 0;
+MODULE_RETAINED static uint32_t context_magic = 0;
+MODULE_RETAINED static char retained_uuid[TOKEN_SIZE + 1];
+MODULE_RETAINED static int64_t clock_offset_us = 0; // Time spent in deep sleep, esp_timer restarts from 0 on every wakeup
+MODULE_RETAINED static int64_t next_diagnostics_us = 0;
+MODULE_RETAINED static struct irrigation_control irrigation;
+static struct control_event control_batch[MAX_BATCH_EVENTS]; // Static, keeps the uplink stack small
+static struct runtime_stats diagnostics;          // Static, keeps the uplink stack small
+static struct cpu_usage_baseline diagnostics_cpu;  // CPU usage is measured from one record to the next
+static char diagnostics_record[RUNTIME_STATS_JSON_SIZE];
 
-static struct peripheral peripherals[N_PERIPHERAL_TYPES];
+// Periods, report and irrigation policies and valve commands from the server, handed over from the MQTT or uplink
+// task to the sampler, which owns the valve of the irrigation loop
+static portMUX_TYPE schedule_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct schedule_config pushed_schedule[N_PERIPHERALS];
+static bool schedule_pushed[N_PERIPHERALS];
+static struct report_policy pushed_report_policy[N_PERIPHERALS]; // Latest policy of every peripheral, saved by the uplink
+static bool report_policy_pushed[N_PERIPHERALS];
+static bool report_policies_unsaved = false;
+static struct control_policy pushed_control_policy;
+static bool control_policy_pushed = false;
+static bool control_policy_unsaved = false; // Left to the uplink, an NVS write would stall the sampler
+static int pushed_command = CONTROL_NO_COMMAND;
+static bool pushed_command_repeated = false;  // The command repeats the last state the server asked for
+MODULE_RETAINED static int server_valve_state = CONTROL_NO_COMMAND; // Last valve state the server asked for, saved
+MODULE_RETAINED static bool server_valve_state_unsaved = false;    // in the configuration like the policy
 
-static char *token_api;
-static char *module_uuid;
+static const char *module_uuid;
 
-static const size_t UUID_SIZE = 37; // UUID length is 36 characters + 1 for null terminator
+static TaskHandle_t sampler_handle = NULL;
+static TaskHandle_t uplink_handle = NULL;    // NULL in duty-cycled mode, where the sampler uploads in place
+static QueueHandle_t uplink_queue = NULL;    // Readings handed over from the sampler to the uplink
+static bool actuator_poll_requested = false; // Set by the sampler, cleared by the uplink
+static esp_timer_handle_t wakeup_timer = NULL;
 
-static nvs_handle_t https_nvs_handle;
 static const char *TAG = "Module";
 
-bool ModuleIsConfigured()
+/**
+ * @brief Loads the module configuration into RAM, migrating the former per-key NVS layout if needed.
+ * Must run once after nvs_flash_init and before any other function of this module.
+ *
+ */
+void ModuleLoadConfig()
 {
-  esp_err_t ret = nvs_open(TAG, NVS_READONLY, &https_nvs_handle);
-  if (ret != ESP_OK)
+  const char *peripheral_keys[N_LEGACY_PERIPHERALS]; // The former layout stored each id under the peripheral type
+  for (size_t i = 0; i < N_LEGACY_PERIPHERALS; i++)
   {
-    ESP_LOGE(TAG, "Failed to open NVS namespace: %s", esp_err_to_name(ret));
-    return false;
+    peripheral_keys[i] = peripheral_table[i].driver->p_type;
   }
-  size_t required_size = UUID_SIZE;
-  char *uuid_buffer = malloc(UUID_SIZE * sizeof(char)); // Allocate memory for UUID buffer
-  ret = nvs_get_str(https_nvs_handle, "token_api", uuid_buffer, &required_size);
-  nvs_close(https_nvs_handle);
-  if (ret == ESP_OK)
+  if (ConfigInit(peripheral_keys, N_LEGACY_PERIPHERALS) != ESP_OK)
   {
-    free(uuid_buffer);
-    return true; // Module is configured
+    ESP_LOGE(TAG, "Failed to load the module configuration, using the defaults");
   }
-  free(uuid_buffer);
-  return false; // Module is not configured
 }
 
+bool ModuleIsConfigured()
+{
+  return ConfigGet()->token_api[0] != '\0'; // Served from RAM, no NVS access
+}
+
+/**
+ * @brief Sets the module up and starts its update cycle. In duty-cycled mode the setup and the cycles run on a task
+ * of their own, and this returns as soon as it is started.
+ *
+ */
 void ModuleInit()
 {
-  esp_err_t ret;
-  ret = nvs_open(TAG, NVS_READWRITE, &https_nvs_handle);
-  if (ret != ESP_OK)
+#if MODULE_DEEP_SLEEP
+  StartDutyCycleTask(false);
+#else
+  struct cycle_metrics_run run;
+  CycleMetricsBegin(&run);
+  ModuleSetup();
+  CycleMetricsEnd(&run, "init", NULL);
+#endif
+}
+
+/**
+ * @brief Tells whether this boot is a timer wakeup of the duty-cycled mode with a complete module context
+ * in RTC memory, in which case ModuleResume can be used instead of ModuleIsConfigured and ModuleInit.
+ *
+ * @return true if the module can resume.
+ */
+bool ModuleCanResume()
+{
+#if MODULE_DEEP_SLEEP
+  return context_magic == MODULE_CONTEXT_MAGIC && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Fast wake path of the duty-cycled mode. The module and peripheral identities, schedules and queued
+ * readings come from RTC memory, so only the peripherals and the reading store are initialized. The cycles run on
+ * a task of their own, this returns as soon as it is started.
+ *
+ */
+void ModuleResume()
+{
+  StartDutyCycleTask(true);
+}
+
+/**
+ * @brief Starts the task that runs the duty-cycled mode until the module deep sleeps. It does the work of the uplink
+ * (TLS handshakes, uploads, store drains and diagnostics), so it gets the uplink stack: the main task stack
+ * (CONFIG_ESP_MAIN_TASK_STACK_SIZE) is too small for it.
+ *
+ * @param resume Whether to take the fast wake path rather than the full setup.
+ */
+static void StartDutyCycleTask(const bool resume)
+{
+  if (xTaskCreatePinnedToCore(ModuleDutyCycleTask, "module_duty", UPLINK_TASK_STACK_SIZE, (void *)(uintptr_t)resume,
+                              UPLINK_TASK_PRIORITY, NULL, UPLINK_TASK_CORE) != pdPASS)
   {
-    ESP_LOGE(TAG, "Failed to open NVS namespace: %s", esp_err_to_name(ret));
-    return;
+    ESP_LOGE(TAG, "Failed to create module duty cycle task");
   }
-  size_t uuid_len = UUID_SIZE;
-  module_uuid = malloc(UUID_SIZE * sizeof(char)); // UUID length is 36 characters + null terminator
-  ret = nvs_get_str(https_nvs_handle, "module_uuid", module_uuid, &uuid_len);
-  if (ret == ESP_ERR_NVS_NOT_FOUND)
+}
+
+/**
+ * @brief Duty-cycle task: sets the module up, or resumes it from RTC memory, then runs the cycles until deep sleep.
+ * Deletes itself if the setup fails.
+ *
+ * @param arg Non-NULL to resume.
+ */
+static void ModuleDutyCycleTask(void *arg)
+{
+  struct cycle_metrics_run run;
+  CycleMetricsBegin(&run);
+  if (arg != NULL)
   {
-    token_api = malloc(UUID_SIZE * sizeof(char)); // Allocate memory for token_api.
-    ret = nvs_get_str(https_nvs_handle, "token_api", token_api, &uuid_len);
-    if (ret == ESP_ERR_NVS_NOT_FOUND)
+    module_uuid = retained_uuid;
+    if (ReadingStoreResume() != ESP_OK)
+    {
+      ESP_LOGW(TAG, "Reading store unavailable, readings taken while offline will be lost");
+    }
+    InitializePeripheralsPinSets();
+    CycleMetricsEnd(&run, "resume", NULL);
+  }
+  else
+  {
+    ModuleSetup();
+    CycleMetricsEnd(&run, "init", NULL);
+  }
+  if (context_magic == MODULE_CONTEXT_MAGIC) // Only set once the setup completed
+  {
+    RunDutyCycle();
+  }
+  vTaskDelete(NULL);
+}
+
+/**
+ * @brief Time since the first boot, deep sleep included. Every schedule deadline is expressed in it.
+ *
+ * @return int64_t The time in microseconds.
+ */
+static int64_t ModuleTimeUs()
+{
+  return esp_timer_get_time() + clock_offset_us;
+}
+
+/**
+ * @brief Loads the module and peripheral identities (registering them on the server when missing),
+ * initializes the peripherals and starts the update cycle.
+ *
+ */
+static void ModuleSetup()
+{
+  context_magic = 0;
+  const struct module_config *config = ConfigGet();
+  if (config->module_uuid[0] == '\0')
+  {
+    if (config->token_api[0] == '\0')
     {
       ESP_LOGE(TAG, "Token API not found in NVS, please register it first.");
-      free(module_uuid);
-      free(token_api);
-      nvs_close(https_nvs_handle);
       esp_restart(); // Restart the ESP32 if token_api is not found
       return;
     }
     ESP_LOGI(TAG, "Module UUID not found in NVS, registering module...");
-    const char *registered_module_uuid = RegisterModule(token_api);
-    ESP_LOGI(TAG, "Module uuid content size: %d", strlen(registered_module_uuid));
-    if (registered_module_uuid == NULL)
+    char registered_uuid[CONFIG_TOKEN_SIZE];
+    if (RegisterModule(config->token_api, registered_uuid, sizeof(registered_uuid)) != ESP_OK)
     {
       ESP_LOGE(TAG, "Failed to register module");
       return;
     }
-    strncpy(module_uuid, registered_module_uuid, UUID_SIZE);
-    free((void *)registered_module_uuid); // Free the memory allocated by RegisterModule
-    ret = nvs_set_str(https_nvs_handle, "module_uuid", module_uuid);
-    if (ret != ESP_OK)
+    ESP_LOGI(TAG, "Module uuid content size: %zu", strlen(registered_uuid));
+    ConfigSetModuleUuid(registered_uuid);
+  }
+  module_uuid = config->module_uuid;
+  ESP_LOGI(TAG, "Module initialized with UUID: %s", module_uuid);
+  if (RegisterMissingPeripherals() != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Fatal, failed to register the peripherals");
+    ConfigCommit(); // Keep what was registered so far
+    return;
+  }
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    ESP_LOGI(TAG, "Peripheral %s #%" PRIu32 " with ID: %" PRIu32, peripheral_table[i].driver->p_type, PeripheralInstance(i),
+             config->peripheral_ids[i]);
+    peripherals[i].id = config->peripheral_ids[i];
+    peripherals[i].p_type = peripheral_table[i].driver->p_type;
+    peripherals[i].desc = &peripheral_table[i];
+  }
+  LoadReportPolicies();
+  ControlInit(&irrigation);
+  if (config->has_control_policy)
+  {
+    ControlSetPolicy(&irrigation, &config->control_policy);
+  }
+  server_valve_state = config->server_valve_state; // The retained state replayed after this boot is no new command
+  // Registrations made above are saved in one write
+  if (ConfigCommit() != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to save the module registration, it will be repeated on the next boot");
+  }
+  if (ReadingStoreInit() != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Reading store unavailable, readings taken while offline will be lost");
+  }
+  InitializePeripheralsPinSets(); // Initialize peripherals pinset
+  const int64_t now_us = ModuleTimeUs();
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    const struct schedule_config *schedule = &peripheral_table[i].driver->default_schedule;
+    ScheduleInit(&peripherals[i].schedule, schedule->sample_period_s, schedule->upload_period_s, schedule->adaptive, now_us);
+  }
+#if MODULE_DEEP_SLEEP
+  // Duty-cycled: a push channel would not stay connected, and ModuleInit runs the cycles itself
+  snprintf(retained_uuid, sizeof(retained_uuid), "%s", module_uuid);
+  context_magic = MODULE_CONTEXT_MAGIC;
+#else
+  struct push_subscription subscriptions[3 * N_PERIPHERALS + 1];
+  size_t n_subscriptions = 0;
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    subscriptions[n_subscriptions++] = (struct push_subscription){.peripheral_id = peripherals[i].id, .topic = PUSH_TOPIC_SCHEDULE};
+    subscriptions[n_subscriptions++] = (struct push_subscription){.peripheral_id = peripherals[i].id, .topic = PUSH_TOPIC_REPORT};
+    // Actuator commands are pushed as soon as they are issued, polling only covers the time the channel is down
+    if (peripheral_table[i].driver->actuate != NULL)
     {
-      ESP_LOGE(TAG, "Failed to save module UUID to NVS: %s", esp_err_to_name(ret));
-      return;
+      subscriptions[n_subscriptions++] = (struct push_subscription){.peripheral_id = peripherals[i].id, .topic = PUSH_TOPIC_STATE};
+    }
+    if (i == CONTROL_ACTUATOR)
+    {
+      subscriptions[n_subscriptions++] = (struct push_subscription){.peripheral_id = peripherals[i].id, .topic = PUSH_TOPIC_CONTROL};
     }
   }
-  ESP_LOGI(TAG, "Module initialized with UUID: %s", module_uuid);
-  for (size_t i = 0; i < N_PERIPHERAL_TYPES; i++)
+  if (PushClientStart(module_uuid, subscriptions, n_subscriptions, OnPushedMessage) != ESP_OK)
   {
-    uint32_t peripheral_id = -1;
-    const char *p_type = peripheral_type[i];
-    ret = nvs_get_u32(https_nvs_handle, p_type, &peripheral_id);
-    if (ret == ESP_ERR_NVS_NOT_FOUND || peripheral_id == -1)
+    ESP_LOGW(TAG, "Push channel unavailable, the actuator states will be polled and the default periods used");
+  }
+  InitPollingTask(); // Set up the polling task
+#endif
+}
+
+/**
+ * @brief Registers every peripheral the configuration has no id for, all of them in a single request.
+ * Falls back to one request per peripheral if the server has no bulk registration endpoint (404 or 405, an older
+ * server).
+ * Peripherals sharing a type are told apart by their instance, their position among the table entries of that type.
+ * The ids are only set in the configuration, the caller commits them.
+ *
+ * @return esp_err_t ESP_OK once every peripheral has an id, ESP_ERR_NOT_SUPPORTED if the server handed out the
+ * same id twice (it does not know about instances), otherwise an error code.
+ */
+static esp_err_t RegisterMissingPeripherals()
+{
+  const struct module_config *config = ConfigGet();
+  const char *missing_types[N_PERIPHERALS];
+  uint32_t missing_instances[N_PERIPHERALS];
+  size_t missing_index[N_PERIPHERALS];
+  size_t n_missing = 0;
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    if (config->peripheral_ids[i] == CONFIG_NO_PERIPHERAL_ID)
     {
-      // If the peripheral ID is not found or is -1, we need to register it
-      ESP_LOGI(TAG, "Peripheral %s not found in NVS, registering...", p_type);
-      peripheral_id = RegisterPeripheral(module_uuid, p_type);
-      if (peripheral_id < 0)
-      {
-        ESP_LOGE(TAG, "Fatal, failed to register peripheral %s", p_type);
-        return;
-      }
-      ret = nvs_set_u32(https_nvs_handle, p_type, peripheral_id);
-      if (ret != ESP_OK)
+      missing_index[n_missing] = i;
+      missing_instances[n_missing] = PeripheralInstance(i);
+      missing_types[n_missing++] = peripheral_table[i].driver->p_type;
+    }
+  }
+  if (n_missing == 0)
+  {
+    return ESP_OK;
+  }
+  ESP_LOGI(TAG, "%zu peripherals not found in NVS, registering...", n_missing);
+  uint32_t ids[N_PERIPHERALS];
+  esp_err_t err = RegisterPeripherals(module_uuid, missing_types, missing_instances, n_missing, ids);
+  if (err == ESP_OK)
+  {
+    for (size_t i = 0; i < n_missing; i++)
+    {
+      err = SetRegisteredId(missing_index[i], ids[i]);
+      if (err != ESP_OK)
       {
-        ESP_LOGE(TAG, "Failed to save peripheral ID for %s: %s", p_type, esp_err_to_name(ret));
-        return;
+        return err;
       }
     }
-    ESP_LOGI(TAG, "Peripheral %s with ID: %ld", p_type, peripheral_id);
-    peripherals[i].id = peripheral_id;
-    peripherals[i].p_type = p_type;
+    return ESP_OK;
   }
-  ESP_ERROR_CHECK(nvs_commit(https_nvs_handle)); // Commit changes to NVS
-  nvs_close(https_nvs_handle);
-  InitializePeripheralsPinSets(); // Initialize peripherals pinset
-  InitPollingTask();              // Set up the polling task
+  // Only a server without the bulk endpoint is worth the fallback, any other failure would hit it too
+  const int status = GetLastHttpStatus();
+  if (err != ESP_ERR_INVALID_RESPONSE || (status != 404 && status != 405))
+  {
+    return err;
+  }
+  ESP_LOGW(TAG, "Bulk registration not supported (HTTP %d), registering the peripherals one by one", status);
+  for (size_t i = 0; i < n_missing; i++)
+  {
+    err = RegisterPeripheral(module_uuid, missing_types[i], missing_instances[i], &ids[i]);
+    if (err == ESP_OK)
+    {
+      err = SetRegisteredId(missing_index[i], ids[i]);
+    }
+    if (err != ESP_OK)
+    {
+      return err;
+    }
+  }
+  return ESP_OK;
+}
+
+/**
+ * @brief Sets the id the server registered a peripheral with, unless another peripheral already has it.
+ *
+ * @param index Position of the peripheral in the table.
+ * @param peripheral_id The registered id.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the id is already taken.
+ */
+static esp_err_t SetRegisteredId(const size_t index, const uint32_t peripheral_id)
+{
+  const struct module_config *config = ConfigGet();
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    if (i != index && config->peripheral_ids[i] == peripheral_id)
+    {
+      ESP_LOGE(TAG, "Server registered %s #%" PRIu32 " with the id of another peripheral, it does not support instances",
+               peripheral_table[index].driver->p_type, PeripheralInstance(index));
+      return ESP_ERR_NOT_SUPPORTED;
+    }
+  }
+  ConfigSetPeripheralId(index, peripheral_id);
+  return ESP_OK;
+}
+
+/**
+ * @brief Position of a peripheral among the table entries with the same driver, 0 for the first one.
+ *
+ * @param index Position of the peripheral in the table.
+ * @return uint32_t The instance.
+ */
+static uint32_t PeripheralInstance(const size_t index)
+{
+  uint32_t instance = 0;
+  for (size_t i = 0; i < index; i++)
+  {
+    if (peripheral_table[i].driver == peripheral_table[index].driver)
+    {
+      instance++;
+    }
+  }
+  return instance;
 }
 
 /**
- * @brief Setups the polling task for the module, main functionality to update periodically the state of the module.
+ * @brief Setups the polling tasks for the module, main functionality to update periodically the state of the module.
  *  This function is intended to be called during the module initialization phase.
- *  It will set up a task that periodically checks the module state and sends updates to the server.
+ *  It creates a sampler task that serves the peripherals that are due, an uplink task that performs every HTTPS request
+ *  on its behalf, and a one-shot timer that only wakes the sampler up at the next deadline, so the blocking ADC reads
+ *  and HTTPS requests never run on the shared esp_timer task. On dual-core boards the two tasks run on different cores
+ *  (see TaskLayout.h), sampling goes on while an upload waits on the network.
  *
  */
 static void InitPollingTask()
 {
-  ESP_LOGI(TAG, "Setting up polling task...");
-  const esp_timer_create_args_t periodicTimerArgs = {
-      .callback = &UpdateModuleState,
-      .name = "PeriodicUpdateTimer"};
-  esp_timer_handle_t timerHandler;
-  ESP_ERROR_CHECK(esp_timer_create(&periodicTimerArgs, &timerHandler));
-  ESP_ERROR_CHECK(esp_timer_start_periodic(timerHandler, MINUTES_TO_MICROSECONDS(1))); // Update every minute
-  ESP_LOGI(TAG, "Started timers, time since boot: %lld us", esp_timer_get_time());
+  ESP_LOGI(TAG, "Setting up polling tasks...");
+  const esp_timer_create_args_t wakeupTimerArgs = {
+      .callback = &WakeupTimerCallback,
+      .name = "ModuleWakeupTimer"};
+  ESP_ERROR_CHECK(esp_timer_create(&wakeupTimerArgs, &wakeup_timer));
+  uplink_queue = xQueueCreate(UPLINK_QUEUE_LENGTH, sizeof(struct peripheral_data));
+  if (uplink_queue == NULL ||
+      xTaskCreatePinnedToCore(ModuleUplinkTask, "module_uplink", UPLINK_TASK_STACK_SIZE, NULL,
+                              UPLINK_TASK_PRIORITY, &uplink_handle, UPLINK_TASK_CORE) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create module uplink task");
+    return;
+  }
+  if (xTaskCreatePinnedToCore(ModuleSamplerTask, "module_sampler", SAMPLER_TASK_STACK_SIZE, NULL,
+                              SAMPLER_TASK_PRIORITY, &sampler_handle, SAMPLER_TASK_CORE) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create module sampler task");
+    return;
+  }
+  xTaskNotifyGive(sampler_handle); // Every peripheral is due right away
+  ESP_LOGI(TAG, "Started sampler on core %d and uplink on core %d, time since boot: %" PRId64 " us",
+           SAMPLER_TASK_CORE, UPLINK_TASK_CORE, esp_timer_get_time());
 }
+
 /**
- * @brief This function is intended to update the module state.
- * Used to send periodic updates or status checks to the server regarding the module.
- * Implementation details will depend on the specific requirements of the module.
+ * @brief Wakeup timer callback, runs on the esp_timer task. It only notifies the sampler.
  *
+ * @param arg Unused.
  */
-static void UpdateModuleState()
+static void WakeupTimerCallback(void *arg)
 {
-  ESP_LOGI(TAG, "Updating module state...");
-  for (size_t i = 0; i < N_PERIPHERAL_TYPES; i++)
+  xTaskNotifyGive(sampler_handle);
+}
+
+/**
+ * @brief Sampler task: every wakeup serves all the peripherals that are due (or about to be) and hands the
+ * readings to upload over to the uplink, then sleeps until the earliest deadline of any peripheral.
+ * Each wakeup is measured as a "sample".
+ *
+ * @param arg Unused.
+ */
+static void ModuleSamplerTask(void *arg)
+{
+  struct cycle_metrics_run run;
+  for (;;)
   {
-    double data = 0.0;
-    switch (i)
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    CycleMetricsBegin(&run);
+    ApplyPushedSchedules();
+    UpdateModuleState(ModuleTimeUs());
+    CycleMetricsEnd(&run, "sample", NULL);
+    ArmWakeupTimer();
+  }
+}
+
+/**
+ * @brief Uplink task: saves newly pushed irrigation and report policies, uploads the readings handed over by the sampler, in
+ * batches, then polls the actuator states if the sampler asked for it and publishes the diagnostics when they are
+ * due. Each run is measured as an "upload".
+ *
+ * @param arg Unused.
+ */
+static void ModuleUplinkTask(void *arg)
+{
+  struct cycle_metrics_run run;
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    SaveControlPolicy();
+    SaveReportPolicies();
+    CycleMetricsBegin(&run);
+    size_t n_readings;
+    while ((n_readings = ReceiveHandedOverReadings(uplink_batch, MAX_BATCH_READINGS)) > 0)
     {
-    case 0: // Hygrometer
-      double humidity = GetHygrometerValue();
-      if (humidity < 0.0f)
-      {
-        ESP_LOGE(TAG, "Failed to read hygrometer value.");
-        continue; // Skip this peripheral if reading failed
-      }
-      data = round(humidity * 100.0) / 100.0; // Round to 2 decimal places
-      ESP_LOGI(TAG, "Hygrometer Humidity: %f", data);
-      break;
-    case 1: // Thermometer
+      UploadReadings(uplink_batch, n_readings);
+    }
+    if (__atomic_exchange_n(&actuator_poll_requested, false, __ATOMIC_RELAXED))
+    {
+      PollActuatorStates();
+    }
+    CycleMetricsEnd(&run, "upload", NULL);
+    PublishDiagnostics(ModuleTimeUs());
+  }
+}
 
-      double temperature = GetThermometerValue();
-      if (temperature < 0.0f)
-      {
-        ESP_LOGE(TAG, "Failed to read thermometer value.");
-        continue; // Skip this peripheral if reading failed
-      }
-      data = round(temperature * 100.0) / 100.0; // Round to 2 decimal places
-      ESP_LOGI(TAG, "Thermometer Temperature: %f", data);
-      break;
-    case 2: // Valve
+/**
+ * @brief Takes the readings handed over by the sampler off the uplink queue, without waiting.
+ *
+ * @param readings Output, the readings.
+ * @param max_readings Size of readings.
+ * @return size_t Number of readings taken, 0 once the queue is empty.
+ */
+static size_t ReceiveHandedOverReadings(struct peripheral_data *readings, const size_t max_readings)
+{
+  size_t n = 0;
+  while (n < max_readings && xQueueReceive(uplink_queue, &readings[n], 0) == pdTRUE)
+  {
+    n++;
+  }
+  return n;
+}
 
-      const char *state = GetPeripheralState(peripherals[i].id); // Get the current state of the valve
-      if (state == NULL)
-      {
-        ESP_LOGE(TAG, "Failed to get valve state.");
-        continue; // Skip this peripheral if reading failed
-      }
-      if (strcmp(state, "off") == 0)
-      {
-        SetValveState(0);
-      }
-      else if (strcmp(state, "on") == 0)
+/**
+ * @brief Duty-cycled mode: serves the peripherals that are due, then deep sleeps until the next deadline.
+ * Waits too short to be worth a wakeup boot are spent awake. Does not return.
+ *
+ */
+static void RunDutyCycle()
+{
+  struct cycle_metrics_run run;
+  for (;;)
+  {
+    CycleMetricsBegin(&run);
+    UpdateModuleState(ModuleTimeUs()); // No uplink task in this mode, uploads are performed in place
+    CycleMetricsEnd(&run, "update", NULL);
+    SaveControlPolicy(); // A polled state that changed
+    PublishDiagnostics(ModuleTimeUs());
+    const int64_t delay_us = NextDeadlineUs() - ModuleTimeUs();
+    if (delay_us >= DEEP_SLEEP_MIN_US)
+    {
+      EnterDeepSleep(delay_us);
+    }
+    if (delay_us > 0)
+    {
+      vTaskDelay(pdMS_TO_TICKS(delay_us / 1000) + 1);
+    }
+  }
+}
+
+/**
+ * @brief Uploads the runtime stats as a diagnostics record every DIAGNOSTICS_PERIOD_US. Only runs right after
+ * a cycle, the radio is already up then, and never wakes the module on its own.
+ *
+ * @param now_us Current ModuleTimeUs time.
+ */
+static void PublishDiagnostics(const int64_t now_us)
+{
+  if (now_us < next_diagnostics_us)
+  {
+    return;
+  }
+  RuntimeStatsCollect(&diagnostics, &diagnostics_cpu);
+  RuntimeStatsLog(&diagnostics);
+  if (RuntimeStatsEncode(diagnostics_record, sizeof(diagnostics_record), module_uuid, &diagnostics) < 0)
+  {
+    ESP_LOGE(TAG, "Diagnostics record does not fit in its buffer");
+  }
+  else if (PostModuleDiagnostics(diagnostics_record) != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Failed to upload the diagnostics record");
+  }
+  next_diagnostics_us = now_us + DIAGNOSTICS_PERIOD_US; // A failed record is not retried before the next period
+}
+
+/**
+ * @brief Enters deep sleep until the given delay expires, keeping the valve output latched meanwhile.
+ * The wakeup boots again and, through ModuleCanResume, takes the fast path.
+ *
+ * @param delay_us Time to sleep.
+ */
+static void EnterDeepSleep(const int64_t delay_us)
+{
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    if (peripheral_table[i].driver->hold != NULL)
+    {
+      peripheral_table[i].driver->hold(&peripheral_table[i]);
+    }
+  }
+  gpio_deep_sleep_hold_en();
+  clock_offset_us += esp_timer_get_time() + delay_us;
+  ESP_ERROR_CHECK(esp_sleep_enable_timer_wakeup(delay_us));
+  ESP_LOGI(TAG, "Entering deep sleep for %" PRId64 " ms", delay_us / 1000);
+  esp_deep_sleep_start();
+}
+
+/**
+ * @brief Returns the earliest sample or upload deadline of all peripherals.
+ *
+ * @return int64_t The deadline, in ModuleTimeUs time.
+ */
+static int64_t NextDeadlineUs()
+{
+  int64_t next_us = INT64_MAX;
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    const int64_t deadline_us = ScheduleNextDeadline(&peripherals[i].schedule);
+    if (deadline_us < next_us)
+    {
+      next_us = deadline_us;
+    }
+  }
+  return next_us;
+}
+
+/**
+ * @brief Arms the wakeup timer for the earliest sample or upload deadline of all peripherals.
+ *
+ */
+static void ArmWakeupTimer()
+{
+  int64_t delay_us = NextDeadlineUs() - ModuleTimeUs();
+  if (delay_us < MIN_WAKEUP_DELAY_US)
+  {
+    delay_us = MIN_WAKEUP_DELAY_US;
+  }
+  esp_timer_stop(wakeup_timer); // Still armed when the sampler was woken up early by a pushed schedule
+  ESP_ERROR_CHECK(esp_timer_start_once(wakeup_timer, delay_us));
+  ESP_LOGD(TAG, "Next wakeup in %" PRId64 " ms", delay_us / 1000);
+}
+
+/**
+ * @brief Applies the periods and report policies pushed by the server since the last wakeup.
+ *
+ */
+static void ApplyPushedSchedules()
+{
+  const int64_t now_us = ModuleTimeUs();
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    taskENTER_CRITICAL(&schedule_lock);
+    const bool pushed = schedule_pushed[i];
+    const struct schedule_config config = pushed_schedule[i];
+    const bool policy_pushed = report_policy_pushed[i];
+    const struct report_policy policy = pushed_report_policy[i];
+    schedule_pushed[i] = false;
+    report_policy_pushed[i] = false;
+    taskEXIT_CRITICAL(&schedule_lock);
+    if (pushed)
+    {
+      ScheduleSetPeriods(&peripherals[i].schedule, config.sample_period_s, config.upload_period_s, now_us);
+      ESP_LOGI(TAG, "Peripheral %s now sampled every %" PRIu32 " s, uploaded every %" PRIu32 " s",
+               peripherals[i].p_type, config.sample_period_s, config.upload_period_s);
+    }
+    if (policy_pushed)
+    {
+      peripherals[i].policy = policy;
+      ESP_LOGI(TAG, "Peripheral %s now reports changes over %.3f, heartbeat %" PRIu32 " s",
+               peripherals[i].p_type, policy.deadband, policy.heartbeat_s);
+    }
+  }
+}
+
+/**
+ * @brief Samples the peripherals that are due, steps the irrigation loop, queues the readings worth reporting and
+ * uploads the queue once any of them reaches its upload deadline, so one connection serves every peripheral.
+ * The upload itself is left to the uplink task when there is one.
+ *
+ * @param now_us Time since boot of this wakeup.
+ */
+static void UpdateModuleState(const int64_t now_us)
+{
+  ESP_LOGI(TAG, "Updating module state...");
+  const int64_t cycle_start_us = TRACE_NOW();
+  const time_t now = time(NULL);
+  const int64_t timestamp = (now >= MIN_VALID_UNIX_TIME) ? (int64_t)now : 0;
+  // Analog peripherals share a single ADC scan, taken once for all the channels as soon as one of them is due
+  bool adc_due = false;
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    adc_due = adc_due || (peripherals[i].adc_slot >= 0 && ScheduleSampleDue(&peripherals[i].schedule, now_us));
+  }
+  if (adc_due)
+  {
+    const int64_t adc_start_us = TRACE_NOW();
+    if (AdcSamplerScan(adc_millivolts) != ESP_OK)
+    {
+      ESP_LOGW(TAG, "ADC scan incomplete, some readings will be skipped.");
+    }
+    TRACE_SPAN(TRACE_PHASE_ADC, adc_start_us);
+  }
+  bool upload_due = false;
+  double moisture = NAN; // Input of the irrigation loop, only set when its hygrometer was sampled
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    struct peripheral *p = &peripherals[i];
+    if (ScheduleSampleDue(&p->schedule, now_us))
+    {
+      double data = 0.0;
+      if (!SamplePeripheral(p, &data))
       {
-        SetValveState(1);
+        ScheduleOnMissedSample(&p->schedule, now_us);
       }
       else
       {
-        ESP_LOGE(TAG, "Invalid valve state received: %s", state);
-        free((void *)state); // Free the state string if it was dynamically allocated
-        continue;            // Skip this peripheral if the state is invalid
+        moisture = (i == CONTROL_SENSOR) ? data : moisture;
+        ScheduleOnSample(&p->schedule, data, p->policy.deadband, now_us);
+        if (ShouldReport(p, data, now_us))
+        {
+          QueueReading(p, data, timestamp, now_us);
+        }
       }
-      int valve_state = GetValveState();
-      free((void *)state);        // Free the state string after use
-      data = (double)valve_state; // Convert valve state to double for consistency
-      break;
-    // Case 3: Other
-    // This case is not implemented, but you can add your logic here if needed.
-    default:
-      continue; // Skip if the peripheral type is not recognized
-      break;
     }
-    ESP_ERROR_CHECK(PostPeripheralData(peripherals[i].id, data));
+    upload_due = upload_due || ScheduleUploadDue(&p->schedule, now_us);
   }
-
+  RunIrrigationControl(moisture, timestamp, now_us);
+  if (upload_due)
+  {
+    UploadPendingReadings();
+  }
+  TRACE_SPAN(TRACE_PHASE_CYCLE, cycle_start_us);
   ESP_LOGI(TAG, "Module state updated successfully.");
 }
 
-static void InitializePeripheralsPinSets()
+/**
+ * @brief Takes a new value of a peripheral through its driver. An actuator is polled for the state the server
+ * wants first, when the push channel is down.
+ *
+ * @param p The peripheral.
+ * @param data Output, the value as reported to the server.
+ * @return true on success, false if the peripheral could not be read.
+ */
+static bool SamplePeripheral(const struct peripheral *p, double *data)
 {
+  const struct peripheral_driver *driver = p->desc->driver;
+  if (driver->actuate != NULL && !PushClientIsConnected()) // Pushed states are already applied
+  {
+    if (uplink_handle != NULL)
+    {
+      // The sampler does not wait on the network, a polled change is reported by the next sample
+      __atomic_store_n(&actuator_poll_requested, true, __ATOMIC_RELAXED);
+      xTaskNotifyGive(uplink_handle);
+    }
+    else if (PollActuatorState(p) != ESP_OK)
+    {
+      return false;
+    }
+  }
+  const int millivolts = (p->adc_slot >= 0) ? adc_millivolts[p->adc_slot] : -1;
+  if (!driver->read(p->desc, millivolts, data))
+  {
+    ESP_LOGE(TAG, "Failed to read %s value.", p->p_type);
+    return false;
+  }
+  if (driver->encode != NULL)
+  {
+    *data = driver->encode(*data);
+  }
+  return true;
+}
 
-  ESP_LOGI(TAG, "Initializing peripherals...");
-  // ADC1 INIT//
-  adc_oneshot_unit_init_cfg_t init_config = {
-      .unit_id = ADC_UNIT_1, // Use ADC1
-  };
-  ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config, &adc1_handle));
-  /// END INIT ADC1 //
-  /// ADC1 CHANNEL CONFIGURATION ///
-  adc_oneshot_chan_cfg_t adc1_config = {
-      .atten = ADC_ATTEN_DB_12,    // Set attenuation to 12dB for 0-3.3V range
-      .bitwidth = ADC_BITWIDTH_12, // Set bitwidth to 12 bits
-  };
-
-  for (size_t i = 0; i < N_PERIPHERAL_TYPES; i++)
-  {
-    switch (i)
-    {
-    case 0: // Hygrometer
-      ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, HYGROMETER_ADC_CHANNEL, &adc1_config));
-      break;
-    case 1: // Thermometer
-      ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, THERMOMETER_ADC_CHANNEL, &adc1_config));
-      break;
-    case 2:                                                                        // Valve
-      ESP_ERROR_CHECK(gpio_set_direction(VALVE_GPIO_PIN, GPIO_MODE_INPUT_OUTPUT)); // Set GPIO13 as output for valve control
-      break;
-    case 3: // Other
-      // NOT IMPLEMENTED
-      ESP_LOGW(TAG, "Peripheral type 'other' is not implemented yet.");
+/**
+ * @brief Adds a reading to the upload queue. A full queue is uploaded right away.
+ *
+ * @param p The peripheral the reading belongs to.
+ * @param data The value.
+ * @param timestamp Unix time of the reading, 0 if unknown.
+ * @param now_us Time since boot of the reading.
+ */
+static void QueueReading(struct peripheral *p, const double data, const int64_t timestamp, const int64_t now_us)
+{
+  if (n_pending_readings == MAX_BATCH_READINGS)
+  {
+    UploadPendingReadings();
+  }
+  // A failed upload goes to the store, so the value counts as reported either way
+  p->reported = true;
+  p->last_reported_value = data;
+  p->last_reported_us = now_us;
+  pending_readings[n_pending_readings].peripheral_id = p->id;
+  pending_readings[n_pending_readings].value = data;
+  pending_readings[n_pending_readings].timestamp = timestamp;
+  n_pending_readings++;
+  ScheduleOnReading(&p->schedule, now_us);
+}
+
+/**
+ * @brief Uploads the queued readings. They are handed over to the uplink task when there is one, otherwise uploaded
+ * in place. The sampler never waits on the uplink: readings it has no room for (an upload stuck on the network)
+ * go straight to the store, and are drained after the next successful upload.
+ *
+ */
+static void UploadPendingReadings()
+{
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    ScheduleOnUpload(&peripherals[i].schedule);
+  }
+  if (n_pending_readings == 0)
+  {
+    return;
+  }
+  if (uplink_handle == NULL)
+  {
+    UploadReadings(pending_readings, n_pending_readings);
+  }
+  else
+  {
+    size_t n_handed_over = 0;
+    while (n_handed_over < n_pending_readings && xQueueSend(uplink_queue, &pending_readings[n_handed_over], 0) == pdTRUE)
+    {
+      n_handed_over++;
+    }
+    if (n_handed_over < n_pending_readings)
+    {
+      ESP_LOGW(TAG, "Uplink queue full, keeping %zu readings in the store", n_pending_readings - n_handed_over);
+      ReadingStoreAppend(&pending_readings[n_handed_over], n_pending_readings - n_handed_over);
     }
+    xTaskNotifyGive(uplink_handle);
   }
-  ESP_LOGI(TAG, "Peripherals initialized successfully.");
+  n_pending_readings = 0;
 }
 
 /**
- * @brief Reads the hygrometer value from the ADC and converts it to a humidity percentage.
+ * @brief Uploads readings in one batch, keeping them in the store if the upload fails and dropping them if the
+ * server rejects them. After a successful upload the readings stored while offline are drained too.
  *
- * @return double The humidity percentage, or -1.0f on error.
+ * @param readings The readings.
+ * @param n_readings Number of readings, up to MAX_BATCH_READINGS.
  */
-double GetHygrometerValue()
+static void UploadReadings(const struct peripheral_data *readings, const size_t n_readings)
 {
-  int raw_adc_reading = -1;
-  ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, HYGROMETER_ADC_CHANNEL, &raw_adc_reading));
-  if (raw_adc_reading < 0)
+  const esp_err_t err = PostPeripheralDataBatch(readings, n_readings);
+  if (IsRejectedByServer(err))
   {
-    ESP_LOGE(TAG, "Failed to read ADC value for hygrometer");
-    return -1.0f; // Return an error value
+    ESP_LOGE(TAG, "Server rejected %zu readings (HTTP %d), dropping them", n_readings, GetLastHttpStatus());
+    return;
   }
-  double humidity = (1.0 - (raw_adc_reading / 4095.0)); // Convert ADC reading to voltage
-  ESP_LOGI(TAG, "Hygrometer Humidity: %.2f", humidity);
-  return humidity;
+  if (err != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Upload failed, keeping %zu readings in the store", n_readings);
+    ReadingStoreAppend(readings, n_readings);
+    return;
+  }
+  CycleMetricsUploadDone();
+  DrainStoredReadings(); // Heartbeats guarantee an upload every now and then, even when nothing changes
+  UploadControlEvents();
 }
 
 /**
- * @brief Reads the thermometer value from the ADC and converts it to a temperature in Celsius.
+ * @brief Steps the irrigation loop. Runs on the sampler, which owns the valve: the policy and the command handed
+ * over by the server are applied first, then the loop drives the valve from the moisture just sampled.
+ * The policy is saved by the uplink, the sampler never writes to flash.
+ * Every action is logged for upload. A switch made here is reported by the next sample of the valve.
  *
- * @return double The temperature in Celsius, or -1.0 on error.
+ * @param moisture Reading of the loop hygrometer taken this cycle, NAN if it was not sampled.
+ * @param timestamp Unix time of the cycle, 0 if unknown.
+ * @param now_us Time since boot of the cycle.
  */
-double GetThermometerValue()
+static void RunIrrigationControl(const double moisture, const int64_t timestamp, const int64_t now_us)
 {
-  int raw_adc_reading = -1;
-  ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, THERMOMETER_ADC_CHANNEL, &raw_adc_reading));
-  if (raw_adc_reading < 0)
+  taskENTER_CRITICAL(&schedule_lock);
+  int command = pushed_command;
+  const bool repeated = pushed_command_repeated;
+  const bool policy_pushed = control_policy_pushed;
+  const struct control_policy policy = pushed_control_policy;
+  pushed_command = CONTROL_NO_COMMAND;
+  pushed_command_repeated = false;
+  control_policy_pushed = false;
+  taskEXIT_CRITICAL(&schedule_lock);
+  if (policy_pushed)
+  {
+    ControlSetPolicy(&irrigation, &policy);
+    ESP_LOGI(TAG, "Irrigation loop opens the valve under %.2f and closes it over %.2f", policy.on_below, policy.off_above);
+  }
+  if (repeated && irrigation.configured)
   {
-    ESP_LOGE(TAG, "Failed to read ADC value for thermometer");
-    return -1.0f; // Return an error value
+    command = CONTROL_NO_COMMAND; // Only a new command starts an override, the valve belongs to the loop otherwise
   }
+  const struct peripheral_desc *valve = &peripheral_table[CONTROL_ACTUATOR];
+  const int valve_state = GetValveState(valve);
+  struct control_event event;
+  const int state = ControlStep(&irrigation, command, moisture, valve_state, now_us, &event);
+  if (state >= 0 && state != valve_state)
+  {
+    SetValveState(valve, state);
+  }
+  if (event.reason == CONTROL_REASON_NONE)
+  {
+    return;
+  }
+  event.timestamp = timestamp;
+  ESP_LOGI(TAG, "Irrigation event %d, valve %d at moisture %.2f", event.reason, event.state, event.moisture);
+  if (!ControlLogAppend(&event))
+  {
+    ESP_LOGW(TAG, "Control event log full, oldest event dropped");
+  }
+}
 
-  // Convert ADC value to voltage (assuming 3.3V reference and 12-bit ADC)
-  double voltage = (raw_adc_reading / 4095.0f) * 3.3f;
+/**
+ * @brief Saves the irrigation policy and the last valve state pushed by the server to the configuration, so the loop
+ * keeps them across reboots. Runs on the uplink task (in the cycle itself in duty-cycled mode), off the sampler: the
+ * NVS write may wait on a flash erase. Nothing is written when they did not change.
+ *
+ */
+static void SaveControlPolicy()
+{
+  taskENTER_CRITICAL(&schedule_lock);
+  const bool policy_unsaved = control_policy_unsaved;
+  const struct control_policy policy = pushed_control_policy;
+  const bool state_unsaved = server_valve_state_unsaved;
+  const int state = server_valve_state;
+  control_policy_unsaved = false;
+  server_valve_state_unsaved = false;
+  taskEXIT_CRITICAL(&schedule_lock);
+  if (!policy_unsaved && !state_unsaved)
+  {
+    return;
+  }
+  if (policy_unsaved)
+  {
+    ConfigSetControlPolicy(&policy);
+  }
+  if (state_unsaved)
+  {
+    ConfigSetServerValveState(state);
+  }
+  if (ConfigCommit() != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to save the irrigation policy, it only lasts until the next boot");
+  }
+}
 
-  // For a BC547 used as a temperature sensor, you typically use Vbe drop:
-  // Vbe decreases by about -2mV/°C, assuming that Vbe at 25°C is about 0.660V.
-  // T(°C) = 25 - ((Vbe - 0.660) / 0.002)
+/**
+ * @brief Uploads the actions of the irrigation loop, oldest first and in batches, with the number of events the
+ * full log dropped. Runs after a successful reading upload, while the connection is up; events that fail to upload
+ * wait for the next one.
+ *
+ */
+static void UploadControlEvents()
+{
+  for (size_t i = 0; i < CONTROL_LOG_CAPACITY / MAX_BATCH_EVENTS; i++)
+  {
+    struct control_log_batch batch;
+    const size_t n_events = ControlLogPeek(control_batch, MAX_BATCH_EVENTS, &batch);
+    if (n_events == 0)
+    {
+      return;
+    }
+    if (PostControlEvents(peripherals[CONTROL_ACTUATOR].id, control_batch, n_events, batch.dropped) != ESP_OK)
+    {
+      ESP_LOGW(TAG, "Failed to upload %zu control events, keeping them for the next upload", n_events);
+      return;
+    }
+    ControlLogConsume(&batch, n_events);
+  }
+}
 
-  double vbe = voltage; // If direct, else adjust for divider
-  double temperature_c = 25.0 - ((vbe - 0.660) / 0.002);
+/**
+ * @brief Change detection: a value is only worth uploading when it moved past the deadband of its
+ * peripheral since the last report, or when the heartbeat of that peripheral expired.
+ *
+ * @param p The peripheral the value belongs to.
+ * @param value The new value.
+ * @param now_us Time since boot of the cycle the value was sampled in.
+ * @return true if the value has to be reported.
+ */
+static bool ShouldReport(const struct peripheral *p, const double value, const int64_t now_us)
+{
+  if (!p->reported)
+  {
+    return true;
+  }
+  if (fabs(value - p->last_reported_value) > p->policy.deadband)
+  {
+    return true;
+  }
+  return (now_us - p->last_reported_us) >= (int64_t)p->policy.heartbeat_s * 1000000;
+}
 
-  ESP_LOGI(TAG, "Temperature: %.2f °C", temperature_c);
-  return temperature_c;
+/**
+ * @brief Loads the report policies from the configuration, falling back to the defaults when none were saved.
+ *
+ */
+static void LoadReportPolicies()
+{
+  const struct module_config *config = ConfigGet();
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    // A saved policy always has a heartbeat, an empty one belongs to a peripheral added after the policies were saved
+    const struct report_policy *saved = &config->report_policies[i];
+    peripherals[i].policy = (config->has_report_policies && saved->heartbeat_s > 0) ? *saved : peripheral_table[i].driver->default_policy;
+    pushed_report_policy[i] = peripherals[i].policy;
+    ESP_LOGI(TAG, "Peripheral %s reports changes over %.3f, heartbeat %" PRIu32 " s",
+             peripheral_table[i].driver->p_type, peripherals[i].policy.deadband, peripherals[i].policy.heartbeat_s);
+  }
 }
 
-int GetValveState()
+/**
+ * @brief Saves the report policies pushed by the server to the configuration, on the uplink task like the
+ * irrigation policy. Nothing is written when they did not change.
+ *
+ */
+static void SaveReportPolicies()
 {
-  int valve_state = gpio_get_level(VALVE_GPIO_PIN);
-  ESP_LOGI(TAG, "Valve state: %d", valve_state);
-  return valve_state;
+  struct report_policy policies[N_PERIPHERALS];
+  taskENTER_CRITICAL(&schedule_lock);
+  const bool unsaved = report_policies_unsaved;
+  memcpy(policies, pushed_report_policy, sizeof(policies));
+  report_policies_unsaved = false;
+  taskEXIT_CRITICAL(&schedule_lock);
+  if (!unsaved)
+  {
+    return;
+  }
+  ConfigSetReportPolicies(policies, N_PERIPHERALS);
+  if (ConfigCommit() != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to save the report policies, they only last until the next boot");
+  }
 }
 
-esp_err_t SetValveState(int state)
+/**
+ * @brief Tells whether the server answered a request and refused it for good: a 4xx, which the same request would
+ * get again. A transport error, a 5xx, and the 408 and 429 statuses (retry later) are worth retrying.
+ *
+ * @param err Result of the request.
+ * @return true if the request must not be retried.
+ */
+static bool IsRejectedByServer(const esp_err_t err)
 {
-  if (state != 0 && state != 1)
+  const int status = GetLastHttpStatus();
+  return err == ESP_ERR_INVALID_RESPONSE && status >= 400 && status < 500 && status != 408 && status != 429;
+}
+
+/**
+ * @brief Uploads the readings kept in the store while the server was unreachable, oldest first.
+ * Readings are only removed from the store once the server has accepted them, or rejected them for good
+ * (they would otherwise block every reading behind them).
+ *
+ */
+static void DrainStoredReadings()
+{
+  for (size_t batch = 0; batch < STORE_DRAIN_MAX_BATCHES && ReadingStorePendingCount() > 0; batch++)
+  {
+    struct reading_store_tail tail;
+    const size_t n_stored = ReadingStorePeek(drain_batch, STORE_DRAIN_BATCH_SIZE, &tail);
+    if (n_stored == 0)
+    {
+      break;
+    }
+    const esp_err_t err = PostPeripheralDataBatch(drain_batch, n_stored);
+    if (IsRejectedByServer(err))
+    {
+      ESP_LOGE(TAG, "Server rejected %zu stored readings (HTTP %d), dropping them", n_stored, GetLastHttpStatus());
+    }
+    else if (err != ESP_OK)
+    {
+      ESP_LOGW(TAG, "Failed to upload stored readings, %zu still pending", ReadingStorePendingCount());
+      return;
+    }
+    // The sampler may have overflowed the ring meanwhile, the batch is then left pending and peeked again
+    ReadingStoreConsume(&tail, n_stored);
+  }
+  if (ReadingStorePendingCount() > 0)
+  {
+    ESP_LOGI(TAG, "%zu stored readings left for the next cycle", ReadingStorePendingCount());
+  }
+}
+
+/**
+ * @brief Initializes every peripheral of the table through its driver. The ADC1 channels of the analog ones are
+ * gathered into a single sampler, scanned in one pass however many there are.
+ *
+ */
+static void InitializePeripheralsPinSets()
+{
+  ESP_LOGI(TAG, "Initializing peripherals...");
+  n_adc_channels = 0;
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    const struct peripheral_desc *desc = &peripheral_table[i];
+    peripherals[i].adc_slot = -1;
+    if (desc->driver->analog && n_adc_channels < ADC_SAMPLER_MAX_CHANNELS)
+    {
+      peripherals[i].adc_slot = n_adc_channels;
+      adc_channels[n_adc_channels] = desc->pin;
+      adc_millivolts[n_adc_channels++] = -1;
+    }
+    else if (desc->driver->analog)
+    {
+      ESP_LOGE(TAG, "No ADC channel left for %s, it will not be sampled", desc->driver->p_type);
+    }
+    if (desc->driver->init != NULL)
+    {
+      ESP_ERROR_CHECK(desc->driver->init(desc));
+    }
+  }
+  if (n_adc_channels > 0)
   {
-    ESP_LOGE(TAG, "Invalid valve state: %d. Must be 0 or 1.", state);
+    ESP_ERROR_CHECK(AdcSamplerInit(adc_channels, n_adc_channels));
+  }
+  ESP_LOGI(TAG, "Peripherals initialized successfully.");
+}
+
+/**
+ * @brief Fetches the state the server wants for an actuator and applies it.
+ *
+ * @param p The actuator.
+ * @return esp_err_t ESP_OK on success, otherwise an error code.
+ */
+static esp_err_t PollActuatorState(const struct peripheral *p)
+{
+  char state[PERIPHERAL_STATE_SIZE];
+  if (GetPeripheralState(p->id, state, sizeof(state)) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to get %s state.", p->p_type);
+    return ESP_FAIL;
+  }
+  return ApplyServerState(p, state, true);
+}
+
+/**
+ * @brief Applies the state the server wants for an actuator. The valve of the irrigation loop is handed over to the
+ * sampler as a command, the loop decides how long it holds; any other actuator is driven right away.
+ * Every state published by the server is a new command. A replayed one (polled, as the server answers the same state
+ * on every poll, or retained, as the broker delivers it again on every reconnect) only is when it differs from the
+ * last state the server asked for; otherwise it is a repeat, which starts no override and only drives the valve
+ * while the loop has no policy.
+ *
+ * @param p The actuator.
+ * @param state Desired state, "on" or "off".
+ * @param replayed Whether the state was polled or retained rather than freshly published.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG if the state is not recognized.
+ */
+static esp_err_t ApplyServerState(const struct peripheral *p, const char *state, const bool replayed)
+{
+  if (p != &peripherals[CONTROL_ACTUATOR])
+  {
+    return p->desc->driver->actuate(p->desc, state);
+  }
+  int command = CONTROL_NO_COMMAND;
+  if (strcmp(state, "on") == 0)
+  {
+    command = 1;
+  }
+  else if (strcmp(state, "off") == 0)
+  {
+    command = 0;
+  }
+  else
+  {
+    ESP_LOGE(TAG, "Invalid valve state received: %s", state);
     return ESP_ERR_INVALID_ARG;
   }
-  ESP_ERROR_CHECK(gpio_set_level(VALVE_GPIO_PIN, state));
-  ESP_LOGI(TAG, "Valve state set to: %d", state);
+  taskENTER_CRITICAL(&schedule_lock);
+  const bool changed = command != server_valve_state;
+  const bool repeated = replayed && !changed;
+  // A repeat never downgrades a new command the sampler has not taken yet
+  pushed_command_repeated = repeated && (pushed_command == CONTROL_NO_COMMAND || pushed_command_repeated);
+  pushed_command = command;
+  server_valve_state = command;
+  server_valve_state_unsaved = server_valve_state_unsaved || changed;
+  taskEXIT_CRITICAL(&schedule_lock);
+  if (changed && uplink_handle != NULL && xTaskGetCurrentTaskHandle() != uplink_handle)
+  {
+    xTaskNotifyGive(uplink_handle); // Saves it
+  }
+  // A repeat waits for the next cycle. Without a sampler task the poll runs in the cycle itself, which steps the
+  // loop before it ends
+  if (!repeated && sampler_handle != NULL)
+  {
+    xTaskNotifyGive(sampler_handle);
+  }
   return ESP_OK;
 }
 
-void RegisterTokenAPI(const char *token_api)
+/**
+ * @brief Polls the state the server wants for every actuator, on behalf of the sampler.
+ *
+ */
+static void PollActuatorStates()
 {
-  ESP_LOGI(TAG, "Registering token API: %s", token_api);
-  esp_err_t ret = nvs_open(TAG, NVS_READWRITE, &https_nvs_handle);
-  if (ret != ESP_OK)
+  for (size_t i = 0; i < N_PERIPHERALS; i++)
+  {
+    if (peripherals[i].desc->driver->actuate != NULL)
+    {
+      PollActuatorState(&peripherals[i]);
+    }
+  }
+}
+
+/**
+ * @brief Push channel callback, runs on the MQTT task. Desired actuator states are applied as soon as the server
+ * publishes them; new periods (e.g. {"sample_period":30,"upload_period":300}) and policies are handed over to the
+ * sampler.
+ *
+ * @param peripheral_id Peripheral the message is meant for.
+ * @param topic Kind of message.
+ * @param payload The message, null terminated.
+ * @param len Length of the message.
+ * @param retained Whether the broker replayed the message on a (re)connect.
+ */
+static void OnPushedMessage(uint32_t peripheral_id, enum push_topic topic, const char *payload, size_t len, bool retained)
+{
+  size_t i = 0;
+  while (i < N_PERIPHERALS && peripherals[i].id != peripheral_id)
+  {
+    i++;
+  }
+  if (i == N_PERIPHERALS)
   {
-    ESP_LOGE(TAG, "Failed to open NVS namespace: %s", esp_err_to_name(ret));
     return;
   }
-  ret = nvs_set_str(https_nvs_handle, "token_api", token_api);
-  if (ret != ESP_OK)
+  const struct peripheral_driver *driver = peripherals[i].desc->driver;
+  if (topic == PUSH_TOPIC_STATE && driver->actuate != NULL)
   {
-    ESP_LOGE(TAG, "Failed to save token API to NVS: %s", esp_err_to_name(ret));
-    nvs_close(https_nvs_handle);
+    ApplyServerState(&peripherals[i], payload, retained);
+    return;
+  }
+  if (topic == PUSH_TOPIC_CONTROL && i == CONTROL_ACTUATOR)
+  {
+    HandOverControlPolicy(payload, len);
+    return;
+  }
+  if (topic == PUSH_TOPIC_REPORT)
+  {
+    HandOverReportPolicy(i, payload, len);
+    return;
+  }
+  if (topic != PUSH_TOPIC_SCHEDULE)
+  {
+    return;
+  }
+  struct schedule_config config = {.adaptive = driver->default_schedule.adaptive};
+  if (SarpDecodeUint32(payload, len, "sample_period", &config.sample_period_s) != ESP_OK ||
+      SarpDecodeUint32(payload, len, "upload_period", &config.upload_period_s) != ESP_OK ||
+      config.sample_period_s == 0 || config.sample_period_s > MAX_SCHEDULE_PERIOD_S ||
+      config.upload_period_s == 0 || config.upload_period_s > MAX_SCHEDULE_PERIOD_S)
+  {
+    ESP_LOGE(TAG, "Invalid schedule received for %s: %s", peripherals[i].p_type, payload);
+    return;
+  }
+  taskENTER_CRITICAL(&schedule_lock);
+  pushed_schedule[i] = config;
+  schedule_pushed[i] = true;
+  taskEXIT_CRITICAL(&schedule_lock);
+  if (sampler_handle != NULL)
+  {
+    xTaskNotifyGive(sampler_handle); // Reschedule now rather than at the next deadline
+  }
+}
+
+/**
+ * @brief Validates the irrigation policy pushed by the server (e.g. {"on_below":0.3,"off_above":0.45,"min_on":120,
+ * "min_off":900,"override_ttl":3600}, moisture fractions and seconds) and hands it over to the sampler, which
+ * applies it, and to the uplink, which saves it. Runs on the MQTT task.
+ *
+ * @param payload The message, null terminated.
+ * @param len Length of the message.
+ */
+static void HandOverControlPolicy(const char *payload, size_t len)
+{
+  struct control_policy policy;
+  if (SarpDecodeDouble(payload, len, "on_below", &policy.on_below) != ESP_OK ||
+      SarpDecodeDouble(payload, len, "off_above", &policy.off_above) != ESP_OK ||
+      SarpDecodeUint32(payload, len, "min_on", &policy.min_on_s) != ESP_OK ||
+      SarpDecodeUint32(payload, len, "min_off", &policy.min_off_s) != ESP_OK ||
+      SarpDecodeUint32(payload, len, "override_ttl", &policy.override_ttl_s) != ESP_OK ||
+      policy.on_below < 0.0 || policy.off_above > 1.0 || policy.on_below >= policy.off_above ||
+      policy.min_on_s > MAX_SCHEDULE_PERIOD_S || policy.min_off_s > MAX_SCHEDULE_PERIOD_S ||
+      policy.override_ttl_s == 0 || policy.override_ttl_s > MAX_SCHEDULE_PERIOD_S)
+  {
+    ESP_LOGE(TAG, "Invalid irrigation policy received: %s", payload);
+    return;
+  }
+  taskENTER_CRITICAL(&schedule_lock);
+  pushed_control_policy = policy;
+  control_policy_pushed = true;
+  control_policy_unsaved = true;
+  taskEXIT_CRITICAL(&schedule_lock);
+  if (sampler_handle != NULL)
+  {
+    xTaskNotifyGive(sampler_handle);
+  }
+  if (uplink_handle != NULL)
+  {
+    xTaskNotifyGive(uplink_handle);
+  }
+}
+
+/**
+ * @brief Validates the report policy pushed by the server for a peripheral (e.g. {"deadband":0.02,"heartbeat":3600},
+ * in the units of the peripheral value and seconds) and hands it over to the sampler, which applies it, and to the
+ * uplink, which saves it. Runs on the MQTT task.
+ *
+ * @param index Position of the peripheral in the table.
+ * @param payload The message, null terminated.
+ * @param len Length of the message.
+ */
+static void HandOverReportPolicy(const size_t index, const char *payload, size_t len)
+{
+  struct report_policy policy;
+  if (SarpDecodeDouble(payload, len, "deadband", &policy.deadband) != ESP_OK ||
+      SarpDecodeUint32(payload, len, "heartbeat", &policy.heartbeat_s) != ESP_OK ||
+      !(policy.deadband >= 0.0) || policy.heartbeat_s == 0 || policy.heartbeat_s > MAX_SCHEDULE_PERIOD_S)
+  {
+    ESP_LOGE(TAG, "Invalid report policy received for %s: %s", peripherals[index].p_type, payload);
+    return;
+  }
+  taskENTER_CRITICAL(&schedule_lock);
+  pushed_report_policy[index] = policy;
+  report_policy_pushed[index] = true;
+  report_policies_unsaved = true;
+  taskEXIT_CRITICAL(&schedule_lock);
+  // Takes effect on the next sample, no need to wake the sampler
+  if (uplink_handle != NULL)
+  {
+    xTaskNotifyGive(uplink_handle);
+  }
+}
+
+void RegisterTokenAPI(const char *token_api)
+{
+  ESP_LOGI(TAG, "Registering token API: %s", token_api);
+  ConfigSetTokenApi(token_api);
+  if (ConfigCommit() != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to save token API to NVS");
     return;
   }
-  nvs_commit(https_nvs_handle); // Commit changes to NVS
   ESP_LOGI(TAG, "Token API registered successfully.");
-  nvs_close(https_nvs_handle);
-}
\ No newline at end of file
+}
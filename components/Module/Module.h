@@ -1,17 +1,56 @@
 #include "nvs_flash.h"
+#include "PushClient.h"
+#include "ConfigStore.h"
 
 #define TOKEN_SIZE 36 // Token size in bytes (UUID length)
 
+void ModuleLoadConfig();
 bool ModuleIsConfigured();
 void ModuleInit();
+bool ModuleCanResume();
+void ModuleResume();
+
+static void StartDutyCycleTask(const bool resume);
+static void ModuleDutyCycleTask(void *arg);
+static void ModuleSetup();
+static esp_err_t RegisterMissingPeripherals();
+static esp_err_t SetRegisteredId(const size_t index, const uint32_t peripheral_id);
+static uint32_t PeripheralInstance(const size_t index);
+static int64_t ModuleTimeUs();
+
+struct peripheral;
+struct peripheral_data;
 
 static void InitPollingTask();
-static void UpdateModuleState();
+static void WakeupTimerCallback(void *arg);
+static void ModuleSamplerTask(void *arg);
+static void ModuleUplinkTask(void *arg);
+static size_t ReceiveHandedOverReadings(struct peripheral_data *readings, const size_t max_readings);
+static void RunDutyCycle();
+static void PublishDiagnostics(const int64_t now_us);
+static void EnterDeepSleep(const int64_t delay_us);
+static int64_t NextDeadlineUs();
+static void ArmWakeupTimer();
+static void ApplyPushedSchedules();
+static void UpdateModuleState(const int64_t now_us);
+static bool SamplePeripheral(const struct peripheral *p, double *data);
+static void QueueReading(struct peripheral *p, const double data, const int64_t timestamp, const int64_t now_us);
+static void UploadPendingReadings();
+static void UploadReadings(const struct peripheral_data *readings, const size_t n_readings);
+static void RunIrrigationControl(const double moisture, const int64_t timestamp, const int64_t now_us);
+static void SaveControlPolicy();
+static void SaveReportPolicies();
+static void UploadControlEvents();
+static bool IsRejectedByServer(const esp_err_t err);
+static void DrainStoredReadings();
+static bool ShouldReport(const struct peripheral *p, const double value, const int64_t now_us);
+static void LoadReportPolicies();
 static void InitializePeripheralsPinSets();
-double GetHygrometerValue();
-double GetThermometerValue();
-int GetValveState();
-
-void RegisterTokenAPI(const char *token_api);
+static esp_err_t PollActuatorState(const struct peripheral *p);
+static esp_err_t ApplyServerState(const struct peripheral *p, const char *state, const bool replayed);
+static void PollActuatorStates();
+static void OnPushedMessage(uint32_t peripheral_id, enum push_topic topic, const char *payload, size_t len, bool retained);
+static void HandOverControlPolicy(const char *payload, size_t len);
+static void HandOverReportPolicy(const size_t index, const char *payload, size_t len);
 
-esp_err_t SetValveState(int state);
\ No newline at end of file
+void RegisterTokenAPI(const char *token_api);
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/adc_types.h"
+#include "driver/gpio.h"
+#include "ConfigStore.h"
+
+/**
+ * @brief Base periods of a peripheral, until the server pushes others.
+ */
+struct schedule_config
+{
+  uint32_t sample_period_s;
+  uint32_t upload_period_s;
+  bool adaptive;
+};
+
+struct peripheral_desc;
+
+/**
+ * @brief Behaviour of a kind of peripheral. Only read is mandatory; actuate makes it an actuator, whose desired
+ * state the server pushes (or the module polls while the push channel is down).
+ */
+struct peripheral_driver
+{
+  const char *p_type;                     // Type the peripheral is registered with on the server
+  bool analog;                            // Sampled through the shared ADC scan, the descriptor pin is its ADC channel
+  struct schedule_config default_schedule;
+  struct report_policy default_policy;    // Used until the server pushes a policy
+  esp_err_t (*init)(const struct peripheral_desc *desc);
+  /**
+   * @brief Reads the current value. Analog drivers get the calibrated millivolts of their channel from the
+   * ADC pass of this cycle, -1 if it is unavailable; the others get -1.
+   */
+  bool (*read)(const struct peripheral_desc *desc, const int millivolts, double *value);
+  esp_err_t (*actuate)(const struct peripheral_desc *desc, const char *state);
+  double (*encode)(const double value);   // Value reported to the server (units, rounding), the reading itself if NULL
+  void (*hold)(const struct peripheral_desc *desc); // Latches an output through deep sleep
+};
+
+/**
+ * @brief One peripheral wired to the module: its driver and where it is connected. Several peripherals can share
+ * a driver, each one is registered with its own id.
+ */
+struct peripheral_desc
+{
+  const struct peripheral_driver *driver;
+  int pin; // ADC1 channel of an analog driver, GPIO of the others
+};
+
+extern const struct peripheral_driver hygrometer_driver;
+extern const struct peripheral_driver thermometer_driver;
+extern const struct peripheral_driver valve_driver;
+
+int GetValveState(const struct peripheral_desc *desc);
+esp_err_t SetValveState(const struct peripheral_desc *desc, int state);
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include <math.h>
+#include <string.h>
+#include "PeripheralDriver.h"
+#include "AdcSampler.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+
+static const char *TAG = "Peripherals";
+
+RTC_DATA_ATTR static int valve_level = 0; // Valve output held through deep sleep
+
+/**
+ * @brief Rounds a reading to 2 decimal places, the precision the server stores.
+ */
+static double RoundToHundredths(const double value)
+{
+  return round(value * 100.0) / 100.0;
+}
+
+/**
+ * @brief Converts the hygrometer millivolts to a humidity fraction.
+ *
+ * @return true on success, false if the ADC value is unavailable or out of range.
+ */
+static bool ReadHygrometer(const struct peripheral_desc *desc, const int millivolts, double *value)
+{
+  if (millivolts < 0)
+  {
+    ESP_LOGE(TAG, "Failed to read ADC1 channel %d for hygrometer", desc->pin);
+    return false;
+  }
+  double humidity = (1.0 - ((double)millivolts / ADC_SAMPLER_FULL_SCALE_MV)); // Dry soil reads close to full scale
+  ESP_LOGI(TAG, "Hygrometer ADC1 channel %d humidity: %.2f", desc->pin, humidity);
+  if (humidity < 0.0)
+  {
+    ESP_LOGE(TAG, "Failed to read hygrometer value.");
+    return false;
+  }
+  *value = humidity;
+  return true;
+}
+
+/**
+ * @brief Converts the thermometer millivolts to a temperature in Celsius.
+ *
+ * @return true on success, false if the ADC value is unavailable or out of range.
+ */
+static bool ReadThermometer(const struct peripheral_desc *desc, const int millivolts, double *value)
+{
+  if (millivolts < 0)
+  {
+    ESP_LOGE(TAG, "Failed to read ADC1 channel %d for thermometer", desc->pin);
+    return false;
+  }
+
+  // Calibrated voltage of the sensor
+  double voltage = millivolts / 1000.0;
+
+  // For a BC547 used as a temperature sensor, you typically use Vbe drop:
+  // Vbe decreases by about -2mV/°C, assuming that Vbe at 25°C is about 0.660V.
+  // T(°C) = 25 - ((Vbe - 0.660) / 0.002)
+
+  double vbe = voltage; // If direct, else adjust for divider
+  double temperature_c = 25.0 - ((vbe - 0.660) / 0.002);
+
+  ESP_LOGI(TAG, "Thermometer ADC1 channel %d temperature: %.2f °C", desc->pin, temperature_c);
+  if (temperature_c < 0.0)
+  {
+    ESP_LOGE(TAG, "Failed to read thermometer value.");
+    return false;
+  }
+  *value = temperature_c;
+  return true;
+}
+
+/**
+ * @brief Sets the valve pin up as an output. After a deep sleep wakeup the pad is still held at the level
+ * it had, drive the same level before releasing it.
+ */
+static esp_err_t InitValve(const struct peripheral_desc *desc)
+{
+  esp_err_t err = gpio_set_direction(desc->pin, GPIO_MODE_INPUT_OUTPUT);
+  if (err != ESP_OK)
+  {
+    return err;
+  }
+  if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED)
+  {
+    gpio_set_level(desc->pin, valve_level);
+    gpio_hold_dis(desc->pin);
+  }
+  return ESP_OK;
+}
+
+static bool ReadValve(const struct peripheral_desc *desc, const int millivolts, double *value)
+{
+  *value = (double)GetValveState(desc); // Convert valve state to double for consistency
+  return true;
+}
+
+/**
+ * @brief Drives the valve to a desired state received from the server.
+ *
+ * @param state Desired state, "on" or "off".
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG if the state is not recognized.
+ */
+static esp_err_t ActuateValve(const struct peripheral_desc *desc, const char *state)
+{
+  if (strcmp(state, "off") == 0)
+  {
+    return SetValveState(desc, 0);
+  }
+  if (strcmp(state, "on") == 0)
+  {
+    return SetValveState(desc, 1);
+  }
+  ESP_LOGE(TAG, "Invalid valve state received: %s", state);
+  return ESP_ERR_INVALID_ARG;
+}
+
+static void HoldValve(const struct peripheral_desc *desc)
+{
+  valve_level = gpio_get_level(desc->pin);
+  gpio_hold_en(desc->pin);
+}
+
+int GetValveState(const struct peripheral_desc *desc)
+{
+  int valve_state = gpio_get_level(desc->pin);
+  ESP_LOGI(TAG, "Valve state: %d", valve_state);
+  return valve_state;
+}
+
+esp_err_t SetValveState(const struct peripheral_desc *desc, int state)
+{
+  if (state != 0 && state != 1)
+  {
+    ESP_LOGE(TAG, "Invalid valve state: %d. Must be 0 or 1.", state);
+    return ESP_ERR_INVALID_ARG;
+  }
+  ESP_ERROR_CHECK(gpio_set_level(desc->pin, state));
+  ESP_LOGI(TAG, "Valve state set to: %d", state);
+  return ESP_OK;
+}
+
+// Humidity is a 0-1 fraction, temperature in Celsius
+const struct peripheral_driver hygrometer_driver = {
+    .p_type = "hygrometer",
+    .analog = true,
+    .default_schedule = {.sample_period_s = 60, .upload_period_s = 300, .adaptive = true},
+    .default_policy = {.deadband = 0.02, .heartbeat_s = 15 * 60},
+    .read = ReadHygrometer,
+    .encode = RoundToHundredths,
+};
+
+const struct peripheral_driver thermometer_driver = {
+    .p_type = "thermometer",
+    .analog = true,
+    .default_schedule = {.sample_period_s = 60, .upload_period_s = 300, .adaptive = true},
+    .default_policy = {.deadband = 0.5, .heartbeat_s = 15 * 60},
+    .read = ReadThermometer,
+    .encode = RoundToHundredths,
+};
+
+// Polled only while the push channel is down, any change is reported
+const struct peripheral_driver valve_driver = {
+    .p_type = "valve",
+    .default_schedule = {.sample_period_s = 60, .upload_period_s = 60, .adaptive = false},
+    .default_policy = {.deadband = 0.0, .heartbeat_s = 15 * 60},
+    .init = InitValve,
+    .read = ReadValve,
+    .actuate = ActuateValve,
+    .hold = HoldValve,
+};
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <math.h>
+#include "Scheduler.h"
+
+#define US_PER_S 1000000LL
+
+/**
+ * @brief Scales a base period by 2^shift, never going below the adapted period floor.
+ */
+static uint32_t ScaledPeriod(const uint32_t base_s, const int8_t shift)
+{
+  const uint32_t scaled_s = (shift >= 0) ? (base_s << shift) : (base_s >> -shift);
+  const uint32_t floor_s = (base_s < SCHEDULE_MIN_PERIOD_S) ? base_s : SCHEDULE_MIN_PERIOD_S;
+  return (scaled_s < floor_s) ? floor_s : scaled_s;
+}
+
+/**
+ * @brief Sets up a schedule with its base periods, the first sample is due right away.
+ *
+ * @param s The schedule.
+ * @param sample_period_s Base sampling period.
+ * @param upload_period_s Base upload period.
+ * @param adaptive Whether the periods adapt to the rate of change of the value.
+ * @param now_us Current time since boot.
+ */
+void ScheduleInit(struct schedule *s, const uint32_t sample_period_s, const uint32_t upload_period_s, const bool adaptive, const int64_t now_us)
+{
+  *s = (struct schedule){
+      .sample_period_s = sample_period_s,
+      .upload_period_s = upload_period_s,
+      .adaptive = adaptive,
+      .next_sample_us = now_us,
+  };
+}
+
+/**
+ * @brief Replaces the base periods (e.g. when the server changes them) and restarts the adaptation.
+ * The next sample is taken right away; a pending reading keeps its deadline unless the new period is shorter.
+ *
+ * @param s The schedule.
+ * @param sample_period_s New base sampling period.
+ * @param upload_period_s New base upload period.
+ * @param now_us Current time since boot.
+ */
+void ScheduleSetPeriods(struct schedule *s, const uint32_t sample_period_s, const uint32_t upload_period_s, const int64_t now_us)
+{
+  s->sample_period_s = sample_period_s;
+  s->upload_period_s = upload_period_s;
+  s->shift = 0;
+  s->stable_samples = 0;
+  s->next_sample_us = now_us;
+  const int64_t upload_by_us = now_us + (int64_t)upload_period_s * US_PER_S;
+  if (s->upload_pending && upload_by_us < s->next_upload_us)
+  {
+    s->next_upload_us = upload_by_us;
+  }
+}
+
+bool ScheduleSampleDue(const struct schedule *s, const int64_t now_us)
+{
+  return s->next_sample_us <= now_us + SCHEDULE_SLACK_US;
+}
+
+/**
+ * @brief Records a sample and plans the next one. An adaptive schedule tightens one step every time the
+ * value moves past the deadband, and relaxes one step after SCHEDULE_STABLE_SAMPLES samples within it.
+ *
+ * @param s The schedule.
+ * @param value The value sampled.
+ * @param deadband Smallest change considered significant.
+ * @param now_us Current time since boot.
+ */
+void ScheduleOnSample(struct schedule *s, const double value, const double deadband, const int64_t now_us)
+{
+  if (s->adaptive && s->sampled)
+  {
+    if (fabs(value - s->last_value) > deadband)
+    {
+      s->stable_samples = 0;
+      if (s->shift > SCHEDULE_MIN_SHIFT)
+      {
+        s->shift--;
+      }
+    }
+    else if (++s->stable_samples >= SCHEDULE_STABLE_SAMPLES)
+    {
+      s->stable_samples = 0;
+      if (s->shift < SCHEDULE_MAX_SHIFT)
+      {
+        s->shift++;
+      }
+    }
+  }
+  s->sampled = true;
+  s->last_value = value;
+  s->next_sample_us = now_us + (int64_t)ScheduleSamplePeriod(s) * US_PER_S;
+}
+
+/**
+ * @brief Plans the next sample after a failed one, at the current period and without adapting.
+ *
+ * @param s The schedule.
+ * @param now_us Current time since boot.
+ */
+void ScheduleOnMissedSample(struct schedule *s, const int64_t now_us)
+{
+  s->next_sample_us = now_us + (int64_t)ScheduleSamplePeriod(s) * US_PER_S;
+}
+
+/**
+ * @brief Records that a reading was queued for upload, the first one sets the upload deadline.
+ *
+ * @param s The schedule.
+ * @param now_us Current time since boot.
+ */
+void ScheduleOnReading(struct schedule *s, const int64_t now_us)
+{
+  if (!s->upload_pending)
+  {
+    s->upload_pending = true;
+    s->next_upload_us = now_us + (int64_t)ScheduleUploadPeriod(s) * US_PER_S;
+  }
+}
+
+bool ScheduleUploadDue(const struct schedule *s, const int64_t now_us)
+{
+  return s->upload_pending && s->next_upload_us <= now_us + SCHEDULE_SLACK_US;
+}
+
+void ScheduleOnUpload(struct schedule *s)
+{
+  s->upload_pending = false;
+}
+
+/**
+ * @brief Returns when the schedule next needs the worker: its next sample, or the upload of its pending reading.
+ *
+ * @param s The schedule.
+ * @return int64_t Time since boot of the next deadline.
+ */
+int64_t ScheduleNextDeadline(const struct schedule *s)
+{
+  if (s->upload_pending && s->next_upload_us < s->next_sample_us)
+  {
+    return s->next_upload_us;
+  }
+  return s->next_sample_us;
+}
+
+uint32_t ScheduleSamplePeriod(const struct schedule *s)
+{
+  return ScaledPeriod(s->sample_period_s, s->shift);
+}
+
+uint32_t ScheduleUploadPeriod(const struct schedule *s)
+{
+  return ScaledPeriod(s->upload_period_s, s->shift);
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SCHEDULE_MIN_PERIOD_S 10   // Floor of any adapted period
+#define SCHEDULE_MAX_SHIFT 2       // Periods relax up to 4 times their base value...
+#define SCHEDULE_MIN_SHIFT -2      // ...and tighten down to a quarter of it
+#define SCHEDULE_STABLE_SAMPLES 3  // Consecutive samples within the deadband before relaxing one step
+#define SCHEDULE_SLACK_US 5000000  // Work due this soon is served by the current wakeup
+
+/**
+ * @brief Sampling and upload schedule of a single peripheral.
+ * The base periods are set by the server, the shift adapts both of them to how fast the value changes.
+ */
+struct schedule
+{
+  uint32_t sample_period_s; // Base sampling period
+  uint32_t upload_period_s; // Base upload period, readings wait at most this long before being uploaded
+  bool adaptive;            // Whether the periods follow the rate of change of the value
+  int8_t shift;             // Periods in use are the base ones scaled by 2^shift
+  uint8_t stable_samples;   // Consecutive samples within the deadband
+  bool sampled;             // Whether last_value holds a sample
+  bool upload_pending;      // A reading of this peripheral waits for upload
+  double last_value;        // Value of the previous sample
+  int64_t next_sample_us;   // Time since boot of the next sample
+  int64_t next_upload_us;   // Time since boot the pending reading has to be uploaded by
+};
+
+void ScheduleInit(struct schedule *s, const uint32_t sample_period_s, const uint32_t upload_period_s, const bool adaptive, const int64_t now_us);
+void ScheduleSetPeriods(struct schedule *s, const uint32_t sample_period_s, const uint32_t upload_period_s, const int64_t now_us);
+bool ScheduleSampleDue(const struct schedule *s, const int64_t now_us);
+void ScheduleOnSample(struct schedule *s, const double value, const double deadband, const int64_t now_us);
+void ScheduleOnMissedSample(struct schedule *s, const int64_t now_us);
+void ScheduleOnReading(struct schedule *s, const int64_t now_us);
+bool ScheduleUploadDue(const struct schedule *s, const int64_t now_us);
+void ScheduleOnUpload(struct schedule *s);
+int64_t ScheduleNextDeadline(const struct schedule *s);
+uint32_t ScheduleSamplePeriod(const struct schedule *s);
+uint32_t ScheduleUploadPeriod(const struct schedule *s);
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "PushClient.h"
+#include "esp_log.h"
+#include "esp_crt_bundle.h"
+
+#define PUSH_KEEPALIVE_S 30             // Broker notices a dead module (and the module a dead link) within this time
+#define PUSH_RECONNECT_TIMEOUT_MS 5000  // Wait between reconnection attempts while the channel is down
+#define PUSH_QOS 1                      // Desired states must not be lost, duplicates are harmless
+static const char TAG[] = "PushClient";
+
+static esp_mqtt_client_handle_t mqtt_client = NULL;
+static volatile bool push_connected = false;
+static push_message_cb message_callback = NULL;
+static const char *const topic_names[N_PUSH_TOPICS] = {"state", "schedule", "control", "report"};
+// Topics are built once at start, incoming messages are matched against them without parsing
+static char topics[PUSH_MAX_SUBSCRIPTIONS][PUSH_TOPIC_SIZE];
+static struct push_subscription subscribed[PUSH_MAX_SUBSCRIPTIONS];
+static size_t n_subscribed = 0;
+
+/**
+ * @brief Opens the persistent push channel to the broker and subscribes to the given peripheral topics.
+ * The client reconnects and resubscribes on its own whenever the link drops.
+ *
+ * @param module_token Token of the module, used as MQTT client id and to build the topics.
+ * @param subscriptions Peripheral topics the server pushes messages on.
+ * @param n_subscriptions Number of subscriptions, up to PUSH_MAX_SUBSCRIPTIONS.
+ * @param on_message Callback receiving every pushed message.
+ * @return esp_err_t ESP_OK if the client was started, otherwise an error code.
+ */
+esp_err_t PushClientStart(const char *module_token, const struct push_subscription *subscriptions, const size_t n_subscriptions, push_message_cb on_message)
+{
+  if (n_subscriptions > PUSH_MAX_SUBSCRIPTIONS || on_message == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (mqtt_client != NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  for (size_t i = 0; i < n_subscriptions; i++)
+  {
+    const int len = snprintf(topics[i], PUSH_TOPIC_SIZE, PUSH_TOPIC_FORMAT,
+                             module_token, subscriptions[i].peripheral_id, topic_names[subscriptions[i].topic]);
+    if (len < 0 || len >= PUSH_TOPIC_SIZE)
+    {
+      ESP_LOGE(TAG, "Topic too long for peripheral %" PRIu32, subscriptions[i].peripheral_id);
+      return ESP_ERR_INVALID_SIZE;
+    }
+    subscribed[i] = subscriptions[i];
+  }
+  n_subscribed = n_subscriptions;
+  message_callback = on_message;
+
+  const esp_mqtt_client_config_t config = {
+      .broker.address.uri = PUSH_BROKER_URI,
+      .broker.verification.crt_bundle_attach = esp_crt_bundle_attach,
+      .credentials.client_id = module_token,
+      .credentials.username = module_token,
+      .session.keepalive = PUSH_KEEPALIVE_S,
+      .network.reconnect_timeout_ms = PUSH_RECONNECT_TIMEOUT_MS,
+  };
+  mqtt_client = esp_mqtt_client_init(&config);
+  if (mqtt_client == NULL)
+  {
+    ESP_LOGE(TAG, "Failed to create MQTT client");
+    return ESP_FAIL;
+  }
+  esp_mqtt_client_register_event(mqtt_client, MQTT_EVENT_ANY, PushEventHandler, NULL);
+  esp_err_t err = esp_mqtt_client_start(mqtt_client);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to start MQTT client: %s", esp_err_to_name(err));
+    return err;
+  }
+  ESP_LOGI(TAG, "Push channel started, broker %s", PUSH_BROKER_URI);
+  return ESP_OK;
+}
+
+/**
+ * @brief Tells whether pushed messages are currently being delivered.
+ * While it is false the caller has to poll the server instead.
+ *
+ * @return true if the channel is connected and subscribed.
+ */
+bool PushClientIsConnected()
+{
+  return push_connected;
+}
+
+/**
+ * @brief Handles the MQTT client events, runs on the MQTT task.
+ */
+static void PushEventHandler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+  const esp_mqtt_event_t *event = event_data;
+  switch ((esp_mqtt_event_id_t)event_id)
+  {
+  case MQTT_EVENT_CONNECTED:
+    // Clean session, subscriptions are lost on every reconnect
+    ESP_LOGI(TAG, "Push channel connected");
+    for (size_t i = 0; i < n_subscribed; i++)
+    {
+      if (esp_mqtt_client_subscribe(event->client, topics[i], PUSH_QOS) < 0)
+      {
+        ESP_LOGE(TAG, "Failed to subscribe to %s", topics[i]);
+      }
+    }
+    break;
+  case MQTT_EVENT_SUBSCRIBED:
+    // Retained messages are delivered right after the subscription, polling is no longer needed
+    push_connected = true;
+    break;
+  case MQTT_EVENT_DISCONNECTED:
+    ESP_LOGW(TAG, "Push channel disconnected, falling back to polling");
+    push_connected = false;
+    break;
+  case MQTT_EVENT_DATA:
+    HandlePushedData(event);
+    break;
+  case MQTT_EVENT_ERROR:
+    ESP_LOGE(TAG, "MQTT_EVENT_ERROR");
+    break;
+  default:
+    break;
+  }
+}
+
+/**
+ * @brief Matches a received message against the subscribed topics and hands its payload to the callback.
+ *
+ * @param event The MQTT data event.
+ */
+static void HandlePushedData(const esp_mqtt_event_t *event)
+{
+  if (event->current_data_offset != 0 || event->data_len != event->total_data_len || event->data_len >= PUSH_PAYLOAD_SIZE)
+  {
+    ESP_LOGW(TAG, "Ignoring oversized push message (%d bytes)", event->total_data_len);
+    return;
+  }
+  for (size_t i = 0; i < n_subscribed; i++)
+  {
+    if (event->topic_len == strlen(topics[i]) && memcmp(event->topic, topics[i], event->topic_len) == 0)
+    {
+      char payload[PUSH_PAYLOAD_SIZE];
+      memcpy(payload, event->data, event->data_len);
+      payload[event->data_len] = '\0';
+      ESP_LOGI(TAG, "Pushed %s for peripheral %" PRIu32 "%s: %s", topic_names[subscribed[i].topic], subscribed[i].peripheral_id,
+               event->retain ? " (retained)" : "", payload);
+      message_callback(subscribed[i].peripheral_id, subscribed[i].topic, payload, event->data_len, event->retain);
+      return;
+    }
+  }
+  ESP_LOGW(TAG, "Message on unexpected topic %.*s", event->topic_len, event->topic);
+}
\ No newline at end of file
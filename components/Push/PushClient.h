@@ -0,0 +1,46 @@
+#pragma once
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#ifndef PUSH_BROKER_URI
+#define PUSH_BROKER_URI "mqtts://sarp01.westeurope.cloudapp.azure.com:8883" // Override with -DPUSH_BROKER_URI=... to test against a local broker
+#endif
+#define PUSH_TOPIC_FORMAT "sarp/module/%s/peripheral/%" PRIu32 "/%s" // Retained, so the last value is delivered on (re)connect
+#define PUSH_TOPIC_SIZE 96        // Longest topic, module token plus peripheral id and topic name
+#define PUSH_MAX_SUBSCRIPTIONS 32 // Peripheral topics the module can subscribe to, a schedule and a report policy per peripheral plus a state per actuator
+#define PUSH_PAYLOAD_SIZE 64      // Longest payload accepted
+
+/**
+ * @brief Kind of message pushed for a peripheral, each one on its own topic.
+ */
+enum push_topic
+{
+  PUSH_TOPIC_STATE,    // Desired state ("on"/"off")
+  PUSH_TOPIC_SCHEDULE, // Sampling and upload periods, as JSON
+  PUSH_TOPIC_CONTROL,  // Thresholds of the on-device irrigation loop, as JSON
+  PUSH_TOPIC_REPORT,   // Report policy (deadband and heartbeat), as JSON
+  N_PUSH_TOPICS,
+};
+
+struct push_subscription
+{
+  uint32_t peripheral_id;
+  enum push_topic topic;
+};
+
+/**
+ * @brief Called from the MQTT task every time the server pushes a message for a peripheral.
+ * Must return quickly, it holds up the delivery of the next messages.
+ * retained is set when the broker replays the last value on a (re)connect rather than forwarding a new publish:
+ * it may be a message the module already handled.
+ */
+typedef void (*push_message_cb)(uint32_t peripheral_id, enum push_topic topic, const char *payload, size_t len, bool retained);
+
+esp_err_t PushClientStart(const char *module_token, const struct push_subscription *subscriptions, const size_t n_subscriptions, push_message_cb on_message);
+bool PushClientIsConnected();
+
+static void PushEventHandler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
+static void HandlePushedData(const esp_mqtt_event_t *event);
\ No newline at end of file
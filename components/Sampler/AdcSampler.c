@@ -0,0 +1,181 @@
+#include <inttypes.h>
+#include <string.h>
+#include "AdcSampler.h"
+#include "esp_log.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+
+#define SAMPLER_ATTEN ADC_ATTEN_DB_12          // 0-3.3V range, same as the former oneshot setup
+#define SAMPLER_FREQ_HZ 20000                  // Lowest conversion rate allowed on ESP32, shared by all channels
+#define SAMPLER_FRAME_SIZE 256                 // Bytes per DMA frame, 128 conversions
+#define SAMPLER_STORE_SIZE 1024                // Bytes kept by the driver between reads
+#define SAMPLER_READ_TIMEOUT_MS 50             // Longest wait for a single frame
+#define SAMPLER_MAX_FRAMES 32                  // Frames read before a scan gives up on a silent channel
+#define SAMPLER_CHANNEL_IDS 16                 // Type1 results carry a 4-bit channel number
+#define SAMPLER_NO_SLOT 0xFF
+_Static_assert(ADC_SAMPLER_MAX_CHANNELS <= 32, "AdcSamplerScan takes the due channels as a 32-bit mask");
+
+static const char TAG[] = "AdcSampler";
+static adc_continuous_handle_t adc_handle = NULL;
+static adc_cali_handle_t cali_handle = NULL;
+static size_t n_sampled_channels = 0;
+static uint8_t channel_slot[SAMPLER_CHANNEL_IDS]; // ADC1 channel number -> position in the results
+static uint8_t frame[SAMPLER_FRAME_SIZE];
+
+esp_err_t AdcSamplerInit(const adc_channel_t *channels, const size_t n_channels)
+{
+  if (n_channels == 0 || n_channels > ADC_SAMPLER_MAX_CHANNELS)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  adc_digi_pattern_config_t pattern[ADC_SAMPLER_MAX_CHANNELS] = {0};
+  memset(channel_slot, SAMPLER_NO_SLOT, sizeof(channel_slot));
+  for (size_t i = 0; i < n_channels; i++)
+  {
+    if (channels[i] >= SAMPLER_CHANNEL_IDS || channel_slot[channels[i]] != SAMPLER_NO_SLOT)
+    {
+      return ESP_ERR_INVALID_ARG;
+    }
+    pattern[i].atten = SAMPLER_ATTEN;
+    pattern[i].channel = channels[i];
+    pattern[i].unit = ADC_UNIT_1;
+    pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    channel_slot[channels[i]] = i;
+  }
+
+  adc_continuous_handle_cfg_t handle_config = {
+      .max_store_buf_size = SAMPLER_STORE_SIZE,
+      .conv_frame_size = SAMPLER_FRAME_SIZE,
+  };
+  esp_err_t err = adc_continuous_new_handle(&handle_config, &adc_handle);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to create continuous ADC handle: %s", esp_err_to_name(err));
+    return err;
+  }
+  adc_continuous_config_t config = {
+      .pattern_num = n_channels,
+      .adc_pattern = pattern,
+      .sample_freq_hz = SAMPLER_FREQ_HZ,
+      .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+      .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1, // The only output format of the ESP32 DMA mode
+  };
+  err = adc_continuous_config(adc_handle, &config);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to configure continuous ADC: %s", esp_err_to_name(err));
+    return err;
+  }
+  n_sampled_channels = n_channels;
+  cali_handle = CreateCalibration();
+  ESP_LOGI(TAG, "Sampling %zu ADC1 channels, %d conversions each", n_channels, ADC_SAMPLER_OVERSAMPLING);
+  return ESP_OK;
+}
+
+esp_err_t AdcSamplerScan(int *millivolts)
+{
+  if (n_sampled_channels == 0)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  uint32_t sums[ADC_SAMPLER_MAX_CHANNELS] = {0};
+  uint32_t counts[ADC_SAMPLER_MAX_CHANNELS] = {0};
+  size_t n_complete = 0;
+
+  esp_err_t err = adc_continuous_start(adc_handle);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to start continuous ADC: %s", esp_err_to_name(err));
+    return err;
+  }
+  // Frames left in the driver pool by the previous scan are stale, drop them before accumulating
+  uint32_t frame_len = 0;
+  while (adc_continuous_read(adc_handle, frame, SAMPLER_FRAME_SIZE, &frame_len, 0) == ESP_OK)
+  {
+  }
+  for (size_t n_frames = 0; n_frames < SAMPLER_MAX_FRAMES && n_complete < n_sampled_channels; n_frames++)
+  {
+    if (adc_continuous_read(adc_handle, frame, SAMPLER_FRAME_SIZE, &frame_len, SAMPLER_READ_TIMEOUT_MS) != ESP_OK)
+    {
+      continue;
+    }
+    // Accumulate the whole frame in one go, every channel of the pattern is interleaved in it
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= frame_len; i += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+      const adc_digi_output_data_t *result = (const adc_digi_output_data_t *)&frame[i];
+      const uint32_t channel = result->type1.channel;
+      if (channel >= SAMPLER_CHANNEL_IDS || channel_slot[channel] == SAMPLER_NO_SLOT)
+      {
+        continue;
+      }
+      const uint8_t slot = channel_slot[channel];
+      if (counts[slot] < ADC_SAMPLER_OVERSAMPLING)
+      {
+        sums[slot] += result->type1.data;
+        if (++counts[slot] == ADC_SAMPLER_OVERSAMPLING)
+        {
+          n_complete++;
+        }
+      }
+    }
+  }
+  adc_continuous_stop(adc_handle);
+
+  err = ESP_OK;
+  for (size_t channel = 0; channel < SAMPLER_CHANNEL_IDS; channel++)
+  {
+    const uint8_t slot = channel_slot[channel];
+    if (slot == SAMPLER_NO_SLOT)
+    {
+      continue;
+    }
+    if (counts[slot] == 0)
+    {
+      ESP_LOGE(TAG, "No conversions for result %d", slot);
+      millivolts[slot] = -1;
+      err = ESP_ERR_TIMEOUT;
+      continue;
+    }
+    if (counts[slot] < ADC_SAMPLER_OVERSAMPLING)
+    {
+      ESP_LOGD(TAG, "Result %d averaged over %" PRIu32 " conversions", slot, counts[slot]);
+    }
+    // Decimate: the average of the oversampled conversions, calibrated once per channel
+    millivolts[slot] = RawToMillivolts(cali_handle, (int)((sums[slot] + counts[slot] / 2) / counts[slot]));
+  }
+  return err;
+}
+
+/**
+ * @brief Creates the eFuse calibration scheme of ADC1.
+ *
+ * @return adc_cali_handle_t The scheme, NULL if the chip has no calibration data.
+ */
+static adc_cali_handle_t CreateCalibration()
+{
+  adc_cali_handle_t handle = NULL;
+#if ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+  adc_cali_line_fitting_config_t cali_config = {
+      .unit_id = ADC_UNIT_1,
+      .atten = SAMPLER_ATTEN,
+      .bitwidth = ADC_BITWIDTH_12,
+  };
+  if (adc_cali_create_scheme_line_fitting(&cali_config, &handle) != ESP_OK)
+  {
+    ESP_LOGW(TAG, "No ADC1 calibration data in eFuse, using the nominal full scale");
+    handle = NULL;
+  }
+#endif
+  return handle;
+}
+
+static int RawToMillivolts(adc_cali_handle_t cali, const int raw)
+{
+  int millivolts = 0;
+  if (cali == NULL || adc_cali_raw_to_voltage(cali, raw, &millivolts) != ESP_OK)
+  {
+    millivolts = raw * ADC_SAMPLER_FULL_SCALE_MV / 4095;
+  }
+  return millivolts;
+}
\ No newline at end of file
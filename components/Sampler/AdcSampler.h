@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "hal/adc_types.h"
+#include "esp_adc/adc_cali.h"
+
+#define ADC_SAMPLER_MAX_CHANNELS 16     // Channels sampled in the same pass, entries of the DMA pattern table
+#define ADC_SAMPLER_OVERSAMPLING 64     // Conversions averaged into every filtered value
+#define ADC_SAMPLER_FULL_SCALE_MV 3300  // Full scale used when the chip has no calibration data
+
+/**
+ * @brief Sets up the ADC1 continuous (DMA) driver for the given channels, plus the calibration scheme that converts
+ * the filtered readings to millivolts. Only ADC1 is supported: the DMA does not reach ADC2 on the ESP32, and the
+ * WiFi driver holds ADC2 whenever WiFi runs.
+ *
+ * @param channels ADC1 channels to sample, in the order their results are returned.
+ * @param n_channels Number of channels, up to ADC_SAMPLER_MAX_CHANNELS.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG for a repeated or unknown channel, otherwise an error code.
+ */
+esp_err_t AdcSamplerInit(const adc_channel_t *channels, const size_t n_channels);
+
+/**
+ * @brief Samples every configured channel in a single frame-based pass. Each channel is oversampled up to
+ * ADC_SAMPLER_OVERSAMPLING times, decimated to one averaged value and calibrated. A channel the pass could not
+ * sample that many times within its frame budget is averaged over the conversions it got.
+ *
+ * @param millivolts Output, one calibrated value per channel in the order given to AdcSamplerInit,
+ * -1 if the channel got no conversion at all.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_TIMEOUT if some channel got no conversion at all.
+ */
+esp_err_t AdcSamplerScan(int *millivolts);
+
+static adc_cali_handle_t CreateCalibration();
+static int RawToMillivolts(adc_cali_handle_t cali, const int raw);
\ No newline at end of file
@@ -0,0 +1,463 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include "ReadingStore.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define STORE_SECTOR_SIZE 4096                                    // Flash erase unit
+#define STORE_RECORD_SIZE 32                                      // Size of a slot, header or reading
+#define STORE_RECORDS_PER_SECTOR (STORE_SECTOR_SIZE / STORE_RECORD_SIZE) // Slot 0 of every sector holds its header
+#define STORE_READ_CHUNK 16                                       // Slots read from flash at once while scanning
+
+#define SECTOR_MAGIC 0x53415250          // "SARP", marks an initialized sector
+#define RING_STATE_MAGIC 0x52494E47      // "RING", marks a ring position in RTC memory left by this firmware
+#define RECORD_STATE_ERASED 0xFFFFFFFF   // Slot never written
+#define RECORD_STATE_COMMITTED 0xFFFF0000 // Payload fully written, reading waits for upload
+#define RECORD_STATE_CONSUMED 0x00000000 // Reading uploaded
+// Flash bits only go from 1 to 0, so every state above is reached from the previous one without an erase.
+
+struct sector_header
+{
+  uint32_t magic;
+  uint32_t sequence; // Increases every time a sector is (re)opened, orders the sectors of the ring
+  uint32_t crc;      // CRC of magic and sequence
+  uint32_t reserved[5];
+};
+
+struct stored_record
+{
+  uint32_t state; // Written last, acts as the commit marker
+  uint32_t crc;   // CRC of payload
+  struct
+  {
+    int64_t timestamp;
+    double value;
+    uint32_t peripheral_id;
+    uint32_t reserved;
+  } payload;
+};
+
+_Static_assert(sizeof(struct sector_header) == STORE_RECORD_SIZE, "sector header must fill a slot");
+_Static_assert(sizeof(struct stored_record) == STORE_RECORD_SIZE, "record must fill a slot");
+
+struct store_cursor
+{
+  uint32_t sector;
+  uint32_t slot;
+};
+
+static const char TAG[] = "ReadingStore";
+// Appends come from the uplink (failed uploads) and from the sampler (readings the uplink has no room for),
+// peeks and consumes from the uplink; every public call holds store_lock
+static StaticSemaphore_t store_lock_buffer;
+static SemaphoreHandle_t store_lock = NULL;
+static const esp_partition_t *store_partition = NULL;
+// The ring position lives in RTC memory: it is kept up to date by every call, so after a deep sleep
+// ReadingStoreResume takes it as is instead of scanning the partition
+RTC_DATA_ATTR static uint32_t ring_state_magic = 0;
+RTC_DATA_ATTR static uint32_t ring_state_address = 0; // Partition the position belongs to
+RTC_DATA_ATTR static uint32_t n_sectors = 0;
+RTC_DATA_ATTR static struct store_cursor head; // Next free slot
+RTC_DATA_ATTR static struct store_cursor tail; // Oldest slot that may still hold a pending reading
+RTC_DATA_ATTR static uint32_t next_sequence = 0;
+RTC_DATA_ATTR static size_t pending_records = 0;
+static uint32_t dropped_records = 0; // Pending readings lost to ring overflow since boot
+static struct stored_record scan_chunk[STORE_READ_CHUNK]; // Only scratch memory of the store, keeps RAM use bounded
+
+static size_t SlotOffset(const struct store_cursor *cursor)
+{
+  return (size_t)cursor->sector * STORE_SECTOR_SIZE + (size_t)cursor->slot * STORE_RECORD_SIZE;
+}
+
+static uint32_t HeaderCrc(const struct sector_header *header)
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(struct sector_header, crc));
+}
+
+static uint32_t PayloadCrc(const struct stored_record *record)
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)&record->payload, sizeof(record->payload));
+}
+
+static bool IsBlank(const void *data, size_t len)
+{
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < len; i++)
+  {
+    if (bytes[i] != 0xFF)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool IsPending(const struct stored_record *record)
+{
+  return record->state == RECORD_STATE_COMMITTED && record->crc == PayloadCrc(record);
+}
+
+/**
+ * @brief Reads a sector header.
+ *
+ * @return true if the sector holds a valid header.
+ */
+static bool ReadSectorHeader(uint32_t sector, struct sector_header *header)
+{
+  if (esp_partition_read(store_partition, (size_t)sector * STORE_SECTOR_SIZE, header, sizeof(*header)) != ESP_OK)
+  {
+    return false;
+  }
+  return header->magic == SECTOR_MAGIC && header->crc == HeaderCrc(header);
+}
+
+/**
+ * @brief Erases a sector and writes a fresh header, making it the new head of the ring.
+ */
+static esp_err_t OpenSector(uint32_t sector)
+{
+  esp_err_t err = esp_partition_erase_range(store_partition, (size_t)sector * STORE_SECTOR_SIZE, STORE_SECTOR_SIZE);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to erase sector %" PRIu32 ": %s", sector, esp_err_to_name(err));
+    return err;
+  }
+  struct sector_header header;
+  memset(&header, 0xFF, sizeof(header));
+  header.magic = SECTOR_MAGIC;
+  header.sequence = next_sequence++;
+  header.crc = HeaderCrc(&header);
+  err = esp_partition_write(store_partition, (size_t)sector * STORE_SECTOR_SIZE, &header, sizeof(header));
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to write header of sector %" PRIu32 ": %s", sector, esp_err_to_name(err));
+    return err;
+  }
+  head.sector = sector;
+  head.slot = 1;
+  return ESP_OK;
+}
+
+/**
+ * @brief Counts the pending readings of a sector.
+ */
+static size_t CountPendingInSector(uint32_t sector)
+{
+  size_t count = 0;
+  for (uint32_t slot = 1; slot < STORE_RECORDS_PER_SECTOR; slot += STORE_READ_CHUNK)
+  {
+    const uint32_t n_slots = (STORE_RECORDS_PER_SECTOR - slot < STORE_READ_CHUNK) ? STORE_RECORDS_PER_SECTOR - slot : STORE_READ_CHUNK;
+    struct store_cursor cursor = {.sector = sector, .slot = slot};
+    if (esp_partition_read(store_partition, SlotOffset(&cursor), scan_chunk, n_slots * STORE_RECORD_SIZE) != ESP_OK)
+    {
+      continue;
+    }
+    for (uint32_t i = 0; i < n_slots; i++)
+    {
+      count += IsPending(&scan_chunk[i]) ? 1 : 0;
+    }
+  }
+  return count;
+}
+
+/**
+ * @brief Moves the head to the next sector of the ring. If that sector still holds pending readings
+ * (the ring is full) they are dropped and the tail skips past them.
+ */
+static esp_err_t AdvanceHead()
+{
+  const uint32_t next_sector = (head.sector + 1) % n_sectors;
+  struct sector_header header;
+  if (ReadSectorHeader(next_sector, &header))
+  {
+    const size_t lost = CountPendingInSector(next_sector);
+    if (lost > 0)
+    {
+      dropped_records += lost;
+      ESP_LOGW(TAG, "Store full, dropping %zu oldest readings (%" PRIu32 " since boot)", lost, dropped_records);
+      pending_records -= lost;
+    }
+    if (tail.sector == next_sector)
+    {
+      tail.sector = (next_sector + 1) % n_sectors;
+      tail.slot = 1;
+    }
+  }
+  return OpenSector(next_sector);
+}
+
+/**
+ * @brief Advances a cursor until it points at a pending reading or reaches the head.
+ *
+ * @param cursor Cursor to advance, left on the pending reading when found.
+ * @param record Output, the pending reading.
+ * @return true if a pending reading was found.
+ */
+static bool SeekPending(struct store_cursor *cursor, struct stored_record *record)
+{
+  while (cursor->sector != head.sector || cursor->slot < head.slot)
+  {
+    if (cursor->slot >= STORE_RECORDS_PER_SECTOR)
+    {
+      cursor->sector = (cursor->sector + 1) % n_sectors;
+      cursor->slot = 1;
+      continue;
+    }
+    if (esp_partition_read(store_partition, SlotOffset(cursor), record, sizeof(*record)) == ESP_OK && IsPending(record))
+    {
+      return true;
+    }
+    cursor->slot++;
+  }
+  return false;
+}
+
+/**
+ * @brief Creates the lock and finds the store partition.
+ */
+static esp_err_t OpenPartition()
+{
+  if (store_lock == NULL)
+  {
+    store_lock = xSemaphoreCreateMutexStatic(&store_lock_buffer);
+  }
+  store_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, READING_STORE_PARTITION_SUBTYPE, READING_STORE_PARTITION_LABEL);
+  if (store_partition == NULL)
+  {
+    ESP_LOGE(TAG, "Partition '%s' not found", READING_STORE_PARTITION_LABEL);
+    return ESP_ERR_NOT_FOUND;
+  }
+  return ESP_OK;
+}
+
+/**
+ * @brief Recovers the ring position from the sector headers and counts the pending readings, reading every sector.
+ */
+static esp_err_t ScanRing()
+{
+  n_sectors = store_partition->size / STORE_SECTOR_SIZE;
+
+  // The head is the sector with the highest sequence, the ring runs from the sector after it back to it.
+  bool found = false;
+  uint32_t head_sequence = 0;
+  for (uint32_t sector = 0; sector < n_sectors; sector++)
+  {
+    struct sector_header header;
+    if (ReadSectorHeader(sector, &header) && (!found || (int32_t)(header.sequence - head_sequence) > 0))
+    {
+      found = true;
+      head_sequence = header.sequence;
+      head.sector = sector;
+    }
+  }
+  if (!found)
+  {
+    ESP_LOGI(TAG, "Empty store, formatting %" PRIu32 " sectors", n_sectors);
+    next_sequence = 0;
+    tail.sector = 0;
+    tail.slot = 1;
+    return OpenSector(0);
+  }
+  next_sequence = head_sequence + 1;
+
+  // Free space starts after the last written slot of the head sector; interrupted writes are left behind.
+  head.slot = 1;
+  for (uint32_t slot = 1; slot < STORE_RECORDS_PER_SECTOR; slot += STORE_READ_CHUNK)
+  {
+    const uint32_t n_slots = (STORE_RECORDS_PER_SECTOR - slot < STORE_READ_CHUNK) ? STORE_RECORDS_PER_SECTOR - slot : STORE_READ_CHUNK;
+    struct store_cursor cursor = {.sector = head.sector, .slot = slot};
+    esp_err_t err = esp_partition_read(store_partition, SlotOffset(&cursor), scan_chunk, n_slots * STORE_RECORD_SIZE);
+    if (err != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Failed to read sector %" PRIu32 ": %s", head.sector, esp_err_to_name(err));
+      return err;
+    }
+    for (uint32_t i = 0; i < n_slots; i++)
+    {
+      if (!IsBlank(&scan_chunk[i], STORE_RECORD_SIZE))
+      {
+        head.slot = slot + i + 1;
+      }
+    }
+  }
+
+  // Tail: first pending reading in ring order, counting every pending reading on the way
+  pending_records = 0;
+  bool tail_found = false;
+  for (uint32_t i = 1; i <= n_sectors; i++)
+  {
+    const uint32_t sector = (head.sector + i) % n_sectors;
+    struct sector_header header;
+    if (!ReadSectorHeader(sector, &header))
+    {
+      continue;
+    }
+    const size_t pending = CountPendingInSector(sector);
+    if (pending > 0 && !tail_found)
+    {
+      tail_found = true;
+      tail.sector = sector;
+      tail.slot = 1;
+    }
+    pending_records += pending;
+  }
+  if (!tail_found)
+  {
+    tail = head;
+  }
+  ESP_LOGI(TAG, "Store ready: %zu pending readings, head at sector %" PRIu32 " slot %" PRIu32, pending_records, head.sector, head.slot);
+  return ESP_OK;
+}
+
+esp_err_t ReadingStoreInit()
+{
+  esp_err_t err = OpenPartition();
+  if (err != ESP_OK)
+  {
+    return err;
+  }
+  ring_state_magic = 0; // Not valid until the scan completes
+  err = ScanRing();
+  if (err == ESP_OK)
+  {
+    ring_state_address = store_partition->address;
+    ring_state_magic = RING_STATE_MAGIC;
+  }
+  return err;
+}
+
+esp_err_t ReadingStoreResume()
+{
+  esp_err_t err = OpenPartition();
+  if (err != ESP_OK)
+  {
+    return err;
+  }
+  if (ring_state_magic == RING_STATE_MAGIC && ring_state_address == store_partition->address &&
+      n_sectors == store_partition->size / STORE_SECTOR_SIZE)
+  {
+    ESP_LOGD(TAG, "Store resumed: %zu pending readings, head at sector %" PRIu32 " slot %" PRIu32, pending_records, head.sector, head.slot);
+    return ESP_OK;
+  }
+  ESP_LOGI(TAG, "No ring position in RTC memory, scanning the store");
+  return ReadingStoreInit();
+}
+
+/**
+ * @brief Body of ReadingStoreAppend, called with store_lock held.
+ */
+static esp_err_t AppendRecords(const struct peripheral_data *data, const size_t n_data)
+{
+  for (size_t i = 0; i < n_data; i++)
+  {
+    if (head.slot >= STORE_RECORDS_PER_SECTOR)
+    {
+      esp_err_t err = AdvanceHead();
+      if (err != ESP_OK)
+      {
+        return err;
+      }
+    }
+    struct stored_record record;
+    memset(&record, 0xFF, sizeof(record));
+    record.payload.timestamp = data[i].timestamp;
+    record.payload.value = data[i].value;
+    record.payload.peripheral_id = data[i].peripheral_id;
+    record.crc = PayloadCrc(&record);
+
+    // Payload first, commit marker last: a power loss in between leaves a slot that is never read back
+    const size_t offset = SlotOffset(&head);
+    esp_err_t err = esp_partition_write(store_partition, offset + offsetof(struct stored_record, crc),
+                                        &record.crc, sizeof(record) - offsetof(struct stored_record, crc));
+    if (err == ESP_OK)
+    {
+      const uint32_t state = RECORD_STATE_COMMITTED;
+      err = esp_partition_write(store_partition, offset, &state, sizeof(state));
+    }
+    head.slot++; // Never reuse a slot, even a failed one, flash can't be rewritten without an erase
+    if (err != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Failed to store reading: %s", esp_err_to_name(err));
+      return err;
+    }
+    pending_records++;
+  }
+  return ESP_OK;
+}
+
+esp_err_t ReadingStoreAppend(const struct peripheral_data *data, const size_t n_data)
+{
+  if (store_partition == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  xSemaphoreTake(store_lock, portMAX_DELAY);
+  const esp_err_t err = AppendRecords(data, n_data);
+  xSemaphoreGive(store_lock);
+  return err;
+}
+
+size_t ReadingStorePeek(struct peripheral_data *data, const size_t max_data, struct reading_store_tail *peeked_tail)
+{
+  if (store_partition == NULL)
+  {
+    return 0;
+  }
+  xSemaphoreTake(store_lock, portMAX_DELAY);
+  peeked_tail->sector = tail.sector;
+  peeked_tail->slot = tail.slot;
+  struct store_cursor cursor = tail;
+  struct stored_record record;
+  size_t n_data = 0;
+  while (n_data < max_data && SeekPending(&cursor, &record))
+  {
+    data[n_data].peripheral_id = record.payload.peripheral_id;
+    data[n_data].value = record.payload.value;
+    data[n_data].timestamp = record.payload.timestamp;
+    n_data++;
+    cursor.slot++;
+  }
+  xSemaphoreGive(store_lock);
+  return n_data;
+}
+
+esp_err_t ReadingStoreConsume(const struct reading_store_tail *peeked_tail, const size_t n_data)
+{
+  if (store_partition == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  xSemaphoreTake(store_lock, portMAX_DELAY);
+  if (tail.sector != peeked_tail->sector || tail.slot != peeked_tail->slot)
+  {
+    xSemaphoreGive(store_lock);
+    ESP_LOGW(TAG, "Ring overflowed since the batch was peeked, leaving it pending");
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = ESP_OK;
+  struct stored_record record;
+  for (size_t i = 0; i < n_data && err == ESP_OK && SeekPending(&tail, &record); i++)
+  {
+    const uint32_t state = RECORD_STATE_CONSUMED;
+    err = esp_partition_write(store_partition, SlotOffset(&tail), &state, sizeof(state));
+    if (err != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Failed to mark reading as uploaded: %s", esp_err_to_name(err));
+      break;
+    }
+    tail.slot++;
+    pending_records--;
+  }
+  xSemaphoreGive(store_lock);
+  return err;
+}
+
+size_t ReadingStorePendingCount()
+{
+  return pending_records;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "esp_err.h"
+#include "HttpsClient.h"
+
+#define READING_STORE_PARTITION_LABEL "readings" // Label of the store partition in partitions.csv
+#define READING_STORE_PARTITION_SUBTYPE 0x40     // Custom data subtype of the store partition
+
+/**
+ * @brief Opens the readings partition and recovers the ring position from flash, reading every sector.
+ * Records whose write was interrupted (no commit marker or a bad CRC) are skipped.
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if the partition is missing.
+ */
+esp_err_t ReadingStoreInit();
+
+/**
+ * @brief Reopens the store after a deep sleep wakeup with the ring position kept in RTC memory, without reading the
+ * flash. Falls back to ReadingStoreInit when RTC memory holds no position for this partition (cold boot).
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if the partition is missing.
+ */
+esp_err_t ReadingStoreResume();
+
+/**
+ * @brief Appends readings to the store. When the ring is full the oldest sector is recycled
+ * and its pending readings are dropped.
+ *
+ * @param data Readings to store.
+ * @param n_data Number of readings in data.
+ * @return esp_err_t ESP_OK on success, otherwise the flash error.
+ */
+esp_err_t ReadingStoreAppend(const struct peripheral_data *data, const size_t n_data);
+
+/**
+ * @brief Position of the oldest pending reading when a batch was peeked, handed back to ReadingStoreConsume.
+ */
+struct reading_store_tail
+{
+  uint32_t sector;
+  uint32_t slot;
+};
+
+/**
+ * @brief Copies the oldest pending readings without removing them from the store.
+ *
+ * @param data Output buffer.
+ * @param max_data Capacity of data.
+ * @param tail Output, where the batch starts, to consume it later.
+ * @return size_t Number of readings copied.
+ */
+size_t ReadingStorePeek(struct peripheral_data *data, const size_t max_data, struct reading_store_tail *tail);
+
+/**
+ * @brief Marks the oldest n_data pending readings as delivered, to be called once a peeked batch has been uploaded.
+ * Appends made in the meantime may have overflowed the ring and dropped the start of the batch; the tail has then
+ * moved and nothing is consumed, the readings left of the batch are peeked again.
+ *
+ * @param tail Where the batch started, as returned by ReadingStorePeek.
+ * @param n_data Number of readings to consume.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if the tail moved, otherwise the flash error.
+ */
+esp_err_t ReadingStoreConsume(const struct reading_store_tail *tail, const size_t n_data);
+
+/**
+ * @brief Returns the number of readings waiting to be uploaded.
+ */
+size_t ReadingStorePendingCount();
\ No newline at end of file
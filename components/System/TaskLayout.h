@@ -0,0 +1,48 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+// Core and priority of every application task, by role. Any of them can be overridden with -D<NAME>=...
+// The WiFi task, Bluedroid, the BT controller and the esp_timer task are pinned to the protocol core (see sdkconfig),
+// so the sampling work gets the other core to itself and runs in parallel with the uploads.
+#ifdef CONFIG_FREERTOS_UNICORE
+#define TASK_PROTOCOL_CORE 0
+#define TASK_APP_CORE 0
+#else
+#define TASK_PROTOCOL_CORE 0
+#define TASK_APP_CORE 1
+#endif
+
+#ifndef SAMPLER_TASK_CORE
+#define SAMPLER_TASK_CORE TASK_APP_CORE // ADC scans and change detection, alone on its core
+#endif
+#ifndef SAMPLER_TASK_PRIORITY
+#define SAMPLER_TASK_PRIORITY 6 // Above the uplink, a sample is never held up by a TLS handshake
+#endif
+
+#ifndef UPLINK_TASK_CORE
+#define UPLINK_TASK_CORE TASK_PROTOCOL_CORE // HTTPS requests, next to the network stack they feed
+#endif
+#ifndef UPLINK_TASK_PRIORITY
+#define UPLINK_TASK_PRIORITY 5 // Below the WiFi and lwIP tasks, which it waits on anyway
+#endif
+
+#ifndef PROVISIONING_TASK_CORE
+#define PROVISIONING_TASK_CORE TASK_PROTOCOL_CORE // Switches between WiFi and BLE, drives both stacks
+#endif
+#ifndef PROVISIONING_TASK_PRIORITY
+#define PROVISIONING_TASK_PRIORITY 5
+#endif
+
+#ifndef LED_TASK_CORE
+#define LED_TASK_CORE TASK_APP_CORE
+#endif
+#ifndef LED_TASK_PRIORITY
+#define LED_TASK_PRIORITY 1 // Just above idle, blinking never delays real work
+#endif
+
+#ifndef CONSOLE_TASK_CORE
+#define CONSOLE_TASK_CORE TASK_APP_CORE
+#endif
+#ifndef CONSOLE_TASK_PRIORITY
+#define CONSOLE_TASK_PRIORITY 1 // Diagnostics console, blocked on the UART until a command is typed
+#endif
\ No newline at end of file
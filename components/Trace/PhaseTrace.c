@@ -0,0 +1,134 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PhaseTrace.h"
+#include "esp_log.h"
+
+static const char TAG[] = "PhaseTrace";
+static const char *const phase_names[N_TRACE_PHASES] = {"cycle", "adc", "connect", "response", "parse", "request"};
+
+#if PHASE_TRACE_ENABLED
+// Written by any task without a lock: a writer claims a slot with a single atomic increment
+static struct trace_span ring[PHASE_TRACE_RING_SIZE];
+static uint32_t ring_head = 0; // Spans recorded since boot
+
+/**
+ * @brief Reads a slot of the ring, seqlock style: the copy is only valid if the slot still holds
+ * the same span once it is copied.
+ *
+ * @param position Position of the span since boot.
+ * @param span Output, the span.
+ * @return true if the span was read, false if it was being written or already overwritten.
+ */
+static bool ReadSpan(const uint32_t position, struct trace_span *span)
+{
+  const struct trace_span *slot = &ring[position & (PHASE_TRACE_RING_SIZE - 1)];
+  if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != position + 1)
+  {
+    return false;
+  }
+  span->start_us = __atomic_load_n(&slot->start_us, __ATOMIC_RELAXED);
+  span->duration_us = __atomic_load_n(&slot->duration_us, __ATOMIC_RELAXED);
+  span->phase = __atomic_load_n(&slot->phase, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  span->seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+  return span->seq == position + 1 && span->phase < N_TRACE_PHASES;
+}
+
+static int CompareDurations(const void *a, const void *b)
+{
+  const uint32_t x = *(const uint32_t *)a;
+  const uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+#endif
+
+/**
+ * @brief Records a span in the ring. Lock free, safe from any task; prefer the TRACE_SPAN and TRACE_RECORD
+ * macros, which compile to nothing when PHASE_TRACE_ENABLED is 0.
+ *
+ * @param phase Phase measured.
+ * @param start_us esp_timer_get_time at the start of the span.
+ * @param duration_us Length of the span.
+ */
+void TraceRecord(const enum trace_phase phase, const int64_t start_us, const int64_t duration_us)
+{
+#if PHASE_TRACE_ENABLED
+  const uint32_t position = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+  struct trace_span *slot = &ring[position & (PHASE_TRACE_RING_SIZE - 1)];
+  __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  // Plain 32-bit stores, relaxed only so a concurrent reader is well defined
+  __atomic_store_n(&slot->start_us, (uint32_t)start_us, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->duration_us, (duration_us > UINT32_MAX) ? UINT32_MAX : (uint32_t)duration_us, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->phase, (uint32_t)phase, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->seq, position + 1, __ATOMIC_RELEASE);
+#endif
+}
+
+/**
+ * @brief Computes the p50, p95 and max latency of every phase over the spans still in the ring,
+ * i.e. the last few cycles. Phases without spans are zeroed.
+ *
+ * @param summary Output, one entry per phase.
+ */
+void TraceSummarize(struct trace_phase_summary summary[N_TRACE_PHASES])
+{
+  memset(summary, 0, N_TRACE_PHASES * sizeof(summary[0]));
+#if PHASE_TRACE_ENABLED
+  uint32_t durations[PHASE_TRACE_RING_SIZE];
+  const uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+  const uint32_t n_positions = (head < PHASE_TRACE_RING_SIZE) ? head : PHASE_TRACE_RING_SIZE;
+  for (size_t phase = 0; phase < N_TRACE_PHASES; phase++)
+  {
+    size_t n = 0;
+    for (uint32_t position = head - n_positions; position != head; position++)
+    {
+      struct trace_span span;
+      if (ReadSpan(position, &span) && span.phase == phase)
+      {
+        durations[n++] = span.duration_us;
+      }
+    }
+    if (n == 0)
+    {
+      continue;
+    }
+    qsort(durations, n, sizeof(durations[0]), CompareDurations);
+    // Nearest rank
+    summary[phase].n_spans = n;
+    summary[phase].p50_us = durations[(n * 50 + 99) / 100 - 1];
+    summary[phase].p95_us = durations[(n * 95 + 99) / 100 - 1];
+    summary[phase].max_us = durations[n - 1];
+  }
+#endif
+}
+
+/**
+ * @brief Logs every span in the ring, oldest first, as one key=value line each.
+ */
+void TraceDump()
+{
+#if PHASE_TRACE_ENABLED
+  const uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+  const uint32_t n_positions = (head < PHASE_TRACE_RING_SIZE) ? head : PHASE_TRACE_RING_SIZE;
+  ESP_LOGI(TAG, "dump spans=%" PRIu32 " recorded=%" PRIu32, n_positions, head);
+  for (uint32_t position = head - n_positions; position != head; position++)
+  {
+    struct trace_span span;
+    if (ReadSpan(position, &span))
+    {
+      ESP_LOGI(TAG, "span seq=%" PRIu32 " phase=%s start_us=%" PRIu32 " duration_us=%" PRIu32,
+               span.seq, phase_names[span.phase], span.start_us, span.duration_us);
+    }
+  }
+#else
+  ESP_LOGI(TAG, "Tracing disabled, build with PHASE_TRACE_ENABLED set to 1");
+#endif
+}
+
+const char *TracePhaseName(const enum trace_phase phase)
+{
+  return (phase < N_TRACE_PHASES) ? phase_names[phase] : "unknown";
+}
\ No newline at end of file
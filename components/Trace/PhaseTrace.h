@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include "esp_timer.h"
+
+#ifndef PHASE_TRACE_ENABLED
+#define PHASE_TRACE_ENABLED 1 // Build with -DPHASE_TRACE_ENABLED=0 to compile every trace point out
+#endif
+#define PHASE_TRACE_RING_SIZE 256 // Spans kept, the oldest are overwritten. Must be a power of two
+
+/**
+ * @brief Phase of an update cycle a span measures.
+ */
+enum trace_phase
+{
+  TRACE_PHASE_CYCLE,    // Whole UpdateModuleState
+  TRACE_PHASE_ADC,      // ADC scan of the analog peripherals
+  TRACE_PHASE_CONNECT,  // DNS lookup, TCP connect and TLS handshake of a new connection
+  TRACE_PHASE_RESPONSE, // Request headers sent until the response is fully received
+  TRACE_PHASE_PARSE,    // Time spent scanning the response body, summed over its chunks
+  TRACE_PHASE_REQUEST,  // Whole HTTP request, retries included
+  N_TRACE_PHASES,
+};
+
+/**
+ * @brief One recorded span. The start is the low 32 bits of esp_timer_get_time, enough to order
+ * the spans of a dump.
+ */
+struct trace_span
+{
+  uint32_t seq; // Position in the ring plus one, written last. 0 or a mismatch means the slot is not readable
+  uint32_t start_us;
+  uint32_t duration_us;
+  uint32_t phase;
+};
+
+/**
+ * @brief Latency distribution of one phase over the spans in the ring.
+ */
+struct trace_phase_summary
+{
+  uint32_t n_spans;
+  uint32_t p50_us;
+  uint32_t p95_us;
+  uint32_t max_us;
+};
+
+#if PHASE_TRACE_ENABLED
+#define TRACE_NOW() esp_timer_get_time()
+#define TRACE_RECORD(phase, start_us, duration_us) TraceRecord((phase), (start_us), (duration_us))
+#define TRACE_SPAN(phase, start_us) TraceRecord((phase), (start_us), esp_timer_get_time() - (start_us))
+#else
+#define TRACE_NOW() ((int64_t)0)
+#define TRACE_RECORD(phase, start_us, duration_us) ((void)(start_us), (void)(duration_us))
+#define TRACE_SPAN(phase, start_us) ((void)(start_us))
+#endif
+
+void TraceRecord(const enum trace_phase phase, const int64_t start_us, const int64_t duration_us);
+void TraceSummarize(struct trace_phase_summary summary[N_TRACE_PHASES]);
+void TraceDump();
+const char *TracePhaseName(const enum trace_phase phase);
\ No newline at end of file
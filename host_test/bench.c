@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <time.h>
+#include "bench.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+// The ESP-IDF heap hook, defined by the code under test when it counts allocations itself (CycleMetrics)
+void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) __attribute__((weak));
+
+static struct bench_allocs allocs;
+
+static void CountAllocation(const size_t size)
+{
+  __atomic_add_fetch(&allocs.count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&allocs.bytes, size, __ATOMIC_RELAXED);
+  if (esp_heap_trace_alloc_hook != NULL)
+  {
+    esp_heap_trace_alloc_hook(NULL, size, 0);
+  }
+}
+
+void *__wrap_malloc(size_t size)
+{
+  CountAllocation(size);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+  CountAllocation(n * size);
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  CountAllocation(size);
+  return __real_realloc(ptr, size);
+}
+
+void BenchAllocsReset()
+{
+  __atomic_store_n(&allocs.count, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&allocs.bytes, 0, __ATOMIC_RELAXED);
+}
+
+struct bench_allocs BenchAllocs()
+{
+  return (struct bench_allocs){
+      .count = __atomic_load_n(&allocs.count, __ATOMIC_RELAXED),
+      .bytes = __atomic_load_n(&allocs.bytes, __ATOMIC_RELAXED),
+  };
+}
+
+uint64_t BenchNowNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+uint64_t BenchCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Measurements shared by the host benchmarks. Heap allocations are counted by wrapping malloc, calloc and realloc
+// at link time (host_bench target), so only the code linked into the benchmark is seen, not the C library itself.
+// Each allocation is also passed to esp_heap_trace_alloc_hook when the benchmark links one, as the IDF heap does.
+
+struct bench_allocs
+{
+  uint64_t count; // Number of allocations
+  uint64_t bytes; // Bytes requested
+};
+
+/**
+ * @brief Starts counting the heap allocations from zero.
+ */
+void BenchAllocsReset();
+
+/**
+ * @brief Returns the heap allocations made since the last BenchAllocsReset.
+ */
+struct bench_allocs BenchAllocs();
+
+/**
+ * @brief Monotonic time in nanoseconds.
+ */
+uint64_t BenchNowNs();
+
+/**
+ * @brief CPU cycle counter, 0 where the host has none that user code can read.
+ */
+uint64_t BenchCycles();
@@ -0,0 +1,98 @@
+#include <string.h>
+#include "bench.h"
+#include "host_test.h"
+#include "AdvParser.h"
+
+// Cost of checking a scan result for provisioning data, as the scan callback does, in a crowded environment:
+// beacons, phones and trackers with a provisioner now and then. Reports time, cycles and heap allocations per scan
+// result, for the advertisers that are rejected and for the provisioner. The parser must not allocate.
+//   bench_adv_parser [iterations]
+
+#define BENCH_DEFAULT_ITERATIONS 1000000
+#define BENCH_WIFI_UUID 0xDEAD // SHORT_WIFI_UUID_TARGET of the scanner
+
+struct bench_scan_result
+{
+  const char *name;
+  uint8_t data[62]; // Advertising data followed by the scan response, as in ble_adv
+  uint8_t adv_len;
+  uint8_t rsp_len;
+};
+
+static const struct bench_scan_result results[] = {
+    {"ibeacon",
+     {0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15, 0xE2, 0xC5, 0x6D, 0xB5, 0xDF, 0xFB, 0x48, 0xD2,
+      0xB0, 0x60, 0xD0, 0xF5, 0xA7, 0x10, 0x96, 0xE0, 0x00, 0x01, 0x00, 0x02, 0xC5},
+     30, 0},
+    {"eddystone uid",
+     {0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE, 0x17, 0x16, 0xAA, 0xFE, 0x00, 0xE7, 0x00, 0x01, 0x02, 0x03,
+      0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x00, 0x00},
+     31, 0},
+    {"phone",
+     {0x02, 0x01, 0x1A, 0x02, 0x0A, 0x0C, 0x0A, 0xFF, 0x4C, 0x00, 0x10, 0x06, 0x0B, 0x1E, 0x5A, 0x3B, 0x8C,
+      0x0C, 0x09, 'P', 'i', 'x', 'e', 'l', ' ', '7', ' ', 'P', 'r', 'o'},
+     17, 13},
+    {"tracker",
+     {0x1E, 0xFF, 0x4C, 0x00, 0x12, 0x19, 0x10, 0x8A, 0x1C, 0x6D, 0x3E, 0x99, 0x01, 0x42, 0xA7, 0x5C, 0x11,
+      0x90, 0x7E, 0x2B, 0x3D, 0xC4, 0x80, 0x05, 0x71, 0xE3, 0x0F, 0xB2, 0x01, 0x00, 0x00},
+     31, 0},
+    {"malformed", {0x02, 0x01, 0x06, 0x1F, 0x16, 0xAD, 0xDE, 'x'}, 8, 0},
+    {"provisioner",
+     {0x02, 0x01, 0x06, 0x0D, 0x16, 0xAD, 0xDE, 'g', 'r', 'e', 'e', 'n', 'h', 'o', 'u', 's', 'e', 0x0F, 0x16,
+      0xAD, 0xDE, 'c', 'o', 'r', 'r', 'e', 'c', 't', 'h', 'o', 'r', 's', 'e'},
+     17, 16},
+};
+
+static volatile size_t sink; // Keeps the results alive
+
+/**
+ * @brief The check of the scan callback (FindProvisioningData in LeScanner.c).
+ */
+static bool FindProvisioningData(const struct bench_scan_result *result, struct adv_field *adv, struct adv_field *rsp)
+{
+  if (!AdvFindServiceData16(result->data, result->adv_len, BENCH_WIFI_UUID, adv))
+  {
+    return false;
+  }
+  if (!AdvFindField(result->data + result->adv_len, result->rsp_len, ADV_TYPE_SERVICE_DATA_16, rsp) || rsp->len < 2)
+  {
+    return false;
+  }
+  rsp->data += 2;
+  rsp->len -= 2;
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  const uint32_t iterations = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+  TEST_CHECK(iterations > 0, "usage: %s [iterations]", argv[0]);
+
+  printf("%-14s %10s %12s %8s\n", "scan result", "ns/result", "cycles/result", "allocs");
+  for (size_t i = 0; i < sizeof(results) / sizeof(results[0]); i++)
+  {
+    const struct bench_scan_result *result = &results[i];
+    struct adv_field adv;
+    struct adv_field rsp;
+    const bool provisioner = strcmp(result->name, "provisioner") == 0;
+    TEST_CHECK(FindProvisioningData(result, &adv, &rsp) == provisioner, "%s misclassified", result->name);
+    TEST_CHECK(!provisioner || (adv.len == 10 && memcmp(adv.data, "greenhouse", 10) == 0 && rsp.len == 12 &&
+                                memcmp(rsp.data, "correcthorse", 12) == 0),
+               "provisioning data misparsed");
+
+    BenchAllocsReset();
+    const uint64_t start_ns = BenchNowNs();
+    const uint64_t start_cycles = BenchCycles();
+    for (uint32_t n = 0; n < iterations; n++)
+    {
+      sink += FindProvisioningData(result, &adv, &rsp);
+    }
+    const uint64_t cycles = BenchCycles() - start_cycles;
+    const uint64_t ns = BenchNowNs() - start_ns;
+    const struct bench_allocs allocs = BenchAllocs();
+    printf("%-14s %10.1f %12.1f %8llu\n", result->name, (double)ns / iterations, (double)cycles / iterations,
+           (unsigned long long)(allocs.count / iterations));
+    TEST_CHECK(allocs.count == 0, "%s: the parser allocated %llu times", result->name, (unsigned long long)allocs.count);
+  }
+  return 0;
+}
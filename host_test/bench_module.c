@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include "host_test.h"
+#include "bench.h"
+#include "mock_sarp_server.h"
+#include "Module.h"
+#include "HttpsClient.h"
+#include "CycleMetrics.h"
+#include "ReadingStore.h"
+#include "esp_http_client.h"
+#include "esp_partition.h"
+#include "esp_sleep.h"
+#include "nvs_flash.h"
+#include "esp_adc/adc_continuous.h"
+
+// Duty-cycled module on the host, against the mock SARP server: the first boot registers the module and its
+// peripherals, every following one is a timer wakeup through ModuleResume, and each ends in deep sleep, which ends
+// the module task and hands back to the harness. The hygrometer reading drifts from boot to boot so readings get
+// uploaded. Per boot it prints the CycleMetrics of the update cycle and the whole boot, and checks that the bytes the
+// HTTPS session counted on its socket are exactly the bytes the server received and sent. Requests go over plain HTTP to 127.0.0.1, TLS is only
+// counted on the device.
+//   bench_module [boots]
+// Statics that are not RTC memory on the device survive a wakeup here; the HTTPS client is dropped by hand, as a
+// reboot would.
+
+#define BENCH_DEFAULT_BOOTS 60 // An hour of wakeups at the valve period
+#define BENCH_STORE_SECTORS 16
+#define BENCH_BOOT_TIMEOUT_MS 30000
+#define BENCH_TOKEN_API "0c1d5e7a9b3f4d2c8e6a1b0f9d7c5e3a"
+#define BENCH_HYGROMETER_CHANNEL ADC_CHANNEL_7
+#define BENCH_THERMOMETER_CHANNEL ADC_CHANNEL_6
+#define BENCH_THERMOMETER_MV 610 // 35 °C, steady
+
+struct boot_totals
+{
+  uint64_t ns;
+  struct bench_allocs allocs;
+  uint32_t requests;
+  uint32_t handshakes;
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+};
+
+static uint32_t n_boots = 0;
+static uint32_t boots;
+static uint64_t boot_start_ns;
+static struct https_session_stats boot_start_https;
+static struct mock_server_stats boot_start_server;
+static struct boot_totals resume_totals;
+
+/**
+ * @brief Boots the module and waits until it deep sleeps.
+ */
+static void RunBoot()
+{
+  n_boots++;
+  // Drifts by 40 mV a boot, a little over the hygrometer deadband, and wraps every 20 boots
+  HostAdcSetMillivolts(ADC_UNIT_1, BENCH_HYGROMETER_CHANNEL, 1200 + (int)(n_boots % 20) * 40);
+  GetHttpsSessionStats(&boot_start_https);
+  MockSarpServerStats(&boot_start_server);
+  BenchAllocsReset();
+  boot_start_ns = BenchNowNs();
+  if (n_boots == 1)
+  {
+    ModuleInit();
+  }
+  else
+  {
+    TEST_CHECK(ModuleCanResume(), "boot %u: no module context to resume", n_boots);
+    ModuleResume();
+  }
+  TEST_CHECK(HostDeepSleepWait(BENCH_BOOT_TIMEOUT_MS), "boot %u did not end in deep sleep", n_boots);
+}
+
+/**
+ * @brief Reports the boot that just went to sleep and checks its byte counts against the server.
+ */
+static void EndBoot()
+{
+  const uint64_t ns = BenchNowNs() - boot_start_ns;
+  const struct bench_allocs allocs = BenchAllocs();
+  struct https_session_stats https;
+  struct mock_server_stats server;
+  struct cycle_metrics cycle;
+  GetHttpsSessionStats(&https);
+  MockSarpServerStats(&server);
+  CycleMetricsGetLast(&cycle);
+
+  const uint32_t requests = https.requests - boot_start_https.requests;
+  const uint32_t handshakes = https.handshakes - boot_start_https.handshakes;
+  const uint32_t bytes_sent = https.bytes_sent - boot_start_https.bytes_sent;
+  const uint32_t bytes_received = https.bytes_received - boot_start_https.bytes_received;
+  const uint64_t server_received = server.bytes_received - boot_start_server.bytes_received;
+  const uint64_t server_sent = server.bytes_sent - boot_start_server.bytes_sent;
+  printf("%5u %10.1f %6u %6u %6u %6u %8u %8u %10.1f %6llu %8llu %6u %6u %8u %8u\n", n_boots, cycle.wall_us / 1e3,
+         cycle.allocations, cycle.allocated_bytes, cycle.requests, cycle.handshakes, cycle.bytes_sent,
+         cycle.bytes_received, ns / 1e6, (unsigned long long)allocs.count, (unsigned long long)allocs.bytes, requests,
+         handshakes, bytes_sent, bytes_received);
+
+  TEST_CHECK(bytes_sent == server_received, "boot %u: %u bytes counted sent, the server received %llu", n_boots,
+             bytes_sent, (unsigned long long)server_received);
+  TEST_CHECK(bytes_received == server_sent, "boot %u: %u bytes counted received, the server sent %llu", n_boots,
+             bytes_received, (unsigned long long)server_sent);
+  TEST_CHECK(requests == 0 || (bytes_sent > 0 && bytes_received > 0), "boot %u: requests without bytes", n_boots);
+  TEST_CHECK(cycle.bytes_sent <= bytes_sent && cycle.bytes_received <= bytes_received && cycle.requests <= requests,
+             "boot %u: update cycle counts more than its boot", n_boots);
+  if (n_boots > 1)
+  {
+    // A wakeup has no connection yet: the first request of the cycle opens one, and the client allocates
+    TEST_CHECK(cycle.handshakes == (cycle.requests > 0), "boot %u: %u handshakes for %u requests", n_boots,
+               cycle.handshakes, cycle.requests);
+    TEST_CHECK(cycle.requests == 0 || cycle.allocations > 0, "boot %u: client setup not counted as allocations", n_boots);
+    resume_totals.ns += ns;
+    resume_totals.allocs.count += allocs.count;
+    resume_totals.allocs.bytes += allocs.bytes;
+    resume_totals.requests += requests;
+    resume_totals.handshakes += handshakes;
+    resume_totals.bytes_sent += bytes_sent;
+    resume_totals.bytes_received += bytes_received;
+  }
+  else
+  {
+    TEST_CHECK(requests >= 3 && handshakes >= 1, "first boot: %u requests, %u handshakes", requests, handshakes);
+  }
+}
+
+static void Summary()
+{
+  struct mock_server_stats server;
+  MockSarpServerStats(&server);
+  printf("server:");
+  for (int route = 0; route < N_MOCK_ROUTES; route++)
+  {
+    printf(" %s=%u", MockSarpRouteName(route), server.requests[route]);
+  }
+  printf(" connections=%u\n", server.connections);
+  const uint32_t n = boots - 1;
+  if (n > 0)
+  {
+    printf("per wakeup: %.2f ms, %.1f allocs, %.0f alloc bytes, %.2f requests, %.2f handshakes, tx %.0f, rx %.0f\n",
+           resume_totals.ns / 1e6 / n, (double)resume_totals.allocs.count / n, (double)resume_totals.allocs.bytes / n,
+           (double)resume_totals.requests / n, (double)resume_totals.handshakes / n,
+           (double)resume_totals.bytes_sent / n, (double)resume_totals.bytes_received / n);
+  }
+  TEST_CHECK(server.requests[MOCK_ROUTE_REGISTER_MODULE] == 1, "module registered %u times",
+             server.requests[MOCK_ROUTE_REGISTER_MODULE]);
+  TEST_CHECK(server.requests[MOCK_ROUTE_REGISTER_PERIPHERALS] == 1 && server.requests[MOCK_ROUTE_REGISTER_PERIPHERAL] == 0,
+             "peripherals not registered in one request");
+  TEST_CHECK(server.requests[MOCK_ROUTE_STATE] > 0, "valve state never polled");
+  TEST_CHECK(server.requests[MOCK_ROUTE_DIAGNOSTICS] > 0, "no diagnostics record");
+  TEST_CHECK(boots < 10 || server.requests[MOCK_ROUTE_DATA_BATCH] + server.requests[MOCK_ROUTE_DATA] > 0,
+             "no reading uploaded in %u boots", boots);
+  TEST_CHECK(server.requests[MOCK_ROUTE_UNKNOWN] == 0, "%u requests to unknown routes", server.requests[MOCK_ROUTE_UNKNOWN]);
+}
+
+int main(int argc, char **argv)
+{
+  boots = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_BOOTS;
+  TEST_CHECK(boots > 0, "at least one boot");
+  const uint16_t port = MockSarpServerStart();
+  TEST_CHECK(port != 0, "mock server failed to start");
+  HostHttpClientRedirect("127.0.0.1", port);
+  HostPartitionSetup(READING_STORE_PARTITION_LABEL, READING_STORE_PARTITION_SUBTYPE, BENCH_STORE_SECTORS * 4096);
+  TEST_CHECK(nvs_flash_init() == ESP_OK, "nvs init failed");
+  HostAdcSetMillivolts(ADC_UNIT_1, BENCH_THERMOMETER_CHANNEL, BENCH_THERMOMETER_MV);
+  ModuleLoadConfig();
+  RegisterTokenAPI(BENCH_TOKEN_API);
+
+  printf("                        update cycle                                           whole boot\n");
+  printf(" boot    wall_ms allocs  bytes   reqs  hands       tx       rx    wall_ms allocs    bytes   reqs  hands       tx       rx\n");
+  while (n_boots < boots)
+  {
+    RunBoot();
+    EndBoot();
+    CloseHttpsSession(); // The reboot drops the client
+  }
+  Summary();
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include <stdint.h>
+#include "host_test.h"
+#include "bench.h"
+#include "mock_sarp_server.h"
+#include "Module.h"
+#include "HttpsClient.h"
+#include "CycleMetrics.h"
+#include "ReadingStore.h"
+#include "esp_http_client.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+#include "esp_adc/adc_continuous.h"
+
+// Always-on module on the host, against the mock SARP server: ModuleInit registers the module and its peripherals
+// and starts the sampler and uplink tasks, then every wakeup of the sampler is driven by firing its timer, which
+// skips the time to the deadline. The sampler hands the readings and the valve polls over to the uplink (there is no
+// push channel on the host). A wakeup ends once both tasks are idle again. Per wakeup it prints the time, heap
+// allocations, requests and bytes of both tasks together, and checks that the bytes the HTTPS session counted on its
+// socket are exactly the bytes the server received and sent. Requests go over plain HTTP to 127.0.0.1, TLS is only
+// counted on the device.
+//   bench_module_always_on [wakeups]
+
+#define BENCH_DEFAULT_WAKEUPS 120 // Close to an hour of module time at the default periods
+#define BENCH_STORE_SECTORS 16
+#define BENCH_WAKEUP_TIMEOUT_MS 30000
+#define BENCH_TOKEN_API "0c1d5e7a9b3f4d2c8e6a1b0f9d7c5e3a"
+#define BENCH_HYGROMETER_CHANNEL ADC_CHANNEL_7
+#define BENCH_THERMOMETER_CHANNEL ADC_CHANNEL_6
+#define BENCH_THERMOMETER_MV 610 // 35 °C, steady
+
+struct wakeup_totals
+{
+  uint64_t ns;
+  struct bench_allocs allocs;
+  uint32_t requests;
+  uint32_t handshakes;
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+};
+
+static uint32_t n_wakeups = 0; // 0 is ModuleInit
+static uint32_t wakeups;
+static uint64_t wakeup_start_ns;
+static struct https_session_stats wakeup_start_https;
+static struct mock_server_stats wakeup_start_server;
+static struct wakeup_totals totals;
+static TaskHandle_t sampler;
+static TaskHandle_t uplink;
+
+/**
+ * @brief Waits until the sampler and then the uplink it handed over to are done with the wakeup.
+ */
+static void WaitIdle()
+{
+  TEST_CHECK(HostTaskWaitIdle(sampler, BENCH_WAKEUP_TIMEOUT_MS), "wakeup %u: sampler still busy", n_wakeups);
+  TEST_CHECK(HostTaskWaitIdle(uplink, BENCH_WAKEUP_TIMEOUT_MS), "wakeup %u: uplink still busy", n_wakeups);
+}
+
+/**
+ * @brief Starts the module, or wakes the sampler up at its next deadline, and waits until both tasks are idle.
+ */
+static void RunWakeup()
+{
+  // Drifts by 40 mV a wakeup, a little over the hygrometer deadband, and wraps every 20 wakeups
+  HostAdcSetMillivolts(ADC_UNIT_1, BENCH_HYGROMETER_CHANNEL, 1200 + (int)(n_wakeups % 20) * 40);
+  GetHttpsSessionStats(&wakeup_start_https);
+  MockSarpServerStats(&wakeup_start_server);
+  BenchAllocsReset();
+  wakeup_start_ns = BenchNowNs();
+  if (n_wakeups == 0)
+  {
+    ModuleInit();
+    sampler = HostTaskGet("module_sampler");
+    uplink = HostTaskGet("module_uplink");
+    TEST_CHECK(sampler != NULL && uplink != NULL, "ModuleInit did not start the sampler and the uplink");
+  }
+  else
+  {
+    TEST_CHECK(HostTimerFireNext(BENCH_WAKEUP_TIMEOUT_MS), "wakeup %u: wakeup timer not armed", n_wakeups);
+  }
+  WaitIdle();
+}
+
+/**
+ * @brief Reports the wakeup that just ended and checks its byte counts against the server.
+ */
+static void EndWakeup()
+{
+  const uint64_t ns = BenchNowNs() - wakeup_start_ns;
+  const struct bench_allocs allocs = BenchAllocs();
+  struct https_session_stats https;
+  struct mock_server_stats server;
+  struct cycle_metrics last;
+  GetHttpsSessionStats(&https);
+  MockSarpServerStats(&server);
+  CycleMetricsGetLast(&last);
+
+  const uint32_t requests = https.requests - wakeup_start_https.requests;
+  const uint32_t handshakes = https.handshakes - wakeup_start_https.handshakes;
+  const uint32_t bytes_sent = https.bytes_sent - wakeup_start_https.bytes_sent;
+  const uint32_t bytes_received = https.bytes_received - wakeup_start_https.bytes_received;
+  const uint64_t server_received = server.bytes_received - wakeup_start_server.bytes_received;
+  const uint64_t server_sent = server.bytes_sent - wakeup_start_server.bytes_sent;
+  printf("%6u %9.1f %6u %10.1f %6llu %8llu %6u %6u %8u %8u\n", n_wakeups, esp_timer_get_time() / 1e6, last.cycle,
+         ns / 1e6, (unsigned long long)allocs.count, (unsigned long long)allocs.bytes, requests, handshakes, bytes_sent,
+         bytes_received);
+
+  TEST_CHECK(bytes_sent == server_received, "wakeup %u: %u bytes counted sent, the server received %llu", n_wakeups,
+             bytes_sent, (unsigned long long)server_received);
+  TEST_CHECK(bytes_received == server_sent, "wakeup %u: %u bytes counted received, the server sent %llu", n_wakeups,
+             bytes_received, (unsigned long long)server_sent);
+  TEST_CHECK(requests == 0 || (bytes_sent > 0 && bytes_received > 0), "wakeup %u: requests without bytes", n_wakeups);
+  if (n_wakeups > 0)
+  {
+    totals.ns += ns;
+    totals.allocs.count += allocs.count;
+    totals.allocs.bytes += allocs.bytes;
+    totals.requests += requests;
+    totals.handshakes += handshakes;
+    totals.bytes_sent += bytes_sent;
+    totals.bytes_received += bytes_received;
+  }
+  else
+  {
+    TEST_CHECK(requests >= 3 && handshakes >= 1, "init: %u requests, %u handshakes", requests, handshakes);
+  }
+}
+
+static void Summary()
+{
+  struct mock_server_stats server;
+  MockSarpServerStats(&server);
+  printf("server:");
+  for (int route = 0; route < N_MOCK_ROUTES; route++)
+  {
+    printf(" %s=%u", MockSarpRouteName(route), server.requests[route]);
+  }
+  printf(" connections=%u\n", server.connections);
+  const uint32_t n = wakeups;
+  if (n > 0)
+  {
+    printf("per wakeup: %.2f ms, %.1f allocs, %.0f alloc bytes, %.2f requests, %.2f handshakes, tx %.0f, rx %.0f\n",
+           totals.ns / 1e6 / n, (double)totals.allocs.count / n, (double)totals.allocs.bytes / n,
+           (double)totals.requests / n, (double)totals.handshakes / n, (double)totals.bytes_sent / n,
+           (double)totals.bytes_received / n);
+  }
+  TEST_CHECK(server.requests[MOCK_ROUTE_REGISTER_MODULE] == 1, "module registered %u times",
+             server.requests[MOCK_ROUTE_REGISTER_MODULE]);
+  TEST_CHECK(server.requests[MOCK_ROUTE_REGISTER_PERIPHERALS] == 1 && server.requests[MOCK_ROUTE_REGISTER_PERIPHERAL] == 0,
+             "peripherals not registered in one request");
+  TEST_CHECK(server.requests[MOCK_ROUTE_STATE] > 0, "valve state never polled through the uplink");
+  TEST_CHECK(server.requests[MOCK_ROUTE_DIAGNOSTICS] > 0, "no diagnostics record");
+  TEST_CHECK(wakeups < 10 || server.requests[MOCK_ROUTE_DATA_BATCH] + server.requests[MOCK_ROUTE_DATA] > 0,
+             "no reading handed over and uploaded in %u wakeups", wakeups);
+  TEST_CHECK(server.requests[MOCK_ROUTE_UNKNOWN] == 0, "%u requests to unknown routes", server.requests[MOCK_ROUTE_UNKNOWN]);
+}
+
+int main(int argc, char **argv)
+{
+  wakeups = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_WAKEUPS;
+  const uint16_t port = MockSarpServerStart();
+  TEST_CHECK(port != 0, "mock server failed to start");
+  HostHttpClientRedirect("127.0.0.1", port);
+  HostPartitionSetup(READING_STORE_PARTITION_LABEL, READING_STORE_PARTITION_SUBTYPE, BENCH_STORE_SECTORS * 4096);
+  TEST_CHECK(nvs_flash_init() == ESP_OK, "nvs init failed");
+  HostAdcSetMillivolts(ADC_UNIT_1, BENCH_THERMOMETER_CHANNEL, BENCH_THERMOMETER_MV);
+  ModuleLoadConfig();
+  RegisterTokenAPI(BENCH_TOKEN_API);
+
+  printf("                                       sampler and uplink\n");
+  printf("wakeup    time_s  cycle    wall_ms allocs    bytes   reqs  hands       tx       rx\n");
+  for (;;)
+  {
+    RunWakeup();
+    EndWakeup();
+    if (n_wakeups == wakeups)
+    {
+      break;
+    }
+    n_wakeups++;
+  }
+  Summary();
+  return 0;
+}
@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "host_test.h"
+#include "SarpCodec.h"
+#include "HttpsClient.h"
+#ifdef SARP_BENCH_CJSON
+#include "cJSON.h"
+#endif
+
+// Cost of every SARP message the module sends or parses, with the codec and, when cJSON was found at configure time,
+// with the cJSON calls HttpsClient made before the codec. Reports time, cycles and heap allocations per message.
+// The codec must not allocate: the benchmark fails if it does.
+//   bench_sarp_codec [iterations]
+
+#define BENCH_DEFAULT_ITERATIONS 100000
+#define BENCH_BATCH_READINGS 16
+#define BENCH_BODY_SIZE (MAX_BATCH_READINGS * SARP_MAX_READING_JSON_SIZE + 16)
+#define BENCH_TOKEN_SIZE 65
+
+static const char token_api[] = "3f2a9c41d07e4b5a8c6d1e2f3a4b5c6d";
+static const char module_token[] = "9b8a7c6d5e4f30211203f4e5d6c7b8a99b8a7c6d5e4f30211203f4e5d6c7b8a9";
+static const char register_module_response[] =
+    "{\"id\":12,\"token_api\":\"3f2a9c41d07e4b5a8c6d1e2f3a4b5c6d\",\"created_at\":\"2024-05-02T10:11:12.123456Z\","
+    "\"moduleToken\":\"9b8a7c6d5e4f30211203f4e5d6c7b8a99b8a7c6d5e4f30211203f4e5d6c7b8a9\"}";
+static const char register_peripheral_response[] =
+    "{\"parent_module\":\"9b8a7c6d5e4f30211203f4e5d6c7b8a99b8a7c6d5e4f30211203f4e5d6c7b8a9\","
+    "\"p_type\":\"soil_moisture\",\"created_at\":\"2024-05-02T10:11:12.123456Z\",\"id\":4711}";
+static const char state_response[] = "{\"id\":4712,\"p_type\":\"valve\",\"state\":\"on\",\"updated_at\":\"2024-05-02T10:11:12Z\"}";
+
+static struct peripheral_data readings[BENCH_BATCH_READINGS];
+static char body[BENCH_BODY_SIZE];
+static volatile size_t sink; // Keeps the results alive
+
+struct bench_message
+{
+  const char *name;
+  bool (*codec)();
+  bool (*cjson)();
+};
+
+static bool CodecRegisterModule()
+{
+  const int len = SarpEncodeRegisterModule(body, sizeof(body), token_api);
+  sink += (size_t)len;
+  return len > 0;
+}
+
+static bool CodecRegisterPeripheral()
+{
+  const int len = SarpEncodeRegisterPeripheral(body, sizeof(body), module_token, "soil_moisture", 0);
+  sink += (size_t)len;
+  return len > 0;
+}
+
+static bool CodecDataBatch()
+{
+  const int len = SarpEncodePeripheralDataBatch(body, sizeof(body), readings, BENCH_BATCH_READINGS);
+  sink += (size_t)len;
+  return len > 0;
+}
+
+static bool CodecModuleToken()
+{
+  char token[BENCH_TOKEN_SIZE];
+  const esp_err_t err = SarpDecodeString(register_module_response, sizeof(register_module_response) - 1, "moduleToken",
+                                         token, sizeof(token));
+  sink += (size_t)token[0];
+  return err == ESP_OK;
+}
+
+static bool CodecPeripheralId()
+{
+  uint32_t id = 0;
+  const esp_err_t err = SarpDecodeUint32(register_peripheral_response, sizeof(register_peripheral_response) - 1, "id", &id);
+  sink += id;
+  return err == ESP_OK && id == 4711;
+}
+
+static bool CodecState()
+{
+  char state[8];
+  const esp_err_t err = SarpDecodeString(state_response, sizeof(state_response) - 1, "state", state, sizeof(state));
+  sink += (size_t)state[0];
+  return err == ESP_OK;
+}
+
+#ifdef SARP_BENCH_CJSON
+// The cJSON calls of HttpsClient before the codec: the body is printed into a malloc'd string, the response parsed
+// into a tree and the result copied out of it.
+static bool PrintAndFree(cJSON *json)
+{
+  char *printed = cJSON_PrintUnformatted(json);
+  cJSON_Delete(json);
+  if (printed == NULL)
+  {
+    return false;
+  }
+  sink += strlen(printed);
+  free(printed);
+  return true;
+}
+
+static bool CjsonRegisterModule()
+{
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddStringToObject(json, "token_api", token_api);
+  return PrintAndFree(json);
+}
+
+static bool CjsonRegisterPeripheral()
+{
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddStringToObject(json, "parent_module", module_token);
+  cJSON_AddStringToObject(json, "p_type", "soil_moisture");
+  return PrintAndFree(json);
+}
+
+static bool CjsonDataBatch()
+{
+  cJSON *json = cJSON_CreateObject();
+  cJSON *data = cJSON_AddArrayToObject(json, "data");
+  for (size_t i = 0; i < BENCH_BATCH_READINGS; i++)
+  {
+    cJSON *reading = cJSON_CreateObject();
+    cJSON_AddNumberToObject(reading, "peripheral_id", readings[i].peripheral_id);
+    cJSON_AddNumberToObject(reading, "value", readings[i].value);
+    cJSON_AddNumberToObject(reading, "timestamp", (double)readings[i].timestamp);
+    cJSON_AddItemToArray(data, reading);
+  }
+  return PrintAndFree(json);
+}
+
+static bool CjsonString(const char *response, const char *key)
+{
+  cJSON *json = cJSON_Parse(response);
+  cJSON *member = cJSON_GetObjectItem(json, key);
+  if (member == NULL || member->type != cJSON_String)
+  {
+    cJSON_Delete(json);
+    return false;
+  }
+  const size_t len = strlen(member->valuestring);
+  char *copy = malloc(len + 1);
+  memcpy(copy, member->valuestring, len + 1);
+  cJSON_Delete(json);
+  sink += (size_t)copy[0];
+  free(copy);
+  return true;
+}
+
+static bool CjsonModuleToken()
+{
+  return CjsonString(register_module_response, "moduleToken");
+}
+
+static bool CjsonPeripheralId()
+{
+  cJSON *json = cJSON_Parse(register_peripheral_response);
+  cJSON *member = cJSON_GetObjectItem(json, "id");
+  const bool found = member != NULL && member->type == cJSON_Number && member->valueint == 4711;
+  cJSON_Delete(json);
+  return found;
+}
+
+static bool CjsonState()
+{
+  return CjsonString(state_response, "state");
+}
+#endif
+
+static const struct bench_message messages[] = {
+#ifdef SARP_BENCH_CJSON
+    {"register module body", CodecRegisterModule, CjsonRegisterModule},
+    {"register peripheral body", CodecRegisterPeripheral, CjsonRegisterPeripheral},
+    {"data batch body (16)", CodecDataBatch, CjsonDataBatch},
+    {"moduleToken response", CodecModuleToken, CjsonModuleToken},
+    {"id response", CodecPeripheralId, CjsonPeripheralId},
+    {"state response", CodecState, CjsonState},
+#else
+    {"register module body", CodecRegisterModule, NULL},
+    {"register peripheral body", CodecRegisterPeripheral, NULL},
+    {"data batch body (16)", CodecDataBatch, NULL},
+    {"moduleToken response", CodecModuleToken, NULL},
+    {"id response", CodecPeripheralId, NULL},
+    {"state response", CodecState, NULL},
+#endif
+};
+
+/**
+ * @brief Runs one message iterations times and prints its cost.
+ *
+ * @return struct bench_allocs Allocations made per message.
+ */
+static struct bench_allocs Run(const char *name, const char *path, bool (*message)(), const uint32_t iterations)
+{
+  TEST_CHECK(message(), "%s (%s) failed", name, path); // Warm up, and check the result once
+  BenchAllocsReset();
+  const uint64_t start_ns = BenchNowNs();
+  const uint64_t start_cycles = BenchCycles();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    message();
+  }
+  const uint64_t cycles = BenchCycles() - start_cycles;
+  const uint64_t ns = BenchNowNs() - start_ns;
+  const struct bench_allocs total = BenchAllocs();
+  const struct bench_allocs per_message = {.count = total.count / iterations, .bytes = total.bytes / iterations};
+  printf("%-26s %-6s %10.1f %12.1f %8llu %10llu\n", name, path, (double)ns / iterations, (double)cycles / iterations,
+         (unsigned long long)per_message.count, (unsigned long long)per_message.bytes);
+  return total;
+}
+
+int main(int argc, char **argv)
+{
+  const uint32_t iterations = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+  TEST_CHECK(iterations > 0, "usage: %s [iterations]", argv[0]);
+  for (size_t i = 0; i < BENCH_BATCH_READINGS; i++)
+  {
+    readings[i] = (struct peripheral_data){.peripheral_id = 4700 + i, .value = 20.0 + i * 1.375, .timestamp = 1714644672 + i};
+  }
+
+  printf("%-26s %-6s %10s %12s %8s %10s\n", "message", "path", "ns/msg", "cycles/msg", "allocs", "bytes");
+  for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++)
+  {
+    const struct bench_allocs codec = Run(messages[i].name, "codec", messages[i].codec, iterations);
+    TEST_CHECK(codec.count == 0, "%s: the codec allocated %llu times", messages[i].name, (unsigned long long)codec.count);
+    if (messages[i].cjson != NULL)
+    {
+      Run(messages[i].name, "cjson", messages[i].cjson, iterations);
+    }
+  }
+#ifndef SARP_BENCH_CJSON
+  printf("Built without cJSON (configure with CJSON_DIR or IDF_PATH set), codec only\n");
+#endif
+  return 0;
+}
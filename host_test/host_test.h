@@ -0,0 +1,17 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+
+// Minimal assertions shared by the host tests: a failed check prints where and why, and the test exits with 1 so
+// ctest reports it
+#define TEST_CHECK(condition, ...)                                            \
+  do                                                                          \
+  {                                                                           \
+    if (!(condition))                                                         \
+    {                                                                         \
+      fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+      fprintf(stderr, __VA_ARGS__);                                           \
+      fputc('\n', stderr);                                                    \
+      exit(1);                                                                \
+    }                                                                         \
+  } while (0)
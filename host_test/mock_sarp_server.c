@@ -0,0 +1,275 @@
+#define _GNU_SOURCE // strcasestr
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "mock_sarp_server.h"
+
+#define MOCK_REQUEST_SIZE 8192 // Largest request, head and body: a full data batch or a diagnostics record
+#define MOCK_RESPONSE_SIZE 512
+#define MOCK_MODULE_TOKEN "5f0c8a2e-3b71-4d9e-a6c4-29e81f7b0d53"
+#define MOCK_FIRST_PERIPHERAL_ID 4700
+
+struct mock_request
+{
+  char method[8];
+  char path[128];
+  const char *body;
+  size_t body_len;
+};
+
+static const char *const route_names[N_MOCK_ROUTES] = {
+    "register module", "register peripheral", "register peripherals", "state",
+    "data", "data batch", "events", "diagnostics", "unknown",
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_server_stats stats;
+static int listen_fd = -1;
+static uint32_t next_peripheral_id = MOCK_FIRST_PERIPHERAL_ID;
+// Only touched by the server thread
+static char request_buf[MOCK_REQUEST_SIZE + 1];
+static char response_buf[MOCK_RESPONSE_SIZE];
+static char response_body[MOCK_RESPONSE_SIZE];
+
+const char *MockSarpRouteName(const enum mock_route route)
+{
+  return (route < N_MOCK_ROUTES) ? route_names[route] : "?";
+}
+
+/**
+ * @brief Copies the counters, consistent with each other.
+ */
+void MockSarpServerStats(struct mock_server_stats *out)
+{
+  pthread_mutex_lock(&stats_lock);
+  *out = stats;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+static void Count(const uint64_t received, const uint64_t sent)
+{
+  pthread_mutex_lock(&stats_lock);
+  stats.bytes_received += received;
+  stats.bytes_sent += sent;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+static enum mock_route Route(const struct mock_request *request)
+{
+  const bool post = strcmp(request->method, "POST") == 0;
+  if (strcmp(request->method, "GET") == 0 && strncmp(request->path, "/api/peripheral/state/", 22) == 0)
+  {
+    return MOCK_ROUTE_STATE;
+  }
+  static const struct
+  {
+    const char *path;
+    enum mock_route route;
+  } posts[] = {
+      {"/api/module/", MOCK_ROUTE_REGISTER_MODULE},
+      {"/api/module/diagnostics", MOCK_ROUTE_DIAGNOSTICS},
+      {"/api/peripheral/", MOCK_ROUTE_REGISTER_PERIPHERAL},
+      {"/api/peripheral/batch", MOCK_ROUTE_REGISTER_PERIPHERALS},
+      {"/api/peripheral/data", MOCK_ROUTE_DATA},
+      {"/api/peripheral/data/batch", MOCK_ROUTE_DATA_BATCH},
+      {"/api/peripheral/events", MOCK_ROUTE_EVENTS},
+  };
+  for (size_t i = 0; post && i < sizeof(posts) / sizeof(posts[0]); i++)
+  {
+    if (strcmp(request->path, posts[i].path) == 0)
+    {
+      return posts[i].route;
+    }
+  }
+  return MOCK_ROUTE_UNKNOWN;
+}
+
+/**
+ * @brief Number of peripheral types in a bulk registration body, one id is answered for each.
+ */
+static size_t CountTypes(const struct mock_request *request)
+{
+  const char *types = strstr(request->body, "\"p_types\":[");
+  if (types == NULL)
+  {
+    return 0;
+  }
+  size_t n = 0;
+  for (const char *c = types + 11; *c != ']' && *c != '\0'; c++)
+  {
+    n += (*c == '"');
+  }
+  return n / 2;
+}
+
+/**
+ * @brief Writes the body of the answer to a request.
+ *
+ * @return int The HTTP status.
+ */
+static int Answer(const struct mock_request *request, const enum mock_route route)
+{
+  switch (route)
+  {
+  case MOCK_ROUTE_REGISTER_MODULE:
+    snprintf(response_body, sizeof(response_body),
+             "{\"id\":12,\"created_at\":\"2024-05-02T10:11:12.123456Z\",\"moduleToken\":\"" MOCK_MODULE_TOKEN "\"}");
+    return 201;
+  case MOCK_ROUTE_REGISTER_PERIPHERAL:
+    snprintf(response_body, sizeof(response_body), "{\"parent_module\":\"" MOCK_MODULE_TOKEN "\",\"id\":%u}",
+             next_peripheral_id++);
+    return 201;
+  case MOCK_ROUTE_REGISTER_PERIPHERALS:
+  {
+    const size_t n_types = CountTypes(request);
+    int len = snprintf(response_body, sizeof(response_body), "{\"ids\":[");
+    for (size_t i = 0; i < n_types && len < (int)sizeof(response_body); i++)
+    {
+      len += snprintf(response_body + len, sizeof(response_body) - len, "%s%u", (i > 0) ? "," : "", next_peripheral_id++);
+    }
+    if (len < (int)sizeof(response_body))
+    {
+      snprintf(response_body + len, sizeof(response_body) - len, "]}");
+    }
+    return (n_types > 0) ? 201 : 400;
+  }
+  case MOCK_ROUTE_STATE:
+    snprintf(response_body, sizeof(response_body), "{\"id\":%s,\"p_type\":\"valve\",\"state\":\"off\"}", request->path + 22);
+    return 200;
+  case MOCK_ROUTE_UNKNOWN:
+    snprintf(response_body, sizeof(response_body), "{\"detail\":\"Not found.\"}");
+    return 404;
+  default:
+    snprintf(response_body, sizeof(response_body), "{}");
+    return 201;
+  }
+}
+
+/**
+ * @brief Reads one request, head and Content-Length body.
+ *
+ * @return ssize_t Bytes the request took, 0 once the client closed the connection, -1 on error.
+ */
+static ssize_t ReadRequest(const int fd, struct mock_request *request)
+{
+  size_t len = 0;
+  char *end = NULL;
+  while (end == NULL)
+  {
+    if (len == MOCK_REQUEST_SIZE)
+    {
+      return -1;
+    }
+    const ssize_t n = recv(fd, request_buf + len, MOCK_REQUEST_SIZE - len, 0);
+    if (n <= 0)
+    {
+      return (n == 0 && len == 0) ? 0 : -1;
+    }
+    len += n;
+    request_buf[len] = '\0';
+    end = strstr(request_buf, "\r\n\r\n");
+  }
+  if (sscanf(request_buf, "%7s %127s", request->method, request->path) != 2)
+  {
+    return -1;
+  }
+  size_t content_length = 0;
+  const char *header = strcasestr(request_buf, "\r\nContent-Length:");
+  if (header != NULL && header < end)
+  {
+    content_length = strtoul(header + 17, NULL, 10);
+  }
+  const size_t head_len = (size_t)(end + 4 - request_buf);
+  if (head_len + content_length > MOCK_REQUEST_SIZE)
+  {
+    return -1;
+  }
+  while (len < head_len + content_length)
+  {
+    const ssize_t n = recv(fd, request_buf + len, head_len + content_length - len, 0);
+    if (n <= 0)
+    {
+      return -1;
+    }
+    len += n;
+  }
+  request_buf[head_len + content_length] = '\0';
+  request->body = request_buf + head_len;
+  request->body_len = content_length;
+  return (ssize_t)len;
+}
+
+static void Serve(const int fd)
+{
+  for (;;)
+  {
+    struct mock_request request;
+    const ssize_t received = ReadRequest(fd, &request);
+    if (received <= 0)
+    {
+      return;
+    }
+    const enum mock_route route = Route(&request);
+    const int status = Answer(&request, route);
+    const int len = snprintf(response_buf, sizeof(response_buf),
+                             "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s", status,
+                             (status < 300) ? "OK" : "Error", strlen(response_body), response_body);
+    // Counted before the answer goes out, so the client never sees bytes the counters do not have yet
+    pthread_mutex_lock(&stats_lock);
+    stats.requests[route]++;
+    pthread_mutex_unlock(&stats_lock);
+    Count(received, len);
+    if (send(fd, response_buf, len, MSG_NOSIGNAL) != len)
+    {
+      return;
+    }
+  }
+}
+
+static void *ServerThread(void *arg)
+{
+  for (;;)
+  {
+    const int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      continue;
+    }
+    pthread_mutex_lock(&stats_lock);
+    stats.connections++;
+    pthread_mutex_unlock(&stats_lock);
+    Serve(fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Starts the server on an ephemeral port of 127.0.0.1.
+ *
+ * @return uint16_t The port, 0 on failure.
+ */
+uint16_t MockSarpServerStart()
+{
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t addr_len = sizeof(addr);
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 4) != 0 ||
+      getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) != 0)
+  {
+    return 0;
+  }
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, ServerThread, NULL) != 0)
+  {
+    return 0;
+  }
+  pthread_detach(thread);
+  return ntohs(addr.sin_port);
+}
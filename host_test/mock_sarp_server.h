@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+
+// In-process stand-in for the SARP server, for the host tests that run the module: plain HTTP/1.1 with keep-alive on
+// 127.0.0.1, one connection at a time, on a thread of its own. It answers every route of the API the module uses and
+// counts the requests and the bytes it received and sent. It never allocates, so the heap counts of a benchmark
+// only see the module.
+
+enum mock_route
+{
+  MOCK_ROUTE_REGISTER_MODULE,      // POST /api/module/
+  MOCK_ROUTE_REGISTER_PERIPHERAL,  // POST /api/peripheral/
+  MOCK_ROUTE_REGISTER_PERIPHERALS, // POST /api/peripheral/batch
+  MOCK_ROUTE_STATE,                // GET /api/peripheral/state/<id>
+  MOCK_ROUTE_DATA,                 // POST /api/peripheral/data
+  MOCK_ROUTE_DATA_BATCH,           // POST /api/peripheral/data/batch
+  MOCK_ROUTE_EVENTS,               // POST /api/peripheral/events
+  MOCK_ROUTE_DIAGNOSTICS,          // POST /api/module/diagnostics
+  MOCK_ROUTE_UNKNOWN,              // Answered with 404
+  N_MOCK_ROUTES,
+};
+
+struct mock_server_stats
+{
+  uint32_t requests[N_MOCK_ROUTES];
+  uint32_t connections;    // Connections accepted
+  uint64_t bytes_received; // Requests, head and body
+  uint64_t bytes_sent;     // Responses, head and body
+};
+
+uint16_t MockSarpServerStart();
+void MockSarpServerStats(struct mock_server_stats *stats);
+const char *MockSarpRouteName(const enum mock_route route);
@@ -0,0 +1,77 @@
+#include <stdbool.h>
+#include "driver/gpio.h"
+#include "driver/uart.h"
+
+static uint8_t levels[GPIO_NUM_MAX];
+static bool held[GPIO_NUM_MAX];
+
+static bool ValidPin(const gpio_num_t gpio_num)
+{
+  return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+  return ValidPin(gpio_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+  if (!ValidPin(gpio_num))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!held[gpio_num]) // A held pad ignores the output until it is released
+  {
+    levels[gpio_num] = level != 0;
+  }
+  return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+  return ValidPin(gpio_num) ? levels[gpio_num] : 0;
+}
+
+esp_err_t gpio_hold_en(gpio_num_t gpio_num)
+{
+  if (!ValidPin(gpio_num))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  held[gpio_num] = true;
+  return ESP_OK;
+}
+
+esp_err_t gpio_hold_dis(gpio_num_t gpio_num)
+{
+  if (!ValidPin(gpio_num))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  held[gpio_num] = false;
+  return ESP_OK;
+}
+
+void gpio_deep_sleep_hold_en(void)
+{
+}
+
+static bool uart_installed = false;
+
+bool uart_is_driver_installed(uart_port_t uart_num)
+{
+  return uart_installed;
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, void *uart_queue,
+                              int intr_alloc_flags)
+{
+  uart_installed = true;
+  return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+  return 0;
+}
@@ -0,0 +1,97 @@
+#include <stdbool.h>
+#include <string.h>
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali.h"
+
+#define HOST_ADC_CHANNELS 10
+#define HOST_ADC_FULL_SCALE_MV 3300 // Nominal full scale at 12 dB, as the sampler assumes without calibration
+#define HOST_ADC_MAX_PATTERN 16
+
+struct host_adc_continuous
+{
+  adc_digi_pattern_config_t pattern[HOST_ADC_MAX_PATTERN];
+  uint32_t pattern_num;
+  uint32_t frame_size;
+  bool started;
+};
+
+static int raw_values[2][HOST_ADC_CHANNELS];
+static struct host_adc_continuous continuous;
+
+/**
+ * @brief Sets the voltage a channel converts from now on.
+ */
+void HostAdcSetMillivolts(const adc_unit_t unit, const adc_channel_t channel, const int millivolts)
+{
+  const int raw = (millivolts * 4095 + HOST_ADC_FULL_SCALE_MV / 2) / HOST_ADC_FULL_SCALE_MV;
+  raw_values[unit][channel] = (raw < 0) ? 0 : ((raw > 4095) ? 4095 : raw);
+}
+
+// Allocations are left out, a wakeup creates the handles again: one of each is reused
+esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t *hdl_config, adc_continuous_handle_t *ret_handle)
+{
+  continuous = (struct host_adc_continuous){.frame_size = hdl_config->conv_frame_size};
+  *ret_handle = &continuous;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_config(adc_continuous_handle_t handle, const adc_continuous_config_t *config)
+{
+  if (config->pattern_num == 0 || config->pattern_num > HOST_ADC_MAX_PATTERN || config->format != ADC_DIGI_OUTPUT_FORMAT_TYPE1)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  memcpy(handle->pattern, config->adc_pattern, config->pattern_num * sizeof(config->adc_pattern[0]));
+  handle->pattern_num = config->pattern_num;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle)
+{
+  if (handle->started)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  handle->started = true;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle)
+{
+  if (!handle->started)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  handle->started = false;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_read(adc_continuous_handle_t handle, uint8_t *buf, uint32_t length_max, uint32_t *out_length,
+                              uint32_t timeout_ms)
+{
+  if (!handle->started)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (timeout_ms == 0)
+  {
+    return ESP_ERR_TIMEOUT;
+  }
+  const uint32_t length = (length_max < handle->frame_size) ? length_max : handle->frame_size;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES, n++)
+  {
+    const adc_digi_pattern_config_t *entry = &handle->pattern[n % handle->pattern_num];
+    adc_digi_output_data_t result = {0};
+    result.type1.channel = entry->channel;
+    result.type1.data = raw_values[ADC_UNIT_1][entry->channel];
+    memcpy(&buf[i], &result, sizeof(result));
+  }
+  *out_length = n * SOC_ADC_DIGI_RESULT_BYTES;
+  return ESP_OK;
+}
+
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t handle, int raw, int *voltage)
+{
+  return ESP_ERR_NOT_SUPPORTED;
+}
@@ -0,0 +1,388 @@
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "esp_http_client.h"
+#include "esp_crt_bundle.h"
+#include "lwip/sockets.h"
+
+#define HOST_HTTP_HOST_SIZE 64
+#define HOST_HTTP_PATH_SIZE 256
+#define HOST_HTTP_HEAD_SIZE 512 // Request line and headers
+#define HOST_HTTP_MAX_HEADERS 4
+#define HOST_HTTP_HEADER_SIZE 64
+#define HOST_HTTP_DEFAULT_BUFFER_SIZE 512
+
+struct host_http_header
+{
+  char key[HOST_HTTP_HEADER_SIZE];
+  char value[HOST_HTTP_HEADER_SIZE];
+};
+
+struct esp_http_client
+{
+  http_event_handle_cb event_handler;
+  void *user_data;
+  esp_http_client_method_t method;
+  char host[HOST_HTTP_HOST_SIZE];
+  char path[HOST_HTTP_PATH_SIZE];
+  struct host_http_header headers[HOST_HTTP_MAX_HEADERS];
+  size_t n_headers;
+  const char *post_data;
+  int post_len;
+  int fd; // -1 while no connection is open
+  int status;
+  char *buffer; // Rx buffer, the response head must fit in it
+  int buffer_size;
+};
+
+static const char *const method_names[] = {"GET", "POST", "PUT", "PATCH", "DELETE"};
+static struct sockaddr_in server = {.sin_family = AF_INET};
+
+/**
+ * @brief Sends every request to ip:port from now on.
+ */
+void HostHttpClientRedirect(const char *ip, const uint16_t port)
+{
+  inet_pton(AF_INET, ip, &server.sin_addr);
+  server.sin_port = htons(port);
+}
+
+esp_err_t esp_crt_bundle_attach(void *conf)
+{
+  return ESP_OK;
+}
+
+static void Dispatch(esp_http_client_handle_t client, const esp_http_client_event_id_t event_id, void *data, const int data_len,
+                     char *header_key, char *header_value)
+{
+  if (client->event_handler == NULL)
+  {
+    return;
+  }
+  esp_http_client_event_t event = {
+      .event_id = event_id,
+      .client = client,
+      .data = data,
+      .data_len = data_len,
+      .user_data = client->user_data,
+      .header_key = header_key,
+      .header_value = header_value,
+  };
+  client->event_handler(&event);
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+  esp_http_client_handle_t client = calloc(1, sizeof(*client));
+  if (client == NULL)
+  {
+    return NULL;
+  }
+  client->buffer_size = (config->buffer_size > 0) ? config->buffer_size : HOST_HTTP_DEFAULT_BUFFER_SIZE;
+  client->buffer = malloc(client->buffer_size + 1);
+  if (client->buffer == NULL)
+  {
+    free(client);
+    return NULL;
+  }
+  client->event_handler = config->event_handler;
+  client->user_data = config->user_data;
+  client->fd = -1;
+  if (config->url != NULL && esp_http_client_set_url(client, config->url) != ESP_OK)
+  {
+    esp_http_client_cleanup(client);
+    return NULL;
+  }
+  return client;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url)
+{
+  const char *host = strstr(url, "://");
+  if (host == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  host += 3;
+  const char *path = strchr(host, '/');
+  const size_t host_len = (path != NULL) ? (size_t)(path - host) : strlen(host);
+  if (host_len >= sizeof(client->host) || (path != NULL && strlen(path) >= sizeof(client->path)))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  memcpy(client->host, host, host_len);
+  client->host[host_len] = '\0';
+  snprintf(client->path, sizeof(client->path), "%s", (path != NULL) ? path : "/");
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+  client->method = method;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void *data)
+{
+  client->user_data = data;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+  if (strlen(key) >= HOST_HTTP_HEADER_SIZE || strlen(value) >= HOST_HTTP_HEADER_SIZE)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  size_t i = 0;
+  while (i < client->n_headers && strcasecmp(client->headers[i].key, key) != 0)
+  {
+    i++;
+  }
+  if (i == HOST_HTTP_MAX_HEADERS)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+  strcpy(client->headers[i].key, key);
+  strcpy(client->headers[i].value, value);
+  client->n_headers += (i == client->n_headers);
+  return ESP_OK;
+}
+
+// As in the IDF client, a NULL body also drops the Content-Type set with it
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len)
+{
+  client->post_data = data;
+  client->post_len = (data != NULL) ? len : 0;
+  if (data == NULL)
+  {
+    for (size_t i = 0; i < client->n_headers; i++)
+    {
+      if (strcasecmp(client->headers[i].key, "Content-Type") == 0)
+      {
+        client->headers[i] = client->headers[--client->n_headers];
+        break;
+      }
+    }
+  }
+  return ESP_OK;
+}
+
+static bool WriteAll(const int fd, const char *data, size_t len)
+{
+  while (len > 0)
+  {
+    const ssize_t n = lwip_write(fd, data, len);
+    if (n <= 0)
+    {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+static esp_err_t Connect(esp_http_client_handle_t client)
+{
+  client->fd = lwip_socket(AF_INET, SOCK_STREAM, 0);
+  if (client->fd < 0)
+  {
+    return ESP_ERR_HTTP_CONNECT;
+  }
+  if (lwip_connect(client->fd, (const struct sockaddr *)&server, sizeof(server)) != 0)
+  {
+    lwip_close(client->fd);
+    client->fd = -1;
+    return ESP_ERR_HTTP_CONNECT;
+  }
+  // The head and the body go out in two writes: Nagle against the delayed ACK of loopback would add 40 ms to each POST
+  const int no_delay = 1;
+  setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+  Dispatch(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+  return ESP_OK;
+}
+
+static esp_err_t SendRequest(esp_http_client_handle_t client)
+{
+  char head[HOST_HTTP_HEAD_SIZE];
+  int len = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: ESP32 HTTP Client/1.0\r\n",
+                     method_names[client->method], client->path, client->host);
+  for (size_t i = 0; i < client->n_headers && len < (int)sizeof(head); i++)
+  {
+    len += snprintf(head + len, sizeof(head) - len, "%s: %s\r\n", client->headers[i].key, client->headers[i].value);
+  }
+  if (client->post_data != NULL && len < (int)sizeof(head))
+  {
+    len += snprintf(head + len, sizeof(head) - len, "Content-Length: %d\r\n", client->post_len);
+  }
+  if (len < (int)sizeof(head))
+  {
+    len += snprintf(head + len, sizeof(head) - len, "\r\n");
+  }
+  if (len >= (int)sizeof(head))
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (!WriteAll(client->fd, head, len))
+  {
+    return ESP_ERR_HTTP_WRITE_DATA;
+  }
+  Dispatch(client, HTTP_EVENT_HEADERS_SENT, NULL, 0, NULL, NULL);
+  if (client->post_len > 0 && !WriteAll(client->fd, client->post_data, client->post_len))
+  {
+    return ESP_ERR_HTTP_WRITE_DATA;
+  }
+  return ESP_OK;
+}
+
+/**
+ * @brief Reads the status line and the headers, raising ON_HEADER for each.
+ *
+ * @param body Output, start of the body bytes read along with the head.
+ * @param body_len Output, number of those bytes.
+ * @param content_length Output, -1 if the response has no Content-Length.
+ * @param keep_alive Output, false if the server closes the connection after the response.
+ */
+static esp_err_t ReadHead(esp_http_client_handle_t client, char **body, int *body_len, int *content_length, bool *keep_alive)
+{
+  int len = 0;
+  char *end = NULL;
+  while (end == NULL)
+  {
+    if (len == client->buffer_size)
+    {
+      return ESP_ERR_HTTP_FETCH_HEADER; // Head larger than the rx buffer
+    }
+    const ssize_t n = lwip_read(client->fd, client->buffer + len, client->buffer_size - len);
+    if (n <= 0)
+    {
+      return ESP_ERR_HTTP_FETCH_HEADER;
+    }
+    len += n;
+    client->buffer[len] = '\0';
+    end = strstr(client->buffer, "\r\n\r\n");
+  }
+  *end = '\0';
+  *body = end + 4;
+  *body_len = len - (int)(*body - client->buffer);
+  if (sscanf(client->buffer, "HTTP/1.%*d %d", &client->status) != 1)
+  {
+    return ESP_ERR_HTTP_FETCH_HEADER;
+  }
+  *content_length = -1;
+  *keep_alive = true;
+  char *line = strstr(client->buffer, "\r\n");
+  while (line != NULL)
+  {
+    char *key = line + 2;
+    line = strstr(key, "\r\n");
+    if (line != NULL)
+    {
+      *line = '\0';
+    }
+    char *value = strchr(key, ':');
+    if (value == NULL)
+    {
+      continue;
+    }
+    *value++ = '\0';
+    value += strspn(value, " ");
+    if (strcasecmp(key, "Content-Length") == 0)
+    {
+      *content_length = atoi(value);
+    }
+    else if (strcasecmp(key, "Connection") == 0 && strcasecmp(value, "close") == 0)
+    {
+      *keep_alive = false;
+    }
+    Dispatch(client, HTTP_EVENT_ON_HEADER, NULL, 0, key, value);
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+  if (client->fd < 0)
+  {
+    esp_err_t err = Connect(client);
+    if (err != ESP_OK)
+    {
+      return err;
+    }
+  }
+  esp_err_t err = SendRequest(client);
+  char *body = NULL;
+  int body_len = 0;
+  int content_length = -1;
+  bool keep_alive = true;
+  if (err == ESP_OK)
+  {
+    err = ReadHead(client, &body, &body_len, &content_length, &keep_alive);
+  }
+  if (err != ESP_OK)
+  {
+    esp_http_client_close(client);
+    return err;
+  }
+  // Without a Content-Length the body runs until the server closes the connection
+  int left = (content_length >= 0) ? content_length : INT32_MAX;
+  if (body_len > left)
+  {
+    body_len = left;
+  }
+  while (body_len > 0)
+  {
+    Dispatch(client, HTTP_EVENT_ON_DATA, body, body_len, NULL, NULL);
+    left -= body_len;
+    body_len = 0;
+    if (left > 0)
+    {
+      const ssize_t n = lwip_read(client->fd, client->buffer, (left < client->buffer_size) ? left : client->buffer_size);
+      body = client->buffer;
+      body_len = (n > 0) ? (int)n : 0;
+    }
+  }
+  if (content_length >= 0 && left > 0)
+  {
+    esp_http_client_close(client);
+    return ESP_FAIL; // Connection lost in the middle of the body
+  }
+  Dispatch(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+  if (!keep_alive || content_length < 0)
+  {
+    esp_http_client_close(client);
+  }
+  return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+  return client->status;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+  if (client->fd < 0)
+  {
+    return ESP_OK;
+  }
+  lwip_close(client->fd);
+  client->fd = -1;
+  Dispatch(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+  if (client == NULL)
+  {
+    return ESP_FAIL;
+  }
+  esp_http_client_close(client);
+  free(client->buffer);
+  free(client);
+  return ESP_OK;
+}
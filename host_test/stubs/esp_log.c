@@ -0,0 +1,75 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "esp_log.h"
+
+static esp_log_level_t LogLevel()
+{
+  static int level = -1;
+  if (level < 0)
+  {
+    const char *env = getenv("SARP_HOST_LOG");
+    level = ESP_LOG_NONE;
+    if (env != NULL)
+    {
+      switch (env[0])
+      {
+      case 'E':
+        level = ESP_LOG_ERROR;
+        break;
+      case 'W':
+        level = ESP_LOG_WARN;
+        break;
+      case 'I':
+        level = ESP_LOG_INFO;
+        break;
+      default:
+        level = ESP_LOG_DEBUG;
+        break;
+      }
+    }
+  }
+  return (esp_log_level_t)level;
+}
+
+void HostLog(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+  static const char letters[] = "NEWIDV";
+  if (level > LogLevel())
+  {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "%c %s: ", letters[level], tag);
+  vfprintf(stderr, format, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+  switch (code)
+  {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  case ESP_ERR_INVALID_RESPONSE:
+    return "ESP_ERR_INVALID_RESPONSE";
+  default:
+    return "ERROR";
+  }
+}
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_partition.h"
+
+#define HOST_FLASH_SECTOR_SIZE 4096
+#define HOST_NO_CUT UINT32_MAX
+
+static esp_partition_t partition;
+static uint8_t *flash = NULL;
+static uint32_t n_ops = 0;            // Writes and erases performed since the setup
+static uint32_t n_reads = 0;          // Reads performed since the setup
+static uint32_t cut_at = HOST_NO_CUT; // Operation interrupted by the power loss
+static enum host_power_cut cut_mode;
+static bool power_lost = false;
+
+/**
+ * @brief Sets up a blank (erased) RAM partition, the only one find_first returns.
+ */
+void HostPartitionSetup(const char *label, esp_partition_subtype_t subtype, const uint32_t size)
+{
+  free(flash);
+  flash = malloc(size);
+  memset(flash, 0xFF, size);
+  partition = (esp_partition_t){
+      .type = ESP_PARTITION_TYPE_DATA,
+      .subtype = subtype,
+      .size = size,
+      .erase_size = HOST_FLASH_SECTOR_SIZE,
+  };
+  strncpy(partition.label, label, sizeof(partition.label) - 1);
+  n_ops = 0;
+  n_reads = 0;
+  cut_at = HOST_NO_CUT;
+  power_lost = false;
+}
+
+/**
+ * @brief Makes the power fail during the given write or erase (counted from 0 since the setup). That operation only
+ * partly reaches the flash, according to mode, and fails, as does every later one until HostPartitionPowerOn.
+ */
+void HostPartitionCutPowerAt(const uint32_t op, const enum host_power_cut mode)
+{
+  cut_at = op;
+  cut_mode = mode;
+}
+
+/**
+ * @brief Restores the power, as on a reboot. The flash keeps whatever the interrupted operation left.
+ */
+void HostPartitionPowerOn()
+{
+  cut_at = HOST_NO_CUT;
+  power_lost = false;
+}
+
+bool HostPartitionPowerLost()
+{
+  return power_lost;
+}
+
+uint32_t HostPartitionOps()
+{
+  return n_ops;
+}
+
+uint32_t HostPartitionReads()
+{
+  return n_reads;
+}
+
+/**
+ * @brief Counts a write or erase, and tells how many of its bytes reach the flash.
+ */
+static size_t StartOperation(const size_t size)
+{
+  if (power_lost)
+  {
+    return 0;
+  }
+  if (n_ops++ != cut_at)
+  {
+    return size;
+  }
+  power_lost = true;
+  return (cut_mode == HOST_CUT_HALFWAY) ? size / 2 : 0;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+  if (flash == NULL || type != partition.type || subtype != partition.subtype ||
+      (label != NULL && strcmp(label, partition.label) != 0))
+  {
+    return NULL;
+  }
+  return &partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t src_offset, void *dst, size_t size)
+{
+  if (p != &partition || src_offset + size > partition.size)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  n_reads++;
+  memcpy(dst, flash + src_offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t dst_offset, const void *src, size_t size)
+{
+  if (p != &partition || dst_offset + size > partition.size)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  const size_t n_written = StartOperation(size);
+  const uint8_t *bytes = src;
+  for (size_t i = 0; i < n_written; i++)
+  {
+    flash[dst_offset + i] &= bytes[i]; // NOR flash: a write only clears bits
+  }
+  return (n_written == size && !power_lost) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size)
+{
+  if (p != &partition || offset + size > partition.size || offset % HOST_FLASH_SECTOR_SIZE != 0 ||
+      size % HOST_FLASH_SECTOR_SIZE != 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  const size_t n_erased = StartOperation(size);
+  memset(flash + offset, 0xFF, n_erased);
+  return (n_erased == size && !power_lost) ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,60 @@
+#include <pthread.h>
+#include <time.h>
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+static pthread_mutex_t sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleep_entered = PTHREAD_COND_INITIALIZER;
+static bool asleep = false;
+static esp_sleep_wakeup_cause_t wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+static uint64_t sleep_duration_us = 0;
+
+/**
+ * @brief Waits until a task enters deep sleep, and takes the module out of it.
+ *
+ * @param timeout_ms Longest wait.
+ * @return true if the module went to sleep, false on timeout.
+ */
+bool HostDeepSleepWait(const uint32_t timeout_ms)
+{
+  struct timespec deadline;
+  HostDeadlineAfter(timeout_ms, &deadline);
+  pthread_mutex_lock(&sleep_mutex);
+  while (!asleep && pthread_cond_timedwait(&sleep_entered, &sleep_mutex, &deadline) == 0)
+  {
+  }
+  const bool slept = asleep;
+  asleep = false;
+  pthread_mutex_unlock(&sleep_mutex);
+  return slept;
+}
+
+/**
+ * @brief Time the last deep sleep was meant to last.
+ */
+uint64_t HostDeepSleepDuration()
+{
+  return sleep_duration_us;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+  return wakeup_cause;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+  sleep_duration_us = time_in_us;
+  return ESP_OK;
+}
+
+void esp_deep_sleep_start(void)
+{
+  pthread_mutex_lock(&sleep_mutex);
+  wakeup_cause = ESP_SLEEP_WAKEUP_TIMER;
+  HostTimerBoot();
+  asleep = true;
+  pthread_cond_signal(&sleep_entered);
+  pthread_mutex_unlock(&sleep_mutex);
+  pthread_exit(NULL);
+}
@@ -0,0 +1,26 @@
+#include <malloc.h>
+#include <stdio.h>
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+
+void esp_restart(void)
+{
+  fprintf(stderr, "esp_restart called\n");
+  exit(1);
+}
+
+// The C library heap has no fixed size, its free space is what the allocator holds on to
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+  return mallinfo2().fordblks;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+  return mallinfo2().fordblks;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+  return mallinfo2().fordblks;
+}
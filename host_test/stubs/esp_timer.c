@@ -0,0 +1,151 @@
+#include <pthread.h>
+#include <time.h>
+#include "esp_timer.h"
+
+struct host_timer
+{
+  esp_timer_create_args_t args;
+  bool armed;
+  int64_t deadline_us; // esp_timer_get_time time it fires at, while armed
+};
+
+#define HOST_MAX_TIMERS 4
+
+static pthread_mutex_t timers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_armed = PTHREAD_COND_INITIALIZER;
+static struct host_timer timers[HOST_MAX_TIMERS];
+static size_t n_timers = 0;
+static int64_t boot_us = -1;
+static int64_t skipped_us = 0;
+
+static int64_t MonotonicUs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Restarts the time since boot from zero, as a reset or a deep sleep wakeup does.
+ */
+void HostTimerBoot()
+{
+  __atomic_store_n(&boot_us, MonotonicUs(), __ATOMIC_RELAXED);
+  __atomic_store_n(&skipped_us, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Moves the time since boot forward without waiting.
+ */
+void HostTimerSkip(const int64_t us)
+{
+  __atomic_add_fetch(&skipped_us, us, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Absolute time for the POSIX timed waits, timeout_ms from now.
+ *
+ * @param timeout_ms Wait.
+ * @param deadline Output, the CLOCK_REALTIME time the wait ends at.
+ */
+void HostDeadlineAfter(const uint32_t timeout_ms, struct timespec *deadline)
+{
+  clock_gettime(CLOCK_REALTIME, deadline);
+  deadline->tv_sec += timeout_ms / 1000;
+  deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+  if (deadline->tv_nsec >= 1000000000)
+  {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+/**
+ * @brief Waits until a timer is armed, moves the time since boot to its deadline and runs its callback on the
+ * calling thread, as the esp_timer task would. The earliest deadline goes first when several timers are armed.
+ *
+ * @param timeout_ms Longest wait for a timer to be armed.
+ * @return true if a timer fired, false on timeout.
+ */
+bool HostTimerFireNext(const uint32_t timeout_ms)
+{
+  struct timespec deadline;
+  HostDeadlineAfter(timeout_ms, &deadline);
+  pthread_mutex_lock(&timers_mutex);
+  struct host_timer *next = NULL;
+  for (;;)
+  {
+    for (size_t i = 0; i < n_timers; i++)
+    {
+      if (timers[i].armed && (next == NULL || timers[i].deadline_us < next->deadline_us))
+      {
+        next = &timers[i];
+      }
+    }
+    if (next != NULL || pthread_cond_timedwait(&timer_armed, &timers_mutex, &deadline) != 0)
+    {
+      break;
+    }
+  }
+  if (next == NULL)
+  {
+    pthread_mutex_unlock(&timers_mutex);
+    return false;
+  }
+  next->armed = false;
+  const esp_timer_create_args_t args = next->args;
+  const int64_t wait_us = next->deadline_us - esp_timer_get_time();
+  pthread_mutex_unlock(&timers_mutex);
+  if (wait_us > 0)
+  {
+    HostTimerSkip(wait_us);
+  }
+  args.callback(args.arg);
+  return true;
+}
+
+int64_t esp_timer_get_time(void)
+{
+  if (__atomic_load_n(&boot_us, __ATOMIC_RELAXED) < 0)
+  {
+    HostTimerBoot();
+  }
+  return MonotonicUs() - __atomic_load_n(&boot_us, __ATOMIC_RELAXED) + __atomic_load_n(&skipped_us, __ATOMIC_RELAXED);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+  pthread_mutex_lock(&timers_mutex);
+  if (n_timers == HOST_MAX_TIMERS)
+  {
+    pthread_mutex_unlock(&timers_mutex);
+    return ESP_ERR_NO_MEM;
+  }
+  timers[n_timers] = (struct host_timer){.args = *create_args};
+  *out_handle = &timers[n_timers++];
+  pthread_mutex_unlock(&timers_mutex);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+  pthread_mutex_lock(&timers_mutex);
+  const bool armed = timer->armed;
+  if (!armed)
+  {
+    timer->armed = true;
+    timer->deadline_us = esp_timer_get_time() + (int64_t)timeout_us;
+    pthread_cond_broadcast(&timer_armed);
+  }
+  pthread_mutex_unlock(&timers_mutex);
+  return armed ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+  pthread_mutex_lock(&timers_mutex);
+  const bool armed = timer->armed;
+  timer->armed = false;
+  pthread_mutex_unlock(&timers_mutex);
+  return armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
@@ -0,0 +1,278 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+
+static pthread_mutex_t critical_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void HostEnterCritical(portMUX_TYPE *mux)
+{
+  (void)mux;
+  pthread_mutex_lock(&critical_mutex);
+}
+
+void HostExitCritical(portMUX_TYPE *mux)
+{
+  (void)mux;
+  pthread_mutex_unlock(&critical_mutex);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+  pthread_mutex_init(&buffer->mutex, NULL);
+  return buffer;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+  if (ticks_to_wait == portMAX_DELAY)
+  {
+    return pthread_mutex_lock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+  }
+  return pthread_mutex_trylock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  return pthread_mutex_unlock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+}
+
+#define HOST_TASK_NAME_SIZE configMAX_TASK_NAME_LEN
+
+struct host_task
+{
+  pthread_t thread;
+  char name[HOST_TASK_NAME_SIZE];
+  TaskFunction_t code;
+  void *parameters;
+  pthread_mutex_t mutex;
+  pthread_cond_t notified;
+  pthread_cond_t idle;
+  uint32_t notifications;
+  bool waiting; // Blocked in ulTaskNotifyTake
+};
+
+#define HOST_MAX_TASKS 16
+
+static __thread struct host_task *current_task = NULL;
+static pthread_mutex_t tasks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct host_task *tasks[HOST_MAX_TASKS]; // Created tasks, for HostTaskGet
+static size_t n_tasks = 0;
+
+static struct host_task *NewTask(const char *name)
+{
+  struct host_task *task = calloc(1, sizeof(*task));
+  if (task == NULL)
+  {
+    return NULL;
+  }
+  snprintf(task->name, sizeof(task->name), "%s", name);
+  pthread_mutex_init(&task->mutex, NULL);
+  pthread_cond_init(&task->notified, NULL);
+  pthread_cond_init(&task->idle, NULL);
+  return task;
+}
+
+static void *RunTask(void *arg)
+{
+  current_task = arg;
+  current_task->code(current_task->parameters);
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char *name, const uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, const BaseType_t core_id)
+{
+  struct host_task *task = NewTask(name);
+  if (task == NULL)
+  {
+    return pdFAIL;
+  }
+  task->code = task_code;
+  task->parameters = parameters;
+  if (created_task != NULL)
+  {
+    *created_task = task;
+  }
+  if (pthread_create(&task->thread, NULL, RunTask, task) != 0)
+  {
+    free(task);
+    return pdFAIL;
+  }
+  pthread_detach(task->thread);
+  pthread_mutex_lock(&tasks_mutex);
+  if (n_tasks < HOST_MAX_TASKS)
+  {
+    tasks[n_tasks++] = task;
+  }
+  pthread_mutex_unlock(&tasks_mutex);
+  return pdPASS;
+}
+
+/**
+ * @brief Finds a task by the name it was created with. A task that deleted itself is still found, a name used
+ * twice finds the latest task.
+ *
+ * @param name Task name.
+ * @return TaskHandle_t The task, NULL if none has this name.
+ */
+TaskHandle_t HostTaskGet(const char *name)
+{
+  struct host_task *found = NULL;
+  pthread_mutex_lock(&tasks_mutex);
+  for (size_t i = 0; i < n_tasks; i++)
+  {
+    if (strcmp(tasks[i]->name, name) == 0)
+    {
+      found = tasks[i];
+    }
+  }
+  pthread_mutex_unlock(&tasks_mutex);
+  return found;
+}
+
+/**
+ * @brief Waits until a task is blocked on its notifications with none pending, that is done with the work it was
+ * given.
+ *
+ * @param task The task.
+ * @param timeout_ms Longest wait.
+ * @return true if the task is idle, false on timeout.
+ */
+bool HostTaskWaitIdle(TaskHandle_t task, const uint32_t timeout_ms)
+{
+  struct timespec deadline;
+  HostDeadlineAfter(timeout_ms, &deadline);
+  pthread_mutex_lock(&task->mutex);
+  while (!(task->waiting && task->notifications == 0) && pthread_cond_timedwait(&task->idle, &task->mutex, &deadline) == 0)
+  {
+  }
+  const bool idle = task->waiting && task->notifications == 0;
+  pthread_mutex_unlock(&task->mutex);
+  return idle;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+  if (current_task == NULL)
+  {
+    current_task = NewTask("main");
+  }
+  return current_task;
+}
+
+char *pcTaskGetName(TaskHandle_t task)
+{
+  return (task != NULL) ? task->name : xTaskGetCurrentTaskHandle()->name;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+  return 0; // Unknown, the host stacks are not filled with a pattern
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+  if (task != NULL && task != current_task)
+  {
+    fprintf(stderr, "vTaskDelete: only a task can delete itself on the host\n");
+    abort();
+  }
+  pthread_exit(NULL);
+}
+
+void vTaskDelay(const TickType_t ticks_to_delay)
+{
+  HostTimerSkip((int64_t)ticks_to_delay * portTICK_PERIOD_MS * 1000);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  pthread_mutex_lock(&task->mutex);
+  task->notifications++;
+  pthread_cond_signal(&task->notified);
+  pthread_mutex_unlock(&task->mutex);
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait)
+{
+  struct host_task *task = xTaskGetCurrentTaskHandle();
+  pthread_mutex_lock(&task->mutex);
+  while (task->notifications == 0 && ticks_to_wait == portMAX_DELAY)
+  {
+    task->waiting = true;
+    pthread_cond_broadcast(&task->idle);
+    pthread_cond_wait(&task->notified, &task->mutex);
+  }
+  task->waiting = false;
+  const uint32_t count = task->notifications;
+  if (count > 0)
+  {
+    task->notifications = clear_count_on_exit ? 0 : count - 1;
+  }
+  pthread_mutex_unlock(&task->mutex);
+  return count;
+}
+
+struct host_queue
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head;
+  UBaseType_t count;
+  uint8_t items[];
+};
+
+QueueHandle_t xQueueCreate(const UBaseType_t length, const UBaseType_t item_size)
+{
+  struct host_queue *queue = calloc(1, sizeof(*queue) + (size_t)length * item_size);
+  if (queue == NULL)
+  {
+    return NULL;
+  }
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+  queue->length = length;
+  queue->item_size = item_size;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+  pthread_mutex_lock(&queue->mutex);
+  const bool full = queue->count == queue->length;
+  if (!full)
+  {
+    memcpy(&queue->items[((queue->head + queue->count) % queue->length) * queue->item_size], item, queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return full ? pdFALSE : pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count == 0 && ticks_to_wait == portMAX_DELAY)
+  {
+    pthread_cond_wait(&queue->not_empty, &queue->mutex);
+  }
+  const bool empty = queue->count == 0;
+  if (!empty)
+  {
+    memcpy(buffer, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return empty ? pdFALSE : pdTRUE;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// Host stand-in for the UART driver. Nothing is ever typed on the host console, reads time out
+typedef int uart_port_t;
+
+bool uart_is_driver_installed(uart_port_t uart_num);
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, void *uart_queue,
+                              int intr_alloc_flags);
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait);
@@ -0,0 +1,7 @@
+#pragma once
+#include "esp_err.h"
+
+// Host stand-in for the ADC calibration. No scheme is supported, the sampler falls back to the nominal full scale
+typedef struct host_adc_cali *adc_cali_handle_t;
+
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t handle, int raw, int *voltage);
@@ -0,0 +1,4 @@
+#pragma once
+#include "esp_adc/adc_cali.h"
+
+// Host stand-in: neither ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED nor the curve fitting scheme is defined
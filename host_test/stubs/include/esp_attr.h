@@ -0,0 +1,8 @@
+#pragma once
+
+// Host stand-in for the placement attributes: IRAM and RTC memory are ordinary memory on the host, and what
+// RTC_DATA_ATTR keeps across deep sleep simply stays in RAM
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
@@ -0,0 +1,5 @@
+#pragma once
+#include "esp_err.h"
+
+// Host stand-in for the certificate bundle, the host requests run over plain HTTP
+esp_err_t esp_crt_bundle_attach(void *conf);
@@ -0,0 +1,24 @@
+#pragma once
+#include "esp_err.h"
+
+// Host stand-in for the ESP-IDF logging macros. Quiet unless SARP_HOST_LOG is set in the environment
+// (to E, W, I or D), so the tests only print their own results.
+// The formats are checked as the firmware's are, so fixed-width arguments need the <inttypes.h> macros (PRIu32 and
+// the like): uint32_t is unsigned long on Xtensa but unsigned int here.
+typedef enum
+{
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+void HostLog(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, format, ...) HostLog(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HostLog(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HostLog(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HostLog(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HostLog(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Host stand-in for esp_partition, backed by RAM. Writes follow NOR flash rules (bits only go from 1 to 0) and
+// every write and erase can be interrupted, to simulate a power loss at any step.
+typedef enum
+{
+  ESP_PARTITION_TYPE_APP = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef int esp_partition_subtype_t;
+
+typedef struct
+{
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  uint32_t address;
+  uint32_t size;
+  uint32_t erase_size;
+  char label[17];
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+
+/**
+ * @brief How an interrupted flash operation leaves the flash.
+ */
+enum host_power_cut
+{
+  HOST_CUT_BEFORE,   // Nothing of the interrupted operation reached the flash
+  HOST_CUT_HALFWAY,  // The first half of the bytes was written (or erased)
+};
+
+void HostPartitionSetup(const char *label, esp_partition_subtype_t subtype, const uint32_t size);
+void HostPartitionCutPowerAt(const uint32_t op, const enum host_power_cut mode);
+void HostPartitionPowerOn();
+bool HostPartitionPowerLost();
+uint32_t HostPartitionOps();
+uint32_t HostPartitionReads();
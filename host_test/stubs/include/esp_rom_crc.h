@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+// Host stand-in for the ROM CRC routines: CRC-32 (IEEE 802.3, reflected), inverted on input and output like the ROM
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
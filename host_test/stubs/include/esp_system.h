@@ -0,0 +1,5 @@
+#pragma once
+#include "esp_err.h"
+
+// Host stand-in for esp_system.h. A restart ends the process, the host tests never expect one
+void esp_restart(void) __attribute__((noreturn));
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+
+// Host stand-in for esp_timer. The time since boot is the monotonic clock since the last (host) boot plus the time
+// skipped by vTaskDelay, which does not really wait. Armed timers only fire when the harness says so
+// (HostTimerFireNext), which skips the time to their deadline rather than waiting for it.
+typedef struct host_timer *esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef struct
+{
+  esp_timer_cb_t callback;
+  void *arg;
+  const char *name;
+} esp_timer_create_args_t;
+
+int64_t esp_timer_get_time(void);
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+
+void HostTimerBoot();
+void HostTimerSkip(const int64_t us);
+bool HostTimerFireNext(const uint32_t timeout_ms);
+void HostDeadlineAfter(const uint32_t timeout_ms, struct timespec *deadline);
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_system.h" // Pulled in by the port layer on the chip
+
+// Host stand-in for the FreeRTOS types and critical sections used by the components. Tasks are POSIX threads,
+// critical sections take one global mutex.
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portNUM_PROCESSORS 2
+#define configMAX_TASK_NAME_LEN 16
+
+typedef struct
+{
+  int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+void HostEnterCritical(portMUX_TYPE *mux);
+void HostExitCritical(portMUX_TYPE *mux);
+
+#define taskENTER_CRITICAL(mux) HostEnterCritical(mux)
+#define taskEXIT_CRITICAL(mux) HostExitCritical(mux)
+#define portENTER_CRITICAL(mux) HostEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) HostExitCritical(mux)
@@ -0,0 +1,10 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+// Host stand-in for the FreeRTOS queues, a ring of copied items under a POSIX mutex. Only the non-blocking send and
+// receive and the receive that waits forever are supported.
+typedef struct host_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(const UBaseType_t length, const UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait);
@@ -0,0 +1,24 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+// Host stand-in for the FreeRTOS tasks, on POSIX threads. The thread that calls in first without being a task
+// (the test's main) gets a handle of its own. Priorities and cores are ignored. vTaskDelay does not wait, it moves
+// esp_timer forward instead, so the host runs through the waits of a duty cycle at once. A harness finds the tasks of
+// the module by name (HostTaskGet) and waits for them to run out of work (HostTaskWaitIdle).
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char *name, const uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, const BaseType_t core_id);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+char *pcTaskGetName(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+void vTaskDelete(TaskHandle_t task); // Only a task deleting itself (NULL) is supported
+void vTaskDelay(const TickType_t ticks_to_delay);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
+
+TaskHandle_t HostTaskGet(const char *name);
+bool HostTaskWaitIdle(TaskHandle_t task, const uint32_t timeout_ms);
@@ -0,0 +1,14 @@
+#pragma once
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Host stand-in for the lwIP socket API, on the POSIX sockets. Separate functions, as in lwIP, so a test can wrap
+// them at link time the way the firmware does.
+int lwip_socket(int domain, int type, int protocol);
+int lwip_connect(int s, const struct sockaddr *name, socklen_t namelen);
+int lwip_close(int s);
+ssize_t lwip_send(int s, const void *dataptr, size_t size, int flags);
+ssize_t lwip_recv(int s, void *mem, size_t len, int flags);
+ssize_t lwip_write(int s, const void *dataptr, size_t size);
+ssize_t lwip_read(int s, void *mem, size_t len);
@@ -0,0 +1,69 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Host stand-in for the MQTT client types. There is no broker on the host: the client cannot be created, and the
+// module falls back to polling as it does whenever the push channel is down.
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+typedef enum
+{
+  MQTT_EVENT_ANY = -1,
+  MQTT_EVENT_ERROR = 0,
+  MQTT_EVENT_CONNECTED,
+  MQTT_EVENT_DISCONNECTED,
+  MQTT_EVENT_SUBSCRIBED,
+  MQTT_EVENT_UNSUBSCRIBED,
+  MQTT_EVENT_PUBLISHED,
+  MQTT_EVENT_DATA,
+} esp_mqtt_event_id_t;
+
+typedef struct
+{
+  esp_mqtt_event_id_t event_id;
+  esp_mqtt_client_handle_t client;
+  char *data;
+  int data_len;
+  int total_data_len;
+  int current_data_offset;
+  char *topic;
+  int topic_len;
+  bool retain;
+} esp_mqtt_event_t;
+
+typedef struct
+{
+  struct
+  {
+    struct
+    {
+      const char *uri;
+    } address;
+    struct
+    {
+      esp_err_t (*crt_bundle_attach)(void *conf);
+    } verification;
+  } broker;
+  struct
+  {
+    const char *username;
+    const char *client_id;
+  } credentials;
+  struct
+  {
+    int keepalive;
+  } session;
+  struct
+  {
+    int reconnect_timeout_ms;
+  } network;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler,
+                                         void *event_handler_arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos);
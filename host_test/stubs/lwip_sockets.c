@@ -0,0 +1,40 @@
+#include <unistd.h>
+#include "lwip/sockets.h"
+
+// Writes go through send with MSG_NOSIGNAL: writing to a socket the peer closed fails, as on lwIP, instead of raising
+// SIGPIPE
+
+int lwip_socket(int domain, int type, int protocol)
+{
+  return socket(domain, type, protocol);
+}
+
+int lwip_connect(int s, const struct sockaddr *name, socklen_t namelen)
+{
+  return connect(s, name, namelen);
+}
+
+int lwip_close(int s)
+{
+  return close(s);
+}
+
+ssize_t lwip_send(int s, const void *dataptr, size_t size, int flags)
+{
+  return send(s, dataptr, size, flags | MSG_NOSIGNAL);
+}
+
+ssize_t lwip_recv(int s, void *mem, size_t len, int flags)
+{
+  return recv(s, mem, len, flags);
+}
+
+ssize_t lwip_write(int s, const void *dataptr, size_t size)
+{
+  return send(s, dataptr, size, MSG_NOSIGNAL);
+}
+
+ssize_t lwip_read(int s, void *mem, size_t len)
+{
+  return read(s, mem, len);
+}
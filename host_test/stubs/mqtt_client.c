@@ -0,0 +1,23 @@
+#include <stddef.h>
+#include "mqtt_client.h"
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+  return NULL;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler,
+                                         void *event_handler_arg)
+{
+  return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+  return ESP_ERR_INVALID_ARG;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+  return -1;
+}
@@ -0,0 +1,175 @@
+#include <stdbool.h>
+#include <string.h>
+#include "nvs_flash.h"
+
+#define HOST_NVS_MAX_ENTRIES 32
+#define HOST_NVS_MAX_NAMESPACES 8
+#define HOST_NVS_KEY_SIZE 16  // 15 characters, as on the chip
+#define HOST_NVS_VALUE_SIZE 1024
+
+enum host_nvs_type
+{
+  HOST_NVS_U32,
+  HOST_NVS_STR,
+  HOST_NVS_BLOB,
+};
+
+struct host_nvs_entry
+{
+  bool used;
+  nvs_handle_t ns;
+  char key[HOST_NVS_KEY_SIZE];
+  enum host_nvs_type type;
+  size_t len;
+  uint8_t value[HOST_NVS_VALUE_SIZE];
+};
+
+static bool initialized = false;
+static char namespaces[HOST_NVS_MAX_NAMESPACES][HOST_NVS_KEY_SIZE];
+static struct host_nvs_entry entries[HOST_NVS_MAX_ENTRIES];
+
+esp_err_t nvs_flash_init(void)
+{
+  initialized = true;
+  return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+  memset(namespaces, 0, sizeof(namespaces));
+  memset(entries, 0, sizeof(entries));
+  return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+  if (!initialized)
+  {
+    return ESP_ERR_NVS_NOT_INITIALIZED;
+  }
+  if (strlen(namespace_name) >= HOST_NVS_KEY_SIZE)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  for (size_t i = 0; i < HOST_NVS_MAX_NAMESPACES; i++)
+  {
+    if (namespaces[i][0] == '\0')
+    {
+      strcpy(namespaces[i], namespace_name);
+    }
+    if (strcmp(namespaces[i], namespace_name) == 0)
+    {
+      *out_handle = (nvs_handle_t)i + 1;
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+  return ESP_OK;
+}
+
+static struct host_nvs_entry *Find(const nvs_handle_t handle, const char *key)
+{
+  for (size_t i = 0; i < HOST_NVS_MAX_ENTRIES; i++)
+  {
+    if (entries[i].used && entries[i].ns == handle && strcmp(entries[i].key, key) == 0)
+    {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+static esp_err_t Set(const nvs_handle_t handle, const char *key, const enum host_nvs_type type, const void *value, const size_t len)
+{
+  if (strlen(key) >= HOST_NVS_KEY_SIZE || len > HOST_NVS_VALUE_SIZE)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  struct host_nvs_entry *entry = Find(handle, key);
+  for (size_t i = 0; i < HOST_NVS_MAX_ENTRIES && entry == NULL; i++)
+  {
+    entry = entries[i].used ? NULL : &entries[i];
+  }
+  if (entry == NULL)
+  {
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+  }
+  entry->used = true;
+  entry->ns = handle;
+  strcpy(entry->key, key);
+  entry->type = type;
+  entry->len = len;
+  memcpy(entry->value, value, len);
+  return ESP_OK;
+}
+
+static esp_err_t Get(const nvs_handle_t handle, const char *key, const enum host_nvs_type type, void *out_value, size_t *length)
+{
+  const struct host_nvs_entry *entry = Find(handle, key);
+  if (entry == NULL || entry->type != type)
+  {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  if (out_value == NULL)
+  {
+    *length = entry->len;
+    return ESP_OK;
+  }
+  if (*length < entry->len)
+  {
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  memcpy(out_value, entry->value, entry->len);
+  *length = entry->len;
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+  return Get(handle, key, HOST_NVS_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+  return Set(handle, key, HOST_NVS_BLOB, value, length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+  return Get(handle, key, HOST_NVS_STR, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+  return Set(handle, key, HOST_NVS_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+  size_t length = sizeof(*out_value);
+  return Get(handle, key, HOST_NVS_U32, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+  return Set(handle, key, HOST_NVS_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+  struct host_nvs_entry *entry = Find(handle, key);
+  if (entry == NULL)
+  {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  entry->used = false;
+  return ESP_OK;
+}
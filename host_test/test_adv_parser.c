@@ -0,0 +1,257 @@
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "host_test.h"
+#include "AdvParser.h"
+
+// Fuzz harness of the AD structure parser. Every buffer is placed right before an unmapped page, so a read past its
+// end crashes the test. The parser is checked against a straightforward walk of the same buffer on hand-written
+// malformed cases, on every buffer of up to 2 bytes and a sweep of 3-byte ones, and on random buffers biased towards
+// truncated and zero-length structures, length bytes running past the end and duplicate service data.
+//   test_adv_parser [random buffers]
+
+#define FUZZ_DEFAULT_BUFFERS 1000000
+#define FUZZ_MAX_LEN 62 // Advertising and scan response data together
+#define FUZZ_MAX_FIELDS 64
+#define FUZZ_UUID 0xABCD
+
+static uint8_t *guarded; // FUZZ_MAX_LEN bytes followed by an unmapped page
+static uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t Random()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return (uint32_t)(rng >> 32);
+}
+
+/**
+ * @brief Copies a buffer so that it ends right at the unmapped page.
+ */
+static const uint8_t *Guard(const uint8_t *buf, const size_t len)
+{
+  uint8_t *placed = guarded + FUZZ_MAX_LEN - len;
+  memcpy(placed, buf, len);
+  return placed;
+}
+
+/**
+ * @brief Reference walk: the structures a correct parser yields, as offsets of their length byte.
+ */
+static size_t ReferenceFields(const uint8_t *buf, const size_t len, size_t *offsets)
+{
+  size_t n = 0;
+  for (size_t pos = 0; pos < len;)
+  {
+    const size_t field_len = buf[pos];
+    if (field_len == 0 || pos + 1 + field_len > len)
+    {
+      break;
+    }
+    offsets[n++] = pos;
+    pos += 1 + field_len;
+  }
+  return n;
+}
+
+/**
+ * @brief Parses buf with every entry point and checks each against the reference walk.
+ */
+static void Check(const uint8_t *original, const size_t len)
+{
+  const uint8_t *buf = Guard(original, len);
+  size_t offsets[FUZZ_MAX_FIELDS];
+  const size_t n_fields = ReferenceFields(buf, len, offsets);
+
+  struct adv_iterator it;
+  struct adv_field field;
+  AdvIteratorInit(&it, buf, len);
+  for (size_t i = 0; i < n_fields; i++)
+  {
+    TEST_CHECK(AdvNextField(&it, &field), "len %zu: structure %zu of %zu missed", len, i, n_fields);
+    TEST_CHECK(field.type == buf[offsets[i] + 1] && field.data == buf + offsets[i] + 2 && field.len == buf[offsets[i]] - 1,
+               "len %zu: structure %zu mismatched", len, i);
+    TEST_CHECK(field.data + field.len <= buf + len, "len %zu: structure %zu runs past the buffer", len, i);
+  }
+  TEST_CHECK(!AdvNextField(&it, &field), "len %zu: structure past the %zu valid ones", len, n_fields);
+  TEST_CHECK(!AdvNextField(&it, &field), "len %zu: iterator restarted after the end", len);
+
+  // Lookups return the first match, later duplicates never shadow it
+  uint8_t types[FUZZ_MAX_FIELDS + 3] = {ADV_TYPE_SERVICE_DATA_16, 0x00, 0xFF};
+  size_t n_types = 3;
+  for (size_t i = 0; i < n_fields; i++)
+  {
+    types[n_types++] = buf[offsets[i] + 1];
+  }
+  for (size_t t = 0; t < n_types; t++)
+  {
+    const uint8_t type = types[t];
+    const uint8_t *expected = NULL;
+    for (size_t i = 0; i < n_fields && expected == NULL; i++)
+    {
+      expected = (buf[offsets[i] + 1] == type) ? buf + offsets[i] + 2 : NULL;
+    }
+    const bool found = AdvFindField(buf, len, type, &field);
+    TEST_CHECK(found == (expected != NULL) && (!found || field.data == expected), "len %zu: type 0x%02x lookup", len, type);
+  }
+
+  const uint8_t *expected = NULL;
+  size_t expected_len = 0;
+  for (size_t i = 0; i < n_fields && expected == NULL; i++)
+  {
+    const uint8_t *s = buf + offsets[i];
+    if (s[1] == ADV_TYPE_SERVICE_DATA_16 && s[0] >= 3 && (s[2] | (s[3] << 8)) == FUZZ_UUID)
+    {
+      expected = s + 4;
+      expected_len = s[0] - 3;
+    }
+  }
+  const bool found = AdvFindServiceData16(buf, len, FUZZ_UUID, &field);
+  TEST_CHECK(found == (expected != NULL), "len %zu: service data %sfound", len, found ? "" : "not ");
+  TEST_CHECK(!found || (field.data == expected && field.len == expected_len), "len %zu: wrong service data", len);
+}
+
+static void TestMalformed()
+{
+  const struct
+  {
+    const char *name;
+    uint8_t buf[16];
+    size_t len;
+    size_t n_fields;
+  } cases[] = {
+      {"empty", {0}, 0, 0},
+      {"zero length", {0x00, 0x16, 0xCD, 0xAB}, 4, 0},
+      {"length byte only", {0x01}, 1, 0},
+      {"type only", {0x01, 0x16}, 2, 1},
+      {"runs past by one", {0x04, 0x16, 0xCD, 0xAB}, 4, 0},
+      {"runs past by many", {0xFF, 0x16, 0xCD, 0xAB}, 4, 0},
+      {"truncated second", {0x02, 0x01, 0x06, 0x05, 0x16, 0xCD, 0xAB}, 7, 1},
+      {"padding after fields", {0x02, 0x01, 0x06, 0x00, 0x03, 0x16, 0xCD, 0xAB}, 8, 1},
+      {"uuid cut short", {0x02, 0x16, 0xCD}, 3, 1},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+  {
+    const uint8_t *buf = Guard(cases[i].buf, cases[i].len);
+    struct adv_iterator it;
+    struct adv_field field;
+    size_t n = 0;
+    AdvIteratorInit(&it, buf, cases[i].len);
+    while (AdvNextField(&it, &field))
+    {
+      n++;
+    }
+    TEST_CHECK(n == cases[i].n_fields, "%s: %zu structures, expected %zu", cases[i].name, n, cases[i].n_fields);
+    TEST_CHECK(!AdvFindServiceData16(buf, cases[i].len, FUZZ_UUID, &field), "%s: service data found", cases[i].name);
+    Check(cases[i].buf, cases[i].len);
+  }
+
+  // Duplicate service data: a short one and another UUID are skipped, the first full match wins
+  const uint8_t duplicates[] = {0x02, 0x16, 0xCD, 0x04, 0x16, 0x34, 0x12, 'x', 0x04, 0x16, 0xCD, 0xAB, 'a',
+                                0x05, 0x16, 0xCD, 0xAB, 'b', 'c'};
+  const uint8_t *buf = Guard(duplicates, sizeof(duplicates));
+  struct adv_field payload;
+  TEST_CHECK(AdvFindServiceData16(buf, sizeof(duplicates), FUZZ_UUID, &payload) && payload.len == 1 && payload.data[0] == 'a',
+             "duplicate service data: wrong one found");
+  const uint8_t empty_payload[] = {0x03, 0x16, 0xCD, 0xAB};
+  buf = Guard(empty_payload, sizeof(empty_payload));
+  TEST_CHECK(AdvFindServiceData16(buf, sizeof(empty_payload), FUZZ_UUID, &payload) && payload.len == 0 &&
+                 payload.data == buf + sizeof(empty_payload),
+             "empty service data not found");
+}
+
+static void TestExhaustive()
+{
+  uint8_t buf[3] = {0};
+  Check(buf, 0);
+  for (uint32_t v = 0; v < (1u << 8); v++)
+  {
+    buf[0] = (uint8_t)v;
+    Check(buf, 1);
+  }
+  for (uint32_t v = 0; v < (1u << 16); v++)
+  {
+    buf[0] = (uint8_t)v;
+    buf[1] = (uint8_t)(v >> 8);
+    Check(buf, 2);
+  }
+  for (uint32_t v = 0; v < (1u << 24); v += 7) // Every 7th, still covers all length bytes against all types
+  {
+    buf[0] = (uint8_t)v;
+    buf[1] = (uint8_t)(v >> 8);
+    buf[2] = (uint8_t)(v >> 16);
+    Check(buf, 3);
+  }
+}
+
+/**
+ * @brief Builds a random buffer out of plausible, truncated, zero-length, overlong and service data structures.
+ */
+static size_t RandomBuffer(uint8_t *buf)
+{
+  const size_t len = Random() % (FUZZ_MAX_LEN + 1);
+  size_t pos = 0;
+  while (pos < len)
+  {
+    const size_t left = len - pos;
+    switch (Random() % 8)
+    {
+    case 0: // Raw noise
+      buf[pos++] = (uint8_t)Random();
+      break;
+    case 1: // Zero length, the start of the padding
+      buf[pos++] = 0;
+      break;
+    case 2: // Length running past the buffer
+      buf[pos++] = (uint8_t)(left + Random() % 4);
+      break;
+    case 3: // Service data of the UUID looked up, or of another one
+    case 4:
+    {
+      const size_t payload = Random() % 8;
+      const uint16_t uuid = (Random() % 2) ? FUZZ_UUID : (uint16_t)Random();
+      const uint8_t field[] = {(uint8_t)(payload + 3), ADV_TYPE_SERVICE_DATA_16, (uint8_t)uuid, (uint8_t)(uuid >> 8)};
+      for (size_t i = 0; i < sizeof(field) && pos < len; i++)
+      {
+        buf[pos++] = field[i];
+      }
+      for (size_t i = 0; i < payload && pos < len; i++)
+      {
+        buf[pos++] = (uint8_t)Random();
+      }
+      break;
+    }
+    default: // Well formed structure of any type, possibly cut by the end of the buffer
+    {
+      const size_t field_len = 1 + Random() % 10;
+      buf[pos++] = (uint8_t)field_len;
+      for (size_t i = 0; i < field_len && pos < len; i++)
+      {
+        buf[pos++] = (uint8_t)Random();
+      }
+      break;
+    }
+    }
+  }
+  return len;
+}
+
+int main(int argc, char **argv)
+{
+  const uint32_t n_buffers = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : FUZZ_DEFAULT_BUFFERS;
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  uint8_t *pages = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  TEST_CHECK(pages != MAP_FAILED && mprotect(pages + page, page, PROT_NONE) == 0, "guard page setup failed");
+  guarded = pages + page - FUZZ_MAX_LEN;
+
+  TestMalformed();
+  TestExhaustive();
+  uint8_t buf[FUZZ_MAX_LEN];
+  for (uint32_t i = 0; i < n_buffers; i++)
+  {
+    Check(buf, RandomBuffer(buf));
+  }
+  printf("adv parser: %u random buffers checked\n", n_buffers);
+  return 0;
+}
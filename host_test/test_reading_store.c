@@ -0,0 +1,230 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "host_test.h"
+#include "esp_partition.h"
+#include "ReadingStore.h"
+
+// Power loss test of the flash ring: the same workload (appends, and consumes that keep a few readings pending
+// while the ring wraps around) is cut at every single write and erase, with nothing or half of the interrupted
+// operation reaching the flash. After each cut the store is recovered as on a reboot and must hold every reading
+// that was committed and not consumed, in order, only ever adding the reading whose append (or consume) was cut,
+// and never a torn one. The recovered store must then keep working. A deep sleep wakeup (ReadingStoreResume) must
+// find the same readings without reading the flash, and a batch peeked before the ring overflowed must not consume
+// readings it never held.
+
+#define TEST_SECTORS 4           // Small ring, the workload wraps around it
+#define TEST_READINGS 700        // More than the ring holds, about 5 sectors of 127 readings
+#define TEST_MAX_PENDING 40      // Readings left pending by the workload, well under a sector
+#define TEST_MORE_READINGS 200   // Readings appended after a recovery
+#define TEST_PEEK_CAP (TEST_MAX_PENDING + 8)
+#define TEST_TIMESTAMP_BASE 1700000000
+
+struct model
+{
+  uint32_t pending[TEST_PEEK_CAP]; // Readings committed and not consumed, oldest first
+  size_t n_pending;
+  uint32_t next_seq;
+  bool append_cut;  // The append of reading next_seq was interrupted, it may or may not be there
+  bool consume_cut; // The consume of pending[0] was interrupted, it may or may not be there
+};
+
+static struct peripheral_data Reading(const uint32_t seq)
+{
+  return (struct peripheral_data){.peripheral_id = seq, .value = seq * 0.25, .timestamp = TEST_TIMESTAMP_BASE + seq};
+}
+
+static bool IsIntact(const struct peripheral_data *reading)
+{
+  const struct peripheral_data expected = Reading(reading->peripheral_id);
+  return reading->value == expected.value && reading->timestamp == expected.timestamp;
+}
+
+/**
+ * @brief Peeks the oldest pending reading and consumes it, as an upload does.
+ */
+static esp_err_t ConsumeOldest()
+{
+  struct peripheral_data oldest;
+  struct reading_store_tail tail;
+  ReadingStorePeek(&oldest, 1, &tail);
+  return ReadingStoreConsume(&tail, 1);
+}
+
+/**
+ * @brief Appends readings up to until_seq, one at a time, consuming the oldest ones to keep TEST_MAX_PENDING pending.
+ *
+ * @return true if the workload completed, false if the power was lost on the way.
+ */
+static bool RunWorkload(struct model *m, const uint32_t until_seq)
+{
+  while (m->next_seq < until_seq)
+  {
+    const struct peripheral_data reading = Reading(m->next_seq);
+    if (ReadingStoreAppend(&reading, 1) != ESP_OK)
+    {
+      TEST_CHECK(HostPartitionPowerLost(), "append of %u failed with the power on", m->next_seq);
+      m->append_cut = true;
+      return false;
+    }
+    m->pending[m->n_pending++] = m->next_seq++;
+    while (m->n_pending > TEST_MAX_PENDING)
+    {
+      if (ConsumeOldest() != ESP_OK)
+      {
+        TEST_CHECK(HostPartitionPowerLost(), "consume of %u failed with the power on", m->pending[0]);
+        m->consume_cut = true;
+        return false;
+      }
+      memmove(&m->pending[0], &m->pending[1], --m->n_pending * sizeof(m->pending[0]));
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Checks the pending readings of the store against the model, then aligns the model with the store
+ * (settling the interrupted operation either way).
+ */
+static void Verify(struct model *m, const char *when)
+{
+  struct peripheral_data stored[TEST_PEEK_CAP];
+  struct reading_store_tail tail;
+  const size_t n_stored = ReadingStorePeek(stored, TEST_PEEK_CAP, &tail);
+  TEST_CHECK(n_stored == ReadingStorePendingCount(), "%s: peeked %zu readings, %zu pending", when, n_stored,
+             ReadingStorePendingCount());
+  size_t expected = 0;
+  if (m->consume_cut && m->n_pending > 0 && (n_stored == 0 || stored[0].peripheral_id != m->pending[0]))
+  {
+    expected = 1; // The interrupted consume went through
+  }
+  size_t i = 0;
+  for (; expected < m->n_pending; i++, expected++)
+  {
+    TEST_CHECK(i < n_stored, "%s: committed reading %u lost", when, m->pending[expected]);
+    TEST_CHECK(stored[i].peripheral_id == m->pending[expected], "%s: reading %u found where %u was expected", when,
+               stored[i].peripheral_id, m->pending[expected]);
+    TEST_CHECK(IsIntact(&stored[i]), "%s: reading %u is torn", when, stored[i].peripheral_id);
+  }
+  if (i < n_stored)
+  {
+    TEST_CHECK(m->append_cut && stored[i].peripheral_id == m->next_seq, "%s: unexpected reading %u", when,
+               stored[i].peripheral_id);
+    TEST_CHECK(IsIntact(&stored[i]), "%s: interrupted reading %u surfaced torn", when, stored[i].peripheral_id);
+    i++;
+  }
+  TEST_CHECK(i == n_stored, "%s: %zu unexpected readings", when, n_stored - i);
+
+  m->n_pending = n_stored;
+  for (size_t j = 0; j < n_stored; j++)
+  {
+    m->pending[j] = stored[j].peripheral_id;
+  }
+  if (m->append_cut)
+  {
+    m->next_seq++; // Never reuse the number of a reading that may be stored
+  }
+  m->append_cut = false;
+  m->consume_cut = false;
+}
+
+/**
+ * @brief Consumes every pending reading and checks the store ends up empty.
+ */
+static void Drain(struct model *m, const char *when)
+{
+  for (size_t i = 0; i < m->n_pending; i++)
+  {
+    TEST_CHECK(ConsumeOldest() == ESP_OK, "%s: consume failed", when);
+  }
+  m->n_pending = 0;
+  Verify(m, when);
+  TEST_CHECK(ReadingStorePendingCount() == 0, "%s: store not empty after draining", when);
+}
+
+static void FormatStore()
+{
+  HostPartitionSetup(READING_STORE_PARTITION_LABEL, READING_STORE_PARTITION_SUBTYPE, TEST_SECTORS * 4096);
+}
+
+/**
+ * @brief Overflows the ring while a batch is out for upload: consuming the batch afterwards must not consume
+ * readings that were never peeked.
+ */
+static void CheckOverflowDuringUpload()
+{
+  FormatStore();
+  TEST_CHECK(ReadingStoreInit() == ESP_OK, "overflow: init failed");
+  uint32_t seq = 0;
+  for (; seq < TEST_MAX_PENDING; seq++)
+  {
+    const struct peripheral_data reading = Reading(seq);
+    TEST_CHECK(ReadingStoreAppend(&reading, 1) == ESP_OK, "overflow: append failed");
+  }
+  struct peripheral_data batch[TEST_MAX_PENDING];
+  struct reading_store_tail tail;
+  const size_t n_batch = ReadingStorePeek(batch, TEST_MAX_PENDING, &tail);
+  TEST_CHECK(n_batch == TEST_MAX_PENDING, "overflow: peeked %zu readings", n_batch);
+  for (; seq < TEST_READINGS; seq++) // Wraps the ring, dropping the sector the batch started in
+  {
+    const struct peripheral_data reading = Reading(seq);
+    TEST_CHECK(ReadingStoreAppend(&reading, 1) == ESP_OK, "overflow: append failed");
+  }
+  const size_t n_pending = ReadingStorePendingCount();
+  TEST_CHECK(ReadingStoreConsume(&tail, n_batch) == ESP_ERR_INVALID_STATE, "overflow: stale batch consumed");
+  TEST_CHECK(ReadingStorePendingCount() == n_pending, "overflow: %zu readings consumed by a stale batch",
+             n_pending - ReadingStorePendingCount());
+  struct peripheral_data oldest;
+  ReadingStorePeek(&oldest, 1, &tail);
+  TEST_CHECK(oldest.peripheral_id > batch[n_batch - 1].peripheral_id, "overflow: reading %u still pending",
+             oldest.peripheral_id);
+}
+
+int main()
+{
+  // Reference run, also gives the number of flash operations to cut
+  FormatStore();
+  struct model m = {0};
+  TEST_CHECK(ReadingStoreInit() == ESP_OK, "init of a blank store failed");
+  TEST_CHECK(RunWorkload(&m, TEST_READINGS), "reference workload failed");
+  Verify(&m, "reference");
+  const uint32_t n_ops = HostPartitionOps();
+  TEST_CHECK(ReadingStoreInit() == ESP_OK, "reboot failed");
+  Verify(&m, "reference reboot");
+  const uint32_t n_reads = HostPartitionReads();
+  TEST_CHECK(ReadingStoreResume() == ESP_OK, "resume failed");
+  TEST_CHECK(HostPartitionReads() == n_reads, "resume read the flash");
+  Verify(&m, "reference resume");
+  Drain(&m, "reference drain");
+
+  const enum host_power_cut modes[] = {HOST_CUT_BEFORE, HOST_CUT_HALFWAY};
+  uint32_t n_cuts = 0;
+  for (size_t mode = 0; mode < sizeof(modes) / sizeof(modes[0]); mode++)
+  {
+    for (uint32_t op = 0; op < n_ops; op++)
+    {
+      char when[64];
+      snprintf(when, sizeof(when), "cut %s at op %u", modes[mode] == HOST_CUT_BEFORE ? "before" : "halfway", op);
+      FormatStore();
+      HostPartitionCutPowerAt(op, modes[mode]);
+      m = (struct model){0};
+      const bool completed = ReadingStoreInit() == ESP_OK && RunWorkload(&m, TEST_READINGS);
+      TEST_CHECK(!completed && HostPartitionPowerLost(), "%s: the power was never cut", when);
+
+      HostPartitionPowerOn();
+      TEST_CHECK(ReadingStoreInit() == ESP_OK, "%s: recovery failed", when);
+      Verify(&m, when);
+      TEST_CHECK(RunWorkload(&m, m.next_seq + TEST_MORE_READINGS), "%s: append after recovery failed", when);
+      Verify(&m, when);
+      TEST_CHECK(ReadingStoreResume() == ESP_OK, "%s: resume failed", when);
+      Verify(&m, when);
+      TEST_CHECK(ReadingStoreInit() == ESP_OK, "%s: second reboot failed", when);
+      Verify(&m, when);
+      Drain(&m, when);
+      n_cuts++;
+    }
+  }
+  CheckOverflowDuringUpload();
+  printf("reading store: %u flash operations per run, %u power cuts recovered\n", n_ops, n_cuts);
+  return 0;
+}
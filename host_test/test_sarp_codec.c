@@ -0,0 +1,329 @@
+#include <math.h>
+#include <string.h>
+#include "host_test.h"
+#include "SarpCodec.h"
+#include "HttpsClient.h"
+
+// Tests of the SARP codec: exact encoder output, encode/decode round trips, escapes, skipping of nested values,
+// 32-bit overflow, bodies fed in every possible split and the -1 return of every encoder at its buffer boundary.
+
+#define TEST_BUF_SIZE 1024
+#define TEST_CANARY 0x5A
+
+typedef int (*encode_fn)(char *buf, const size_t buf_len, const void *arg);
+
+struct encode_case
+{
+  const char *name;
+  encode_fn encode;
+  const void *arg;
+  const char *expected;
+};
+
+static const char *const test_types[] = {"soil_moisture", "valve", "soil_moisture"};
+static const uint32_t test_instances[] = {0, 0, 1};
+static const uint32_t test_first_instances[] = {0, 0, 0};
+static const struct peripheral_data test_readings[] = {
+    {.peripheral_id = 17, .value = 42.5, .timestamp = 1700000000},
+    {.peripheral_id = 4294967295u, .value = -0.0004, .timestamp = 0},
+    {.peripheral_id = 3, .value = 0.1236, .timestamp = 1},
+};
+static const struct control_event test_events[] = {
+    {.timestamp = 1700000000, .moisture = 31.25, .state = 1, .reason = CONTROL_REASON_DRY},
+    {.timestamp = 0, .moisture = NAN, .state = 0, .reason = CONTROL_REASON_OVERRIDE},
+};
+
+static int EncodeRegisterModule(char *buf, const size_t buf_len, const void *arg)
+{
+  return SarpEncodeRegisterModule(buf, buf_len, arg);
+}
+
+static int EncodeRegisterPeripheral(char *buf, const size_t buf_len, const void *arg)
+{
+  return SarpEncodeRegisterPeripheral(buf, buf_len, arg, "soil_moisture", 0);
+}
+
+static int EncodeRegisterPeripheralInstance(char *buf, const size_t buf_len, const void *arg)
+{
+  return SarpEncodeRegisterPeripheral(buf, buf_len, arg, "valve", 2);
+}
+
+static int EncodeRegisterBatch(char *buf, const size_t buf_len, const void *arg)
+{
+  return SarpEncodeRegisterPeripheralBatch(buf, buf_len, "m", test_types, arg, 3);
+}
+
+static int EncodeData(char *buf, const size_t buf_len, const void *arg)
+{
+  return SarpEncodePeripheralData(buf, buf_len, 7, *(const double *)arg);
+}
+
+static int EncodeDataBatch(char *buf, const size_t buf_len, const void *arg)
+{
+  (void)arg;
+  return SarpEncodePeripheralDataBatch(buf, buf_len, test_readings, 3);
+}
+
+static int EncodeEvents(char *buf, const size_t buf_len, const void *arg)
+{
+  (void)arg;
+  return SarpEncodeControlEvents(buf, buf_len, 9, test_events, 2, 0);
+}
+
+static int EncodeEventsDropped(char *buf, const size_t buf_len, const void *arg)
+{
+  (void)arg;
+  return SarpEncodeControlEvents(buf, buf_len, 9, test_events, 1, 4294967295u);
+}
+
+static const double test_value_rounded = 2.0625;
+static const double test_value_negative = -12.75;
+static const double test_value_nan = NAN;
+
+static const struct encode_case encode_cases[] = {
+    {"register module", EncodeRegisterModule, "tok", "{\"token_api\":\"tok\"}"},
+    {"register module escapes", EncodeRegisterModule, "a\"b\\c\n\x01",
+     "{\"token_api\":\"a\\\"b\\\\c\\u000a\\u0001\"}"},
+    {"register peripheral", EncodeRegisterPeripheral, "mod", "{\"parent_module\":\"mod\",\"p_type\":\"soil_moisture\"}"},
+    {"register peripheral instance", EncodeRegisterPeripheralInstance, "mod",
+     "{\"parent_module\":\"mod\",\"p_type\":\"valve\",\"instance\":2}"},
+    {"register batch", EncodeRegisterBatch, test_instances,
+     "{\"parent_module\":\"m\",\"p_types\":[\"soil_moisture\",\"valve\",\"soil_moisture\"],\"instances\":[0,0,1]}"},
+    {"register batch first instances", EncodeRegisterBatch, test_first_instances,
+     "{\"parent_module\":\"m\",\"p_types\":[\"soil_moisture\",\"valve\",\"soil_moisture\"]}"},
+    {"data rounded", EncodeData, &test_value_rounded, "{\"peripheral_id\":7,\"value\":2.063}"},
+    {"data negative", EncodeData, &test_value_negative, "{\"peripheral_id\":7,\"value\":-12.75}"},
+    {"data nan", EncodeData, &test_value_nan, "{\"peripheral_id\":7,\"value\":null}"},
+    {"data batch", EncodeDataBatch, NULL,
+     "{\"data\":[{\"peripheral_id\":17,\"value\":42.5,\"timestamp\":1700000000},"
+     "{\"peripheral_id\":4294967295,\"value\":0},{\"peripheral_id\":3,\"value\":0.124,\"timestamp\":1}]}"},
+    {"control events", EncodeEvents, NULL,
+     "{\"peripheral_id\":9,\"events\":[{\"state\":1,\"reason\":\"dry\",\"moisture\":31.25,\"timestamp\":1700000000},"
+     "{\"state\":0,\"reason\":\"override\"}]}"},
+    {"control events dropped", EncodeEventsDropped, NULL,
+     "{\"peripheral_id\":9,\"dropped\":4294967295,\"events\":[{\"state\":1,\"reason\":\"dry\",\"moisture\":31.25,"
+     "\"timestamp\":1700000000}]}"},
+};
+
+/**
+ * @brief Checks the exact output of an encoder, then that every smaller buffer makes it return -1 without writing
+ * past the buffer, always leaving it NUL terminated.
+ */
+static void TestEncoder(const struct encode_case *c)
+{
+  char buf[TEST_BUF_SIZE];
+  const int len = c->encode(buf, sizeof(buf), c->arg);
+  TEST_CHECK(len == (int)strlen(c->expected) && strcmp(buf, c->expected) == 0, "%s: encoded %s, expected %s", c->name,
+             buf, c->expected);
+  TEST_CHECK(c->encode(buf, (size_t)len + 1, c->arg) == len, "%s: does not fit its exact size", c->name);
+
+  for (size_t cap = 0; cap <= (size_t)len; cap++)
+  {
+    memset(buf, TEST_CANARY, sizeof(buf));
+    TEST_CHECK(c->encode(buf, cap, c->arg) == -1, "%s: fits in %zu bytes", c->name, cap);
+    TEST_CHECK(buf[cap] == TEST_CANARY, "%s: wrote past %zu bytes", c->name, cap);
+    TEST_CHECK(cap == 0 || (buf[cap - 1] == '\0' && strncmp(buf, c->expected, cap - 1) == 0),
+               "%s: %zu byte buffer not a terminated prefix", c->name, cap);
+  }
+}
+
+static void TestRoundTrips()
+{
+  char body[TEST_BUF_SIZE];
+  char out[64];
+  const char *tokens[] = {"", "plain", "quote\" and back\\slash", "{\"not\":\"json\"}", "tab\tnewline\n"};
+  for (size_t i = 0; i < sizeof(tokens) / sizeof(tokens[0]); i++)
+  {
+    TEST_CHECK(SarpEncodeRegisterModule(body, sizeof(body), tokens[i]) > 0, "encoding %s failed", tokens[i]);
+    TEST_CHECK(SarpDecodeString(body, strlen(body), "token_api", out, sizeof(out)) == ESP_OK, "decoding %s failed", body);
+    // Control characters go out as \u00XX, which the decoder (ASCII only) reads back as '?'
+    char expected[64];
+    strcpy(expected, tokens[i]);
+    for (char *c = expected; *c != '\0'; c++)
+    {
+      *c = ((unsigned char)*c < 0x20) ? '?' : *c;
+    }
+    TEST_CHECK(strcmp(out, expected) == 0, "round trip of %s gave %s", tokens[i], out);
+  }
+
+  const double values[] = {0, 1, -1, 0.5, 123.456, -0.001, 99999.999, 4294967295.0};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+  {
+    uint32_t id = 0;
+    double value = NAN;
+    TEST_CHECK(SarpEncodePeripheralData(body, sizeof(body), (uint32_t)i * 1000003u, values[i]) > 0, "encoding failed");
+    TEST_CHECK(SarpDecodeUint32(body, strlen(body), "peripheral_id", &id) == ESP_OK && id == (uint32_t)i * 1000003u,
+               "id round trip of %s", body);
+    TEST_CHECK(SarpDecodeDouble(body, strlen(body), "value", &value) == ESP_OK && value == values[i],
+               "value round trip of %s gave %f", body, value);
+  }
+
+  uint32_t instances[8];
+  size_t n_instances = 0;
+  struct sarp_scanner s;
+  TEST_CHECK(SarpEncodeRegisterPeripheralBatch(body, sizeof(body), "m", test_types, test_instances, 3) > 0, "encoding failed");
+  SarpScannerInitUint32Array(&s, "instances", instances, 8);
+  SarpScannerFeed(&s, body, strlen(body));
+  TEST_CHECK(SarpScannerUint32Array(&s, &n_instances) == ESP_OK && n_instances == 3 && instances[2] == 1,
+             "instances round trip of %s", body);
+}
+
+static void TestDecodeEscapes()
+{
+  char out[32];
+  const char body[] = "{\"state\":\"a\\\"b\\\\c\\/d\\n\\t\\u0041e\"}";
+  TEST_CHECK(SarpDecodeString(body, strlen(body), "state", out, sizeof(out)) == ESP_OK, "decoding failed");
+  TEST_CHECK(strcmp(out, "a\"b\\c/d\n\t?e") == 0, "unescaped to %s", out);
+
+  // Escaped keys never match, escaped quotes do not end strings that are skipped
+  const char keys[] = "{\"st\\u0061te\":\"no\",\"x\":\"\\\"state\\\":\\\"no\",\"state\":\"yes\"}";
+  TEST_CHECK(SarpDecodeString(keys, strlen(keys), "state", out, sizeof(out)) == ESP_OK && strcmp(out, "yes") == 0,
+             "escaped keys: got %s", out);
+}
+
+static void TestNestedSkipping()
+{
+  char out[32];
+  const char body[] = "{\"a\":{\"state\":\"nested\",\"b\":[1,{\"state\":\"deeper\"},\"]}\"],\"c\":\"}\\\"]\"},"
+                      "\"d\":[[],[[{}]],\"[\"],\"e\":true,\"f\":null,\"g\":-1.5e3,\"state\":\"top\"}";
+  TEST_CHECK(SarpDecodeString(body, strlen(body), "state", out, sizeof(out)) == ESP_OK && strcmp(out, "top") == 0,
+             "nested: got %s", out);
+
+  const char only_nested[] = "{\"a\":{\"state\":\"nested\"},\"b\":[{\"state\":\"x\"}]}";
+  TEST_CHECK(SarpDecodeString(only_nested, strlen(only_nested), "state", out, sizeof(out)) == ESP_ERR_NOT_FOUND,
+             "nested member reported as top level");
+
+  const char not_string[] = "{\"state\":{\"on\":true}}";
+  TEST_CHECK(SarpDecodeString(not_string, strlen(not_string), "state", out, sizeof(out)) == ESP_ERR_NOT_FOUND,
+             "object member reported as a string");
+}
+
+static void TestUint32()
+{
+  uint32_t id = 0;
+  const struct
+  {
+    const char *body;
+    esp_err_t err;
+    uint32_t id;
+  } cases[] = {
+      {"{\"id\":0}", ESP_OK, 0},
+      {"{\"id\":4294967295}", ESP_OK, 4294967295u},
+      {"{\"id\": 42 }", ESP_OK, 42},
+      {"{\"id\":12.9}", ESP_OK, 12},
+      {"{\"id\":4294967296}", ESP_ERR_INVALID_SIZE, 0},
+      {"{\"id\":99999999999999999999999}", ESP_ERR_INVALID_SIZE, 0},
+      {"{\"id\":-1}", ESP_ERR_NOT_FOUND, 0},
+      {"{\"id\":\"12\"}", ESP_ERR_NOT_FOUND, 0},
+      {"{\"ids\":1}", ESP_ERR_NOT_FOUND, 0},
+      {"{\"id\":1", ESP_ERR_INVALID_RESPONSE, 0},
+      {"[\"id\",1]", ESP_ERR_INVALID_RESPONSE, 0},
+      {"", ESP_ERR_INVALID_RESPONSE, 0},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+  {
+    id = 0;
+    const esp_err_t err = SarpDecodeUint32(cases[i].body, strlen(cases[i].body), "id", &id);
+    TEST_CHECK(err == cases[i].err, "%s: got 0x%x, expected 0x%x", cases[i].body, err, cases[i].err);
+    TEST_CHECK(err != ESP_OK || id == cases[i].id, "%s: got %u", cases[i].body, id);
+  }
+
+  uint32_t items[2];
+  size_t n_items = 0;
+  struct sarp_scanner s;
+  const char overflow[] = "{\"ids\":[1,4294967296]}";
+  SarpScannerInitUint32Array(&s, "ids", items, 2);
+  SarpScannerFeed(&s, overflow, strlen(overflow));
+  TEST_CHECK(SarpScannerUint32Array(&s, &n_items) == ESP_ERR_INVALID_RESPONSE, "array item overflow accepted");
+
+  const char too_many[] = "{\"ids\":[1,2,3]}";
+  SarpScannerInitUint32Array(&s, "ids", items, 2);
+  SarpScannerFeed(&s, too_many, strlen(too_many));
+  TEST_CHECK(SarpScannerUint32Array(&s, &n_items) == ESP_ERR_INVALID_SIZE, "array overflow accepted");
+
+  const char empty[] = "{\"ids\":[ ]}";
+  SarpScannerInitUint32Array(&s, "ids", items, 2);
+  SarpScannerFeed(&s, empty, strlen(empty));
+  TEST_CHECK(SarpScannerUint32Array(&s, &n_items) == ESP_OK && n_items == 0, "empty array rejected");
+}
+
+static void TestStringOverflow()
+{
+  char out[4];
+  const char body[] = "{\"moduleToken\":\"abcd\"}";
+  TEST_CHECK(SarpDecodeString(body, strlen(body), "moduleToken", out, sizeof(out)) == ESP_ERR_INVALID_SIZE,
+             "oversized string accepted");
+  TEST_CHECK(strcmp(out, "abc") == 0, "oversized string not truncated: %s", out);
+  const char fits[] = "{\"moduleToken\":\"abc\"}";
+  TEST_CHECK(SarpDecodeString(fits, strlen(fits), "moduleToken", out, sizeof(out)) == ESP_OK, "fitting string rejected");
+}
+
+/**
+ * @brief Outcome of a scan for key over body, fed as the given chunks.
+ */
+static esp_err_t ScanChunks(const char *body, const size_t *splits, const size_t n_splits, const char *key, char *out,
+                            const size_t out_len)
+{
+  struct sarp_scanner s;
+  SarpScannerInit(&s, key, out, out_len);
+  size_t start = 0;
+  for (size_t i = 0; i <= n_splits; i++)
+  {
+    const size_t end = (i < n_splits) ? splits[i] : strlen(body);
+    SarpScannerFeed(&s, body + start, end - start);
+    start = end;
+  }
+  return SarpScannerResult(&s);
+}
+
+static void TestChunkSplits()
+{
+  const char *bodies[] = {
+      "{\"id\":17,\"p_type\":\"x\\\"y\",\"nested\":{\"state\":[\"}\"]},\"state\":\"on\\u0041\\n\"}",
+      " { \"moduleToken\" : \"0123456789abcdef\" , \"state\" : 4294967295 } ",
+      "{\"a\":[[[\"\\\\\"]]],\"state\":-12.5e-1}",
+      "{\"state\":\"trunc",
+  };
+  for (size_t b = 0; b < sizeof(bodies) / sizeof(bodies[0]); b++)
+  {
+    const char *body = bodies[b];
+    const size_t len = strlen(body);
+    char whole[64];
+    const esp_err_t expected = ScanChunks(body, NULL, 0, "state", whole, sizeof(whole));
+
+    // Every two-chunk split, including empty chunks at either end
+    for (size_t split = 0; split <= len; split++)
+    {
+      char out[64];
+      const esp_err_t err = ScanChunks(body, &split, 1, "state", out, sizeof(out));
+      TEST_CHECK(err == expected && strcmp(out, whole) == 0, "%s split at %zu: got 0x%x %s", body, split, err, out);
+    }
+    // Every three-chunk split
+    for (size_t first = 0; first <= len; first++)
+    {
+      for (size_t second = first; second <= len; second++)
+      {
+        char out[64];
+        const size_t splits[] = {first, second};
+        const esp_err_t err = ScanChunks(body, splits, 2, "state", out, sizeof(out));
+        TEST_CHECK(err == expected && strcmp(out, whole) == 0, "%s split at %zu, %zu", body, first, second);
+      }
+    }
+  }
+}
+
+int main()
+{
+  for (size_t i = 0; i < sizeof(encode_cases) / sizeof(encode_cases[0]); i++)
+  {
+    TestEncoder(&encode_cases[i]);
+  }
+  TestRoundTrips();
+  TestDecodeEscapes();
+  TestNestedSkipping();
+  TestUint32();
+  TestStringOverflow();
+  TestChunkSplits();
+  printf("sarp codec: %zu encoder cases passed\n", sizeof(encode_cases) / sizeof(encode_cases[0]));
+  return 0;
+}
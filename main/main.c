@@ -5,6 +5,10 @@
 #include "Module.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "esp_netif_sntp.h"
+#include "RuntimeStats.h"
+
+#define SNTP_SERVER "pool.ntp.org"
 
 static const char TAG[] = "Main_App";
 void FlashInit()
@@ -25,17 +29,47 @@ void FlashInit()
   ESP_LOGI(TAG, "NVS Flash initialized successfully");
 }
 
+/**
+ * @brief Starts SNTP so readings can be timestamped. Sync happens in the background once WiFi is up,
+ * readings taken before that are sent without a timestamp.
+ *
+ */
+void InitTimeSync()
+{
+  esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(SNTP_SERVER);
+  esp_err_t ret = esp_netif_sntp_init(&config);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to start SNTP: %s", esp_err_to_name(ret));
+  }
+}
+
 void InitComponents()
 {
   FlashInit();
+  ModuleLoadConfig();
   ESP_ERROR_CHECK(esp_event_loop_create_default());
   InitLEDS();
+  RuntimeStatsStartConsole(); // Type "diag" on the serial monitor for the heap and stack report
   InitWiFi();
+  InitTimeSync();
   SwitchWiFi();
 }
 
 void app_main(void)
 {
+  if (ModuleCanResume())
+  {
+    // Deep sleep wakeup: the module context and the WiFi association survived in RTC memory,
+    // so the configuration checks, LEDs and BLE are skipped
+    FlashInit(); // WiFi keeps its calibration data in NVS
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ResumeWiFi();
+    InitTimeSync();
+    BlockUntilHasConnection();
+    ModuleResume();
+    return;
+  }
   InitComponents();
   BlockUntilHasConnection();
   ModuleInit();